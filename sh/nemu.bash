@@ -11,11 +11,12 @@ _nemu_completions()
 
     if [[ "$COMP_CWORD" == 1 ]]; then
         COMPREPLY=( $(compgen -W "-h --help -l --list -s --start -p --powerdown \
-            -f --force-stop -z --reset -k --kill -v --version" -- "$curr") )
-    elif [[ "$COMP_CWORD" == 2 ]]; then
-        case "$prev" in
-            "-s"|"--start"|"-p"|"--powerdown"|"-f"|"--force-stop"|"-z"|"--reset"|"-k"|"--kill")
-                COMPREPLY=( $(compgen -W "$(nemu -l)" -- "$curr") )
+            -f --force-stop -z --reset -k --kill -t --stat -j --jobs -v --version" -- "$curr") )
+    else
+        # action takes several vm names
+        case "${COMP_WORDS[1]}" in
+            "-s"|"--start"|"-p"|"--powerdown"|"-f"|"--force-stop"|"-z"|"--reset"|"-k"|"--kill"|"-t"|"--stat")
+                COMPREPLY=( $(compgen -W "$(nemu -l) --all" -- "$curr") )
             ;;
             *)
             ;;
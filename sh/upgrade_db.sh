@@ -6,7 +6,7 @@ if [ -z "$1" ]; then
 fi
 
 DB_PATH="$1"
-DB_ACTUAL_VERSION=11
+DB_ACTUAL_VERSION=14
 DB_CURRENT_VERSION=$(sqlite3 "$DB_PATH" -line 'PRAGMA user_version;' | sed 's/.*[[:space:]]=[[:space:]]//')
 RC=0
 
@@ -104,6 +104,37 @@ while [ "$DB_CURRENT_VERSION" != "$DB_ACTUAL_VERSION" ]; do
             ) || RC=1
             ;;
 
+        ( 11 )
+            (
+            sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD backing char;' &&
+            sqlite3 "$DB_PATH" -line 'UPDATE drives SET backing="";' &&
+            sqlite3 "$DB_PATH" -line 'PRAGMA user_version=12'
+            ) || RC=1
+            ;;
+
+        ( 12 )
+            (
+            sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD ova_path char;' &&
+            sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD ova_offset integer;' &&
+            sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD ova_size integer;' &&
+            sqlite3 "$DB_PATH" -line 'ALTER TABLE drives ADD ova_fmt char;' &&
+            sqlite3 "$DB_PATH" -line 'UPDATE drives SET ova_path="", ova_offset="", ova_size="", ova_fmt="";' &&
+            sqlite3 "$DB_PATH" -line 'PRAGMA user_version=13'
+            ) || RC=1
+            ;;
+
+        ( 13 )
+            (
+            sqlite3 "$DB_PATH" -line 'CREATE INDEX IF NOT EXISTS vms_name ON vms(name);' &&
+            sqlite3 "$DB_PATH" -line 'CREATE INDEX IF NOT EXISTS ifaces_vm_name ON ifaces(vm_name);' &&
+            sqlite3 "$DB_PATH" -line 'CREATE INDEX IF NOT EXISTS drives_vm_name ON drives(vm_name);' &&
+            sqlite3 "$DB_PATH" -line 'CREATE INDEX IF NOT EXISTS vmsnapshots_vm_name ON vmsnapshots(vm_name);' &&
+            sqlite3 "$DB_PATH" -line 'CREATE INDEX IF NOT EXISTS usb_vm_name ON usb(vm_name);' &&
+            sqlite3 "$DB_PATH" -line 'PRAGMA journal_mode=WAL;' &&
+            sqlite3 "$DB_PATH" -line 'PRAGMA user_version=14'
+            ) || RC=1
+            ;;
+
         ( * )
             echo "Unsupported database user_version" >&2
             exit 1
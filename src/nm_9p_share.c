@@ -9,11 +9,11 @@
 #include <nm_9p_share.h>
 
 static const char NM_9P_SET_MODE_SQL[] =
-    "UPDATE vms SET fs9p_enable='%s' WHERE name='%s'";
+    "UPDATE vms SET fs9p_enable=? WHERE name=?";
 static const char NM_9P_SET_PATH_SQL[] =
-    "UPDATE vms SET fs9p_path='%s' WHERE name='%s'";
+    "UPDATE vms SET fs9p_path=? WHERE name=?";
 static const char NM_9P_SET_NAME_SQL[] =
-    "UPDATE vms SET fs9p_name='%s' WHERE name='%s'";
+    "UPDATE vms SET fs9p_name=? WHERE name=?";
 
 typedef struct {
     nm_str_t mode;
@@ -70,10 +70,9 @@ void nm_9p_share(const nm_str_t *name)
     field_opts_off(fields[NM_FLD_9PNAME], O_STATIC);
 
     set_field_buffer(fields[NM_FLD_9PMODE], 0,
-        (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_9FLG),
-            NM_ENABLE) == NM_OK) ? "yes" : "no");
-    set_field_buffer(fields[NM_FLD_9PPATH], 0, nm_vect_str_ctx(&vm.main, NM_SQL_9PTH));
-    set_field_buffer(fields[NM_FLD_9PNAME], 0, nm_vect_str_ctx(&vm.main, NM_SQL_9ID));
+        nm_db_vm(&vm.main, 0)->fs9p_enable ? "yes" : "no");
+    set_field_buffer(fields[NM_FLD_9PPATH], 0, nm_db_vm(&vm.main, 0)->fs9p_path);
+    set_field_buffer(fields[NM_FLD_9PNAME], 0, nm_db_vm(&vm.main, 0)->fs9p_name);
 
     for (size_t n = 0, y = 1, x = 2; n < NM_FLD_COUNT; n++)
     {
@@ -115,7 +114,7 @@ static int nm_9p_get_data(nm_9p_data_t *data, const nm_vmctl_data_t *cur)
     }
     else
     {
-        if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_9FLG), NM_ENABLE) != NM_OK)
+        if (!nm_db_vm(&cur->main, 0)->fs9p_enable)
             goto out;
     }
 
@@ -131,31 +130,17 @@ out:
 
 static void nm_9p_update_db(const nm_str_t *name, const nm_9p_data_t *data)
 {
-    nm_str_t query = NM_INIT_STR;
-    nm_str_free(&query);
-
     if (field_status(fields[NM_FLD_9PMODE]))
     {
-        nm_str_format(&query, NM_9P_SET_MODE_SQL,
+        nm_db_edit(NM_9P_SET_MODE_SQL,
             (nm_str_cmp_st(&data->mode, "yes") == NM_OK) ? "1" : "0", name->data);
-        nm_db_edit(query.data);
-        nm_str_trunc(&query, 0);
     }
 
     if (field_status(fields[NM_FLD_9PPATH]))
-    {
-        nm_str_format(&query, NM_9P_SET_PATH_SQL, data->path.data, name->data);
-        nm_db_edit(query.data);
-        nm_str_trunc(&query, 0);
-    }
+        nm_db_edit(NM_9P_SET_PATH_SQL, data->path.data, name->data);
 
     if (field_status(fields[NM_FLD_9PNAME]))
-    {
-        nm_str_format(&query, NM_9P_SET_NAME_SQL, data->name.data, name->data);
-        nm_db_edit(query.data);
-    }
-
-    nm_str_free(&query);
+        nm_db_edit(NM_9P_SET_NAME_SQL, data->name.data, name->data);
 }
 
 /* vim:set ts=4 sw=4: */
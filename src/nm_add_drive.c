@@ -21,7 +21,7 @@ enum {
 };
 
 static void nm_add_drive_to_db(const nm_str_t *name, const nm_str_t *size,
-                               const nm_str_t *type, const nm_vect_t *drives);
+                               const nm_str_t *type, const nm_db_res_t *drives);
 
 void nm_add_drive(const nm_str_t *name)
 {
@@ -37,7 +37,7 @@ void nm_add_drive(const nm_str_t *name)
     size_t msg_len;
 
     nm_vmctl_get_data(name, &vm);
-    if ((vm.drives.n_memb / 4) == NM_DRIVE_LIMIT)
+    if (vm.drives.n_rows == NM_DRIVE_LIMIT)
     {
         nm_warn(_(NM_NSG_DRV_LIM));
         goto out;
@@ -105,16 +105,15 @@ out:
 void nm_del_drive(const nm_str_t *name)
 {
     int ch = 0, delete_drive = 0;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t drive_path = NM_INIT_STR;
-    nm_vect_t drv_list = NM_INIT_VECT;
+    nm_menu_item_t drv_buf[NM_MENU_STACK_ITEMS];
+    nm_arr_t drv_list = NM_INIT_ARR_BUF(drv_buf);
     nm_vect_t drives = NM_INIT_VECT;
     nm_menu_data_t m_drvs = NM_INIT_MENU_DATA;
     size_t drv_list_len = (getmaxy(side_window) - 4);
     size_t drv_count;
 
-    nm_str_format(&query, NM_VM_GET_ADDDRIVES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select(NM_VM_GET_ADDDRIVES_SQL, &drives, name->data);
 
     if (drives.n_memb == 0)
     {
@@ -138,11 +137,10 @@ void nm_del_drive(const nm_str_t *name)
 
     for (size_t n = 0; n < drv_count; n++)
     {
-        size_t idx_shift = 2 * n;
-        nm_vect_insert(&drv_list,
-                       nm_vect_str_ctx(&drives, idx_shift),
-                       nm_vect_str_len(&drives, idx_shift) + 1,
-                       NULL);
+        nm_menu_item_t drive = NM_INIT_MENU_ITEM;
+
+        drive.name = nm_str_view(nm_vect_str_ctx(&drives, 2 * n));
+        nm_arr_push(&drv_list, &drive);
     }
 
     m_drvs.v = &drv_list;
@@ -196,77 +194,84 @@ void nm_del_drive(const nm_str_t *name)
     if (unlink(drive_path.data) == -1)
         nm_warn(_(NM_MSG_DRV_EDEL));
 
-    nm_str_format(&query, NM_DEL_DRIVE_SQL,
-        name->data, nm_vect_str_ctx(&drives, 2 * (m_drvs.highlight - 1)));
+    {
+        const char *drive = nm_vect_str_ctx(&drives, 2 * (m_drvs.highlight - 1));
+        nm_vect_t base = NM_INIT_VECT;
+
+        nm_db_select(NM_DRIVE_BASE_SQL, &base, name->data, drive);
+        nm_db_edit(NM_DEL_DRIVE_SQL, name->data, drive);
+
+        if (base.n_memb)
+            nm_vmctl_base_unref(nm_vect_str_ctx(&base, 0));
+
+        nm_vect_free(&base, nm_str_vect_free_cb);
+    }
 
 quit:
-    nm_db_edit(query.data);
     werase(side_window);
     werase(help_window);
     nm_init_side();
     nm_init_help_main();
 
 out:
-    nm_str_free(&query);
     nm_str_free(&drive_path);
-    nm_vect_free(&drv_list, NULL);
+    nm_arr_free(&drv_list, NULL);
     nm_vect_free(&drives, nm_str_vect_free_cb);
 }
 
 int nm_add_drive_to_fs(const nm_str_t *name, const nm_str_t *size,
-    const nm_vect_t *drives)
+    const nm_db_res_t *drives)
 {
     nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
+    nm_argv_t argv = NM_INIT_ARGV;
 
     nm_str_alloc_text(&buf, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
-    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(&argv, buf.data);
 
-    nm_vect_insert_cstr(&argv, "create");
-    nm_vect_insert_cstr(&argv, "-f");
-    nm_vect_insert_cstr(&argv, "qcow2");
+    nm_argv_add(&argv, "create");
+    nm_argv_add(&argv, "-f");
+    nm_argv_add(&argv, "qcow2");
 
 //@TODO Fix conversion from size_t to char (might be a problem if there is too many drives)
     size_t drive_count = 0;
     if (drives != NULL)
     {
-        drive_count = drives->n_memb / 4;
+        drive_count = drives->n_rows;
     }
     char drv_ch = 'a' + drive_count;
 
 //@TODO Why add VM name twice (in directory name and in filename)?
     nm_str_format(&buf, "%s/%s/%s_%c.img",
         nm_cfg_get()->vm_dir.data, name->data, name->data, drv_ch);
-    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(&argv, buf.data);
 
     nm_str_format(&buf, "%sG", size->data);
-    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(&argv, buf.data);
 
-    nm_vect_end_zero(&argv);
     if (nm_spawn_process(&argv, NULL) != NM_OK)
         return NM_ERR;
 
     nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
+    nm_argv_free(&argv);
 
     return NM_OK;
 }
 
 static void nm_add_drive_to_db(const nm_str_t *name, const nm_str_t *size,
-                               const nm_str_t *type, const nm_vect_t *drives)
+                               const nm_str_t *type, const nm_db_res_t *drives)
 {
 //@TODO Fix conversion from size_t to char (might be a problem if there is too many drives)
-    size_t drive_count = drives->n_memb / 4;
+    size_t drive_count = drives->n_rows;
     char drv_ch = 'a' + drive_count;
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t drive_name = NM_INIT_STR;
 
-    nm_str_format(&query, "INSERT INTO drives("
-        "vm_name, drive_name, drive_drv, capacity, boot) \
-        VALUES('%s', '%s_%c.img', '%s', '%s', '0')",
-        name->data, name->data, drv_ch, type->data, size->data);
-    nm_db_edit(query.data);
+    nm_str_format(&drive_name, "%s_%c.img", name->data, drv_ch);
+    nm_db_edit("INSERT INTO drives("
+        "vm_name, drive_name, drive_drv, capacity, boot) "
+        "VALUES(?, ?, ?, ?, '0')",
+        name->data, drive_name.data, type->data, size->data);
 
-    nm_str_free(&query);
+    nm_str_free(&drive_name);
 }
 
 /* vim:set ts=4 sw=4: */
@@ -268,14 +268,14 @@ out:
 void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
                      int import, const nm_vect_t *drives)
 {
-    nm_str_t query = NM_INIT_STR;
     int altname = 0;
 
+    nm_db_begin();
+
     /* insert main VM data */
-    nm_str_format(&query,
-        "INSERT INTO vms(name, mem, smp, kvm, hcpu, vnc, arch, iso, install, "
+    nm_db_edit("INSERT INTO vms(name, mem, smp, kvm, hcpu, vnc, arch, iso, install, "
         "mouse_override, usb, usb_type, fs9p_enable, spice, debug_port, debug_freeze) "
-        "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s')",
+        "VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
         vm->name.data, vm->memo.data, vm->cpus.data,
 #if (NM_OS_LINUX)
         NM_ENABLE, NM_ENABLE, /* enable KVM and host CPU by default */
@@ -293,32 +293,31 @@ void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
         "", /* disable GDB debug by default */
         NM_DISABLE);
 
-    nm_db_edit(query.data);
-
     /* insert drive info */
     if (drives == NULL)
     {
-        nm_str_format(&query,
-            "INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot) "
-            "VALUES('%s', '%s_a.img', '%s', '%s', '%s')",
+        nm_db_edit("INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot) "
+            "VALUES(?, ? || '_a.img', ?, ?, ?)",
             vm->name.data, vm->name.data, vm->drive.driver.data, vm->drive.size.data,
             NM_ENABLE /* boot flag */
             );
-        nm_db_edit(query.data);
     }
     else /* imported from OVF */
     {
         for (size_t n = 0; n < drives->n_memb; n++)
         {
-            nm_str_format(&query,
-                "INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot) "
-                "VALUES('%s', '%s', '%s', '%s', '%s')",
+            const nm_drive_t *drive = drives->data[n];
+
+            nm_db_edit("INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot, "
+                "ova_path, ova_offset, ova_size, ova_fmt) "
+                "VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?)",
                 vm->name.data,
-                nm_drive_file(drives->data[n])->data, NM_DEFAULT_DRVINT,
-                nm_drive_size(drives->data[n])->data,
-                n == 0 ? NM_ENABLE : NM_DISABLE /* boot flag */
+                nm_drive_file(drive)->data, NM_DEFAULT_DRVINT,
+                nm_drive_size(drive)->data,
+                n == 0 ? NM_ENABLE : NM_DISABLE, /* boot flag */
+                drive->ova_path.data, drive->ova_offset.data,
+                drive->ova_size.data, drive->ova_fmt.data
                 );
-            nm_db_edit(query.data);
         }
     }
 
@@ -335,9 +334,8 @@ void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
         nm_str_copy(&if_name_copy, &if_name);
         altname = nm_net_fix_tap_name(&if_name, &maddr);
 
-        nm_str_format(&query,
-            "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, altname) "
-            "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s')",
+        nm_db_edit("INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, altname) "
+            "VALUES(?, ?, ?, ?, ?, ?, ?)",
             vm->name.data, if_name.data, maddr.data, vm->ifs.driver.data,
 #if defined (NM_OS_LINUX)
             nm_str_cmp_st(&vm->ifs.driver, NM_DEFAULT_NETDRV) == NM_OK ?
@@ -348,7 +346,6 @@ void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
             "0", /* disable macvtap by default */
             (altname) ? if_name_copy.data : ""
         );
-        nm_db_edit(query.data);
 
         nm_str_free(&if_name);
         nm_str_free(&if_name_copy);
@@ -358,7 +355,7 @@ void nm_add_vm_to_db(nm_vm_t *vm, uint64_t mac,
     nm_form_update_last_mac(mac);
     nm_form_update_last_vnc(nm_str_stoui(&vm->vncp, 10));
 
-    nm_str_free(&query);
+    nm_db_commit();
 }
 
 static void nm_add_vm_to_fs(nm_vm_t *vm, int import)
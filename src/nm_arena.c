@@ -0,0 +1,157 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_arena.h>
+
+enum {
+    NM_ARENA_BLK_SIZE = 4096,
+    NM_ARENA_ALIGN = 16,
+};
+
+struct nm_arena_blk {
+    nm_arena_blk_t *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+};
+
+static nm_arena_t nm_frame;
+
+static nm_arena_blk_t *nm_arena_blk_new(nm_arena_t *a, size_t size);
+
+void *nm_arena_alloc(nm_arena_t *a, size_t size)
+{
+    nm_arena_blk_t *blk = a->head;
+    size_t pad = 0;
+    void *p;
+
+    if (!size)
+        size = 1;
+
+    if (blk)
+    {
+        uintptr_t top = (uintptr_t) (blk->data + blk->used);
+        pad = (NM_ARENA_ALIGN - (top & (NM_ARENA_ALIGN - 1))) &
+            (NM_ARENA_ALIGN - 1);
+    }
+
+    if (!blk || (blk->size - blk->used < size + pad))
+    {
+        size_t blk_size = blk ? blk->size * 2 : NM_ARENA_BLK_SIZE;
+
+        if (size + NM_ARENA_ALIGN < size)
+            nm_bug(_("Integer overflow\n"));
+
+        while (blk_size < size + NM_ARENA_ALIGN)
+            blk_size *= 2;
+
+        blk = nm_arena_blk_new(a, blk_size);
+        pad = (NM_ARENA_ALIGN - ((uintptr_t) blk->data & (NM_ARENA_ALIGN - 1))) &
+            (NM_ARENA_ALIGN - 1);
+    }
+
+    p = blk->data + blk->used + pad;
+    blk->used += size + pad;
+
+    return p;
+}
+
+/* Memory of several blocks is merged into one,
+ * so the same work fits in one block next time */
+void nm_arena_reset(nm_arena_t *a)
+{
+    if (!a->head)
+        return;
+
+    if (a->head->next)
+    {
+        size_t total = a->total;
+
+        nm_arena_free(a);
+        nm_arena_blk_new(a, total);
+        return;
+    }
+
+    a->head->used = 0;
+}
+
+void nm_arena_free(nm_arena_t *a)
+{
+    nm_arena_blk_t *blk = a->head;
+
+    while (blk)
+    {
+        nm_arena_blk_t *next = blk->next;
+
+        free(blk);
+        blk = next;
+    }
+
+    a->head = NULL;
+    a->total = 0;
+}
+
+nm_str_t nm_arena_text(nm_arena_t *a, const char *src, size_t len)
+{
+    char *p = nm_arena_alloc(a, len + 1);
+
+    if (len)
+        memcpy(p, src, len);
+    p[len] = '\0';
+
+    return (nm_str_t) { p, len, 0 };
+}
+
+nm_str_t nm_arena_format(nm_arena_t *a, const char *fmt, ...)
+{
+    va_list args;
+    char *p;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        nm_bug(_("%s: invalid length: %d"), __func__, len);
+
+    p = nm_arena_alloc(a, len + 1);
+
+    va_start(args, fmt);
+    vsnprintf(p, len + 1, fmt, args);
+    va_end(args);
+
+    return (nm_str_t) { p, len, 0 };
+}
+
+void nm_arena_arr(nm_arena_t *a, nm_arr_t *arr, size_t n_memb)
+{
+    if (arr->data)
+        nm_bug(_("%s: vector already has storage"), __func__);
+
+    if (!n_memb)
+        return;
+
+    arr->data = arr->buf = nm_arena_alloc(a, n_memb * arr->unit_size);
+    arr->n_alloc = n_memb;
+}
+
+nm_arena_t *nm_arena_frame(void)
+{
+    return &nm_frame;
+}
+
+static nm_arena_blk_t *nm_arena_blk_new(nm_arena_t *a, size_t size)
+{
+    nm_arena_blk_t *blk = nm_alloc(sizeof(nm_arena_blk_t) + size);
+
+    blk->next = a->head;
+    blk->size = size;
+    blk->used = 0;
+
+    a->head = blk;
+    a->total += size;
+
+    return blk;
+}
+
+/* vim:set ts=4 sw=4: */
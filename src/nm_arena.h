@@ -0,0 +1,34 @@
+#ifndef NM_ARENA_H_
+#define NM_ARENA_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+
+/* Bump allocator for short-lived data. Memory is released all at once
+ * by nm_arena_reset(), blocks are kept for reuse. */
+typedef struct nm_arena_blk nm_arena_blk_t;
+
+typedef struct {
+    nm_arena_blk_t *head; /* current block */
+    size_t total;         /* bytes in all blocks */
+} nm_arena_t;
+
+#define NM_INIT_ARENA (nm_arena_t) { NULL, 0 }
+
+void *nm_arena_alloc(nm_arena_t *a, size_t size);
+void nm_arena_reset(nm_arena_t *a);
+void nm_arena_free(nm_arena_t *a);
+
+/* Strings are read-only views, like nm_str_view() */
+nm_str_t nm_arena_text(nm_arena_t *a, const char *src, size_t len);
+nm_str_t nm_arena_format(nm_arena_t *a, const char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)));
+
+/* Storage of arr is taken from arena, it is moved to heap if outgrown */
+void nm_arena_arr(nm_arena_t *a, nm_arr_t *arr, size_t n_memb);
+
+/* Arena of TUI main loop, reset after every iteration */
+nm_arena_t *nm_arena_frame(void);
+
+#endif /* NM_ARENA_H_ */
+/* vim:set ts=4 sw=4: */
@@ -5,6 +5,7 @@
 #include <nm_cfg_file.h>
 #include <nm_mon_daemon.h>
 #include <nm_ini_parser.h>
+#include <nm_trace.h>
 
 static const char NM_CFG_NAME[]         = "nemu.cfg";
 static const char NM_DEFAULT_VMDIR[]    = "nemu_vm";
@@ -32,9 +33,15 @@ static const char NM_INI_P_VANY[]       = "listen_any";
 static const char NM_INI_P_QTRG[]       = "targets";
 static const char NM_INI_P_QENL[]       = "enable_log";
 static const char NM_INI_P_QLOG[]       = "log_cmd";
+static const char NM_INI_P_QIOT[]       = "iothread";
+static const char NM_INI_P_QURG[]       = "io_uring";
 static const char NM_INI_P_PID[]        = "pid";
 static const char NM_INI_P_AUTO[]       = "autostart";
 static const char NM_INI_P_SLP[]        = "sleep";
+static const char NM_INI_P_SOCK[]       = "api_socket";
+static const char NM_INI_P_TRCE[]       = "trace";
+static const char NM_INI_P_TFIL[]       = "trace_file";
+static const char NM_INI_P_TSLW[]       = "trace_slow";
 #if defined (NM_OS_LINUX)
 static const char NM_INI_P_DYES[]       = "dbus_enabled";
 static const char NM_INI_P_DTMT[]       = "dbus_timeout";
@@ -173,6 +180,20 @@ void nm_cfg_init(void)
             nm_bug(_("cfg: no write access to %s"), tmp_buf.data);
     }
 
+    /* virtio disks with own I/O thread, off by default */
+    nm_str_trunc(&tmp_buf, 0);
+    if (nm_get_opt_param(ini, NM_INI_S_QEMU, NM_INI_P_QIOT, &tmp_buf) == NM_OK)
+        cfg.iothread = !!nm_str_stoui(&tmp_buf, 10);
+    else
+        cfg.iothread = 0;
+
+    /* disk AIO with io_uring, off by default */
+    nm_str_trunc(&tmp_buf, 0);
+    if (nm_get_opt_param(ini, NM_INI_S_QEMU, NM_INI_P_QURG, &tmp_buf) == NM_OK)
+        cfg.io_uring = !!nm_str_stoui(&tmp_buf, 10);
+    else
+        cfg.io_uring = 0;
+
     nm_str_trunc(&tmp_buf, 0);
     if (nm_get_opt_param(ini, NM_INI_S_MAIN, NM_INI_P_HL, &tmp_buf) == NM_OK)
     {
@@ -187,6 +208,33 @@ void nm_cfg_init(void)
         nm_debug("HL color: r:%d g:%d b:%d\n",
                 cfg.hl_color.r, cfg.hl_color.g, cfg.hl_color.b);
     }
+
+    /* Trace log: level, file and threshold of slow operations (ms) */
+    nm_str_trunc(&tmp_buf, 0);
+    if (nm_get_opt_param(ini, NM_INI_S_MAIN, NM_INI_P_TRCE, &tmp_buf) == NM_OK)
+    {
+        cfg.trace_level = nm_str_stoui(&tmp_buf, 10);
+        if (cfg.trace_level > NM_TRACE_DEBUG)
+            nm_bug(_("cfg: incorrect trace level %u"), cfg.trace_level);
+    } else {
+#ifdef NM_DEBUG
+        cfg.trace_level = NM_TRACE_DEBUG;
+#else
+        cfg.trace_level = NM_TRACE_OFF;
+#endif
+    }
+
+    /* default file is kept if not set */
+    nm_get_opt_param(ini, NM_INI_S_MAIN, NM_INI_P_TFIL, &cfg.trace_path);
+
+    nm_str_trunc(&tmp_buf, 0);
+    if (nm_get_opt_param(ini, NM_INI_S_MAIN, NM_INI_P_TSLW, &tmp_buf) == NM_OK) {
+        cfg.trace_slow = nm_str_stoul(&tmp_buf, 10);
+    } else {
+        cfg.trace_slow = NM_TRACE_SLOW;
+    }
+
+    nm_trace_init(cfg.trace_path.data, cfg.trace_level, cfg.trace_slow);
     nm_str_trunc(&tmp_buf, 0);
     if (nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_AUTO, &tmp_buf) == NM_OK) {
         cfg.start_daemon = !!nm_str_stoui(&tmp_buf, 10);
@@ -201,6 +249,10 @@ void nm_cfg_init(void)
     } else {
         cfg.daemon_sleep = NM_MON_SLEEP;
     }
+
+    if (nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_SOCK, &cfg.daemon_sock) != NM_OK) {
+        nm_str_alloc_text(&cfg.daemon_sock, NM_MON_API_SOCK);
+    }
 #if NM_WITH_DBUS
     nm_str_trunc(&tmp_buf, 0);
     if (nm_get_opt_param(ini, NM_INI_S_DMON, NM_INI_P_DYES, &tmp_buf) == NM_OK) {
@@ -240,7 +292,9 @@ void nm_cfg_free(void)
     nm_str_free(&cfg.spice_args);
 #endif
     nm_str_free(&cfg.log_path);
+    nm_str_free(&cfg.trace_path);
     nm_str_free(&cfg.daemon_pid);
+    nm_str_free(&cfg.daemon_sock);
     nm_vect_free(&cfg.qemu_targets, NULL);
 }
 
@@ -31,10 +31,14 @@ typedef struct {
     nm_view_args_t vnc_view;
 #endif
     nm_str_t log_path;
+    nm_str_t trace_path;
     nm_str_t daemon_pid;
+    nm_str_t daemon_sock;
     nm_vect_t qemu_targets;
     nm_rgb_t hl_color;
     uint64_t daemon_sleep;
+    uint64_t trace_slow;
+    uint32_t trace_level;
 #if NM_WITH_DBUS
     uint32_t dbus_enabled:1;
     int64_t dbus_timeout;
@@ -43,6 +47,8 @@ typedef struct {
     uint32_t listen_any:1;
     uint32_t spice_default:1;
     uint32_t log_enabled:1;
+    uint32_t iothread:1;
+    uint32_t io_uring:1;
     uint32_t hl_is_set:1;
 } nm_cfg_t;
 
@@ -9,29 +9,62 @@
 #include <nm_vm_control.h>
 #include <nm_clone_vm.h>
 
+#include <time.h>
+
 static const char NM_CLONE_NAME_MSG[] ="Name";
+static const char NM_CLONE_LINK_MSG[] ="Linked clone";
+
+static const char *nm_form_msg[] = {
+    NM_CLONE_NAME_MSG, NM_CLONE_LINK_MSG, NULL
+};
+
+/* base images of linked clones, inside vm_dir */
+static const char NM_CLONE_BASE_DIR[] = ".base";
 
+static const char NM_QCOW2_MAGIC[] = "QFI\xfb";
+
+enum {
+    NM_FLD_NAME = 0,
+    NM_FLD_LINK,
+    NM_FLD_COUNT
+};
+
+static int nm_clone_has_snaps(const nm_str_t *name);
 static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vect_t *drives);
+                              const nm_db_res_t *drives, int linked,
+                              nm_vect_t *bases, nm_vect_t *swaps);
 static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vmctl_data_t *vm);
+                              const nm_vmctl_data_t *vm,
+                              const nm_vect_t *bases, const nm_vect_t *swaps);
+static int nm_clone_vm_swap(const nm_str_t *src, const nm_db_res_t *drives,
+                            const nm_vect_t *bases, const nm_vect_t *swaps);
+static int nm_clone_drive_link(const nm_str_t *src, const nm_db_drive_t *drive,
+                               const nm_str_t *dst_path, nm_str_t *base,
+                               nm_str_t *swap);
+static int nm_clone_make_base(const nm_db_drive_t *drive,
+                              const nm_str_t *src_path, nm_str_t *base,
+                              nm_str_t *swap);
+static int nm_clone_base_path(const char *drive_name, nm_str_t *base);
+static int nm_clone_overlay(const nm_str_t *base, const nm_str_t *path);
 
 void nm_clone_vm(const nm_str_t *name)
 {
     nm_form_t *form = NULL;
-    nm_field_t *fields[2];
+    nm_field_t *fields[NM_FLD_COUNT + 1];
     nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_str_t buf = NM_INIT_STR;
     nm_str_t cl_name = NM_INIT_STR;
+    nm_str_t link = NM_INIT_STR;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
     nm_vect_t err = NM_INIT_VECT;
-    size_t msg_len;
+    nm_vect_t bases = NM_INIT_VECT;
+    nm_vect_t swaps = NM_INIT_VECT;
+    size_t msg_len = nm_max_msg_len(nm_form_msg);
     pthread_t spin_th;
-    int done = 0;
+    int done = 0, linked, rc;
 
-    msg_len = mbstowcs(NULL, NM_CLONE_NAME_MSG, strlen(NM_CLONE_NAME_MSG));
-    if (nm_form_calc_size(msg_len, 1, &form_data) != NM_OK)
+    if (nm_form_calc_size(msg_len, NM_FLD_COUNT, &form_data) != NM_OK)
         return;
 
     werase(action_window);
@@ -41,22 +74,28 @@ void nm_clone_vm(const nm_str_t *name)
 
     nm_vmctl_get_data(name, &vm);
 
-    fields[0] = new_field(1, form_data.form_len, 0, 0, 0, 0);
-    fields[1] = NULL;
+    for (size_t n = 0; n < NM_FLD_COUNT; n++)
+        fields[n] = new_field(1, form_data.form_len, n * 2, 0, 0, 0);
+    fields[NM_FLD_COUNT] = NULL;
 
-    set_field_type(fields[0], TYPE_REGEXP, "^[a-zA-Z0-9_-]{1,30} *$");
+    set_field_type(fields[NM_FLD_NAME], TYPE_REGEXP, "^[a-zA-Z0-9_-]{1,30} *$");
+    set_field_type(fields[NM_FLD_LINK], TYPE_ENUM, nm_form_yes_no, false, false);
 
     nm_str_format(&buf, "%s-clone", name->data);
-    set_field_buffer(fields[0], 0, buf.data);
+    set_field_buffer(fields[NM_FLD_NAME], 0, buf.data);
+    set_field_buffer(fields[NM_FLD_LINK], 0, nm_form_yes_no[1]);
 
     mvwaddstr(form_data.form_window, 1, 2, _(NM_CLONE_NAME_MSG));
+    mvwaddstr(form_data.form_window, 3, 2, _(NM_CLONE_LINK_MSG));
 
     form = nm_post_form(form_data.form_window, fields, msg_len + 4, NM_TRUE);
     if (nm_draw_form(action_window, form) != NM_OK)
         goto out;
 
-    nm_get_field_buf(fields[0], &cl_name);
+    nm_get_field_buf(fields[NM_FLD_NAME], &cl_name);
+    nm_get_field_buf(fields[NM_FLD_LINK], &link);
     nm_form_check_data(_(NM_CLONE_NAME_MSG), cl_name, err);
+    nm_form_check_data(_(NM_CLONE_LINK_MSG), link, err);
 
     if (nm_print_empty_fields(&err) == NM_ERR)
     {
@@ -67,33 +106,68 @@ void nm_clone_vm(const nm_str_t *name)
     if (nm_form_name_used(&cl_name) == NM_ERR)
         goto out;
 
+    /* internal snapshots would stay in base, while vmsnapshots
+     * of source would refer to its new overlay */
+    linked = (nm_str_cmp_st(&link, "yes") == NM_OK);
+    if (linked && nm_clone_has_snaps(name))
+    {
+        nm_warn(_(NM_MSG_CLONE_SNAP));
+        goto out;
+    }
+
     sp_data.stop = &done;
 
     if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
         nm_bug(_("%s: cannot create thread"), __func__);
 
-    nm_clone_vm_to_fs(name, &cl_name, &vm.drives);
-    nm_clone_vm_to_db(name, &cl_name, &vm);
+    nm_clone_vm_to_fs(name, &cl_name, &vm.drives, linked, &bases, &swaps);
+    nm_clone_vm_to_db(name, &cl_name, &vm, &bases, &swaps);
+    rc = nm_clone_vm_swap(name, &vm.drives, &bases, &swaps);
 
     done = 1;
     if (pthread_join(spin_th, NULL) != 0)
         nm_bug(_("%s: cannot join thread"), __func__);
 
+    /* bases not used by source any more are deleted with clone */
+    if (rc != NM_OK)
+    {
+        nm_vmctl_delete(&cl_name);
+        nm_warn(_(NM_MSG_CLONE_ERR));
+    }
+
 out:
     NM_FORM_EXIT();
     nm_vmctl_free_data(&vm);
     nm_form_free(form, fields);
     nm_str_free(&buf);
     nm_str_free(&cl_name);
+    nm_str_free(&link);
+    nm_vect_free(&bases, nm_str_vect_free_cb);
+    nm_vect_free(&swaps, nm_str_vect_free_cb);
 }
 
+static int nm_clone_has_snaps(const nm_str_t *name)
+{
+    nm_vect_t snaps = NM_INIT_VECT;
+    int rc;
+
+    nm_db_select(NM_GET_SNAPS_NAME_SQL, &snaps, name->data);
+    rc = (snaps.n_memb != 0);
+    nm_vect_free(&snaps, nm_str_vect_free_cb);
+
+    return rc;
+}
+
+/* bases gets base image path of every drive, empty for full copy.
+ * swaps gets path of new overlay of source drive, empty if source
+ * drive is not changed. Source drives are not touched here. */
 static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vect_t *drives)
+                              const nm_db_res_t *drives, int linked,
+                              nm_vect_t *bases, nm_vect_t *swaps)
 {
     nm_str_t old_vm_path = NM_INIT_STR;
     nm_str_t new_vm_path = NM_INIT_STR;
     nm_str_t new_vm_dir = NM_INIT_STR;
-    size_t drives_count;
     char drv_ch = 'a';
 
     nm_str_format(&new_vm_dir, "%s/%s", nm_cfg_get()->vm_dir.data, dst->data);
@@ -109,19 +183,31 @@ static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
     nm_str_format(&old_vm_path, "%s/%s/",
         nm_cfg_get()->vm_dir.data, src->data);
 
-    drives_count = drives->n_memb / NM_DRV_IDX_COUNT;
-
-    for (size_t n = 0; n < drives_count; n++)
+    for (size_t n = 0; n < drives->n_rows; n++)
     {
-        size_t idx_shift = NM_DRV_IDX_COUNT * n;
-        nm_str_t *drive_name = nm_vect_str(drives, NM_SQL_DRV_NAME + idx_shift);
+        const nm_db_drive_t *drive = nm_db_drive(drives, n);
+        const char *drive_name = drive->name;
+        nm_str_t base = NM_INIT_STR;
+        nm_str_t swap = NM_INIT_STR;
 
-        nm_str_add_str(&old_vm_path, drive_name);
+        nm_str_add_text(&old_vm_path, drive_name);
         nm_str_append_format(&new_vm_path, "_%c.img", drv_ch);
 
-        nm_copy_file(&old_vm_path, &new_vm_path);
-
-        nm_str_trunc(&old_vm_path, old_vm_path.len - drive_name->len);
+        /* drive that cannot be linked is copied */
+        if (!linked ||
+            nm_clone_drive_link(src, drive, &new_vm_path, &base, &swap) != NM_OK)
+        {
+            nm_str_trunc(&base, 0);
+            nm_str_trunc(&swap, 0);
+            nm_copy_file(&old_vm_path, &new_vm_path);
+        }
+
+        nm_vect_insert(bases, &base, sizeof(base), nm_str_vect_ins_cb);
+        nm_vect_insert(swaps, &swap, sizeof(swap), nm_str_vect_ins_cb);
+        nm_str_free(&base);
+        nm_str_free(&swap);
+
+        nm_str_trunc(&old_vm_path, old_vm_path.len - strlen(drive_name));
         nm_str_trunc(&new_vm_path, new_vm_path.len - 6);
         drv_ch++;
     }
@@ -131,28 +217,40 @@ static void nm_clone_vm_to_fs(const nm_str_t *src, const nm_str_t *dst,
     nm_str_free(&new_vm_dir);
 }
 
+/* Source drives are switched to new bases in the same transaction
+ * as clone is inserted */
 static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
-                              const nm_vmctl_data_t *vm)
+                              const nm_vmctl_data_t *vm,
+                              const nm_vect_t *bases, const nm_vect_t *swaps)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t buf = NM_INIT_STR;
+    nm_str_t macvtap = NM_INIT_STR;
     uint64_t last_mac;
     uint32_t last_vnc;
-    size_t ifs_count;
-    size_t drives_count;
     int altname = 0;
     char drv_ch = 'a';
 
+    /* MAC and VNC port are taken under write lock,
+     * so concurrent clones get different ones */
+    nm_db_begin();
     nm_form_get_last(&last_mac, &last_vnc);
 
-    nm_str_format(&query, NM_CLONE_VMS_SQL, dst->data, last_vnc, src->data);
-    nm_db_edit(query.data);
+    nm_str_format(&buf, "%u", last_vnc);
+    nm_db_edit(NM_CLONE_VMS_SQL, dst->data, buf.data, src->data);
 
-    /* insert network interface info */
-    ifs_count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
+    for (size_t n = 0; n < vm->drives.n_rows; n++)
+    {
+        if (!*nm_vect_str_ctx(swaps, n))
+            continue;
+
+        nm_db_edit(NM_UPDATE_DRIVE_BASE_SQL, nm_vect_str_ctx(bases, n),
+                src->data, nm_db_drive(&vm->drives, n)->name);
+    }
 
-    for (size_t n = 0; n < ifs_count; n++)
+    /* insert network interface info */
+    for (size_t n = 0; n < vm->ifs.n_rows; n++)
     {
-        size_t idx_shift = NM_IFS_IDX_COUNT * n;
+        const nm_db_iface_t *iface = nm_db_iface(&vm->ifs, n);
         nm_str_t if_name = NM_INIT_STR;
         nm_str_t if_name_copy = NM_INIT_STR;
         nm_str_t maddr = NM_INIT_STR;
@@ -162,17 +260,14 @@ static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
         nm_str_format(&if_name, "%s_eth%zu", dst->data, n);
         nm_str_copy(&if_name_copy, &if_name);
         altname = nm_net_fix_tap_name(&if_name, &maddr);
+        nm_str_format(&macvtap, "%d", iface->macvtap);
 
-        nm_str_format(&query,
-            "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, parent_eth, altname) "
-            "VALUES ('%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s')",
+        nm_db_edit("INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, parent_eth, altname) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
             dst->data, if_name.data, maddr.data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_DRV + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_PET + idx_shift)->data,
+            iface->drv, iface->vhost ? NM_ENABLE : NM_DISABLE,
+            macvtap.data, iface->parent_eth,
             (altname) ? if_name_copy.data : "");
-        nm_db_edit(query.data);
 
         nm_str_free(&if_name);
         nm_str_free(&if_name_copy);
@@ -180,28 +275,224 @@ static void nm_clone_vm_to_db(const nm_str_t *src, const nm_str_t *dst,
     }
 
     /* insert drive info */
-    drives_count = vm->drives.n_memb / NM_DRV_IDX_COUNT;
-
-    for (size_t n = 0; n < drives_count; n++)
+    for (size_t n = 0; n < vm->drives.n_rows; n++)
     {
-        size_t idx_shift = NM_DRV_IDX_COUNT * n;
+        const nm_db_drive_t *drive = nm_db_drive(&vm->drives, n);
 
-        nm_str_format(&query,
-            "INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot) "
-            "VALUES('%s', '%s_%c.img', '%s', '%s', '%s')",
-            dst->data, dst->data, drv_ch,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_TYPE + idx_shift)->data,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_SIZE + idx_shift)->data,
-            nm_vect_str(&vm->drives, NM_SQL_DRV_BOOT + idx_shift)->data);
-        nm_db_edit(query.data);
+        nm_str_format(&buf, "%s_%c.img", dst->data, drv_ch);
+        nm_db_edit("INSERT INTO drives(vm_name, drive_name, drive_drv, capacity, boot, backing) "
+            "VALUES(?, ?, ?, ?, ?, ?)",
+            dst->data, buf.data,
+            drive->drv, drive->capacity,
+            drive->boot ? NM_ENABLE : NM_DISABLE,
+            nm_vect_str_ctx(bases, n));
 
         drv_ch++;
     }
 
     nm_form_update_last_mac(last_mac);
     nm_form_update_last_vnc(last_vnc);
+    nm_db_commit();
+
+    nm_str_free(&buf);
+    nm_str_free(&macvtap);
+}
+
+/* New overlays of source drives are put in place only after clone is
+ * stored: if database update fails, source VM is left as it was.
+ * If overlay cannot be put in place, source drives which are not
+ * switched yet are restored in database and NM_ERR is returned,
+ * clone must be deleted then. */
+static int nm_clone_vm_swap(const nm_str_t *src, const nm_db_res_t *drives,
+                            const nm_vect_t *bases, const nm_vect_t *swaps)
+{
+    nm_str_t src_path = NM_INIT_STR;
+    size_t n;
+
+    for (n = 0; n < drives->n_rows; n++)
+    {
+        const nm_db_drive_t *drive = nm_db_drive(drives, n);
+        const char *swap = nm_vect_str_ctx(swaps, n);
+        const char *base = nm_vect_str_ctx(bases, n);
+
+        if (!*swap)
+            continue;
+
+        nm_str_format(&src_path, "%s/%s/%s",
+            nm_cfg_get()->vm_dir.data, src->data, drive->name);
 
-    nm_str_free(&query);
+        if (rename(swap, src_path.data) != 0)
+            break;
+
+        chmod(base, S_IRUSR | S_IRGRP | S_IROTH);
+
+        /* old base may still be used by other clones */
+        if (*drive->backing)
+            nm_vmctl_base_unref(drive->backing);
+
+        nm_debug("%s: %s is base of %s\n", __func__, base, src_path.data);
+    }
+
+    nm_str_free(&src_path);
+
+    if (n == drives->n_rows)
+        return NM_OK;
+
+    nm_db_begin();
+    for (; n < drives->n_rows; n++)
+    {
+        const nm_db_drive_t *drive = nm_db_drive(drives, n);
+        const char *swap = nm_vect_str_ctx(swaps, n);
+
+        if (!*swap)
+            continue;
+
+        unlink(swap);
+        nm_db_edit(NM_RESTORE_DRIVE_BASE_SQL, drive->backing,
+                drive->ova_path, drive->ova_offset, drive->ova_size,
+                drive->ova_fmt, src->data, drive->name);
+    }
+    nm_db_commit();
+
+    return NM_ERR;
+}
+
+/* Linked clone drive is qcow2 overlay on read-only base image.
+ * Source drive becomes base and source VM gets overlay too.
+ * New base is made for every clone: an unchanged source overlay
+ * cannot be told from a changed one by its stat(2) alone. */
+static int nm_clone_drive_link(const nm_str_t *src, const nm_db_drive_t *drive,
+                               const nm_str_t *dst_path, nm_str_t *base,
+                               nm_str_t *swap)
+{
+    nm_str_t src_path = NM_INIT_STR;
+    int rc = NM_ERR;
+
+    nm_str_format(&src_path, "%s/%s/%s",
+        nm_cfg_get()->vm_dir.data, src->data, drive->name);
+
+    if (nm_clone_make_base(drive, &src_path, base, swap) != NM_OK)
+        goto out;
+
+    if ((rc = nm_clone_overlay(base, dst_path)) != NM_OK)
+    {
+        unlink(swap->data);
+        unlink(base->data);
+    }
+
+out:
+    nm_str_free(&src_path);
+
+    return rc;
+}
+
+/* Bases are kept flat: changed overlay is merged with its old base
+ * (or with disk image in OVA) into a new one instead of making
+ * backing chains. Base of plain image is hard link to it, so source
+ * drive is kept until its new overlay (swap) replaces it. */
+static int nm_clone_make_base(const nm_db_drive_t *drive,
+                              const nm_str_t *src_path, nm_str_t *base,
+                              nm_str_t *swap)
+{
+    if (nm_clone_base_path(drive->name, base) != NM_OK)
+        return NM_ERR;
+
+    if (!*drive->backing && !*drive->ova_path)
+    {
+        if (link(src_path->data, base->data) != 0)
+            return NM_ERR;
+    }
+    else
+    {
+        nm_argv_t argv = NM_INIT_ARGV;
+        int conv_rc;
+
+        nm_argv_add(&argv, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
+        nm_argv_add(&argv, "convert");
+        nm_argv_add(&argv, "-O");
+        nm_argv_add(&argv, "qcow2");
+        nm_argv_add(&argv, src_path->data);
+        nm_argv_add(&argv, base->data);
+
+        conv_rc = nm_spawn_process(&argv, NULL);
+        nm_argv_free(&argv);
+
+        if (conv_rc != NM_OK)
+        {
+            unlink(base->data);
+            return NM_ERR;
+        }
+    }
+
+    nm_str_format(swap, "%s.new", src_path->data);
+
+    if (nm_clone_overlay(base, swap) != NM_OK)
+    {
+        unlink(swap->data);
+        unlink(base->data);
+        return NM_ERR;
+    }
+
+    return NM_OK;
+}
+
+static int nm_clone_base_path(const char *drive_name, nm_str_t *base)
+{
+    nm_str_t dir = NM_INIT_STR;
+    struct stat info;
+    long long stamp = (long long) time(NULL);
+    int rc = NM_OK;
+
+    nm_str_format(&dir, "%s/%s", nm_cfg_get()->vm_dir.data, NM_CLONE_BASE_DIR);
+
+    if (mkdir(dir.data, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 &&
+        errno != EEXIST)
+    {
+        rc = NM_ERR;
+        goto out;
+    }
+
+    do {
+        nm_str_format(base, "%s/%s.%lld", dir.data, drive_name, stamp++);
+    } while (stat(base->data, &info) == 0);
+
+out:
+    nm_str_free(&dir);
+
+    return rc;
+}
+
+static int nm_clone_overlay(const nm_str_t *base, const nm_str_t *path)
+{
+    nm_argv_t argv = NM_INIT_ARGV;
+    char magic[sizeof(NM_QCOW2_MAGIC) - 1] = {0};
+    int fd, rc;
+
+    if ((fd = open(base->data, O_RDONLY)) == -1)
+        return NM_ERR;
+
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic))
+    {
+        close(fd);
+        return NM_ERR;
+    }
+    close(fd);
+
+    nm_argv_add(&argv, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
+    nm_argv_add(&argv, "create");
+    nm_argv_add(&argv, "-f");
+    nm_argv_add(&argv, "qcow2");
+    nm_argv_add(&argv, "-F");
+    nm_argv_add(&argv, memcmp(magic, NM_QCOW2_MAGIC, sizeof(magic)) ?
+            "raw" : "qcow2");
+    nm_argv_add(&argv, "-b");
+    nm_argv_add(&argv, base->data);
+    nm_argv_add(&argv, path->data);
+
+    rc = nm_spawn_process(&argv, NULL);
+    nm_argv_free(&argv);
+
+    return rc;
 }
 
 /* vim:set ts=4 sw=4: */
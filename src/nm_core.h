@@ -79,6 +79,8 @@ static const char NM_DEFAULT_DRVINT[] = "virtio";
 static const char NM_DEFAULT_USBVER[] = "XHCI";
 static const char NM_VM_PID_FILE[]    = "qemu.pid";
 static const char NM_VM_QMP_FILE[]    = "qmp.sock";
+/* QMP monitor reserved for events delivery to nemu-monitor */
+static const char NM_VM_QMP_EVT_FILE[] = "qmp_evt.sock";
 
 static inline char * __attribute__((format_arg (1))) _(const char *str)
 {
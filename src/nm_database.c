@@ -4,16 +4,153 @@
 #include <nm_vector.h>
 #include <nm_cfg_file.h>
 #include <nm_database.h>
+#include <nm_trace.h>
 
+#include <stddef.h>
 #include <sqlite3.h>
 
 typedef sqlite3 nm_sqlite_t;
 
+/* Compiled statements are kept for the whole session and looked up
+ * by hash of SQL text: query templates are constant, values are bound.
+ * Table is open addressed and kept at most half full. */
+enum {
+    NM_DB_STMT_SLOTS = 256,         /* power of two */
+    NM_DB_STMT_MAX   = NM_DB_STMT_SLOTS / 2
+};
+
+/* Database is shared with nemu-monitor, CLI calls and other TUIs.
+ * Writer waits for lock up to NM_DB_BUSY_TIMEOUT ms, then statement
+ * is retried before giving up. */
+enum {
+    NM_DB_BUSY_TIMEOUT = 5000,
+    NM_DB_BUSY_RETRY   = 3
+};
+
+typedef struct {
+    uint32_t hash;
+    sqlite3_stmt *stmt;
+} nm_db_stmt_slot_t;
+
 static nm_sqlite_t *db_handler = NULL;
+static nm_db_stmt_slot_t nm_db_stmts[NM_DB_STMT_SLOTS];
+static size_t nm_db_stmt_count = 0;
+static uint64_t nm_db_edits = 0;
+static size_t nm_db_depth = 0;
+
+enum {
+    NM_DB_COL_TEXT = 0,
+    NM_DB_COL_INT
+};
+
+typedef struct {
+    int type;
+    size_t offset;
+} nm_db_col_t;
+
+typedef struct {
+    const nm_db_col_t *cols;
+    size_t n_cols;
+    size_t row_size;
+} nm_db_row_desc_t;
+
+#define NM_DB_TEXT(t, f) { NM_DB_COL_TEXT, offsetof(t, f) }
+#define NM_DB_INT(t, f)  { NM_DB_COL_INT, offsetof(t, f) }
+
+/* column order must follow the order of selected columns */
+static const nm_db_col_t nm_db_vm_cols[] = {
+    NM_DB_INT(nm_db_vm_t, id),
+    NM_DB_TEXT(nm_db_vm_t, name),
+    NM_DB_INT(nm_db_vm_t, mem),
+    NM_DB_INT(nm_db_vm_t, smp),
+    NM_DB_INT(nm_db_vm_t, kvm),
+    NM_DB_INT(nm_db_vm_t, hcpu),
+    NM_DB_INT(nm_db_vm_t, vnc),
+    NM_DB_TEXT(nm_db_vm_t, arch),
+    NM_DB_TEXT(nm_db_vm_t, iso),
+    NM_DB_INT(nm_db_vm_t, install),
+    NM_DB_INT(nm_db_vm_t, usb),
+    NM_DB_INT(nm_db_vm_t, usbid),
+    NM_DB_TEXT(nm_db_vm_t, bios),
+    NM_DB_TEXT(nm_db_vm_t, kernel),
+    NM_DB_INT(nm_db_vm_t, mouse_override),
+    NM_DB_TEXT(nm_db_vm_t, kernel_append),
+    NM_DB_TEXT(nm_db_vm_t, tty_path),
+    NM_DB_TEXT(nm_db_vm_t, socket_path),
+    NM_DB_TEXT(nm_db_vm_t, initrd),
+    NM_DB_TEXT(nm_db_vm_t, machine),
+    NM_DB_INT(nm_db_vm_t, fs9p_enable),
+    NM_DB_TEXT(nm_db_vm_t, fs9p_path),
+    NM_DB_TEXT(nm_db_vm_t, fs9p_name),
+    NM_DB_TEXT(nm_db_vm_t, usb_type),
+    NM_DB_INT(nm_db_vm_t, spice),
+    NM_DB_INT(nm_db_vm_t, debug_port),
+    NM_DB_INT(nm_db_vm_t, debug_freeze),
+    NM_DB_TEXT(nm_db_vm_t, cmdappend)
+};
+
+static const nm_db_col_t nm_db_iface_cols[] = {
+    NM_DB_TEXT(nm_db_iface_t, name),
+    NM_DB_TEXT(nm_db_iface_t, mac_addr),
+    NM_DB_TEXT(nm_db_iface_t, drv),
+    NM_DB_TEXT(nm_db_iface_t, ipv4_addr),
+    NM_DB_INT(nm_db_iface_t, vhost),
+    NM_DB_INT(nm_db_iface_t, macvtap),
+    NM_DB_TEXT(nm_db_iface_t, parent_eth),
+    NM_DB_TEXT(nm_db_iface_t, altname),
+    NM_DB_TEXT(nm_db_iface_t, vm_name)
+};
+
+static const nm_db_col_t nm_db_drive_cols[] = {
+    NM_DB_TEXT(nm_db_drive_t, name),
+    NM_DB_TEXT(nm_db_drive_t, drv),
+    NM_DB_TEXT(nm_db_drive_t, capacity),
+    NM_DB_INT(nm_db_drive_t, boot),
+    NM_DB_TEXT(nm_db_drive_t, backing),
+    NM_DB_TEXT(nm_db_drive_t, ova_path),
+    NM_DB_TEXT(nm_db_drive_t, ova_offset),
+    NM_DB_TEXT(nm_db_drive_t, ova_size),
+    NM_DB_TEXT(nm_db_drive_t, ova_fmt),
+    NM_DB_TEXT(nm_db_drive_t, vm_name)
+};
+
+static const nm_db_col_t nm_db_usb_cols[] = {
+    NM_DB_INT(nm_db_usb_t, id),
+    NM_DB_TEXT(nm_db_usb_t, vm_name),
+    NM_DB_TEXT(nm_db_usb_t, dev_name),
+    NM_DB_TEXT(nm_db_usb_t, vendor_id),
+    NM_DB_TEXT(nm_db_usb_t, product_id),
+    NM_DB_TEXT(nm_db_usb_t, serial)
+};
+
+static const nm_db_col_t nm_db_snap_cols[] = {
+    NM_DB_INT(nm_db_snap_t, id),
+    NM_DB_TEXT(nm_db_snap_t, vm_name),
+    NM_DB_TEXT(nm_db_snap_t, snap_name),
+    NM_DB_INT(nm_db_snap_t, load),
+    NM_DB_TEXT(nm_db_snap_t, timestamp)
+};
+
+static const nm_db_row_desc_t nm_db_rows[NM_DB_ROW_COUNT] = {
+    [NM_DB_ROW_VM] = { nm_db_vm_cols, nm_arr_len(nm_db_vm_cols),
+                       sizeof(nm_db_vm_t) },
+    [NM_DB_ROW_IFACE] = { nm_db_iface_cols, nm_arr_len(nm_db_iface_cols),
+                          sizeof(nm_db_iface_t) },
+    [NM_DB_ROW_DRIVE] = { nm_db_drive_cols, nm_arr_len(nm_db_drive_cols),
+                          sizeof(nm_db_drive_t) },
+    [NM_DB_ROW_USB] = { nm_db_usb_cols, nm_arr_len(nm_db_usb_cols),
+                        sizeof(nm_db_usb_t) },
+    [NM_DB_ROW_SNAP] = { nm_db_snap_cols, nm_arr_len(nm_db_snap_cols),
+                         sizeof(nm_db_snap_t) }
+};
 
 static void nm_db_check_version(void);
-static int nm_db_select_cb(void *v, int argc, char **argv,
-                           char **unused NM_UNUSED);
+static void nm_db_exec(const char *query);
+static int nm_db_step(sqlite3_stmt *stmt);
+static sqlite3_stmt *nm_db_cached(const char *query);
+static uint32_t nm_db_hash(const char *query);
+static sqlite3_stmt *nm_db_prepare(const char *query, va_list args);
+static void nm_db_finalize(void);
 
 void nm_db_init(void)
 {
@@ -39,12 +176,19 @@ void nm_db_init(void)
             "vm_name char, if_name char, mac_addr char, ipv4_addr char, "
             "if_drv char, vhost integer, macvtap integer, parent_eth char, altname char)",
         "CREATE TABLE drives(id integer primary key autoincrement, "
-            "vm_name char, drive_name char, drive_drv char, capacity integer, boot integer)",
+            "vm_name char, drive_name char, drive_drv char, capacity integer, boot integer, "
+            "backing char, ova_path char, ova_offset integer, ova_size integer, "
+            "ova_fmt char)",
         "CREATE TABLE vmsnapshots(id integer primary key autoincrement, "
             "vm_name char, snap_name char, load integer, timestamp char)",
         "CREATE TABLE veth(id integer primary key autoincrement, l_name char, r_name char)",
         "CREATE TABLE usb(id integer primary key autoincrement, "
-            "vm_name char, dev_name char, vendor_id char, product_id char, serial char)"
+            "vm_name char, dev_name char, vendor_id char, product_id char, serial char)",
+        "CREATE INDEX vms_name ON vms(name)",
+        "CREATE INDEX ifaces_vm_name ON ifaces(vm_name)",
+        "CREATE INDEX drives_vm_name ON drives(vm_name)",
+        "CREATE INDEX vmsnapshots_vm_name ON vmsnapshots(vm_name)",
+        "CREATE INDEX usb_vm_name ON usb(vm_name)"
     };
 
     if (stat(cfg->db_path.data, &file_info) == -1)
@@ -53,12 +197,25 @@ void nm_db_init(void)
     if ((rc = sqlite3_open(cfg->db_path.data, &db_handler)) != SQLITE_OK)
         nm_bug(_("%s: database error: %s"), __func__, sqlite3_errstr(rc));
 
+    sqlite3_busy_timeout(db_handler, NM_DB_BUSY_TIMEOUT);
+
+    /* readers do not block writer and commit is one append to WAL.
+     * Mode is stored in database file, so it is set only once */
+    if (sqlite3_exec(db_handler, "PRAGMA journal_mode=WAL",
+                NULL, NULL, &db_errmsg) != SQLITE_OK)
+    {
+        nm_debug("%s: cannot enable WAL: %s\n", __func__, db_errmsg);
+        sqlite3_free(db_errmsg);
+    }
+
     if (!need_create_db)
     {
         nm_db_check_version();
         return;
     }
 
+    nm_db_begin();
+
     for (size_t n = 0; n < nm_arr_len(query); n++)
     {
         nm_debug("%s: \"%s\"\n", __func__, query[n]);
@@ -66,43 +223,256 @@ void nm_db_init(void)
         if (sqlite3_exec(db_handler, query[n], NULL, NULL, &db_errmsg) != SQLITE_OK)
             nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
     }
+
+    nm_db_commit();
 }
 
-void nm_db_select(const char *query, nm_vect_t *v)
+void nm_db_select(const char *query, nm_vect_t *v, ...)
 {
-    char *db_errmsg;
+    nm_trace_span_t span = nm_trace_begin();
+    sqlite3_stmt *stmt;
+    nm_str_t value = NM_INIT_STR;
+    va_list args;
+    int rc;
 
     nm_debug("%s: \"%s\"\n", __func__, query);
 
-    if (sqlite3_exec(db_handler, query, nm_db_select_cb,
-                    (void *) v, &db_errmsg) != SQLITE_OK)
+    va_start(args, v);
+    stmt = nm_db_prepare(query, args);
+    va_end(args);
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+        int ncol = sqlite3_column_count(stmt);
+
+        for (int n = 0; n < ncol; n++)
+        {
+            const char *text = (const char *) sqlite3_column_text(stmt, n);
+
+            nm_str_alloc_text(&value, text ? text : "");
+            nm_vect_insert(v, &value, sizeof(nm_str_t), nm_str_vect_ins_cb);
+        }
     }
+
+    if (rc != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    nm_str_free(&value);
+
+    nm_trace_end(span, "db: %s", query);
 }
 
-void nm_db_edit(const char *query)
+/* Statement is stepped once, so rows come from single read.
+ * Rows and strings are collected into two growing buffers, string
+ * fields keep offsets until strings are appended after the rows
+ * and offsets are turned into pointers. */
+void nm_db_select_rows(const char *query, int type, nm_db_res_t *res, ...)
 {
-    char *db_errmsg;
+    nm_trace_span_t span = nm_trace_begin();
+    const nm_db_row_desc_t *desc;
+    sqlite3_stmt *stmt;
+    size_t rows_cap = 0, text_len = 0, text_cap = 0;
+    char *rows = NULL, *text_buf = NULL;
+    va_list args;
+    int rc;
 
     nm_debug("%s: \"%s\"\n", __func__, query);
 
-    if (sqlite3_exec(db_handler, query, NULL, NULL, &db_errmsg) != SQLITE_OK)
-        nm_bug(_("%s: database error: %s"), __func__, db_errmsg);
+    if (type < 0 || type >= NM_DB_ROW_COUNT)
+        nm_bug(_("%s: invalid row type"), __func__);
+
+    desc = &nm_db_rows[type];
+
+    va_start(args, res);
+    stmt = nm_db_prepare(query, args);
+    va_end(args);
+
+    res->row_size = desc->row_size;
+    res->n_rows = 0;
+    res->rows = NULL;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        int ncol = sqlite3_column_count(stmt);
+        char *row;
+
+        if (res->n_rows == rows_cap)
+        {
+            rows_cap = rows_cap ? rows_cap * 2 : 8;
+            rows = nm_realloc(rows, rows_cap * desc->row_size);
+        }
+
+        row = rows + res->n_rows * desc->row_size;
+
+        for (size_t n = 0; n < desc->n_cols; n++)
+        {
+            const nm_db_col_t *col = &desc->cols[n];
+            const char *text = NULL;
+            size_t len = 0;
+
+            if (col->type == NM_DB_COL_INT)
+            {
+                *(int *) (row + col->offset) =
+                    ((int) n < ncol) ? sqlite3_column_int(stmt, n) : 0;
+                continue;
+            }
+
+            /* column_bytes() is valid only after column_text() */
+            if ((int) n < ncol)
+            {
+                text = (const char *) sqlite3_column_text(stmt, n);
+                len = sqlite3_column_bytes(stmt, n);
+            }
+
+            if (text_len + len + 1 > text_cap)
+            {
+                while (text_len + len + 1 > text_cap)
+                    text_cap = text_cap ? text_cap * 2 : 256;
+                text_buf = nm_realloc(text_buf, text_cap);
+            }
+
+            if (text && len)
+                memcpy(text_buf + text_len, text, len);
+            text_buf[text_len + len] = '\0';
+
+            *(const char **) (row + col->offset) =
+                (const char *) (uintptr_t) text_len;
+            text_len += len + 1;
+        }
+        res->n_rows++;
+    }
+
+    if (rc != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    if (res->n_rows)
+    {
+        size_t rows_len = res->n_rows * desc->row_size;
+
+        rows = nm_realloc(rows, rows_len + text_len);
+        memcpy(rows + rows_len, text_buf, text_len);
+
+        for (size_t r = 0; r < res->n_rows; r++)
+        {
+            char *row = rows + r * desc->row_size;
+
+            for (size_t n = 0; n < desc->n_cols; n++)
+            {
+                const nm_db_col_t *col = &desc->cols[n];
+                uintptr_t off;
+
+                if (col->type != NM_DB_COL_TEXT)
+                    continue;
+
+                off = (uintptr_t) *(const char **) (row + col->offset);
+                *(const char **) (row + col->offset) = rows + rows_len + off;
+            }
+        }
+
+        res->rows = rows;
+    }
+
+    free(text_buf);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    nm_trace_end(span, "db: %s: %zu rows", query, res->n_rows);
+}
+
+const void *nm_db_row(const nm_db_res_t *res, size_t idx)
+{
+    if (res == NULL)
+        nm_bug(_("%s: NULL result pointer value"), __func__);
+
+    if (idx >= res->n_rows)
+        nm_bug(_("%s: invalid index"), __func__);
+
+    return (const char *) res->rows + idx * res->row_size;
+}
+
+void nm_db_res_free(nm_db_res_t *res)
+{
+    free(res->rows);
+    *res = NM_INIT_DB_RES;
+}
+
+void nm_db_edit(const char *query, ...)
+{
+    nm_trace_span_t span = nm_trace_begin();
+    sqlite3_stmt *stmt;
+    va_list args;
+    int rc;
+
+    nm_debug("%s: \"%s\"\n", __func__, query);
+
+    va_start(args, query);
+    stmt = nm_db_prepare(query, args);
+    va_end(args);
+
+    if ((rc = nm_db_step(stmt)) != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    nm_db_edits++;
+
+    nm_trace_end(span, "db: %s", query);
+}
+
+/* Edits made between nm_db_begin() and nm_db_commit() are written
+ * at once or not at all. Write lock is taken at begin, so values read
+ * inside transaction, e.g. last MAC, are not changed by other
+ * processes until commit. Nested scopes join the outermost one.
+ * If process fails inside transaction, it is rolled back by SQLite. */
+void nm_db_begin(void)
+{
+    if (nm_db_depth++ == 0)
+        nm_db_exec("BEGIN IMMEDIATE");
+}
+
+void nm_db_commit(void)
+{
+    if (!nm_db_depth)
+        nm_bug(_("%s: no transaction"), __func__);
+
+    if (--nm_db_depth == 0)
+        nm_db_exec("COMMIT");
+}
+
+/* Number of nm_db_edit() calls made by this process */
+uint64_t nm_db_edit_count(void)
+{
+    return nm_db_edits;
+}
+
+/* Changes when other connections commit to the database,
+ * changes made by this connection are not counted */
+int64_t nm_db_data_version(void)
+{
+    sqlite3_stmt *stmt = nm_db_cached(NM_GET_DATA_VERSION_SQL);
+    int64_t version = -1;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64(stmt, 0);
+
+    sqlite3_reset(stmt);
+
+    return version;
 }
 
 void nm_db_close(void)
 {
+    nm_db_finalize();
     sqlite3_close(db_handler);
 }
 
 static void nm_db_check_version(void)
 {
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t res = NM_INIT_VECT;
 
-    nm_str_alloc_text(&query, NM_GET_DB_VERSION_SQL);
-    nm_db_select(query.data, &res);
+    nm_db_select(NM_GET_DB_VERSION_SQL, &res);
 
     if (!res.n_memb)
     {
@@ -118,24 +488,127 @@ static void nm_db_check_version(void)
     }
 
     nm_vect_free(&res, nm_str_vect_free_cb);
-    nm_str_free(&query);
 }
 
-static int nm_db_select_cb(void *v, int argc, char **argv,
-                           char **unused NM_UNUSED)
+static void nm_db_exec(const char *query)
 {
-    nm_vect_t *res = (nm_vect_t *) v;
-    nm_str_t value = NM_INIT_STR;
+    nm_trace_span_t span = nm_trace_begin();
+    sqlite3_stmt *stmt = nm_db_cached(query);
+    int rc;
+
+    nm_debug("%s: \"%s\"\n", __func__, query);
+
+    if ((rc = nm_db_step(stmt)) != SQLITE_DONE)
+        nm_bug(_("%s: database error: %s"), __func__, sqlite3_errmsg(db_handler));
+
+    sqlite3_reset(stmt);
 
-    for (int n = 0; n < argc; n++)
+    /* commit time includes waiting for lock and fsync */
+    nm_trace_end(span, "db: %s", query);
+}
+
+/* Busy handler has already waited for lock when SQLITE_BUSY is
+ * returned. Statement is run again, lock may be free by now. */
+static int nm_db_step(sqlite3_stmt *stmt)
+{
+    int rc = SQLITE_BUSY;
+
+    for (int n = 0; n < NM_DB_BUSY_RETRY && (rc & 0xff) == SQLITE_BUSY; n++)
     {
-        nm_str_alloc_text(&value, argv[n] ? argv[n] : "");
-        nm_vect_insert(res, &value, sizeof(nm_str_t), nm_str_vect_ins_cb);
+        if (n)
+        {
+            nm_debug("%s: database is locked, retry %d\n", __func__, n);
+            sqlite3_reset(stmt);
+        }
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            ;
     }
 
-    nm_str_free(&value);
+    return rc;
+}
+
+static sqlite3_stmt *nm_db_cached(const char *query)
+{
+    uint32_t hash = nm_db_hash(query);
+    size_t n = hash & (NM_DB_STMT_SLOTS - 1);
+    nm_db_stmt_slot_t *slot;
+
+    for (; nm_db_stmts[n].stmt; n = (n + 1) & (NM_DB_STMT_SLOTS - 1))
+    {
+        slot = &nm_db_stmts[n];
+
+        if (slot->hash == hash && strcmp(sqlite3_sql(slot->stmt), query) == 0)
+            return slot->stmt;
+    }
+
+    /* queries are not built at runtime and all of them fit,
+     * table is started over only if many templates are added */
+    if (nm_db_stmt_count == NM_DB_STMT_MAX)
+    {
+        nm_db_finalize();
+        n = hash & (NM_DB_STMT_SLOTS - 1);
+    }
+
+    slot = &nm_db_stmts[n];
+
+    if (sqlite3_prepare_v2(db_handler, query, -1, &slot->stmt, NULL) != SQLITE_OK)
+    {
+        nm_bug(_("%s: database error: %s"), __func__,
+                sqlite3_errmsg(db_handler));
+    }
+
+    slot->hash = hash;
+    nm_db_stmt_count++;
+
+    return slot->stmt;
+}
+
+/* FNV-1a */
+static uint32_t nm_db_hash(const char *query)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *query; query++)
+    {
+        hash ^= (unsigned char) *query;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* Returns cached statement for query with all parameters bound.
+ * Every '?' takes next argument as text, NULL is bound as empty string */
+static sqlite3_stmt *nm_db_prepare(const char *query, va_list args)
+{
+    sqlite3_stmt *stmt = nm_db_cached(query);
+    int nparams = sqlite3_bind_parameter_count(stmt);
+
+    for (int n = 1; n <= nparams; n++)
+    {
+        const char *param = va_arg(args, const char *);
+
+        if (sqlite3_bind_text(stmt, n, param ? param : "", -1,
+                    SQLITE_STATIC) != SQLITE_OK)
+        {
+            nm_bug(_("%s: database error: %s"), __func__,
+                    sqlite3_errmsg(db_handler));
+        }
+    }
+
+    return stmt;
+}
+
+static void nm_db_finalize(void)
+{
+    for (size_t n = 0; n < NM_DB_STMT_SLOTS; n++)
+    {
+        sqlite3_finalize(nm_db_stmts[n].stmt);
+        nm_db_stmts[n].stmt = NULL;
+    }
 
-    return 0;
+    nm_db_stmt_count = 0;
 }
 
 /* vim:set ts=4 sw=4: */
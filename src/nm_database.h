@@ -2,112 +2,134 @@
 #define NM_DATABASE_H_
 
 #include <nm_vector.h>
+#include <stdint.h>
 
-#define NM_DB_VERSION "11"
+#define NM_DB_VERSION "14"
 
 //@TODO Those queries should have constant naming convention and some kind of sorting
 static const char NM_GET_VMS_SQL[] = \
     "SELECT name FROM vms ORDER BY name ASC";
 
 static const char NM_CLONE_VMS_SQL[] = \
-    "INSERT INTO vms SELECT NULL, '%s', mem, smp, kvm, hcpu, '%d', arch, iso, " \
+    "INSERT INTO vms SELECT NULL, ?, mem, smp, kvm, hcpu, ?, arch, iso, " \
     "install, usb, usbid, bios, kernel, mouse_override, kernel_append, tty_path, " \
     "socket_path, initrd, machine, fs9p_enable, fs9p_path, fs9p_name, usb_type, " \
-    "spice, debug_port, debug_freeze, cmdappend FROM vms WHERE name='%s'";
+    "spice, debug_port, debug_freeze, cmdappend FROM vms WHERE name=?";
 
 static const char NM_RESET_LOAD_SQL[] = \
-    "UPDATE vmsnapshots SET load='0' WHERE vm_name='%s'";
+    "UPDATE vmsnapshots SET load='0' WHERE vm_name=?";
 
 static const char NM_USB_GET_SQL[] = \
-    "SELECT * FROM usb WHERE vm_name='%s'";
+    "SELECT * FROM usb WHERE vm_name=?";
 
 static const char NM_USB_ADD_SQL[] = \
     "INSERT INTO usb(vm_name, dev_name, vendor_id, product_id, serial) " \
-    "VALUES ('%s', '%s', '%s', '%s', '%s')";
+    "VALUES (?, ?, ?, ?, ?)";
 
 static const char NM_USB_DELETE_SQL[] = \
-    "DELETE FROM usb WHERE vm_name='%s' AND dev_name='%s' " \
-    "AND vendor_id='%s' AND product_id='%s' AND serial='%s'";
+    "DELETE FROM usb WHERE vm_name=? AND dev_name=? " \
+    "AND vendor_id=? AND product_id=? AND serial=?";
 
 static const char NM_USB_CHECK_SQL[] = \
-    "SELECT usbid FROM vms WHERE name='%s'";
+    "SELECT usbid FROM vms WHERE name=?";
 
 static const char NM_DEL_DRIVES_SQL[] = \
-    "DELETE FROM drives WHERE vm_name='%s'";
+    "DELETE FROM drives WHERE vm_name=?";
 
 static const char NM_DEL_DRIVE_SQL[] = \
-    "DELETE FROM drives WHERE vm_name='%s' AND drive_name='%s'";
+    "DELETE FROM drives WHERE vm_name=? AND drive_name=?";
 
 static const char NM_DEL_VMSNAP_SQL[] = \
-    "DELETE FROM vmsnapshots WHERE vm_name='%s'";
+    "DELETE FROM vmsnapshots WHERE vm_name=?";
 
 static const char NM_DEL_IFS_SQL[] = \
-    "DELETE FROM ifaces WHERE vm_name='%s'";
+    "DELETE FROM ifaces WHERE vm_name=?";
 
 static const char NM_DEL_USB_SQL[] = \
-    "DELETE FROM usb WHERE vm_name='%s'";
+    "DELETE FROM usb WHERE vm_name=?";
 
 static const char NM_DEL_VM_SQL[] = \
-    "DELETE FROM vms WHERE name='%s'";
+    "DELETE FROM vms WHERE name=?";
 
 static const char NM_USB_EXISTS_SQL[] = \
-    "SELECT id FROM usb WHERE vm_name='%s' AND dev_name='%s' " \
-    "AND vendor_id='%s' AND product_id='%s' AND serial='%s'";
+    "SELECT id FROM usb WHERE vm_name=? AND dev_name=? " \
+    "AND vendor_id=? AND product_id=? AND serial=?";
 
 static const char NM_VM_GET_LIST_SQL[] = \
-    "SELECT * FROM vms WHERE name='%s'";
+    "SELECT * FROM vms WHERE name=?";
 
 static const char NM_VM_GET_IFACES_SQL [] = \
     "SELECT if_name, mac_addr, if_drv, ipv4_addr, vhost, " \
     "macvtap, parent_eth, altname FROM ifaces " \
-    "WHERE vm_name='%s' ORDER BY if_name ASC";
+    "WHERE vm_name=? ORDER BY if_name ASC";
 
 static const char NM_VM_GET_DRIVES_SQL[] = \
-    "SELECT drive_name, drive_drv, capacity, boot " \
-    "FROM drives WHERE vm_name='%s' ORDER BY id ASC";
+    "SELECT drive_name, drive_drv, capacity, boot, backing, " \
+    "ova_path, ova_offset, ova_size, ova_fmt " \
+    "FROM drives WHERE vm_name=? ORDER BY id ASC";
 
 static const char NM_VM_GET_ADDDRIVES_SQL[] = \
-    "SELECT drive_name, capacity FROM drives WHERE vm_name='%s' " \
+    "SELECT drive_name, capacity FROM drives WHERE vm_name=? " \
     "AND boot='0'";
 
 static const char NM_SNAP_GET_NAME_SQL[] = \
-    "SELECT * FROM vmsnapshots WHERE vm_name='%s' " \
-    "AND snap_name='%s'";
+    "SELECT * FROM vmsnapshots WHERE vm_name=? " \
+    "AND snap_name=?";
 
 static const char NM_GET_SNAPS_ALL_SQL[] = \
-    "SELECT * FROM vmsnapshots WHERE vm_name='%s' " \
+    "SELECT * FROM vmsnapshots WHERE vm_name=? " \
     "ORDER BY timestamp ASC";
 
 static const char NM_GET_SNAPS_NAME_SQL[] = \
-    "SELECT snap_name FROM vmsnapshots WHERE vm_name='%s' " \
+    "SELECT snap_name FROM vmsnapshots WHERE vm_name=? " \
     "ORDER BY timestamp ASC";
 
 static const char NM_SNAP_UPDATE_LOAD_SQL[] = \
     "UPDATE vmsnapshots SET load='1' " \
-    "WHERE vm_name='%s' AND snap_name='%s'";
+    "WHERE vm_name=? AND snap_name=?";
 
 static const char NM_DELETE_SNAP_SQL[] = \
-    "DELETE FROM vmsnapshots WHERE vm_name='%s' " \
-    "AND snap_name='%s'";
+    "DELETE FROM vmsnapshots WHERE vm_name=? " \
+    "AND snap_name=?";
 
 static const char NM_INSERT_SNAP_SQL[] = \
     "INSERT INTO vmsnapshots(vm_name, snap_name, load, timestamp) " \
-    "VALUES('%s', '%s', '%d', DATETIME('now','localtime'))";
+    "VALUES(?, ?, ?, DATETIME('now','localtime'))";
 
 static const char NM_UPDATE_SNAP_SQL[] = \
-    "UPDATE vmsnapshots SET load='%d', " \
+    "UPDATE vmsnapshots SET load=?, " \
     "timestamp=DATETIME('now','localtime') " \
-    "WHERE vm_name='%s' AND snap_name='%s'";
+    "WHERE vm_name=? AND snap_name=?";
 
 static const char NM_CHECK_SNAP_SQL[] = \
-    "SELECT id FROM snapshots WHERE vm_name='%s'";
+    "SELECT id FROM snapshots WHERE vm_name=?";
 
 static const char NM_GET_BOOT_DRIVE_SQL[] = \
     "SELECT drive_name FROM drives " \
-    "WHERE vm_name='%s' AND boot='1'";
+    "WHERE vm_name=? AND boot='1'";
 
 static const char NM_SELECT_DRIVE_NAMES_SQL[] = \
-    "SELECT drive_name FROM drives WHERE vm_name='%s'";
+    "SELECT drive_name FROM drives WHERE vm_name=?";
+
+static const char NM_SELECT_DRIVE_BASES_SQL[] = \
+    "SELECT DISTINCT backing FROM drives WHERE vm_name=? AND backing!=''";
+
+static const char NM_DRIVE_BASE_SQL[] = \
+    "SELECT backing FROM drives WHERE vm_name=? AND drive_name=? " \
+    "AND backing!=''";
+
+static const char NM_DRIVE_BASE_REFS_SQL[] = \
+    "SELECT COUNT(*) FROM drives WHERE backing=?";
+
+/* drive in OVA becomes part of the base */
+static const char NM_UPDATE_DRIVE_BASE_SQL[] = \
+    "UPDATE drives SET backing=?, ova_path='', ova_offset='', ova_size='', " \
+    "ova_fmt='' WHERE vm_name=? AND drive_name=?";
+
+/* undo of NM_UPDATE_DRIVE_BASE_SQL */
+static const char NM_RESTORE_DRIVE_BASE_SQL[] = \
+    "UPDATE drives SET backing=?, ova_path=?, ova_offset=?, ova_size=?, " \
+    "ova_fmt=? WHERE vm_name=? AND drive_name=?";
 
 static const char NM_GET_VETH_SQL[] = \
     "SELECT l_name, r_name FROM veth";
@@ -116,114 +138,190 @@ static const char NM_LAN_GET_VETH_SQL[] = \
     "SELECT (l_name || '<->' || r_name) FROM veth ORDER by l_name ASC";
 
 static const char NM_LAN_ADD_VETH_SQL[] = \
-    "INSERT INTO veth(l_name, r_name) VALUES ('%s', '%s')";
+    "INSERT INTO veth(l_name, r_name) VALUES (?, ?)";
 
 static const char NM_LAN_CHECK_NAME_SQL[] = \
-    "SELECT id FROM veth WHERE l_name='%s' OR r_name='%s'";
+    "SELECT id FROM veth WHERE l_name=? OR r_name=?";
 
 static const char NM_LAN_DEL_VETH_SQL[] = \
-    "DELETE FROM veth WHERE l_name='%s'";
+    "DELETE FROM veth WHERE l_name=?";
 
 static const char NM_GET_IFACES_SQL[] = \
-    "SELECT if_name FROM ifaces WHERE vm_name='%s'";
+    "SELECT if_name FROM ifaces WHERE vm_name=?";
 
 static const char NM_GET_IFACE_SQL[] = \
-    "SELECT id FROM ifaces WHERE vm_name='%s' AND if_name='%s' AND if_drv='%s'";
+    "SELECT id FROM ifaces WHERE vm_name=? AND if_name=? AND if_drv=?";
 
 static const char NM_DEL_IFACE_SQL[] = \
-    "DELETE FROM ifaces WHERE vm_name='%s' AND if_name='%s'";
+    "DELETE FROM ifaces WHERE vm_name=? AND if_name=?";
 
 static const char NM_GET_IFACES_MACS[] = \
     "SELECT mac_addr FROM ifaces";
 
 static const char NM_GET_IFMAP_SQL[] = \
-    "SELECT vm_name, if_name FROM ifaces WHERE parent_eth='%s'" \
-    "OR parent_eth='%s'";
+    "SELECT vm_name, if_name FROM ifaces WHERE parent_eth=? " \
+    "OR parent_eth=?";
 
 static const char NM_LAN_VETH_INF_SQL[] = \
-    "SELECT if_name FROM ifaces WHERE parent_eth='%s'";
+    "SELECT if_name FROM ifaces WHERE parent_eth=?";
 
 static const char NM_LAN_VETH_DEP_SQL[] = \
     "UPDATE ifaces SET macvtap='0', parent_eth='' " \
-    "WHERE parent_eth='%s' OR parent_eth='%s'";
+    "WHERE parent_eth=? OR parent_eth=?";
 
 static const char NM_GET_VMSNAP_LOAD_SQL[] = \
-    "SELECT snap_name FROM vmsnapshots WHERE vm_name='%s' " \
+    "SELECT snap_name FROM vmsnapshots WHERE vm_name=? " \
     "AND load='1'";
 
 static const char NM_USB_UPDATE_STATE_SQL[] = \
-    "UPDATE vms SET usbid='%s' WHERE name='%s'";
+    "UPDATE vms SET usbid=? WHERE name=?";
 
 static const char NM_VMCTL_GET_VNC_PORT_SQL[] = \
-    "SELECT vnc, spice FROM vms WHERE name='%s'";
+    "SELECT vnc, spice FROM vms WHERE name=?";
 
 static const char NM_GET_DB_VERSION_SQL[] = \
     "PRAGMA user_version";
 
-void nm_db_init(void);
-void nm_db_select(const char *query, nm_vect_t *v);
-void nm_db_edit(const char *query);
-void nm_db_close(void);
+static const char NM_GET_DATA_VERSION_SQL[] = \
+    "PRAGMA data_version";
 
-enum select_main_idx {
-    NM_SQL_ID = 0,
-    NM_SQL_NAME,
-    NM_SQL_MEM,
-    NM_SQL_SMP,
-    NM_SQL_KVM,
-    NM_SQL_HCPU,
-    NM_SQL_VNC,
-    NM_SQL_ARCH,
-    NM_SQL_ISO,
-    NM_SQL_INST,
-    NM_SQL_USBF,
-    NM_SQL_USBD,
-    NM_SQL_BIOS,
-    NM_SQL_KERN,
-    NM_SQL_OVER,
-    NM_SQL_KAPP,
-    NM_SQL_TTY,
-    NM_SQL_SOCK,
-    NM_SQL_INIT,
-    NM_SQL_MACH,
-    NM_SQL_9FLG,
-    NM_SQL_9PTH,
-    NM_SQL_9ID,
-    NM_SQL_USBT,
-    NM_SQL_SPICE,
-    NM_SQL_DEBP,
-    NM_SQL_DEBF
-};
+/* Queries for all VMs at once, rows are grouped by VM name */
+static const char NM_MODEL_GET_VMS_SQL[] = \
+    "SELECT * FROM vms ORDER BY name ASC";
 
-enum select_ifs_idx {
-    NM_SQL_IF_NAME = 0,
-    NM_SQL_IF_MAC,
-    NM_SQL_IF_DRV,
-    NM_SQL_IF_IP4,
-    NM_SQL_IF_VHO,
-    NM_SQL_IF_MVT,
-    NM_SQL_IF_PET,
-    NM_SQL_IF_ALT,
-    NM_IFS_IDX_COUNT
-};
+static const char NM_MODEL_GET_IFACES_SQL[] = \
+    "SELECT if_name, mac_addr, if_drv, ipv4_addr, vhost, " \
+    "macvtap, parent_eth, altname, vm_name FROM ifaces " \
+    "ORDER BY vm_name ASC, if_name ASC";
 
-enum select_drive_idx {
-    NM_SQL_DRV_NAME = 0,
-    NM_SQL_DRV_TYPE,
-    NM_SQL_DRV_SIZE,
-    NM_SQL_DRV_BOOT,
-    NM_DRV_IDX_COUNT
-};
+static const char NM_MODEL_GET_DRIVES_SQL[] = \
+    "SELECT drive_name, drive_drv, capacity, boot, backing, " \
+    "ova_path, ova_offset, ova_size, ova_fmt, vm_name " \
+    "FROM drives ORDER BY vm_name ASC, id ASC";
+
+static const char NM_MODEL_GET_USB_SQL[] = \
+    "SELECT * FROM usb ORDER BY vm_name ASC, id ASC";
 
-enum select_usb_idx {
-    NM_SQL_USB_ID = 0,
-    NM_SQL_USB_VMNAME,
-    NM_SQL_USB_NAME,
-    NM_SQL_USB_VID,
-    NM_SQL_USB_PID,
-    NM_SQL_USB_SERIAL,
-    NM_USB_IDX_COUNT
+/* Queries use '?' placeholders, values are passed as C strings
+ * after the query, one for each placeholder */
+void nm_db_init(void);
+void nm_db_select(const char *query, nm_vect_t *v, ...);
+void nm_db_edit(const char *query, ...);
+/* Transaction scope for several edits, can be nested */
+void nm_db_begin(void);
+void nm_db_commit(void);
+uint64_t nm_db_edit_count(void);
+int64_t nm_db_data_version(void);
+void nm_db_close(void);
+
+/* Typed result sets: rows are decoded into structs of matching
+ * row type, rows and their strings share one allocation.
+ * Text columns are never NULL, missing values are empty strings. */
+enum nm_db_row_type {
+    NM_DB_ROW_VM = 0,
+    NM_DB_ROW_IFACE,
+    NM_DB_ROW_DRIVE,
+    NM_DB_ROW_USB,
+    NM_DB_ROW_SNAP,
+    NM_DB_ROW_COUNT
 };
 
+typedef struct {
+    void *rows;
+    size_t n_rows;
+    size_t row_size;
+} nm_db_res_t;
+
+#define NM_INIT_DB_RES (nm_db_res_t) { NULL, 0, 0 }
+
+/* SELECT * FROM vms */
+typedef struct {
+    int id;
+    const char *name;
+    int mem;
+    int smp;
+    int kvm;
+    int hcpu;
+    int vnc;
+    const char *arch;
+    const char *iso;
+    int install;
+    int usb;
+    int usbid;
+    const char *bios;
+    const char *kernel;
+    int mouse_override;
+    const char *kernel_append;
+    const char *tty_path;
+    const char *socket_path;
+    const char *initrd;
+    const char *machine;
+    int fs9p_enable;
+    const char *fs9p_path;
+    const char *fs9p_name;
+    const char *usb_type;
+    int spice;
+    int debug_port;
+    int debug_freeze;
+    const char *cmdappend;
+} nm_db_vm_t;
+
+/* NM_VM_GET_IFACES_SQL, vm_name is selected by NM_MODEL_* only */
+typedef struct {
+    const char *name;
+    const char *mac_addr;
+    const char *drv;
+    const char *ipv4_addr;
+    int vhost;
+    int macvtap;
+    const char *parent_eth;
+    const char *altname;
+    const char *vm_name;
+} nm_db_iface_t;
+
+/* NM_VM_GET_DRIVES_SQL, capacity and OVA offsets are kept as text:
+ * imported OVF disks may not fit into int */
+typedef struct {
+    const char *name;
+    const char *drv;
+    const char *capacity;
+    int boot;
+    const char *backing;    /* base image of linked clone */
+    const char *ova_path;   /* OVA file the drive overlay is based on */
+    const char *ova_offset; /* disk image offset in OVA */
+    const char *ova_size;
+    const char *ova_fmt;
+    const char *vm_name;
+} nm_db_drive_t;
+
+/* SELECT * FROM usb */
+typedef struct {
+    int id;
+    const char *vm_name;
+    const char *dev_name;
+    const char *vendor_id;
+    const char *product_id;
+    const char *serial;
+} nm_db_usb_t;
+
+/* SELECT * FROM vmsnapshots */
+typedef struct {
+    int id;
+    const char *vm_name;
+    const char *snap_name;
+    int load;
+    const char *timestamp;
+} nm_db_snap_t;
+
+#define nm_db_vm(r, i)    ((const nm_db_vm_t *) nm_db_row(r, i))
+#define nm_db_iface(r, i) ((const nm_db_iface_t *) nm_db_row(r, i))
+#define nm_db_drive(r, i) ((const nm_db_drive_t *) nm_db_row(r, i))
+#define nm_db_usb(r, i)   ((const nm_db_usb_t *) nm_db_row(r, i))
+#define nm_db_snap(r, i)  ((const nm_db_snap_t *) nm_db_row(r, i))
+
+void nm_db_select_rows(const char *query, int type, nm_db_res_t *res, ...);
+const void *nm_db_row(const nm_db_res_t *res, size_t idx);
+void nm_db_res_free(nm_db_res_t *res);
+
 #endif /* NM_DATABASE_H_ */
 /* vim:set ts=4 sw=4: */
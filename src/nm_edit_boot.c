@@ -82,9 +82,12 @@ out:
 
 static void nm_edit_boot_field_setup(const nm_vmctl_data_t *cur)
 {
+    const nm_db_vm_t *row = nm_db_vm(&cur->main, 0);
+    nm_str_t arch = nm_str_view(row->arch);
+    nm_str_t buf = NM_INIT_STR;
     const char **machs = NULL;
 
-    machs = nm_mach_get(nm_vect_str(&cur->main, NM_SQL_ARCH));
+    machs = nm_mach_get(&arch);
 
     for (size_t n = 1; n < NM_FLD_COUNT; n++)
         field_opts_off(fields[n], O_STATIC);
@@ -104,27 +107,33 @@ static void nm_edit_boot_field_setup(const nm_vmctl_data_t *cur)
     if (machs == NULL)
         field_opts_off(fields[NM_FLD_MACH], O_ACTIVE);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_INST), NM_ENABLE) == NM_OK)
+    if (row->install)
         set_field_buffer(fields[NM_FLD_INST], 0, nm_form_yes_no[1]);
     else
         set_field_buffer(fields[NM_FLD_INST], 0, nm_form_yes_no[0]);
 
-    set_field_buffer(fields[NM_FLD_MACH], 0, nm_vect_str_ctx(&cur->main, NM_SQL_MACH));
-    set_field_buffer(fields[NM_FLD_SRCP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_ISO));
-    set_field_buffer(fields[NM_FLD_BIOS], 0, nm_vect_str_ctx(&cur->main, NM_SQL_BIOS));
-    set_field_buffer(fields[NM_FLD_KERN], 0, nm_vect_str_ctx(&cur->main, NM_SQL_KERN));
-    set_field_buffer(fields[NM_FLD_CMDL], 0, nm_vect_str_ctx(&cur->main, NM_SQL_KAPP));
-    set_field_buffer(fields[NM_FLD_INIT], 0, nm_vect_str_ctx(&cur->main, NM_SQL_INIT));
-    set_field_buffer(fields[NM_FLD_TTYP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_TTY));
-    set_field_buffer(fields[NM_FLD_SOCK], 0, nm_vect_str_ctx(&cur->main, NM_SQL_SOCK));
-    set_field_buffer(fields[NM_FLD_DEBP], 0, nm_vect_str_ctx(&cur->main, NM_SQL_DEBP));
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
+    set_field_buffer(fields[NM_FLD_MACH], 0, row->machine);
+    set_field_buffer(fields[NM_FLD_SRCP], 0, row->iso);
+    set_field_buffer(fields[NM_FLD_BIOS], 0, row->bios);
+    set_field_buffer(fields[NM_FLD_KERN], 0, row->kernel);
+    set_field_buffer(fields[NM_FLD_CMDL], 0, row->kernel_append);
+    set_field_buffer(fields[NM_FLD_INIT], 0, row->initrd);
+    set_field_buffer(fields[NM_FLD_TTYP], 0, row->tty_path);
+    set_field_buffer(fields[NM_FLD_SOCK], 0, row->socket_path);
+    if (row->debug_port)
+    {
+        nm_str_format(&buf, "%d", row->debug_port);
+        set_field_buffer(fields[NM_FLD_DEBP], 0, buf.data);
+    }
+    if (row->debug_freeze)
         set_field_buffer(fields[NM_FLD_DEBF], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_DEBF], 0, nm_form_yes_no[1]);
 
     for (size_t n = 0; n < NM_FLD_COUNT; n++)
         set_field_status(fields[n], 0);
+
+    nm_str_free(&buf);
 }
 
 static void nm_edit_boot_field_names(nm_window_t *w)
@@ -190,86 +199,75 @@ out:
 
 static void nm_edit_boot_update_db(const nm_str_t *name, nm_vm_boot_t *vm)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_db_begin();
 
     if (field_status(fields[NM_FLD_INST]))
     {
-        nm_str_format(&query, "UPDATE vms SET install='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET install=? WHERE name=?",
             vm->installed ? NM_ENABLE : NM_DISABLE, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_MACH]))
     {
-        nm_str_format(&query, "UPDATE vms SET machine='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET machine=? WHERE name=?",
             vm->mach.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_SRCP]))
     {
-        nm_str_format(&query, "UPDATE vms SET iso='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET iso=? WHERE name=?",
             vm->inst_path.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_BIOS]))
     {
-        nm_str_format(&query, "UPDATE vms SET bios='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET bios=? WHERE name=?",
             vm->bios.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_KERN]))
     {
-        nm_str_format(&query, "UPDATE vms SET kernel='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET kernel=? WHERE name=?",
             vm->kernel.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_CMDL]))
     {
-        nm_str_format(&query, "UPDATE vms SET kernel_append='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET kernel_append=? WHERE name=?",
             vm->cmdline.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_INIT]))
     {
-        nm_str_format(&query, "UPDATE vms SET initrd='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET initrd=? WHERE name=?",
             vm->initrd.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_TTYP]))
     {
-        nm_str_format(&query, "UPDATE vms SET tty_path='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET tty_path=? WHERE name=?",
             vm->tty.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_SOCK]))
     {
-        nm_str_format(&query, "UPDATE vms SET socket_path='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET socket_path=? WHERE name=?",
             vm->socket.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_DEBP]))
     {
-        nm_str_format(&query, "UPDATE vms SET debug_port='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET debug_port=? WHERE name=?",
             vm->debug_port.data, name->data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_DEBF]))
     {
-        nm_str_format(&query, "UPDATE vms SET debug_freeze='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET debug_freeze=? WHERE name=?",
             vm->debug_freeze ? NM_ENABLE : NM_DISABLE, name->data);
-        nm_db_edit(query.data);
     }
 
-    nm_str_free(&query);
+    nm_db_commit();
 }
 
 /* vim:set ts=4 sw=4: */
@@ -58,6 +58,7 @@ static void nm_edit_net_field_setup(const nm_vmctl_data_t *vm,
 static int nm_edit_net_get_data(const nm_str_t *name, nm_iface_t *ifp);
 static void nm_edit_net_update_db(const nm_str_t *name, nm_iface_t *ifp);
 static inline void nm_edit_net_iface_free(nm_iface_t *ifp);
+static void nm_edit_net_menu(const nm_vmctl_data_t *vm, nm_arr_t *items);
 static int nm_edit_net_maddr_busy(const nm_str_t *mac);
 static int nm_edit_net_action(const nm_str_t *name,
                               const nm_vmctl_data_t *vm, size_t if_idx);
@@ -89,14 +90,15 @@ void nm_edit_net(const nm_str_t *name)
 {
     int ch = 0;
     nm_menu_data_t ifs = NM_INIT_MENU_DATA;
-    nm_vect_t ifaces = NM_INIT_VECT;
+    nm_menu_item_t ifaces_buf[NM_MENU_STACK_ITEMS];
+    nm_arr_t ifaces = NM_INIT_ARR_BUF(ifaces_buf);
     nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
     size_t vm_list_len = (getmaxy(side_window) - 4);
     size_t iface_count;
 
     nm_vmctl_get_data(name, &vm);
 
-    if (vm.ifs.n_memb == 0)
+    if (vm.ifs.n_rows == 0)
     {
         nm_warn(_(NM_MSG_NO_IFACES));
         goto out;
@@ -109,7 +111,7 @@ void nm_edit_net(const nm_str_t *name)
     nm_init_action(_(NM_MSG_IF_PROP));
     nm_init_side_if_list();
 
-    iface_count = vm.ifs.n_memb / NM_IFS_IDX_COUNT;
+    iface_count = vm.ifs.n_rows;
 
     ifs.highlight = 1;
     if (vm_list_len < iface_count)
@@ -117,14 +119,7 @@ void nm_edit_net(const nm_str_t *name)
     else
         ifs.item_last = vm_list_len = iface_count;
 
-    for (size_t n = 0; n < iface_count; n++)
-    {
-        size_t idx_shift = NM_IFS_IDX_COUNT * n;
-        nm_vect_insert(&ifaces,
-                       nm_vect_str_ctx(&vm.ifs, NM_SQL_IF_NAME + idx_shift),
-                       nm_vect_str_len(&vm.ifs, NM_SQL_IF_NAME + idx_shift) + 1,
-                       NULL);
-    }
+    nm_edit_net_menu(&vm, &ifaces);
 
     ifs.v = &ifaces;
     do {
@@ -139,6 +134,7 @@ void nm_edit_net(const nm_str_t *name)
             {
                 nm_vmctl_free_data(&vm);
                 nm_vmctl_get_data(name, &vm);
+                nm_edit_net_menu(&vm, &ifaces);
             }
         }
 
@@ -178,7 +174,7 @@ void nm_edit_net(const nm_str_t *name)
     nm_init_help_main();
 
 out:
-    nm_vect_free(&ifaces, NULL);
+    nm_arr_free(&ifaces, NULL);
     nm_vmctl_free_data(&vm);
 }
 
@@ -189,14 +185,11 @@ nm_edit_net_action(const nm_str_t *name, const nm_vmctl_data_t *vm, size_t if_id
     size_t msg_len = nm_max_msg_len(nm_form_msg);
     nm_iface_t iface_data = NM_INIT_NET_IF;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
-    size_t idx_shift;
 
     assert(if_idx > 0);
-    idx_shift = NM_IFS_IDX_COUNT * (--if_idx);
-    if_idx++; /* restore idx */
 
     nm_str_format(&iface_data.name, "%s",
-        nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data);
+        nm_db_iface(&vm->ifs, if_idx - 1)->name);
 
     assert(iface_data.name.len > 0);
 
@@ -240,11 +233,11 @@ out:
 
 static void nm_edit_net_field_setup(const nm_vmctl_data_t *vm, size_t if_idx)
 {
+    const nm_db_iface_t *iface;
     size_t mvtap_idx = 0;
-    size_t idx_shift;
 
     assert(if_idx > 0);
-    idx_shift = NM_IFS_IDX_COUNT * (--if_idx);
+    iface = nm_db_iface(&vm->ifs, if_idx - 1);
 
     set_field_type(fields[NM_FLD_NDRV], TYPE_ENUM, nm_form_net_drv, false, false);
     set_field_type(fields[NM_FLD_MADR], TYPE_REGEXP, ".*");
@@ -261,29 +254,19 @@ static void nm_edit_net_field_setup(const nm_vmctl_data_t *vm, size_t if_idx)
     field_opts_off(fields[NM_FLD_PETH], O_STATIC);
 #endif
 
-    set_field_buffer(fields[NM_FLD_NDRV], 0,
-        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
-    set_field_buffer(fields[NM_FLD_MADR], 0,
-        nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0)
-    {
-        set_field_buffer(fields[NM_FLD_IPV4], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
-    }
+    set_field_buffer(fields[NM_FLD_NDRV], 0, iface->drv);
+    set_field_buffer(fields[NM_FLD_MADR], 0, iface->mac_addr);
+    if (*iface->ipv4_addr)
+        set_field_buffer(fields[NM_FLD_IPV4], 0, iface->ipv4_addr);
 #if defined (NM_OS_LINUX)
-    set_field_buffer(fields[NM_FLD_VHST], 0,
-        (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
-            NM_ENABLE) == NM_OK) ? "yes" : "no");
+    set_field_buffer(fields[NM_FLD_VHST], 0, iface->vhost ? "yes" : "no");
 
-    mvtap_idx = nm_str_stoui(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), 10);
+    mvtap_idx = (size_t) iface->macvtap;
     if (mvtap_idx > NM_NET_MACVTAP_NUM)
         nm_bug("%s: invalid macvtap array index: %zu", __func__, mvtap_idx);
     set_field_buffer(fields[NM_FLD_MTAP], 0, nm_form_macvtap[mvtap_idx]);
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) > 0)
-    {
-        set_field_buffer(fields[NM_FLD_PETH], 0,
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_PET + idx_shift));
-    }
+    if (*iface->parent_eth)
+        set_field_buffer(fields[NM_FLD_PETH], 0, iface->parent_eth);
 #else
     (void) mvtap_idx;
 #endif
@@ -374,18 +357,15 @@ static int nm_edit_net_get_data(const nm_str_t *name, nm_iface_t *ifp)
         }
         else
         {
-            nm_str_t query = NM_INIT_STR;
             nm_vect_t netv = NM_INIT_VECT;
 
-            nm_str_format(&query, NM_GET_IFACE_SQL,
+            nm_db_select(NM_GET_IFACE_SQL, &netv,
                 name->data, ifp->name.data, NM_DEFAULT_NETDRV);
-            nm_db_select(query.data, &netv);
 
             if (netv.n_memb == 0)
                 vhost_ok = 0;
 
             nm_vect_free(&netv, nm_str_vect_free_cb);
-            nm_str_free(&query);
         }
 
         if (!vhost_ok)
@@ -417,51 +397,43 @@ out:
 
 static void nm_edit_net_update_db(const nm_str_t *name, nm_iface_t *ifp)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t buf = NM_INIT_STR;
+
+    nm_db_begin();
 
     if (field_status(fields[NM_FLD_NDRV]))
     {
-        nm_str_format(&query,
-            "UPDATE ifaces SET if_drv='%s' WHERE vm_name='%s' AND if_name='%s'",
+        nm_db_edit("UPDATE ifaces SET if_drv=? WHERE vm_name=? AND if_name=?",
             ifp->drv.data, name->data, ifp->name.data);
-        nm_db_edit(query.data);
 
 #if defined (NM_OS_LINUX)
         /* disable vhost if driver is not virtio-net */
         if (nm_str_cmp_st(&ifp->drv, NM_DEFAULT_NETDRV) != NM_OK)
         {
-            nm_str_format(&query,
-                "UPDATE ifaces SET vhost='0' WHERE vm_name='%s' AND if_name='%s'",
+            nm_db_edit("UPDATE ifaces SET vhost='0' WHERE vm_name=? AND if_name=?",
                 name->data, ifp->name.data);
-            nm_db_edit(query.data);
         }
 #endif
     }
 
     if (field_status(fields[NM_FLD_MADR]))
     {
-        nm_str_format(&query,
-            "UPDATE ifaces SET mac_addr='%s' WHERE vm_name='%s' AND if_name='%s'",
+        nm_db_edit("UPDATE ifaces SET mac_addr=? WHERE vm_name=? AND if_name=?",
             ifp->maddr.data, name->data, ifp->name.data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_IPV4]))
     {
-        nm_str_format(&query,
-            "UPDATE ifaces SET ipv4_addr='%s' WHERE vm_name='%s' AND if_name='%s'",
+        nm_db_edit("UPDATE ifaces SET ipv4_addr=? WHERE vm_name=? AND if_name=?",
             ifp->ipv4.data, name->data, ifp->name.data);
-        nm_db_edit(query.data);
     }
 
 #if defined (NM_OS_LINUX)
     if (field_status(fields[NM_FLD_VHST]))
     {
-        nm_str_format(&query,
-            "UPDATE ifaces SET vhost='%s' WHERE vm_name='%s' AND if_name='%s'",
+        nm_db_edit("UPDATE ifaces SET vhost=? WHERE vm_name=? AND if_name=?",
             (nm_str_cmp_st(&ifp->vhost, "yes") == NM_OK) ? NM_ENABLE : NM_DISABLE,
             name->data, ifp->name.data);
-        nm_db_edit(query.data);
     }
 
     if (field_status(fields[NM_FLD_MTAP]))
@@ -481,22 +453,20 @@ static void nm_edit_net_update_db(const nm_str_t *name, nm_iface_t *ifp)
         if (macvtap_idx == -1)
             nm_bug("%s: macvtap_idx is not found", __func__);
 
-        nm_str_format(&query,
-            "UPDATE ifaces SET macvtap='%zd' WHERE vm_name='%s' AND if_name='%s'",
-            macvtap_idx, name->data, ifp->name.data);
-        nm_db_edit(query.data);
+        nm_str_format(&buf, "%zd", macvtap_idx);
+        nm_db_edit("UPDATE ifaces SET macvtap=? WHERE vm_name=? AND if_name=?",
+            buf.data, name->data, ifp->name.data);
     }
 
     if (field_status(fields[NM_FLD_PETH]))
     {
-        nm_str_format(&query,
-            "UPDATE ifaces SET parent_eth='%s' WHERE vm_name='%s' AND if_name='%s'",
+        nm_db_edit("UPDATE ifaces SET parent_eth=? WHERE vm_name=? AND if_name=?",
             ifp->parent_eth.data, name->data, ifp->name.data);
-        nm_db_edit(query.data);
     }
 #endif
 
-    nm_str_free(&query);
+    nm_db_commit();
+    nm_str_free(&buf);
 }
 
 static inline void nm_edit_net_iface_free(nm_iface_t *ifp)
@@ -512,6 +482,20 @@ static inline void nm_edit_net_iface_free(nm_iface_t *ifp)
 #endif
 }
 
+/* Item names point to vm rows, menu must be rebuilt after vm reload */
+static void nm_edit_net_menu(const nm_vmctl_data_t *vm, nm_arr_t *items)
+{
+    nm_arr_clear(items, NULL);
+
+    for (size_t n = 0; n < vm->ifs.n_rows; n++)
+    {
+        nm_menu_item_t iface = NM_INIT_MENU_ITEM;
+
+        iface.name = nm_str_view(nm_db_iface(&vm->ifs, n)->name);
+        nm_arr_push(items, &iface);
+    }
+}
+
 /* TODO add this check in all genmaddr points */
 static int nm_edit_net_maddr_busy(const nm_str_t *mac)
 {
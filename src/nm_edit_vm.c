@@ -105,6 +105,7 @@ out:
 
 static void nm_edit_vm_field_setup(const nm_vmctl_data_t *cur)
 {
+    const nm_db_vm_t *row = nm_db_vm(&cur->main, 0);
     nm_str_t buf = NM_INIT_STR;
 
     set_field_type(fields[NM_FLD_CPUNUM], TYPE_INTEGER, 0, 1, nm_hw_ncpus());
@@ -120,40 +121,42 @@ static void nm_edit_vm_field_setup(const nm_vmctl_data_t *cur)
     set_field_type(fields[NM_FLD_SPICE], TYPE_ENUM, nm_form_yes_no, false, false);
 #endif
 
-    set_field_buffer(fields[NM_FLD_CPUNUM], 0, nm_vect_str_ctx(&cur->main, NM_SQL_SMP));
-    set_field_buffer(fields[NM_FLD_RAMTOT], 0, nm_vect_str_ctx(&cur->main, NM_SQL_MEM));
+    nm_str_format(&buf, "%d", row->smp);
+    set_field_buffer(fields[NM_FLD_CPUNUM], 0, buf.data);
+    nm_str_format(&buf, "%d", row->mem);
+    set_field_buffer(fields[NM_FLD_RAMTOT], 0, buf.data);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_KVM), NM_ENABLE) == NM_OK)
+    if (row->kvm)
         set_field_buffer(fields[NM_FLD_KVMFLG], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_KVMFLG], 0, nm_form_yes_no[1]);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
+    if (row->hcpu)
         set_field_buffer(fields[NM_FLD_HOSCPU], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_HOSCPU], 0, nm_form_yes_no[1]);
 
-    nm_str_format(&buf, "%zu", cur->ifs.n_memb / NM_IFS_IDX_COUNT);
+    nm_str_format(&buf, "%zu", cur->ifs.n_rows);
     set_field_buffer(fields[NM_FLD_IFSCNT], 0, buf.data);
-    set_field_buffer(fields[NM_FLD_DISKIN], 0, nm_vect_str_ctx(&cur->drives, NM_SQL_DRV_TYPE));
+    set_field_buffer(fields[NM_FLD_DISKIN], 0, nm_db_drive(&cur->drives, 0)->drv);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_USBF), NM_ENABLE) == NM_OK)
+    if (row->usb)
         set_field_buffer(fields[NM_FLD_USBUSE], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_USBUSE], 0, nm_form_yes_no[1]);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_USBT), NM_DEFAULT_USBVER) == NM_OK)
+    if (nm_str_cmp_tt(row->usb_type, NM_DEFAULT_USBVER) == NM_OK)
         set_field_buffer(fields[NM_FLD_USBTYP], 0, nm_form_usbtype[1]);
     else
         set_field_buffer(fields[NM_FLD_USBTYP], 0, nm_form_usbtype[0]);
 
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_OVER), NM_ENABLE) == NM_OK)
+    if (row->mouse_override)
         set_field_buffer(fields[NM_FLD_MOUSES], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_MOUSES], 0, nm_form_yes_no[1]);
 
 #if defined(NM_WITH_SPICE)
-    if (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_SPICE), NM_ENABLE) == NM_OK)
+    if (row->spice)
         set_field_buffer(fields[NM_FLD_SPICE], 0, nm_form_yes_no[0]);
     else
         set_field_buffer(fields[NM_FLD_SPICE], 0, nm_form_yes_no[1]);
@@ -256,7 +259,7 @@ static int nm_edit_vm_get_data(nm_vm_t *vm, const nm_vmctl_data_t *cur)
         else
         {
             if (!field_status(fields[NM_FLD_HOSCPU]) &&
-                (nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK))
+                nm_db_vm(&cur->main, 0)->hcpu)
             {
                 rc = NM_ERR;
                 NM_FORM_RESET();
@@ -271,7 +274,7 @@ static int nm_edit_vm_get_data(nm_vm_t *vm, const nm_vmctl_data_t *cur)
         if (nm_str_cmp_st(&hcpu, "yes") == NM_OK)
         {
             if (((!vm->kvm.enable) && (field_status(fields[NM_FLD_KVMFLG]))) ||
-                ((nm_str_cmp_st(nm_vect_str(&cur->main, NM_SQL_KVM), NM_DISABLE) == NM_OK) &&
+                (!nm_db_vm(&cur->main, 0)->kvm &&
                  !field_status(fields[NM_FLD_KVMFLG])))
             {
                 rc = NM_ERR;
@@ -323,41 +326,37 @@ out:
 
 static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64_t mac)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_db_begin();
 
     if (field_status(fields[NM_FLD_CPUNUM]))
     {
-        nm_str_format(&query, "UPDATE vms SET smp='%s' WHERE name='%s'",
-            vm->cpus.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+        nm_db_edit("UPDATE vms SET smp=? WHERE name=?",
+            vm->cpus.data, nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_RAMTOT]))
     {
-        nm_str_format(&query, "UPDATE vms SET mem='%s' WHERE name='%s'",
-            vm->memo.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+        nm_db_edit("UPDATE vms SET mem=? WHERE name=?",
+            vm->memo.data, nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_KVMFLG]))
     {
-        nm_str_format(&query, "UPDATE vms SET kvm='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET kvm=? WHERE name=?",
             vm->kvm.enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_HOSCPU]))
     {
-        nm_str_format(&query, "UPDATE vms SET hcpu='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET hcpu=? WHERE name=?",
             vm->kvm.hostcpu_enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_IFSCNT]))
     {
-        size_t cur_count = cur->ifs.n_memb / NM_IFS_IDX_COUNT;
+        size_t cur_count = cur->ifs.n_rows;
         int altname;
 
         if (vm->ifs.count < cur_count)
@@ -365,12 +364,9 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
             for (; cur_count > vm->ifs.count; cur_count--)
             {
-                size_t idx_shift = NM_IFS_IDX_COUNT * (cur_count - 1);
-
-                nm_str_format(&query, NM_DEL_IFACE_SQL,
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME),
-                    nm_vect_str_ctx(&cur->ifs, NM_SQL_IF_NAME + idx_shift));
-                nm_db_edit(query.data);
+                nm_db_edit(NM_DEL_IFACE_SQL,
+                    nm_db_vm(&cur->main, 0)->name,
+                    nm_db_iface(&cur->ifs, cur_count - 1)->name);
             }
         }
 
@@ -385,15 +381,14 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
                 nm_net_mac_n2a(mac, &maddr);
                 nm_str_format(&if_name, "%s_eth%zu",
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME), n);
+                    nm_db_vm(&cur->main, 0)->name, n);
                 nm_str_copy(&if_name_copy, &if_name);
 
                 altname = nm_net_fix_tap_name(&if_name, &maddr);
 
-                nm_str_format(&query,
-                    "INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, altname) "
-                    "VALUES('%s', '%s', '%s', '%s', '%s', '%s', '%s')",
-                    nm_vect_str_ctx(&cur->main, NM_SQL_NAME),
+                nm_db_edit("INSERT INTO ifaces(vm_name, if_name, mac_addr, if_drv, vhost, macvtap, altname) "
+                    "VALUES(?, ?, ?, ?, ?, ?, ?)",
+                    nm_db_vm(&cur->main, 0)->name,
                     if_name.data,
                     maddr.data,
                     NM_DEFAULT_NETDRV,
@@ -404,7 +399,6 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 #endif
                     NM_DISABLE,
                     (altname) ? if_name_copy.data : "");
-                nm_db_edit(query.data);
 
                 nm_str_free(&if_name);
                 nm_str_free(&if_name_copy);
@@ -417,46 +411,41 @@ static void nm_edit_vm_update_db(nm_vm_t *vm, const nm_vmctl_data_t *cur, uint64
 
     if (field_status(fields[NM_FLD_DISKIN]))
     {
-        nm_str_format(&query, "UPDATE drives SET drive_drv='%s' WHERE vm_name='%s'",
-            vm->drive.driver.data, nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+        nm_db_edit("UPDATE drives SET drive_drv=? WHERE vm_name=?",
+            vm->drive.driver.data, nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_USBUSE]))
     {
-        nm_str_format(&query, "UPDATE vms SET usb='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET usb=? WHERE name=?",
             vm->usb_enable ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_USBTYP]))
     {
-        nm_str_format(&query, "UPDATE vms SET usb_type='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET usb_type=? WHERE name=?",
             vm->usb_xhci ? nm_form_usbtype[1] : nm_form_usbtype[0],
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 
     if (field_status(fields[NM_FLD_MOUSES]))
     {
-        nm_str_format(&query, "UPDATE vms SET mouse_override='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET mouse_override=? WHERE name=?",
             vm->mouse_sync ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 
 #if defined(NM_WITH_SPICE)
     if (field_status(fields[NM_FLD_SPICE]))
     {
-        nm_str_format(&query, "UPDATE vms SET spice='%s' WHERE name='%s'",
+        nm_db_edit("UPDATE vms SET spice=? WHERE name=?",
             vm->spice ? NM_ENABLE : NM_DISABLE,
-            nm_vect_str_ctx(&cur->main, NM_SQL_NAME));
-        nm_db_edit(query.data);
+            nm_db_vm(&cur->main, 0)->name);
     }
 #endif
 
-    nm_str_free(&query);
+    nm_db_commit();
 }
 
 /* vim:set ts=4 sw=4: */
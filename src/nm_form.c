@@ -442,13 +442,8 @@ int nm_form_name_used(const nm_str_t *name)
     int rc = NM_OK;
 
     nm_vect_t res = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
 
-    nm_str_alloc_text(&query, "SELECT id FROM vms WHERE name='");
-    nm_str_add_str(&query, name);
-    nm_str_add_char(&query, '\'');
-
-    nm_db_select(query.data, &res);
+    nm_db_select("SELECT id FROM vms WHERE name=?", &res, name->data);
     if (res.n_memb > 0)
     {
         rc = NM_ERR;
@@ -457,7 +452,6 @@ int nm_form_name_used(const nm_str_t *name)
     }
 
     nm_vect_free(&res, NULL);
-    nm_str_free(&query);
 
     return rc;
 }
@@ -483,23 +477,23 @@ void nm_form_get_last(uint64_t *mac, uint32_t *vnc)
 
 void nm_form_update_last_mac(uint64_t mac)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t buf = NM_INIT_STR;
 
-    nm_str_format(&query, "UPDATE lastval SET mac='%" PRIu64 "'", mac);
-    nm_db_edit(query.data);
+    nm_str_format(&buf, "%" PRIu64, mac);
+    nm_db_edit("UPDATE lastval SET mac=?", buf.data);
 
-    nm_str_free(&query);
+    nm_str_free(&buf);
 }
 
 void nm_form_update_last_vnc(uint32_t vnc)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_str_t buf = NM_INIT_STR;
 
     vnc++;
-    nm_str_format(&query, "UPDATE lastval SET vnc='%u'", vnc);
-    nm_db_edit(query.data);
+    nm_str_format(&buf, "%u", vnc);
+    nm_db_edit("UPDATE lastval SET vnc=?", buf.data);
 
-    nm_str_free(&query);
+    nm_str_free(&buf);
 }
 
 void nm_vm_free(nm_vm_t *vm)
@@ -72,7 +72,7 @@ nm_ini_node_t *nm_ini_parser_init(const nm_str_t *path)
             if (*buf_ini == ']')
             {
                 curr_node = nm_ini_node_push(&head, &sec_name);
-                nm_str_free(&sec_name);
+                nm_str_trunc(&sec_name, 0);
                 look_for_sec_end = 0;
                 look_for_param_end = 1;
                 continue;
@@ -112,8 +112,8 @@ nm_ini_node_t *nm_ini_parser_init(const nm_str_t *path)
                 look_for_value_end = 0;
                 look_for_param_end = 1;
                 nm_ini_value_push(curr_node, &par_name, &value);
-                nm_str_free(&par_name);
-                nm_str_free(&par_value);
+                nm_str_trunc(&par_name, 0);
+                nm_str_trunc(&par_value, 0);
                 continue;
             }
             nm_str_add_char_opt(&par_value, *buf_ini);
@@ -121,6 +121,9 @@ nm_ini_node_t *nm_ini_parser_init(const nm_str_t *path)
     }
 
     nm_unmap_file(&file);
+    nm_str_free(&sec_name);
+    nm_str_free(&par_name);
+    nm_str_free(&par_value);
 
     if (look_for_sec_end)
         nm_bug(_("Bad INI file: missing \"]\" at section name"));
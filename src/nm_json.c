@@ -0,0 +1,494 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_arena.h>
+#include <nm_json.h>
+
+/* Parser keeps no copy of the input: bytes of strings and numbers
+ * are collected in tok and moved to arena when token is complete,
+ * everything else is consumed at once. Arena is reset after every
+ * top-level value, so memory of large replies is reused. */
+
+enum {
+    NM_JSON_S_VALUE,     /* value, whitespace between messages */
+    NM_JSON_S_ARR_FIRST, /* value or ']' */
+    NM_JSON_S_OBJ_FIRST, /* member name or '}' */
+    NM_JSON_S_KEY,       /* member name */
+    NM_JSON_S_COLON,
+    NM_JSON_S_NEXT,      /* ',' or end of array or object */
+    NM_JSON_S_STRING,
+    NM_JSON_S_ESCAPE,
+    NM_JSON_S_UNICODE,
+    NM_JSON_S_SCALAR     /* number, true, false or null */
+};
+
+static int nm_json_token(nm_json_parser_t *p, char ch,
+                         nm_json_cb_t cb, void *ctx);
+static int nm_json_escape(nm_json_parser_t *p, char ch);
+static int nm_json_unicode(nm_json_parser_t *p, char ch);
+static int nm_json_string_end(nm_json_parser_t *p,
+                              nm_json_cb_t cb, void *ctx);
+static int nm_json_scalar_end(nm_json_parser_t *p,
+                              nm_json_cb_t cb, void *ctx);
+static nm_json_t *nm_json_new(nm_json_parser_t *p, nm_json_type_t type);
+static int nm_json_open(nm_json_parser_t *p, nm_json_type_t type);
+static void nm_json_close(nm_json_parser_t *p, nm_json_cb_t cb, void *ctx);
+static void nm_json_done(nm_json_parser_t *p, nm_json_cb_t cb, void *ctx);
+static void nm_json_utf8(nm_str_t *str, uint32_t code);
+static int nm_json_is_scalar(char ch);
+static int nm_json_is_number(const char *str);
+
+int nm_json_feed(nm_json_parser_t *p, const char *buf, size_t len,
+                 nm_json_cb_t cb, void *ctx)
+{
+    const char *end = buf + len;
+    const char *ptr = buf;
+    int rc = NM_OK;
+
+    while (ptr < end && rc == NM_OK)
+    {
+        const char *run = ptr;
+
+        switch (p->state) {
+        case NM_JSON_S_STRING:
+            while (ptr < end && *ptr != '"' && *ptr != '\\')
+                ptr++;
+            if (ptr != run)
+                nm_str_add_text_part(&p->tok, run, ptr - run);
+            if (ptr == end)
+                break;
+            if (*ptr++ == '\\')
+                p->state = NM_JSON_S_ESCAPE;
+            else
+                rc = nm_json_string_end(p, cb, ctx);
+            break;
+
+        case NM_JSON_S_ESCAPE:
+            rc = nm_json_escape(p, *ptr++);
+            break;
+
+        case NM_JSON_S_UNICODE:
+            rc = nm_json_unicode(p, *ptr++);
+            break;
+
+        case NM_JSON_S_SCALAR:
+            while (ptr < end && nm_json_is_scalar(*ptr))
+                ptr++;
+            if (ptr != run)
+                nm_str_add_text_part(&p->tok, run, ptr - run);
+            /* delimiter is handled in the next state */
+            if (ptr != end)
+                rc = nm_json_scalar_end(p, cb, ctx);
+            break;
+
+        default:
+            if (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')
+            {
+                ptr++;
+                break;
+            }
+            if (p->state <= NM_JSON_S_ARR_FIRST && nm_json_is_scalar(*ptr))
+            {
+                nm_str_trunc(&p->tok, 0);
+                p->state = NM_JSON_S_SCALAR;
+                break;
+            }
+            rc = nm_json_token(p, *ptr++, cb, ctx);
+            break;
+        }
+    }
+
+    if (rc != NM_OK)
+        nm_json_reset(p);
+
+    return rc;
+}
+
+void nm_json_reset(nm_json_parser_t *p)
+{
+    p->state = NM_JSON_S_VALUE;
+    p->in_key = 0;
+    p->surrogate = 0;
+    p->depth = 0;
+    p->root = NULL;
+    p->key = NM_INIT_STR;
+    nm_str_trunc(&p->tok, 0);
+    nm_arena_reset(&p->arena);
+}
+
+void nm_json_free(nm_json_parser_t *p)
+{
+    nm_str_free(&p->tok);
+    nm_arena_free(&p->arena);
+    *p = NM_INIT_JSON_PARSER;
+}
+
+const nm_json_t *nm_json_get(const nm_json_t *obj, const char *key)
+{
+    if (!obj || obj->type != NM_JSON_OBJECT)
+        return NULL;
+
+    for (const nm_json_t *item = obj->child; item; item = item->next)
+    {
+        if (nm_str_cmp_st(&item->key, key) == NM_OK)
+            return item;
+    }
+
+    return NULL;
+}
+
+const nm_json_t *nm_json_at(const nm_json_t *arr, size_t idx)
+{
+    const nm_json_t *item;
+
+    if (!arr || idx >= arr->n_child)
+        return NULL;
+
+    for (item = arr->child; idx; idx--)
+        item = item->next;
+
+    return item;
+}
+
+const char *nm_json_str(const nm_json_t *val)
+{
+    if (!val || val->type != NM_JSON_STRING)
+        return NULL;
+
+    return val->str.data;
+}
+
+int nm_json_int(const nm_json_t *val, int64_t *res)
+{
+    char *end;
+
+    if (!val || val->type != NM_JSON_NUMBER)
+        return NM_ERR;
+
+    errno = 0;
+    *res = strtoll(val->str.data, &end, 10);
+    if (errno || *end != '\0')
+        return NM_ERR;
+
+    return NM_OK;
+}
+
+int nm_json_bool(const nm_json_t *val)
+{
+    return (val && val->type == NM_JSON_TRUE);
+}
+
+static int nm_json_token(nm_json_parser_t *p, char ch,
+                         nm_json_cb_t cb, void *ctx)
+{
+    const nm_json_t *parent = p->depth ? p->stack[p->depth - 1] : NULL;
+
+    switch (p->state) {
+    case NM_JSON_S_VALUE:
+    case NM_JSON_S_ARR_FIRST:
+        if (ch == '{')
+            return nm_json_open(p, NM_JSON_OBJECT);
+        if (ch == '[')
+            return nm_json_open(p, NM_JSON_ARRAY);
+        if (ch == ']' && p->state == NM_JSON_S_ARR_FIRST)
+        {
+            nm_json_close(p, cb, ctx);
+            return NM_OK;
+        }
+        if (ch == '"')
+        {
+            nm_str_trunc(&p->tok, 0);
+            p->in_key = 0;
+            p->state = NM_JSON_S_STRING;
+            return NM_OK;
+        }
+        break;
+
+    case NM_JSON_S_OBJ_FIRST:
+    case NM_JSON_S_KEY:
+        if (ch == '}' && p->state == NM_JSON_S_OBJ_FIRST)
+        {
+            nm_json_close(p, cb, ctx);
+            return NM_OK;
+        }
+        if (ch == '"')
+        {
+            nm_str_trunc(&p->tok, 0);
+            p->in_key = 1;
+            p->state = NM_JSON_S_STRING;
+            return NM_OK;
+        }
+        break;
+
+    case NM_JSON_S_COLON:
+        if (ch == ':')
+        {
+            p->state = NM_JSON_S_VALUE;
+            return NM_OK;
+        }
+        break;
+
+    case NM_JSON_S_NEXT:
+        if (ch == ',')
+        {
+            p->state = (parent->type == NM_JSON_OBJECT) ?
+                NM_JSON_S_KEY : NM_JSON_S_VALUE;
+            return NM_OK;
+        }
+        if ((ch == '}' && parent->type == NM_JSON_OBJECT) ||
+            (ch == ']' && parent->type == NM_JSON_ARRAY))
+        {
+            nm_json_close(p, cb, ctx);
+            return NM_OK;
+        }
+        break;
+    }
+
+    return NM_ERR;
+}
+
+static int nm_json_escape(nm_json_parser_t *p, char ch)
+{
+    static const char from[] = "\"\\/bfnrt";
+    static const char to[] = "\"\\/\b\f\n\r\t";
+    const char *pos;
+
+    p->state = NM_JSON_S_STRING;
+
+    if (ch == 'u')
+    {
+        p->ucode = 0;
+        p->n_hex = 0;
+        p->state = NM_JSON_S_UNICODE;
+        return NM_OK;
+    }
+
+    if (ch == '\0' || (pos = strchr(from, ch)) == NULL)
+        return NM_ERR;
+
+    nm_str_add_char(&p->tok, to[pos - from]);
+
+    return NM_OK;
+}
+
+static int nm_json_unicode(nm_json_parser_t *p, char ch)
+{
+    uint32_t code = p->ucode;
+
+    if (ch >= '0' && ch <= '9')
+        code = (code << 4) | (ch - '0');
+    else if (ch >= 'a' && ch <= 'f')
+        code = (code << 4) | (ch - 'a' + 10);
+    else if (ch >= 'A' && ch <= 'F')
+        code = (code << 4) | (ch - 'A' + 10);
+    else
+        return NM_ERR;
+
+    p->ucode = code;
+    if (++p->n_hex < 4)
+        return NM_OK;
+
+    p->state = NM_JSON_S_STRING;
+
+    /* characters above BMP come as UTF-16 pair of escapes */
+    if (code >= 0xd800 && code <= 0xdbff)
+    {
+        p->surrogate = code;
+        return NM_OK;
+    }
+    if (code >= 0xdc00 && code <= 0xdfff && p->surrogate)
+        code = 0x10000 + ((p->surrogate - 0xd800) << 10) + (code - 0xdc00);
+
+    p->surrogate = 0;
+    nm_json_utf8(&p->tok, code);
+
+    return NM_OK;
+}
+
+static int nm_json_string_end(nm_json_parser_t *p,
+                              nm_json_cb_t cb, void *ctx)
+{
+    nm_json_t *val;
+
+    p->surrogate = 0;
+
+    if (p->in_key)
+    {
+        p->key = nm_arena_text(&p->arena, p->tok.data, p->tok.len);
+        p->state = NM_JSON_S_COLON;
+        return NM_OK;
+    }
+
+    val = nm_json_new(p, NM_JSON_STRING);
+    val->str = nm_arena_text(&p->arena, p->tok.data, p->tok.len);
+    nm_json_done(p, cb, ctx);
+
+    return NM_OK;
+}
+
+static int nm_json_scalar_end(nm_json_parser_t *p,
+                              nm_json_cb_t cb, void *ctx)
+{
+    nm_json_type_t type = NM_JSON_NUMBER;
+    nm_json_t *val;
+
+    if (!p->tok.len)
+        return NM_ERR;
+
+    if (nm_str_cmp_st(&p->tok, "true") == NM_OK)
+        type = NM_JSON_TRUE;
+    else if (nm_str_cmp_st(&p->tok, "false") == NM_OK)
+        type = NM_JSON_FALSE;
+    else if (nm_str_cmp_st(&p->tok, "null") == NM_OK)
+        type = NM_JSON_NULL;
+    else if (!nm_json_is_number(p->tok.data))
+        return NM_ERR;
+
+    val = nm_json_new(p, type);
+    if (type == NM_JSON_NUMBER)
+        val->str = nm_arena_text(&p->arena, p->tok.data, p->tok.len);
+    nm_json_done(p, cb, ctx);
+
+    return NM_OK;
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ * Checked by hand: strtod() follows locale and takes inf, nan and hex */
+static int nm_json_is_number(const char *str)
+{
+    if (*str == '-')
+        str++;
+
+    if (*str == '0')
+        str++;
+    else if (*str >= '1' && *str <= '9')
+    {
+        while (*str >= '0' && *str <= '9')
+            str++;
+    }
+    else
+        return NM_FALSE;
+
+    if (*str == '.')
+    {
+        if (!(*++str >= '0' && *str <= '9'))
+            return NM_FALSE;
+        while (*str >= '0' && *str <= '9')
+            str++;
+    }
+
+    if (*str == 'e' || *str == 'E')
+    {
+        str++;
+        if (*str == '+' || *str == '-')
+            str++;
+        if (!(*str >= '0' && *str <= '9'))
+            return NM_FALSE;
+        while (*str >= '0' && *str <= '9')
+            str++;
+    }
+
+    return *str == '\0';
+}
+
+static nm_json_t *nm_json_new(nm_json_parser_t *p, nm_json_type_t type)
+{
+    nm_json_t *val = nm_arena_alloc(&p->arena, sizeof(nm_json_t));
+    nm_json_t *parent;
+
+    memset(val, 0, sizeof(nm_json_t));
+    val->type = type;
+
+    if (!p->depth)
+    {
+        p->root = val;
+        return val;
+    }
+
+    parent = p->stack[p->depth - 1];
+    if (parent->type == NM_JSON_OBJECT)
+        val->key = p->key;
+
+    if (p->tail[p->depth - 1])
+        p->tail[p->depth - 1]->next = val;
+    else
+        parent->child = val;
+
+    p->tail[p->depth - 1] = val;
+    parent->n_child++;
+
+    return val;
+}
+
+static int nm_json_open(nm_json_parser_t *p, nm_json_type_t type)
+{
+    if (p->depth == NM_JSON_DEPTH)
+        return NM_ERR;
+
+    p->stack[p->depth] = nm_json_new(p, type);
+    p->tail[p->depth] = NULL;
+    p->depth++;
+
+    p->state = (type == NM_JSON_OBJECT) ?
+        NM_JSON_S_OBJ_FIRST : NM_JSON_S_ARR_FIRST;
+
+    return NM_OK;
+}
+
+static void nm_json_close(nm_json_parser_t *p, nm_json_cb_t cb, void *ctx)
+{
+    p->depth--;
+    nm_json_done(p, cb, ctx);
+}
+
+static void nm_json_done(nm_json_parser_t *p, nm_json_cb_t cb, void *ctx)
+{
+    if (p->depth)
+    {
+        p->state = NM_JSON_S_NEXT;
+        return;
+    }
+
+    p->state = NM_JSON_S_VALUE;
+
+    if (cb)
+        cb(p->root, ctx);
+
+    p->root = NULL;
+    p->key = NM_INIT_STR;
+    nm_arena_reset(&p->arena);
+}
+
+static void nm_json_utf8(nm_str_t *str, uint32_t code)
+{
+    if (code < 0x80)
+    {
+        nm_str_add_char(str, code);
+    }
+    else if (code < 0x800)
+    {
+        nm_str_add_char(str, 0xc0 | (code >> 6));
+        nm_str_add_char(str, 0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        nm_str_add_char(str, 0xe0 | (code >> 12));
+        nm_str_add_char(str, 0x80 | ((code >> 6) & 0x3f));
+        nm_str_add_char(str, 0x80 | (code & 0x3f));
+    }
+    else
+    {
+        nm_str_add_char(str, 0xf0 | (code >> 18));
+        nm_str_add_char(str, 0x80 | ((code >> 12) & 0x3f));
+        nm_str_add_char(str, 0x80 | ((code >> 6) & 0x3f));
+        nm_str_add_char(str, 0x80 | (code & 0x3f));
+    }
+}
+
+static int nm_json_is_scalar(char ch)
+{
+    return ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') ||
+            (ch >= 'A' && ch <= 'Z') || ch == '-' || ch == '+' || ch == '.');
+}
+
+/* vim:set ts=4 sw=4: */
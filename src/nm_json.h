@@ -0,0 +1,66 @@
+#ifndef NM_JSON_H_
+#define NM_JSON_H_
+
+#include <nm_string.h>
+#include <nm_arena.h>
+
+/* Incremental JSON parser for QMP streams.
+ * Data is fed in chunks as it is read from socket, every complete
+ * top-level value is passed to callback as a tree. Tree is allocated
+ * from parser arena and is valid only inside the callback. */
+
+typedef enum {
+    NM_JSON_NULL,
+    NM_JSON_FALSE,
+    NM_JSON_TRUE,
+    NM_JSON_NUMBER,
+    NM_JSON_STRING,
+    NM_JSON_ARRAY,
+    NM_JSON_OBJECT
+} nm_json_type_t;
+
+typedef struct nm_json nm_json_t;
+
+struct nm_json {
+    nm_json_type_t type;
+    nm_str_t key;      /* member name, if parent is object */
+    nm_str_t str;      /* string value or number as text */
+    nm_json_t *child;  /* first element of array or object */
+    nm_json_t *next;   /* next element of parent */
+    size_t n_child;
+};
+
+typedef void (*nm_json_cb_t)(const nm_json_t *val, void *ctx);
+
+enum {NM_JSON_DEPTH = 64};
+
+typedef struct {
+    int state;
+    int in_key;
+    uint32_t ucode;     /* \uXXXX being read */
+    uint32_t surrogate; /* high half of UTF-16 pair */
+    int n_hex;
+    size_t depth;
+    nm_str_t tok;       /* string, number or literal being read */
+    nm_str_t key;       /* member name of the next value */
+    nm_json_t *root;
+    nm_json_t *stack[NM_JSON_DEPTH];
+    nm_json_t *tail[NM_JSON_DEPTH];
+    nm_arena_t arena;
+} nm_json_parser_t;
+
+#define NM_INIT_JSON_PARSER (nm_json_parser_t) { .state = 0 }
+
+int nm_json_feed(nm_json_parser_t *p, const char *buf, size_t len,
+                 nm_json_cb_t cb, void *ctx);
+void nm_json_reset(nm_json_parser_t *p);
+void nm_json_free(nm_json_parser_t *p);
+
+const nm_json_t *nm_json_get(const nm_json_t *obj, const char *key);
+const nm_json_t *nm_json_at(const nm_json_t *arr, size_t idx);
+const char *nm_json_str(const nm_json_t *val);
+int nm_json_int(const nm_json_t *val, int64_t *res);
+int nm_json_bool(const nm_json_t *val);
+
+#endif /* NM_JSON_H_ */
+/* vim:set ts=4 sw=4: */
@@ -55,7 +55,7 @@ void nm_lan_settings(void)
     int ch = 0, regen_data = 1, renew_status = 0;
     nm_str_t query = NM_INIT_STR;
     nm_vect_t veths = NM_INIT_VECT;
-    nm_vect_t veths_list = NM_INIT_VECT;
+    nm_arr_t veths_list = NM_INIT_ARR(nm_menu_item_t);
     nm_menu_data_t veths_data = NM_INIT_MENU_DATA;
     size_t veth_list_len, old_hl = 0;
 
@@ -127,7 +127,7 @@ void nm_lan_settings(void)
 
         if (regen_data)
         {
-            nm_vect_free(&veths_list, NULL);
+            nm_arr_free(&veths_list, NULL);
             nm_vect_free(&veths, nm_str_vect_free_cb);
             nm_db_select(NM_LAN_GET_VETH_SQL, &veths);
             veth_list_len = (getmaxy(side_window) - 4);
@@ -148,11 +148,12 @@ void nm_lan_settings(void)
             else
                 veths_data.item_last = veth_list_len = veths.n_memb;
 
+            nm_arr_reserve(&veths_list, veths.n_memb);
             for (size_t n = 0; n < veths.n_memb; n++)
             {
                 nm_menu_item_t veth = NM_INIT_MENU_ITEM;
-                veth.name = (nm_str_t *) nm_vect_at(&veths, n);
-                nm_vect_insert(&veths_list, &veth, sizeof(veth), NULL);
+                veth.name = nm_str_view(nm_vect_str_ctx(&veths, n));
+                nm_arr_push(&veths_list, &veth);
             }
 
             veths_data.v = &veths_list;
@@ -210,7 +211,7 @@ void nm_lan_settings(void)
     nm_init_side();
     nm_init_help_main();
     nm_vect_free(&veths, nm_str_vect_free_cb);
-    nm_vect_free(&veths_list, NULL);
+    nm_arr_free(&veths_list, NULL);
     nm_str_free(&query);
 }
 
@@ -218,7 +219,6 @@ static void nm_lan_add_veth(void)
 {
     nm_str_t l_name = NM_INIT_STR;
     nm_str_t r_name = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_form_t *form = NULL;
     size_t msg_len = nm_max_msg_len(nm_form_add_msg);
@@ -251,8 +251,7 @@ static void nm_lan_add_veth(void)
     nm_net_link_up(&l_name);
     nm_net_link_up(&r_name);
 
-    nm_str_format(&query, NM_LAN_ADD_VETH_SQL, l_name.data, r_name.data);
-    nm_db_edit(query.data);
+    nm_db_edit(NM_LAN_ADD_VETH_SQL, l_name.data, r_name.data);
 
 out:
     wtimeout(action_window, -1);
@@ -261,13 +260,11 @@ out:
     nm_form_free(form, fields);
     nm_str_free(&l_name);
     nm_str_free(&r_name);
-    nm_str_free(&query);
 }
 
 static int nm_lan_add_get_data(nm_str_t *ln, nm_str_t *rn)
 {
     int rc = NM_OK;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t err = NM_INIT_VECT;
     nm_vect_t names = NM_INIT_VECT;
 
@@ -283,8 +280,7 @@ static int nm_lan_add_get_data(nm_str_t *ln, nm_str_t *rn)
         goto out;
     }
 
-    nm_str_format(&query, NM_LAN_CHECK_NAME_SQL, ln->data, ln->data);
-    nm_db_select(query.data, &names);
+    nm_db_select(NM_LAN_CHECK_NAME_SQL, &names, ln->data, ln->data);
     if (names.n_memb > 0)
     {
         nm_warn(_(NM_MSG_NAME_BUSY));
@@ -292,8 +288,7 @@ static int nm_lan_add_get_data(nm_str_t *ln, nm_str_t *rn)
         goto out;
     }
 
-    nm_str_format(&query, NM_LAN_CHECK_NAME_SQL, rn->data, rn->data);
-    nm_db_select(query.data, &names);
+    nm_db_select(NM_LAN_CHECK_NAME_SQL, &names, rn->data, rn->data);
     if (names.n_memb > 0)
     {
         nm_warn(_(NM_MSG_NAME_BUSY));
@@ -309,7 +304,6 @@ static int nm_lan_add_get_data(nm_str_t *ln, nm_str_t *rn)
 
 out:
     nm_vect_free(&names, nm_str_vect_free_cb);
-    nm_str_free(&query);
     return rc;
 }
 
@@ -317,20 +311,17 @@ static void nm_lan_del_veth(const nm_str_t *name)
 {
     nm_str_t lname = NM_INIT_STR;
     nm_str_t rname = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
 
     nm_lan_parse_name(name, &lname, &rname);
     nm_net_del_iface(&lname);
 
-    nm_str_format(&query, NM_LAN_DEL_VETH_SQL, lname.data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_LAN_VETH_DEP_SQL, lname.data, rname.data);
-    nm_db_edit(query.data);
+    nm_db_begin();
+    nm_db_edit(NM_LAN_DEL_VETH_SQL, lname.data);
+    nm_db_edit(NM_LAN_VETH_DEP_SQL, lname.data, rname.data);
+    nm_db_commit();
 
     nm_str_free(&lname);
     nm_str_free(&rname);
-    nm_str_free(&query);
 }
 
 static void nm_lan_up_veth(const nm_str_t *name)
@@ -367,7 +358,6 @@ static void nm_lan_veth_info(const nm_str_t *name)
     size_t y = 3, x = 2;
     size_t cols, rows;
     nm_str_t rname = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
     nm_vect_t ifs = NM_INIT_VECT;
 
@@ -375,8 +365,7 @@ static void nm_lan_veth_info(const nm_str_t *name)
     getmaxyx(action_window, rows, cols);
     nm_lan_parse_name(name, &buf, &rname);
 
-    nm_str_format(&query, NM_LAN_VETH_INF_SQL, buf.data);
-    nm_db_select(query.data, &ifs);
+    nm_db_select(NM_LAN_VETH_INF_SQL, &ifs, buf.data);
 
     nm_str_add_char(&buf, ':');
     if (ifs.n_memb > 0)
@@ -391,8 +380,7 @@ static void nm_lan_veth_info(const nm_str_t *name)
     nm_vect_free(&ifs, nm_str_vect_free_cb);
     nm_str_copy(&buf, &rname);
 
-    nm_str_format(&query, NM_LAN_VETH_INF_SQL, buf.data);
-    nm_db_select(query.data, &ifs);
+    nm_db_select(NM_LAN_VETH_INF_SQL, &ifs, buf.data);
 
     nm_str_add_char(&buf, ':');
     if (ifs.n_memb > 0)
@@ -404,8 +392,6 @@ static void nm_lan_veth_info(const nm_str_t *name)
 
     nm_vect_free(&ifs, nm_str_vect_free_cb);
     nm_str_free(&rname);
-    nm_str_free(&query);
-
     nm_str_free(&buf);
 }
 
@@ -436,11 +422,13 @@ void nm_lan_parse_name(const nm_str_t *name, nm_str_t *ln, nm_str_t *rn)
 void nm_lan_create_veth(int info)
 {
     nm_vect_t veths = NM_INIT_VECT;
+    nm_arr_t missing = NM_INIT_ARR(size_t);
     size_t veth_count, veth_created = 0;
 
     nm_db_select(NM_GET_VETH_SQL, &veths);
     veth_count = veths.n_memb / 2;
 
+    /* all lookups are done first: they send queued requests */
     for (size_t n = 0; n < veth_count; n++)
     {
         size_t idx_shift = n * 2;
@@ -455,11 +443,7 @@ void nm_lan_create_veth(int info)
             if (info)
                 printf("\t[not found]\n");
 
-            nm_net_add_veth(l_name, r_name);
-            nm_net_link_up(l_name);
-            nm_net_link_up(r_name);
-
-            veth_created++;
+            nm_arr_push(&missing, &idx_shift);
         }
         else
         {
@@ -468,11 +452,27 @@ void nm_lan_create_veth(int info)
         }
     }
 
+    nm_net_batch_begin();
+    for (size_t n = 0; n < missing.n_memb; n++)
+    {
+        size_t idx_shift = *(size_t *) nm_arr_at(&missing, n);
+        const nm_str_t *l_name = nm_vect_str(&veths, idx_shift);
+        const nm_str_t *r_name = nm_vect_str(&veths, idx_shift + 1);
+
+        nm_net_add_veth(l_name, r_name);
+        nm_net_link_up(l_name);
+        nm_net_link_up(r_name);
+
+        veth_created++;
+    }
+    nm_net_batch_end();
+
     if (info && !veth_created)
         printf("Nothing to do.\n");
     else if (info && veth_created)
         printf("%zu VETH interface[s] was created.\n", veth_created);
 
+    nm_arr_free(&missing, NULL);
     nm_vect_free(&veths, nm_str_vect_free_cb);
 }
 
@@ -6,171 +6,525 @@
 #include <nm_machine.h>
 #include <nm_cfg_file.h>
 
-#include <sys/wait.h>
-
-static inline nm_str_t *nm_mach_arch(const nm_mach_t *p)
-{
-    return (nm_str_t *)&p->arch;
-}
-static inline nm_vect_t **nm_mach_list(const nm_mach_t *p)
-{
-    return (nm_vect_t **)&p->list;
-}
+#include <sys/socket.h>
+
+/* Machine types, devices and optional features of QEMU targets.
+ * Data is kept in file next to database and is valid while QEMU binary
+ * has the same mtime and size, so QEMU is started only after upgrade.
+ * Stale targets are probed at once, each with three processes. */
+
+#define NM_MACH_CACHE_FILE  "qemu.cache"
+#define NM_MACH_CACHE_MAGIC "nemu-qemu-cache 1"
+#define NM_MACH_QMP_PROBE \
+    "{\"execute\":\"qmp_capabilities\"}\n" \
+    "{\"execute\":\"query-qmp-schema\"}\n" \
+    "{\"execute\":\"quit\"}\n"
+
+enum {
+    NM_MACH_PROBE_MACH,
+    NM_MACH_PROBE_DEV,
+    NM_MACH_PROBE_QMP,
+    NM_MACH_PROBE_COUNT
+};
+
+/* QEMU that does not answer is killed, e.g. broken build
+ * waiting for something forever. Time is in ms. */
+enum {NM_MACH_PROBE_TIMEOUT = 30000};
+
+typedef struct {
+    nm_mach_t mach;
+    nm_spawn_t *sp[NM_MACH_PROBE_COUNT];
+} nm_mach_probe_t;
 
 static nm_vect_t nm_machs = NM_INIT_VECT;
+static int nm_machs_loaded;
 
 static void nm_mach_init(void);
-static void nm_mach_get_data(const char *arch);
-static nm_vect_t *nm_mach_parse(const nm_str_t *buf);
+static const nm_mach_t *nm_mach_find(const char *arch);
+static void nm_mach_bin(const char *arch, nm_str_t *bin);
+static int nm_mach_stamp(const char *arch, nm_mach_t *mach);
+static void nm_mach_warn(const char *arch);
+static void nm_mach_probe_start(nm_mach_probe_t *probe);
+static int nm_mach_probe_finish(nm_mach_probe_t *probe);
+static void nm_mach_parse_mach(const nm_str_t *buf, nm_vect_t *v);
+static void nm_mach_parse_dev(const nm_str_t *buf, nm_vect_t *v);
+static uint32_t nm_mach_parse_caps(const nm_str_t *buf);
+static void nm_mach_cache_path(nm_str_t *path);
+static void nm_mach_cache_load(nm_vect_t *cached);
+static void nm_mach_cache_save(void);
 
 static void nm_mach_init(void)
 {
     const nm_vect_t *archs = &nm_cfg_get()->qemu_targets;
+    nm_arr_t probes = NM_INIT_ARR(nm_mach_probe_t);
+    nm_vect_t cached = NM_INIT_VECT;
+    size_t hits = 0;
+
+    nm_machs_loaded = NM_TRUE;
+    nm_mach_cache_load(&cached);
 
     for (size_t n = 0; n < archs->n_memb; n++)
-        nm_mach_get_data(((char **) archs->data)[n]);
+    {
+        const char *arch = ((char **) archs->data)[n];
+        nm_mach_probe_t probe;
+        int found = NM_FALSE;
+
+        memset(&probe, 0, sizeof(probe));
+
+        if (nm_mach_stamp(arch, &probe.mach) != NM_OK)
+        {
+            nm_mach_warn(arch);
+            nm_mach_vect_free_mlist_cb(&probe.mach);
+            continue;
+        }
+
+        for (size_t m = 0; m < cached.n_memb; m++)
+        {
+            nm_mach_t *entry = nm_vect_at(&cached, m);
+
+            if (nm_str_cmp_ss(&entry->arch, &probe.mach.arch) != NM_OK ||
+                entry->mtime_sec != probe.mach.mtime_sec ||
+                entry->mtime_nsec != probe.mach.mtime_nsec ||
+                entry->size != probe.mach.size)
+            {
+                continue;
+            }
+
+            /* data is moved, empty entry is left in cache list */
+            nm_vect_insert(&nm_machs, entry, sizeof(nm_mach_t), NULL);
+            memset(entry, 0, sizeof(nm_mach_t));
+            found = NM_TRUE;
+            hits++;
+            break;
+        }
+
+        if (found)
+        {
+            nm_mach_vect_free_mlist_cb(&probe.mach);
+            continue;
+        }
+
+        nm_mach_probe_start(nm_arr_push(&probes, &probe));
+    }
+
+    for (size_t n = 0; n < probes.n_memb; n++)
+    {
+        nm_mach_probe_t *probe = nm_arr_at(&probes, n);
+
+        if (nm_mach_probe_finish(probe) != NM_OK)
+        {
+            nm_mach_warn(probe->mach.arch.data);
+            nm_mach_vect_free_mlist_cb(&probe->mach);
+            continue;
+        }
+
+        nm_vect_insert(&nm_machs, &probe->mach, sizeof(nm_mach_t), NULL);
+    }
+
+    if (probes.n_memb || hits != cached.n_memb)
+        nm_mach_cache_save();
+
+    nm_arr_free(&probes, NULL);
+    nm_vect_free(&cached, nm_mach_vect_free_mlist_cb);
 
 #ifdef NM_DEBUG
     nm_debug("\n");
     for (size_t n = 0; n < nm_machs.n_memb; n++)
     {
-        nm_vect_t *v = *nm_mach_list(nm_machs.data[n]);
-        nm_debug("Get machine list for %s:\n",
-            nm_mach_arch(nm_machs.data[n])->data);
+        const nm_mach_t *mach = nm_machs.data[n];
 
-        for (size_t n = 0; n < v->n_memb; n++)
-        {
-            nm_debug(">> mach: %s\n", (char *) v->data[n]);
-        }
+        nm_debug("Get machine list for %s (caps %#x):\n",
+            mach->arch.data, mach->caps);
+
+        for (size_t m = 0; m < mach->list.n_memb; m++)
+            nm_debug(">> mach: %s\n", (char *) mach->list.data[m]);
     }
 #endif
 }
 
 const char **nm_mach_get(const nm_str_t *arch)
 {
-    const char **v = NULL;
+    const nm_mach_t *mach = nm_mach_find(arch->data);
 
-    if (nm_machs.data == NULL)
-        nm_mach_init();
+    return mach ? (const char **) mach->list.data : NULL;
+}
 
-    for (size_t n = 0; n < nm_machs.n_memb; n++)
+int nm_mach_has_cap(const char *arch, uint32_t cap)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    return mach && ((mach->caps & cap) == cap);
+}
+
+int nm_mach_has_device(const char *arch, const char *dev)
+{
+    const nm_mach_t *mach = nm_mach_find(arch);
+
+    if (!mach)
+        return NM_FALSE;
+
+    for (size_t n = 0; n < mach->devs.n_memb; n++)
     {
-        if (nm_str_cmp_ss(nm_machs.data[n], arch) == NM_OK)
-        {
-            v = (const char **) (*nm_mach_list(nm_machs.data[n]))->data;
-            break;
-        }
+        if (nm_str_cmp_tt(mach->devs.data[n], dev) == NM_OK)
+            return NM_TRUE;
     }
 
-    return v;
+    return NM_FALSE;
 }
 
 void nm_mach_free(void)
 {
-    for (size_t n = 0; n < nm_machs.n_memb; n++)
-        nm_vect_free(*nm_mach_list(nm_machs.data[n]), NULL);
-
     nm_vect_free(&nm_machs, nm_mach_vect_free_mlist_cb);
+    nm_machs_loaded = NM_FALSE;
 }
 
-static void nm_mach_get_data(const char *arch)
+void nm_mach_vect_free_mlist_cb(void *unit_p)
 {
-    nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
-    nm_str_t answer = NM_INIT_STR;
-    nm_mach_t mach_list = NM_INIT_MLIST;
+    nm_mach_t *mach = unit_p;
+
+    nm_str_free(&mach->arch);
+    nm_vect_free(&mach->list, NULL);
+    nm_vect_free(&mach->devs, NULL);
+}
+
+static const nm_mach_t *nm_mach_find(const char *arch)
+{
+    if (!nm_machs_loaded)
+        nm_mach_init();
+
+    if (!arch)
+        return NULL;
+
+    for (size_t n = 0; n < nm_machs.n_memb; n++)
+    {
+        const nm_mach_t *mach = nm_machs.data[n];
 
-    nm_str_alloc_text(&mach_list.arch, arch);
+        if (nm_str_cmp_st(&mach->arch, arch) == NM_OK)
+            return mach;
+    }
+
+    return NULL;
+}
 
-    nm_str_format(&buf, "%s/bin/qemu-system-%s",
+static void nm_mach_bin(const char *arch, nm_str_t *bin)
+{
+    nm_str_format(bin, "%s/bin/qemu-system-%s",
         NM_STRING(NM_USR_PREFIX), arch);
-    nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+}
 
-    nm_vect_insert_cstr(&argv, "-M");
-    nm_vect_insert_cstr(&argv, "help");
+static int nm_mach_stamp(const char *arch, nm_mach_t *mach)
+{
+    nm_str_t bin = NM_INIT_STR;
+    struct stat info;
+    int rc;
+
+    nm_str_alloc_text(&mach->arch, arch);
+    nm_mach_bin(arch, &bin);
 
-    nm_vect_end_zero(&argv);
-    if (nm_spawn_process(&argv, &answer) != NM_OK)
+    if ((rc = stat(bin.data, &info)) == 0)
     {
-        nm_str_t warn_msg = NM_INIT_STR;
-        nm_str_format(&warn_msg,
-            _("Cannot get mach for %-6s  . Error was logged"), arch);
-        nm_warn(warn_msg.data);
-        nm_str_free(&warn_msg);
-        goto out;
+        mach->mtime_sec = info.st_mtim.tv_sec;
+        mach->mtime_nsec = info.st_mtim.tv_nsec;
+        mach->size = info.st_size;
     }
 
-    mach_list.list = nm_mach_parse(&answer);
+    nm_str_free(&bin);
 
-    nm_vect_insert(&nm_machs, &mach_list,
-        sizeof(mach_list), nm_mach_vect_ins_mlist_cb);
-out:
-    nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
-    nm_str_free(&answer);
-    nm_str_free(&mach_list.arch);
+    return (rc == 0) ? NM_OK : NM_ERR;
 }
 
-static nm_vect_t *nm_mach_parse(const nm_str_t *buf)
+static void nm_mach_warn(const char *arch)
 {
-    const char *bufp = buf->data;
-    int lookup_mach = 1;
-    nm_str_t mach = NM_INIT_STR;
-    nm_vect_t *v = NULL;
+    nm_str_t warn_msg = NM_INIT_STR;
+
+    nm_str_format(&warn_msg,
+        _("Cannot get mach for %-6s  . Error was logged"), arch);
+    nm_warn(warn_msg.data);
+    nm_str_free(&warn_msg);
+}
+
+static void nm_mach_probe_start(nm_mach_probe_t *probe)
+{
+    nm_str_t bin = NM_INIT_STR;
+
+    nm_mach_bin(probe->mach.arch.data, &bin);
+
+    for (int n = 0; n < NM_MACH_PROBE_COUNT; n++)
+    {
+        nm_argv_t argv = NM_INIT_ARGV;
+
+        nm_argv_add(&argv, bin.data);
 
-    assert(bufp != NULL);
+        switch (n) {
+        case NM_MACH_PROBE_MACH:
+            nm_argv_add(&argv, "-M");
+            nm_argv_add(&argv, "help");
+            probe->sp[n] = nm_spawn_start(&argv, 0, NM_MACH_PROBE_TIMEOUT);
+            break;
+
+        case NM_MACH_PROBE_DEV:
+            nm_argv_add(&argv, "-device");
+            nm_argv_add(&argv, "help");
+            probe->sp[n] = nm_spawn_start(&argv, 0, NM_MACH_PROBE_TIMEOUT);
+            break;
+
+        case NM_MACH_PROBE_QMP:
+            /* commands are queued in socket before QEMU reads them,
+             * output is read until QEMU quits */
+            nm_argv_add(&argv, "-machine");
+            nm_argv_add(&argv, "none");
+            nm_argv_add(&argv, "-nodefaults");
+            nm_argv_add(&argv, "-display");
+            nm_argv_add(&argv, "none");
+            nm_argv_add(&argv, "-qmp");
+            nm_argv_add(&argv, "stdio");
+            probe->sp[n] = nm_spawn_start(&argv, NM_SPAWN_STDIN,
+                                          NM_MACH_PROBE_TIMEOUT);
+
+            if (send(nm_spawn_fd(probe->sp[n]), NM_MACH_QMP_PROBE,
+                     strlen(NM_MACH_QMP_PROBE), MSG_NOSIGNAL) == -1)
+            {
+                nm_debug("%s: send: %s\n", __func__, strerror(errno));
+            }
+            break;
+        }
 
-    v = nm_calloc(1, sizeof(nm_vect_t));
+        nm_argv_free(&argv);
+    }
 
-    /* skip first line */
-    while (*bufp != '\n')
-        bufp++;
+    nm_str_free(&bin);
+}
 
-    bufp++;
+/* Only machine list is required, older QEMU may lack the rest */
+static int nm_mach_probe_finish(nm_mach_probe_t *probe)
+{
+    nm_str_t answer = NM_INIT_STR;
+    int rc = NM_OK;
 
-    while (*bufp != '\0')
+    for (int n = 0; n < NM_MACH_PROBE_COUNT; n++)
     {
-        if (lookup_mach && (*bufp != 0x20))
+        nm_str_trunc(&answer, 0);
+
+        if (nm_spawn_wait(probe->sp[n], &answer) != NM_OK ||
+            !answer.len)
         {
-            nm_str_add_char_opt(&mach, *bufp);
+            if (n == NM_MACH_PROBE_MACH)
+                rc = NM_ERR;
+            continue;
         }
-        else if (lookup_mach && (*bufp == 0x20))
-        {
-            lookup_mach = 0;
+
+        switch (n) {
+        case NM_MACH_PROBE_MACH:
+            nm_mach_parse_mach(&answer, &probe->mach.list);
+            break;
+        case NM_MACH_PROBE_DEV:
+            nm_mach_parse_dev(&answer, &probe->mach.devs);
+            break;
+        case NM_MACH_PROBE_QMP:
+            probe->mach.caps = nm_mach_parse_caps(&answer);
+            break;
         }
+    }
 
-        if (!lookup_mach && (*bufp == '\n'))
-        {
-            nm_str_t item = NM_INIT_STR;
+    nm_str_free(&answer);
 
-            nm_str_copy(&item, &mach);
-            nm_vect_insert(v, item.data, item.len + 1, NULL);
-            nm_str_trunc(&mach, 0);
-            lookup_mach = 1;
+    return rc;
+}
+
+/* Machine name is the first word of each line after the header */
+static void nm_mach_parse_mach(const nm_str_t *buf, nm_vect_t *v)
+{
+    nm_str_t mach = NM_INIT_STR;
+    const char *line = strchr(buf->data, '\n');
+
+    while (line && *++line)
+    {
+        size_t len = strcspn(line, " \n");
 
-            nm_str_free(&item);
+        if (len && line[len] == ' ')
+        {
+            nm_str_trunc(&mach, 0);
+            nm_str_add_text_part(&mach, line, len);
+            nm_vect_insert_cstr(v, mach.data);
         }
 
-        bufp++;
+        line = strchr(line, '\n');
     }
 
     nm_vect_end_zero(v);
-
     nm_str_free(&mach);
+}
 
-    return v;
+/* Lines look like: name "virtio-blk-pci", bus PCI, alias "virtio-blk" */
+static void nm_mach_parse_dev(const nm_str_t *buf, nm_vect_t *v)
+{
+    static const char prefix[] = "name \"";
+    nm_str_t dev = NM_INIT_STR;
+    const char *line = buf->data;
+
+    while (line && *line)
+    {
+        if (strncmp(line, prefix, sizeof(prefix) - 1) == 0)
+        {
+            const char *name = line + sizeof(prefix) - 1;
+            size_t len = strcspn(name, "\"\n");
+
+            if (len && name[len] == '"')
+            {
+                nm_str_trunc(&dev, 0);
+                nm_str_add_text_part(&dev, name, len);
+                nm_vect_insert_cstr(v, dev.data);
+            }
+        }
+
+        if ((line = strchr(line, '\n')) != NULL)
+            line++;
+    }
+
+    nm_str_free(&dev);
 }
 
-void nm_mach_vect_ins_mlist_cb(void *unit_p, const void *ctx)
+/* Schema is not kept: only names of features nemu can use
+ * are looked up, e.g. "iothread" of ObjectType enum */
+static uint32_t nm_mach_parse_caps(const nm_str_t *buf)
 {
-    nm_str_copy(nm_mach_arch(unit_p), nm_mach_arch(ctx));
-    memcpy(nm_mach_list(unit_p), nm_mach_list(ctx), sizeof(nm_vect_t *));
+    uint32_t caps = 0;
+
+    if (!strstr(buf->data, "\"return\""))
+        return 0;
+
+    if (strstr(buf->data, "\"iothread\""))
+        caps |= NM_CAP_IOTHREAD;
+    if (strstr(buf->data, "\"io_uring\""))
+        caps |= NM_CAP_IO_URING;
+
+    return caps;
 }
 
-void nm_mach_vect_free_mlist_cb(void *unit_p)
+static void nm_mach_cache_path(nm_str_t *path)
+{
+    nm_str_dirname(&nm_cfg_get()->db_path, path);
+    nm_str_append_format(path, "/%s", NM_MACH_CACHE_FILE);
+}
+
+/* File has one line per value:
+ * target <arch> <mtime sec> <mtime nsec> <size>
+ * caps <hex>
+ * mach <name>
+ * dev <name> */
+static void nm_mach_cache_load(nm_vect_t *cached)
+{
+    nm_str_t path = NM_INIT_STR;
+    nm_mach_t *mach = NULL;
+    char *line = NULL;
+    size_t alloc = 0;
+    ssize_t len;
+    FILE *fp;
+
+    nm_mach_cache_path(&path);
+    fp = fopen(path.data, "r");
+    nm_str_free(&path);
+
+    if (!fp)
+        return;
+
+    if ((len = getline(&line, &alloc, fp)) == -1 ||
+        nm_str_cmp_tt(line, NM_MACH_CACHE_MAGIC "\n") != NM_OK)
+    {
+        goto out;
+    }
+
+    while ((len = getline(&line, &alloc, fp)) != -1)
+    {
+        char *val;
+
+        if (len && line[len - 1] == '\n')
+            line[--len] = '\0';
+
+        if ((val = strchr(line, ' ')) == NULL)
+            continue;
+        *val++ = '\0';
+
+        if (nm_str_cmp_tt(line, "target") == NM_OK)
+        {
+            nm_mach_t entry = NM_INIT_MLIST;
+            char *stamp = strchr(val, ' ');
+
+            mach = NULL;
+            if (!stamp)
+                continue;
+            *stamp++ = '\0';
+
+            if (sscanf(stamp, "%" SCNd64 " %" SCNd64 " %" SCNd64,
+                    &entry.mtime_sec, &entry.mtime_nsec, &entry.size) != 3)
+            {
+                continue;
+            }
+
+            nm_str_alloc_text(&entry.arch, val);
+            nm_vect_insert(cached, &entry, sizeof(entry), NULL);
+            mach = nm_vect_at(cached, cached->n_memb - 1);
+        }
+        else if (!mach)
+            continue;
+        else if (nm_str_cmp_tt(line, "caps") == NM_OK)
+            mach->caps = strtoul(val, NULL, 16);
+        else if (nm_str_cmp_tt(line, "mach") == NM_OK)
+            nm_vect_insert_cstr(&mach->list, val);
+        else if (nm_str_cmp_tt(line, "dev") == NM_OK)
+            nm_vect_insert_cstr(&mach->devs, val);
+    }
+
+    for (size_t n = 0; n < cached->n_memb; n++)
+        nm_vect_end_zero(&((nm_mach_t *) cached->data[n])->list);
+
+out:
+    free(line);
+    fclose(fp);
+}
+
+/* File is replaced at once, so other nemu process never
+ * reads half-written cache */
+static void nm_mach_cache_save(void)
 {
-    nm_str_free(nm_mach_arch(unit_p));
-    free(*nm_mach_list(unit_p));
+    nm_str_t path = NM_INIT_STR;
+    nm_str_t tmp = NM_INIT_STR;
+    FILE *fp;
+    int err;
+
+    nm_mach_cache_path(&path);
+    nm_str_format(&tmp, "%s.%d", path.data, getpid());
+
+    if ((fp = fopen(tmp.data, "w")) == NULL)
+    {
+        nm_debug("%s: cannot create %s: %s\n",
+            __func__, tmp.data, strerror(errno));
+        goto out;
+    }
+
+    fprintf(fp, "%s\n", NM_MACH_CACHE_MAGIC);
+
+    for (size_t n = 0; n < nm_machs.n_memb; n++)
+    {
+        const nm_mach_t *mach = nm_machs.data[n];
+
+        fprintf(fp, "target %s %" PRId64 " %" PRId64 " %" PRId64 "\n",
+            mach->arch.data, mach->mtime_sec, mach->mtime_nsec, mach->size);
+        fprintf(fp, "caps %" PRIx32 "\n", mach->caps);
+
+        for (size_t m = 0; m < mach->list.n_memb; m++)
+            fprintf(fp, "mach %s\n", (char *) mach->list.data[m]);
+        for (size_t m = 0; m < mach->devs.n_memb; m++)
+            fprintf(fp, "dev %s\n", (char *) mach->devs.data[m]);
+    }
+
+    err = ferror(fp);
+    if ((fclose(fp) != 0) || err || (rename(tmp.data, path.data) != 0))
+        unlink(tmp.data);
+
+out:
+    nm_str_free(&path);
+    nm_str_free(&tmp);
 }
 
 /* vim:set ts=4 sw=4: */
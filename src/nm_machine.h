@@ -4,17 +4,32 @@
 #include <nm_string.h>
 #include <nm_vector.h>
 
+#include <stdint.h>
+
+/* Optional features found in QMP schema of QEMU binary */
+enum {
+    NM_CAP_IOTHREAD = (1 << 0),
+    NM_CAP_IO_URING = (1 << 1),
+};
+
 typedef struct {
-     nm_str_t arch;
-     nm_vect_t *list;
+    nm_str_t arch;
+    nm_vect_t list;     /* machine types, NULL terminated */
+    nm_vect_t devs;     /* device names */
+    uint32_t caps;
+    int64_t mtime_sec;  /* QEMU binary stamp */
+    int64_t mtime_nsec;
+    int64_t size;
 } nm_mach_t;
 
-#define NM_INIT_MLIST { NM_INIT_STR, NULL }
+#define NM_INIT_MLIST (nm_mach_t) \
+    { NM_INIT_STR, NM_INIT_VECT, NM_INIT_VECT, 0, 0, 0, 0 }
 
 void nm_mach_free(void);
-void nm_mach_vect_ins_mlist_cb(void *unit_p, const void *ctx);
 void nm_mach_vect_free_mlist_cb(void *unit_p);
 const char **nm_mach_get(const nm_str_t *arch);
+int nm_mach_has_cap(const char *arch, uint32_t cap);
+int nm_mach_has_device(const char *arch, const char *dev);
 
 #endif /* NM_MACHINE_H_ */
 /* vim:set ts=4 sw=4: */
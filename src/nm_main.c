@@ -1,21 +1,52 @@
 #include <nm_core.h>
 #include <nm_menu.h>
+#include <nm_utils.h>
 #include <nm_database.h>
 #include <nm_cfg_file.h>
+#include <nm_mon_api.h>
 #include <nm_main_loop.h>
 #include <nm_mon_daemon.h>
 #include <nm_vm_control.h>
+#include <nm_stat_usage.h>
 #include <nm_qmp_control.h>
 #include <nm_lan_settings.h>
 
+#include <time.h> /* nanosleep(2) */
+#include <fnmatch.h>
+
 #if defined (NM_OS_LINUX)
-    static const char NM_OPT_ARGS[] = "cs:p:f:z:k:vhld";
+    static const char NM_OPT_ARGS[] = "cs:p:f:z:k:t:j:vhld";
 #else
-    static const char NM_OPT_ARGS[] = "s:p:f:z:k:vhld";
+    static const char NM_OPT_ARGS[] = "s:p:f:z:k:t:j:vhld";
 #endif
 
+/* name argument of -s, -p, -f, -z, -k, -t that selects all VMs */
+static const char NM_CLI_ALL[] = "--all";
+
+typedef struct {
+    int opt;
+    const char *method; /* nemu-monitor API method */
+    int (*exec)(const nm_str_t *name);
+    int (*send)(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx); /* QMP */
+} nm_cli_action_t;
+
+static int nm_cli_kill(const nm_str_t *name);
+static void nm_cli_done(const nm_str_t *name, int rc, void *ctx);
+
+static const nm_cli_action_t nm_cli_actions[] = {
+    { 's', "vm.start",     NULL,        NULL },
+    { 'p', "vm.powerdown", NULL,        nm_qmp_vm_shut_async },
+    { 'f', "vm.stop",      NULL,        nm_qmp_vm_stop_async },
+    { 'z', "vm.reset",     NULL,        nm_qmp_vm_reset_async },
+    { 'k', "vm.kill",      nm_cli_kill, NULL },
+};
+
 static void signals_handler(int signal);
 static void nm_process_args(int argc, char **argv);
+static void __attribute__((noreturn)) nm_cli_exec(const nm_cli_action_t *act,
+        const nm_vect_t *args, size_t jobs);
+static void __attribute__((noreturn)) nm_cli_stat(const nm_vect_t *args);
+static int nm_cli_select(const nm_vect_t *args, nm_vect_t *names);
 static void nm_print_feset(void);
 
 volatile sig_atomic_t redraw_window = 0;
@@ -66,8 +97,11 @@ static void nm_process_args(int argc, char **argv)
 {
     int opt;
     const char *optstr = NM_OPT_ARGS;
-    nm_str_t vmname = NM_INIT_STR;
     nm_vect_t vm_list = NM_INIT_VECT;
+    nm_vect_t args = NM_INIT_VECT;
+    const nm_cli_action_t *act = NULL;
+    int stat = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
 
     static const struct option longopts[] = {
 #if defined (NM_OS_LINUX)
@@ -78,6 +112,8 @@ static void nm_process_args(int argc, char **argv)
         { "force-stop",  required_argument, NULL, 'f' },
         { "reset",       required_argument, NULL, 'z' },
         { "kill",        required_argument, NULL, 'k' },
+        { "stat",        required_argument, NULL, 't' },
+        { "jobs",        required_argument, NULL, 'j' },
         { "list",        no_argument,       NULL, 'l' },
         { "daemon",      no_argument,       NULL, 'd' },
         { "version",     no_argument,       NULL, 'v' },
@@ -95,35 +131,31 @@ static void nm_process_args(int argc, char **argv)
             nm_exit_core();
 #endif
         case 's':
-            nm_init_core();
-            nm_str_alloc_text(&vmname, optarg);
-            nm_vmctl_start(&vmname, 0);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'p':
-            nm_init_core();
-            nm_str_alloc_text(&vmname, optarg);
-            nm_qmp_vm_shut(&vmname);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'f':
-            nm_init_core();
-            nm_str_alloc_text(&vmname, optarg);
-            nm_qmp_vm_stop(&vmname);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'z':
-            nm_init_core();
-            nm_str_alloc_text(&vmname, optarg);
-            nm_qmp_vm_reset(&vmname);
-            nm_str_free(&vmname);
-            nm_exit_core();
         case 'k':
-            nm_init_core();
-            nm_str_alloc_text(&vmname, optarg);
-            nm_vmctl_kill(&vmname);
-            nm_str_free(&vmname);
-            nm_exit_core();
+            for (size_t n = 0; n < nm_arr_len(nm_cli_actions); n++)
+            {
+                if (nm_cli_actions[n].opt != opt)
+                    continue;
+
+                if (act && act != &nm_cli_actions[n])
+                {
+                    fprintf(stderr, "%s\n", _("only one action is allowed"));
+                    exit(NM_ERR);
+                }
+                act = &nm_cli_actions[n];
+            }
+            nm_vect_insert_cstr(&args, optarg);
+            break;
+        case 't':
+            stat = 1;
+            nm_vect_insert_cstr(&args, optarg);
+            break;
+        case 'j':
+            jobs = nm_str_ttoul(optarg, 10);
+            break;
         case 'd':
             nm_mon_loop();
             nm_cfg_free();
@@ -145,6 +177,10 @@ static void nm_process_args(int argc, char **argv)
             printf("%s\n", _("-f, --force-stop <name> shutdown vm"));
             printf("%s\n", _("-z, --reset      <name> reset vm"));
             printf("%s\n", _("-k, --kill       <name> kill vm process"));
+            printf("%s\n", _("-t, --stat       <name> show vm resource usage"));
+            printf("%s\n", _("                        <name> can be followed by more names,"));
+            printf("%s\n", _("                        glob patterns or --all for all vms"));
+            printf("%s\n", _("-j, --jobs       <num>  vms started at once"));
             printf("%s\n", _("-l, --list              list vms"));
             printf("%s\n", _("-d, --daemon            vm monitoring daemon"));
 #if defined (NM_OS_LINUX)
@@ -157,6 +193,206 @@ static void nm_process_args(int argc, char **argv)
             exit(NM_ERR);
         }
     }
+
+    if (act && stat)
+    {
+        fprintf(stderr, "%s\n", _("only one action is allowed"));
+        exit(NM_ERR);
+    }
+
+    if (stat || act)
+    {
+        /* more VM names after options: nemu -s vm1 vm2 'web-*' */
+        for (int n = optind; n < argc; n++)
+            nm_vect_insert_cstr(&args, argv[n]);
+
+        if (stat)
+            nm_cli_stat(&args);
+
+        nm_cli_exec(act, &args, (jobs > 0) ? (size_t) jobs : 1);
+    }
+}
+
+/* Run action for all selected VMs and exit.
+ * Commands are sent to nemu-monitor if it is running, all of them
+ * over one connection, so daemon runs them in parallel: up to jobs
+ * VMs are started at once, other commands are sent for all VMs.
+ * Otherwise they are executed here with one database handle
+ * and one QMP session pool. Start is done by nm_vmctl_start_list(),
+ * which waits for QEMU of up to jobs VMs at once. QMP commands are
+ * sent to all VMs first, then replies are collected. */
+static void nm_cli_exec(const nm_cli_action_t *act,
+                        const nm_vect_t *args, size_t jobs)
+{
+    nm_vect_t names = NM_INIT_VECT;
+    nm_str_t *errs;
+    int *results;
+    int rc;
+
+    nm_init_core();
+
+    rc = nm_cli_select(args, &names);
+    results = nm_calloc(names.n_memb ? names.n_memb : 1, sizeof(int));
+    errs = nm_calloc(names.n_memb ? names.n_memb : 1, sizeof(nm_str_t));
+
+    if (names.n_memb && nm_api_call(act->method, &names,
+                (act->exec == NULL && act->send == NULL) ? jobs : names.n_memb,
+                results, errs) == NM_API_NOCONN)
+    {
+        if (act->send != NULL)
+        {
+            for (size_t n = 0; n < names.n_memb; n++)
+            {
+                results[n] = act->send(nm_vect_str(&names, n),
+                        nm_cli_done, &results[n]);
+            }
+
+            while (nm_qmp_poll(-1))
+                ;
+        }
+        else if (act->exec == NULL)
+            nm_vmctl_start_list(&names, jobs, results);
+        else
+        {
+            for (size_t n = 0; n < names.n_memb; n++)
+                results[n] = act->exec(nm_vect_str(&names, n));
+        }
+    }
+
+    for (size_t n = 0; n < names.n_memb; n++)
+    {
+        if (results[n] != NM_OK)
+        {
+            /* daemon tells the reason, local errors are already printed */
+            fprintf(stderr, "%s: %s\n", nm_vect_str(&names, n)->data,
+                    errs[n].len ? errs[n].data : _("failed"));
+            rc = NM_ERR;
+        }
+        else if (names.n_memb > 1)
+            printf("%s: %s\n", nm_vect_str(&names, n)->data, _("done"));
+    }
+
+    for (size_t n = 0; n < names.n_memb; n++)
+        nm_str_free(&errs[n]);
+
+    nm_qmp_pool_free();
+    nm_vect_free(&names, nm_str_vect_free_cb);
+    free(results);
+    free(errs);
+    nm_db_close();
+    nm_cfg_free();
+    exit((rc == NM_OK) ? NM_OK : EXIT_FAILURE);
+}
+
+/* Print resource usage of selected running VMs and exit.
+ * Usage is measured over one sampling interval. */
+static void nm_cli_stat(const nm_vect_t *args)
+{
+    nm_vect_t names = NM_INIT_VECT;
+    struct timespec ts;
+    int rc;
+
+    nm_init_core();
+
+    rc = nm_cli_select(args, &names);
+
+    ts.tv_sec = NM_STAT_INTERVAL / 1000;
+    ts.tv_nsec = (NM_STAT_INTERVAL % 1000) * 1e+6;
+
+    nm_stat_update(&names);
+    nanosleep(&ts, NULL);
+    nm_stat_update(&names);
+
+    printf("%-20s %8s %7s %10s %10s %12s %12s\n", _("NAME"), _("PID"),
+            _("CPU%"), _("RSS(MiB)"), _("PSS(MiB)"),
+            _("READ(KiB/s)"), _("WRITE(KiB/s)"));
+
+    for (size_t n = 0; n < names.n_memb; n++)
+    {
+        const nm_str_t *name = nm_vect_str(&names, n);
+        nm_stat_t st;
+
+        if (nm_stat_get(name, &st) != NM_OK)
+        {
+            fprintf(stderr, "%s: %s\n", name->data, _("not running"));
+            continue;
+        }
+
+        printf("%-20s %8d %7.1f %10" PRIu64 " %10" PRIu64
+                " %12" PRIu64 " %12" PRIu64 "\n",
+                name->data, st.pid, st.cpu, st.rss / 1024, st.pss / 1024,
+                st.rd_rate / 1024, st.wr_rate / 1024);
+    }
+
+    nm_stat_free();
+    nm_vect_free(&names, nm_str_vect_free_cb);
+    nm_db_close();
+    nm_cfg_free();
+    exit((rc == NM_OK) ? NM_OK : EXIT_FAILURE);
+}
+
+/* Names, glob patterns and --all are resolved to list of VMs,
+ * each VM is taken once. Unknown names are reported. */
+static int nm_cli_select(const nm_vect_t *args, nm_vect_t *names)
+{
+    nm_vect_t vm_list = NM_INIT_VECT;
+    int rc = NM_OK;
+
+    nm_db_select(NM_GET_VMS_SQL, &vm_list);
+
+    for (size_t n = 0; n < args->n_memb; n++)
+    {
+        const char *arg = nm_vect_at(args, n);
+        int all = (nm_str_cmp_tt(arg, NM_CLI_ALL) == NM_OK);
+        int found = 0;
+
+        for (size_t m = 0; m < vm_list.n_memb; m++)
+        {
+            const nm_str_t *vm = nm_vect_str(&vm_list, m);
+            int added = 0;
+
+            if (!all && fnmatch(arg, vm->data, 0) != 0)
+                continue;
+
+            found = 1;
+            for (size_t k = 0; k < names->n_memb; k++)
+            {
+                if (nm_str_cmp_ss(nm_vect_str(names, k), vm) == NM_OK)
+                {
+                    added = 1;
+                    break;
+                }
+            }
+
+            if (!added)
+                nm_vect_insert(names, vm, sizeof(nm_str_t), nm_str_vect_ins_cb);
+        }
+
+        if (!found && !all)
+        {
+            fprintf(stderr, "%s: %s\n", arg, _("no such vm"));
+            rc = NM_ERR;
+        }
+    }
+
+    nm_vect_free(&vm_list, nm_str_vect_free_cb);
+
+    return rc;
+}
+
+/* Returns NM_ERR if nemu-monitor is not running */
+static int nm_cli_kill(const nm_str_t *name)
+{
+    nm_vmctl_kill(name);
+
+    return NM_OK;
+}
+
+static void nm_cli_done(const nm_str_t *name, int rc, void *ctx)
+{
+    (void) name;
+
+    *(int *) ctx = rc;
 }
 
 static void nm_print_feset(void)
@@ -5,6 +5,7 @@
 #include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_window.h>
+#include <nm_arena.h>
 #include <nm_add_vm.h>
 #include <nm_machine.h>
 #include <nm_edit_vm.h>
@@ -14,9 +15,14 @@
 #include <nm_edit_net.h>
 #include <nm_9p_share.h>
 #include <nm_usb_plug.h>
+#include <nm_usb_devices.h>
+#include <nm_network.h>
 #include <nm_add_drive.h>
 #include <nm_edit_boot.h>
 #include <nm_ovf_import.h>
+#include <nm_vm_model.h>
+#include <nm_vm_status.h>
+#include <nm_stat_usage.h>
 #include <nm_vm_control.h>
 #include <nm_mon_daemon.h>
 #include <nm_vm_snapshot.h>
@@ -25,17 +31,20 @@
 
 static const char NM_SEARCH_STR[] = "Search:";
 
+/* time to wait on exit for replies of QEMU commands, e.g. savevm */
+enum {NM_QUIT_QMP_WAIT = 60000};
+
 static size_t nm_search_vm(const nm_vect_t *list, int *err);
+static int nm_vm_list_changed(const nm_vect_t *list);
 static int nm_search_cmp_cb(const void *s1, const void *s2);
 
 void nm_start_main_loop(void)
 {
-    int ch, nemu = 0, regen_data = 1;
+    int ch = ERR, nemu = 0, regen_data = 1;
     int clear_action = 1;
     size_t vm_list_len, old_hl = 0;
     nm_menu_data_t vms = NM_INIT_MENU_DATA;
-    nm_vmctl_data_t vm_props = NM_VMCTL_INIT_DATA;
-    nm_vect_t vms_v = NM_INIT_VECT;
+    nm_arr_t vms_v = NM_INIT_ARR(nm_menu_item_t);
     nm_vect_t vm_list = NM_INIT_VECT;
     const nm_cfg_t *cfg = nm_cfg_get();
 
@@ -57,11 +66,30 @@ void nm_start_main_loop(void)
 
     for (;;)
     {
+        /* drawing data of previous iteration is not used anymore */
+        nm_arena_reset(nm_arena_frame());
+
+        /* Own edits are seen at once, other processes (nemu-monitor, CLI)
+         * are checked with PRAGMA data_version only when no key was pressed */
+        if (nm_vm_model_update(ch == ERR) && !regen_data &&
+            nm_vm_list_changed(&vm_list))
+        {
+            regen_data = 1;
+            old_hl = vms.highlight;
+            clear_action = 1;
+        }
+
         if (regen_data)
         {
             nm_vect_free(&vm_list, nm_str_vect_free_cb);
-            nm_vect_free(&vms_v, NULL);
-            nm_db_select(NM_GET_VMS_SQL, &vm_list);
+            nm_arr_free(&vms_v, NULL);
+            for (size_t n = 0; n < nm_vm_model_count(); n++)
+            {
+                nm_str_t vm = nm_str_view(
+                        nm_db_vm(&nm_vm_model_at(n)->main, 0)->name);
+
+                nm_vect_insert(&vm_list, &vm, sizeof(vm), nm_str_vect_ins_cb);
+            }
             vm_list_len = (getmaxy(side_window) - 4);
 
             vms.highlight = 1;
@@ -80,14 +108,16 @@ void nm_start_main_loop(void)
             else
                 vms.item_last = vm_list_len = vm_list.n_memb;
 
+            nm_arr_reserve(&vms_v, vm_list.n_memb);
             for (size_t n = 0; n < vm_list.n_memb; n++)
             {
                 nm_menu_item_t vm = NM_INIT_MENU_ITEM;
-                vm.name = (nm_str_t *) nm_vect_at(&vm_list, n);
-                nm_vect_insert(&vms_v, &vm, sizeof(vm), NULL);
+                vm.name = nm_str_view(nm_vect_str_ctx(&vm_list, n));
+                nm_arr_push(&vms_v, &vm);
             }
 
             vms.v = &vms_v;
+            nm_vm_status_init(&vm_list);
 
             regen_data = 0;
         }
@@ -96,18 +126,18 @@ void nm_start_main_loop(void)
         {
             const nm_str_t *name = nm_vect_item_name_cur(&vms);
             int status = nm_vect_item_status_cur(&vms);
+            const nm_vmctl_data_t *vm_props = nm_vm_model_get(name);
 
             if (clear_action)
             {
-                nm_vmctl_free_data(&vm_props);
-                nm_vmctl_get_data(name, &vm_props);
                 werase(action_window);
                 nm_init_action(NULL);
                 clear_action = 0;
             }
 
             nm_print_vm_menu(&vms);
-            nm_print_vm_info(name, &vm_props, status);
+            if (vm_props)
+                nm_print_vm_info(name, vm_props, status);
             wrefresh(side_window);
             wrefresh(action_window);
         }
@@ -122,6 +152,10 @@ void nm_start_main_loop(void)
         }
 
         ch = wgetch(side_window);
+        nm_qmp_poll(0);
+        nm_qmp_pool_expire();
+        nm_vm_status_update();
+        nm_stat_update(&vm_list);
 
         /* Clear action window only if key pressed.
          * Otherwise text will be flicker in tty. */
@@ -135,9 +169,32 @@ void nm_start_main_loop(void)
         {
             nm_destroy_windows();
             nm_curses_deinit();
+
+            /* snapshot callbacks write results to database */
+            if (nm_qmp_pending())
+            {
+                size_t left;
+
+                printf("%s\n", _("Waiting for QEMU commands to complete..."));
+                if ((left = nm_qmp_drain(NM_QUIT_QMP_WAIT)) != 0)
+                {
+                    fprintf(stderr, _("%zu QEMU commands are not completed, "
+                                "their results are not saved\n"), left);
+                }
+            }
+
+            nm_qmp_pool_free();
+            nm_vm_status_free();
+            nm_stat_free();
+            nm_vm_model_free();
+            nm_arena_free(nm_arena_frame());
             nm_db_close();
             nm_cfg_free();
             nm_mach_free();
+            nm_usb_free();
+#if defined (NM_OS_LINUX)
+            nm_net_free();
+#endif
             break;
         }
 
@@ -167,27 +224,27 @@ void nm_start_main_loop(void)
 
             case NM_KEY_P:
                 if (vm_status)
-                    nm_qmp_vm_shut(name);
+                    nm_qmp_vm_shut_async(name, NULL, NULL);
                 break;
 
             case NM_KEY_F:
                 if (vm_status)
-                    nm_qmp_vm_stop(name);
+                    nm_qmp_vm_stop_async(name, NULL, NULL);
                 break;
 
             case NM_KEY_Z:
                 if (vm_status)
-                    nm_qmp_vm_reset(name);
+                    nm_qmp_vm_reset_async(name, NULL, NULL);
                 break;
 
             case NM_KEY_P_UP:
                 if (vm_status)
-                    nm_qmp_vm_pause(name);
+                    nm_qmp_vm_pause_async(name, NULL, NULL);
                 break;
 
             case NM_KEY_R_UP:
                 if (vm_status)
-                    nm_qmp_vm_resume(name);
+                    nm_qmp_vm_resume_async(name, NULL, NULL);
                 break;
 
             case NM_KEY_K:
@@ -432,11 +489,29 @@ void nm_start_main_loop(void)
         }
     }
 
-    nm_vmctl_free_data(&vm_props);
-    nm_vect_free(&vms_v, NULL);
+    nm_vm_status_free();
+    nm_stat_free();
+    nm_vm_model_free();
+    nm_arena_free(nm_arena_frame());
+    nm_arr_free(&vms_v, NULL);
     nm_vect_free(&vm_list, nm_str_vect_free_cb);
 }
 
+static int nm_vm_list_changed(const nm_vect_t *list)
+{
+    if (list->n_memb != nm_vm_model_count())
+        return 1;
+
+    for (size_t n = 0; n < list->n_memb; n++)
+    {
+        if (nm_str_cmp_st(nm_vect_str(list, n),
+                    nm_db_vm(&nm_vm_model_at(n)->main, 0)->name) != NM_OK)
+            return 1;
+    }
+
+    return 0;
+}
+
 static size_t nm_search_vm(const nm_vect_t *list, int *err)
 {
     size_t pos = 0;
@@ -1,19 +1,23 @@
 #include <nm_core.h>
 #include <nm_menu.h>
 #include <nm_dbus.h>
+#include <nm_arena.h>
 #include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_window.h>
 #include <nm_network.h>
 #include <nm_cfg_file.h>
-#include <nm_stat_usage.h>
-#include <nm_qmp_control.h>
+#include <nm_vm_status.h>
 #include <nm_lan_settings.h>
 
+static nm_str_t nm_menu_line(nm_arena_t *arena, const char *name,
+                             size_t screen_x);
+
 void nm_print_base_menu(nm_menu_data_t *ifs)
 {
     int x = 2, y = 3;
     size_t screen_x;
+    nm_str_t if_name = NM_INIT_STR;
 
     wattroff(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
 
@@ -27,13 +31,12 @@ void nm_print_base_menu(nm_menu_data_t *ifs)
 
     for (size_t n = ifs->item_first, i = 0; n < ifs->item_last; n++, i++)
     {
-        nm_str_t if_name = NM_INIT_STR;
         int space_num;
 
         if (n >= ifs->v->n_memb)
             nm_bug(_("%s: invalid index: %zu"), __func__, n);
 
-        nm_str_alloc_text(&if_name, (char *) ifs->v->data[n]);
+        nm_str_alloc_text(&if_name, nm_vect_item_name_ctx(ifs->v, n));
         nm_align2line(&if_name, screen_x);
 
         space_num = (screen_x - if_name.len - 4);
@@ -56,14 +59,16 @@ void nm_print_base_menu(nm_menu_data_t *ifs)
 
         y++;
         wrefresh(side_window);
-        nm_str_free(&if_name);
     }
+
+    nm_str_free(&if_name);
 }
 
 void nm_print_vm_menu(nm_menu_data_t *vm)
 {
     int x = 2, y = 3;
     size_t screen_x;
+    nm_arena_t *arena = nm_arena_frame();
 
     screen_x = getmaxx(side_window);
     if (screen_x < 20) /* window to small */
@@ -77,23 +82,14 @@ void nm_print_vm_menu(nm_menu_data_t *vm)
 
     for (size_t n = vm->item_first, i = 0; n < vm->item_last; n++, i++)
     {
-        int space_num;
-        nm_str_t vm_name = NM_INIT_STR;
+        nm_str_t vm_name;
 
         if (n >= vm->v->n_memb)
             nm_bug(_("%s: invalid index: %zu"), __func__, n);
 
-        nm_str_alloc_text(&vm_name, nm_vect_item_name_ctx(vm->v, n));
-        nm_align2line(&vm_name, screen_x);
-
-        space_num = (screen_x - vm_name.len - 4);
-        if (space_num > 0)
-        {
-            for (int n = 0; n < space_num; n++)
-                nm_str_add_char_opt(&vm_name, ' ');
-        }
+        vm_name = nm_menu_line(arena, nm_vect_item_name_ctx(vm->v, n), screen_x);
 
-        if (nm_qmp_test_socket(nm_vect_item_name(vm->v, n)) == NM_OK)
+        if (nm_vm_status_get(nm_vect_item_name(vm->v, n)))
         {
             nm_vect_set_item_status(vm->v, n, 1);
             wattron(side_window, COLOR_PAIR(NM_COLOR_HIGHLIGHT));
@@ -117,7 +113,6 @@ void nm_print_vm_menu(nm_menu_data_t *vm)
 
         y++;
         wrefresh(side_window);
-        nm_str_free(&vm_name);
     }
 }
 
@@ -183,8 +178,17 @@ void nm_menu_scroll(nm_menu_data_t *menu, size_t list_len, int ch)
         menu->item_last = menu->v->n_memb;
     }
 
-    if (ch == KEY_UP || ch == KEY_DOWN || ch == KEY_HOME || ch == KEY_END)
-        NM_STAT_CLEAN();
+}
+
+/* Menu line: name is cut with "..." or padded with spaces to line width,
+ * same as nm_align2line() with padding */
+static nm_str_t nm_menu_line(nm_arena_t *arena, const char *name,
+                             size_t screen_x)
+{
+    if (strlen(name) > (screen_x - 4))
+        return nm_arena_format(arena, "%.*s...", (int) (screen_x - 7), name);
+
+    return nm_arena_format(arena, "%-*s", (int) (screen_x - 4), name);
 }
 
 #if defined (NM_OS_LINUX)
@@ -6,7 +6,7 @@
 #include <nm_ncurses.h>
 
 typedef struct {
-    nm_vect_t *v;
+    nm_arr_t *v; /* nm_menu_item_t */
     size_t item_first;
     size_t item_last;
     uint32_t highlight;
@@ -14,27 +14,31 @@ typedef struct {
 
 #define NM_INIT_MENU_DATA (nm_menu_data_t) { NULL, 0, 0, 0 }
 
+/* name is not owned by item, see nm_str_view() */
 typedef struct {
-    const nm_str_t *name;
+    nm_str_t name;
     uint32_t status:1;
 } nm_menu_item_t;
 
-#define NM_INIT_MENU_ITEM (nm_menu_item_t) { NULL, 0 }
+#define NM_INIT_MENU_ITEM (nm_menu_item_t) { NM_INIT_STR, 0 }
+
+/* items kept on stack by short lists (drives, interfaces) */
+enum {NM_MENU_STACK_ITEMS = 16};
 
 void nm_print_base_menu(nm_menu_data_t *ifs);
 void nm_print_vm_menu(nm_menu_data_t *vm);
 void nm_print_veth_menu(nm_menu_data_t *veth, int get_status);
 void nm_menu_scroll(nm_menu_data_t *menu, size_t list_len, int ch);
 
-static inline nm_menu_item_t *nm_vect_item(const nm_vect_t *v, const size_t index)
+static inline nm_menu_item_t *nm_vect_item(const nm_arr_t *v, const size_t index)
 {
-    return (nm_menu_item_t *)nm_vect_at(v, index);
+    return (nm_menu_item_t *)nm_arr_at(v, index);
 }
-static inline nm_str_t *nm_vect_item_name(const nm_vect_t *v, const size_t index)
+static inline nm_str_t *nm_vect_item_name(const nm_arr_t *v, const size_t index)
 {
-    return (nm_str_t*)nm_vect_item(v, index)->name;
+    return &nm_vect_item(v, index)->name;
 }
-static inline char *nm_vect_item_name_ctx(const nm_vect_t *v, const size_t index)
+static inline char *nm_vect_item_name_ctx(const nm_arr_t *v, const size_t index)
 {
     return nm_vect_item_name(v, index)->data;
 }
@@ -42,7 +46,7 @@ static inline nm_str_t *nm_vect_item_name_cur(const nm_menu_data_t *p)
 {
     return nm_vect_item_name(p->v, (p->item_first + p->highlight) - 1);
 }
-static inline int nm_vect_item_status(const nm_vect_t *v, const size_t index)
+static inline int nm_vect_item_status(const nm_arr_t *v, const size_t index)
 {
     return nm_vect_item(v, index)->status;
 }
@@ -50,7 +54,7 @@ static inline int nm_vect_item_status_cur(const nm_menu_data_t *p)
 {
     return nm_vect_item_status(p->v, (p->item_first + p->highlight) - 1);
 }
-static inline void nm_vect_set_item_status(nm_vect_t *v, const size_t index, const int s)
+static inline void nm_vect_set_item_status(nm_arr_t *v, const size_t index, const int s)
 {
     nm_vect_item(v, index)->status = s;
 }
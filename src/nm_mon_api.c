@@ -0,0 +1,996 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_window.h>
+#include <nm_mon_api.h>
+#include <nm_cfg_file.h>
+#include <nm_mon_daemon.h>
+#include <nm_vm_control.h>
+#include <nm_stat_usage.h>
+#include <nm_qmp_control.h>
+#include <nm_json.h>
+
+#include <poll.h>
+#include <time.h> /* clock_gettime(2) */
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/*
+ * JSON-RPC 2.0 over unix socket, one message per line:
+ *
+ *  -> {"jsonrpc":"2.0","id":1,"method":"vm.start","params":{"name":"vm1"}}
+ *  <- {"jsonrpc":"2.0","id":1,"result":true}
+ *
+ * After "events.subscribe" client also receives notifications:
+ *
+ *  <- {"jsonrpc":"2.0","method":"vm.event",
+ *      "params":{"name":"vm1","event":"started"}}
+ *
+ * VM start and QMP commands are not waited for: reply is sent when
+ * they complete, so several requests can be in flight and replies
+ * may come in other order. Requests are matched by id.
+ */
+
+enum {
+    NM_API_MAX_CLIENTS = 64,
+    NM_API_MAX_REQUEST = 64 * 1024,
+    NM_API_READLEN = 4096,
+    NM_API_SEND_TIMEOUT = 1000, /* ms */
+    NM_API_STAT_KEEP = 30       /* s of sampling after last vm.stat */
+};
+
+enum {
+    NM_API_E_PARSE   = -32700,
+    NM_API_E_REQUEST = -32600,
+    NM_API_E_METHOD  = -32601,
+    NM_API_E_PARAMS  = -32602,
+    NM_API_E_FAILED  = -32000
+};
+
+typedef struct {
+    int fd;
+    int subscribed;
+    uint64_t gen; /* slot is reused by next client */
+    nm_str_t buf;
+} nm_api_client_t;
+
+typedef struct nm_api_method nm_api_method_t;
+
+/* Request which is replied when operation completes */
+typedef struct {
+    int slot;
+    uint64_t gen;
+    nm_str_t id;
+    const nm_api_method_t *m;
+    nm_str_t name;       /* VM of vm.start */
+    nm_vmctl_job_t *job;
+    int polled;          /* exit of QEMU is watched by epoll */
+} nm_api_defer_t;
+
+/* Returns NM_OK if operation is done or, for async method, started */
+typedef int (*nm_api_vm_op_t)(const nm_str_t *name, const nm_json_t *params,
+                              nm_api_defer_t *dfr);
+typedef int (*nm_api_snap_op_t)(const nm_str_t *name, const nm_str_t *snap,
+                                nm_qmp_cb_t cb, void *ctx);
+
+struct nm_api_method {
+    const char *method;
+    nm_api_vm_op_t op;
+    int8_t state; /* required VM state, -1 - any */
+    int rebuild;  /* VM list is changed */
+    int async;    /* reply is sent by nm_api_finish() */
+};
+
+/* Parsed request is handled in parser callback */
+typedef struct {
+    nm_api_client_t *cl;
+    const nm_vect_t *mon_list;
+    int *rebuild;
+    int done;
+} nm_api_req_ctx_t;
+
+/* Answers of nemu-monitor read by nm_api_call(), request id is
+ * index of VM in the list */
+typedef struct {
+    size_t count;
+    size_t replied;
+    int *results;
+    nm_str_t *errs;
+    uint8_t *done;
+} nm_api_ans_ctx_t;
+
+static int nm_api_vm_start(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr);
+static int nm_api_vm_shut(const nm_str_t *name, const nm_json_t *params,
+                          nm_api_defer_t *dfr);
+static int nm_api_vm_stop(const nm_str_t *name, const nm_json_t *params,
+                          nm_api_defer_t *dfr);
+static int nm_api_vm_reset(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr);
+static int nm_api_vm_pause(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr);
+static int nm_api_vm_resume(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr);
+static int nm_api_vm_kill(const nm_str_t *name, const nm_json_t *params,
+                          nm_api_defer_t *dfr);
+static int nm_api_vm_delete(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr);
+static int nm_api_vm_savevm(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr);
+static int nm_api_vm_loadvm(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr);
+static int nm_api_vm_delvm(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr);
+static int nm_api_vm_snap(const nm_str_t *name, const nm_json_t *params,
+                          nm_api_snap_op_t op, nm_api_defer_t *dfr);
+
+static const nm_api_method_t nm_api_methods[] = {
+    { "vm.start",     nm_api_vm_start,  0, 0, 1 },
+    { "vm.powerdown", nm_api_vm_shut,   1, 0, 1 },
+    { "vm.stop",      nm_api_vm_stop,   1, 0, 1 },
+    { "vm.reset",     nm_api_vm_reset,  1, 0, 1 },
+    { "vm.pause",     nm_api_vm_pause,  1, 0, 1 },
+    { "vm.resume",    nm_api_vm_resume, 1, 0, 1 },
+    { "vm.kill",      nm_api_vm_kill,   1, 0, 0 },
+    { "vm.delete",    nm_api_vm_delete, 0, 1, 0 },
+    { "vm.savevm",    nm_api_vm_savevm, 1, 0, 1 },
+    { "vm.loadvm",    nm_api_vm_loadvm, -1, 0, 1 },
+    { "vm.delvm",     nm_api_vm_delvm,  -1, 0, 1 }
+};
+
+static nm_api_client_t nm_api_clients[NM_API_MAX_CLIENTS];
+static int nm_api_lfd = -1;
+static int nm_api_efd = -1;
+static uint64_t nm_api_job_tag;
+static uint64_t nm_api_gen;
+static nm_arr_t nm_api_starts = { 0, 0, sizeof(nm_api_defer_t *), NULL, NULL };
+static nm_json_parser_t nm_api_json; /* zeroed is initial state */
+static time_t nm_api_stat_time = -1;
+
+static void nm_api_request_cb(const nm_json_t *req, void *ctx);
+static void nm_api_handle(nm_api_client_t *cl, const nm_json_t *req,
+                          const nm_vect_t *mon_list, int *rebuild);
+static const nm_mon_item_t *nm_api_find_vm(const nm_vect_t *mon_list,
+                                           const nm_str_t *name);
+static int nm_api_starting(const nm_str_t *name);
+static time_t nm_api_now(void);
+static void nm_api_qmp_done(const nm_str_t *name, int rc, void *ctx);
+static void nm_api_stop_done(const nm_str_t *name, int rc, void *ctx);
+static void nm_api_warn_drop(void);
+static void nm_api_finish(nm_api_defer_t *dfr, int rc, const char *err);
+static void nm_api_reply(nm_api_client_t *cl, const nm_str_t *id,
+                         const char *result);
+static void nm_api_error(nm_api_client_t *cl, const nm_str_t *id,
+                         int code, const char *msg);
+static int nm_api_send(nm_api_client_t *cl, nm_str_t *msg);
+static void nm_api_drop(nm_api_client_t *cl);
+static int nm_api_connect(void);
+static int nm_api_send_call(int sd, const char *method, const char *name,
+                            size_t id);
+static void nm_api_answer_cb(const nm_json_t *ans, void *ctx);
+static void nm_api_json_id(nm_str_t *out, const nm_json_t *id);
+static void nm_api_json_str(nm_str_t *out, const char *str);
+static const char *nm_api_state(int8_t state);
+
+int nm_api_listen(int efd, uint64_t job_tag)
+{
+    struct sockaddr_un addr;
+    const nm_str_t *path = &nm_cfg_get()->daemon_sock;
+    int sd;
+
+    nm_api_efd = efd;
+    nm_api_job_tag = job_tag;
+
+    for (size_t n = 0; n < NM_API_MAX_CLIENTS; n++) {
+        nm_api_clients[n].fd = -1;
+        nm_api_clients[n].subscribed = 0;
+        nm_api_clients[n].buf = NM_INIT_STR;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (nm_strlcpy(addr.sun_path, path->data,
+                sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+        nm_debug("%s: socket path is too long: %s\n", __func__, path->data);
+        return -1;
+    }
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        nm_debug("%s: socket error: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    /* left by killed daemon, pid file guards from second instance */
+    unlink(path->data);
+
+    if (bind(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            chmod(path->data, S_IRUSR | S_IWUSR) == -1 ||
+            listen(sd, SOMAXCONN) == -1) {
+        nm_debug("%s: cannot listen on %s: %s\n",
+                __func__, path->data, strerror(errno));
+        close(sd);
+        return -1;
+    }
+
+    nm_api_lfd = sd;
+
+    return sd;
+}
+
+int nm_api_accept(int lfd)
+{
+    int sd;
+
+    if ((sd = accept(lfd, NULL, NULL)) == -1)
+        return -1;
+
+    if (fcntl(sd, F_SETFL, O_NONBLOCK) == -1 ||
+            fcntl(sd, F_SETFD, FD_CLOEXEC) == -1) {
+        close(sd);
+        return -1;
+    }
+
+    for (int n = 0; n < NM_API_MAX_CLIENTS; n++) {
+        if (nm_api_clients[n].fd == -1) {
+            nm_api_clients[n].fd = sd;
+            nm_api_clients[n].subscribed = 0;
+            nm_api_clients[n].gen = ++nm_api_gen;
+            return n;
+        }
+    }
+
+    nm_debug("%s: too many clients\n", __func__);
+    close(sd);
+
+    return -1;
+}
+
+int nm_api_client_fd(int slot)
+{
+    return nm_api_clients[slot].fd;
+}
+
+int nm_api_read(int slot, const nm_vect_t *mon_list, int *rebuild)
+{
+    nm_api_client_t *cl = &nm_api_clients[slot];
+    char buf[NM_API_READLEN];
+    char *line, *end;
+    ssize_t nread;
+
+    if (cl->fd == -1)
+        return NM_ERR;
+
+    for (;;) {
+        nread = read(cl->fd, buf, sizeof(buf));
+        if (nread > 0) {
+            nm_str_add_text_part(&cl->buf, buf, nread);
+            if (cl->buf.len > NM_API_MAX_REQUEST) {
+                nm_api_drop(cl);
+                return NM_ERR;
+            }
+            continue;
+        }
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        nm_api_drop(cl);
+        return NM_ERR;
+    }
+
+    if (!cl->buf.len)
+        return NM_OK;
+
+    line = cl->buf.data;
+    while ((end = strchr(line, '\n')) != NULL) {
+        nm_api_req_ctx_t ctx = { cl, mon_list, rebuild, 0 };
+
+        *end = '\0';
+        if (*line != '\0' && *line != '\r') {
+            nm_debug("api: %s\n", line);
+            /* each line is one request, partial value is an error */
+            if (nm_json_feed(&nm_api_json, line, end - line,
+                        nm_api_request_cb, &ctx) != NM_OK || !ctx.done) {
+                nm_json_reset(&nm_api_json);
+                if (cl->fd != -1 && !ctx.done)
+                    nm_api_error(cl, NULL, NM_API_E_PARSE, "Parse error");
+            }
+        }
+        /* client can be dropped on send error */
+        if (cl->fd == -1)
+            return NM_ERR;
+        line = end + 1;
+    }
+
+    if (*line != '\0') {
+        nm_str_t rest = NM_INIT_STR;
+
+        nm_str_alloc_text(&rest, line);
+        nm_str_free(&cl->buf);
+        cl->buf = rest;
+    } else {
+        nm_str_free(&cl->buf);
+    }
+
+    return NM_OK;
+}
+
+void nm_api_notify(const char *name, const char *event)
+{
+    nm_str_t msg = NM_INIT_STR;
+
+    if (nm_api_lfd == -1)
+        return;
+
+    for (size_t n = 0; n < NM_API_MAX_CLIENTS; n++) {
+        nm_api_client_t *cl = &nm_api_clients[n];
+
+        if (cl->fd == -1 || !cl->subscribed)
+            continue;
+
+        if (!msg.len) {
+            nm_str_alloc_text(&msg,
+                    "{\"jsonrpc\":\"2.0\",\"method\":\"vm.event\","
+                    "\"params\":{\"name\":");
+            nm_api_json_str(&msg, name);
+            nm_str_add_text(&msg, ",\"event\":");
+            nm_api_json_str(&msg, event);
+            nm_str_add_text(&msg, "}}");
+        }
+
+        nm_api_send(cl, &msg);
+    }
+
+    nm_str_free(&msg);
+}
+
+void nm_api_jobs_check(void)
+{
+    nm_str_t err = NM_INIT_STR;
+    size_t n = 0;
+
+    while (n < nm_api_starts.n_memb) {
+        nm_api_defer_t *dfr = *(nm_api_defer_t **) nm_arr_at(&nm_api_starts, n);
+
+        if (!nm_spawn_done(nm_vmctl_job_spawn(dfr->job))) {
+            n++;
+            continue;
+        }
+
+        /* order does not matter, last job is moved here */
+        *(nm_api_defer_t **) nm_arr_at(&nm_api_starts, n) =
+            *(nm_api_defer_t **) nm_arr_at(&nm_api_starts,
+                    nm_api_starts.n_memb - 1);
+        nm_api_starts.n_memb--;
+
+        /* pidfd is closed here, it is removed from epoll set */
+        nm_api_warn_drop();
+        if (nm_vmctl_start_end(dfr->job) == NM_OK) {
+            nm_api_finish(dfr, NM_OK, NULL);
+        } else {
+            nm_warn_pop(&err);
+            nm_api_finish(dfr, NM_ERR, err.data);
+            nm_str_free(&err);
+        }
+    }
+}
+
+int nm_api_timeout(void)
+{
+    for (size_t n = 0; n < nm_api_starts.n_memb; n++) {
+        if (!(*(nm_api_defer_t **) nm_arr_at(&nm_api_starts, n))->polled)
+            return NM_SPAWN_TICK;
+    }
+
+    return -1;
+}
+
+int nm_api_stat_wanted(void)
+{
+    return nm_api_stat_time != -1 &&
+        nm_api_now() - nm_api_stat_time < NM_API_STAT_KEEP;
+}
+
+void nm_api_close(void)
+{
+    /* started QEMU is not left as zombie, taps are closed */
+    for (size_t n = 0; n < nm_api_starts.n_memb; n++) {
+        nm_api_defer_t *dfr = *(nm_api_defer_t **) nm_arr_at(&nm_api_starts, n);
+
+        nm_vmctl_start_end(dfr->job);
+        nm_str_free(&dfr->id);
+        nm_str_free(&dfr->name);
+        free(dfr);
+    }
+    nm_arr_free(&nm_api_starts, NULL);
+    nm_json_free(&nm_api_json);
+
+    if (nm_api_lfd == -1)
+        return;
+
+    for (size_t n = 0; n < NM_API_MAX_CLIENTS; n++)
+        nm_api_drop(&nm_api_clients[n]);
+
+    close(nm_api_lfd);
+    nm_api_lfd = -1;
+    unlink(nm_cfg_get()->daemon_sock.data);
+}
+
+/* Requests are pipelined on one connection, daemon completes them
+ * in parallel and replies in order of completion */
+int nm_api_call(const char *method, const nm_vect_t *names, size_t jobs,
+                int *results, nm_str_t *errs)
+{
+    nm_json_parser_t json = NM_INIT_JSON_PARSER;
+    nm_api_ans_ctx_t ans = { names->n_memb, 0, results, errs, NULL };
+    char buf[NM_API_READLEN];
+    size_t sent = 0;
+    ssize_t nread;
+    int sd;
+
+    if ((sd = nm_api_connect()) == -1)
+        return NM_API_NOCONN;
+
+    if (!jobs)
+        jobs = 1;
+
+    ans.done = nm_calloc(names->n_memb ? names->n_memb : 1, sizeof(uint8_t));
+
+    for (size_t n = 0; n < names->n_memb; n++) {
+        results[n] = NM_ERR;
+        nm_str_trunc(&errs[n], 0);
+    }
+
+    /* operation may take a long time (savevm), no timeout here */
+    while (ans.replied < names->n_memb) {
+        for (; sent < names->n_memb && sent - ans.replied < jobs; sent++) {
+            if (nm_api_send_call(sd, method,
+                        nm_vect_str(names, sent)->data, sent) != NM_OK)
+                goto out;
+        }
+
+        if ((nread = read(sd, buf, sizeof(buf))) <= 0)
+            break;
+        if (nm_json_feed(&json, buf, nread, nm_api_answer_cb, &ans) != NM_OK)
+            break;
+    }
+
+out:
+    for (size_t n = 0; n < names->n_memb; n++) {
+        if (ans.done[n])
+            continue;
+        nm_str_format(&errs[n], "%s", (n < sent) ?
+                _("bad answer from nemu-monitor") :
+                _("nemu-monitor is not reachable"));
+    }
+
+    close(sd);
+    free(ans.done);
+    nm_json_free(&json);
+
+    return NM_OK;
+}
+
+static void nm_api_request_cb(const nm_json_t *req, void *ctx)
+{
+    nm_api_req_ctx_t *rctx = ctx;
+
+    rctx->done++;
+
+    /* client can be dropped on send error */
+    if (rctx->cl->fd != -1)
+        nm_api_handle(rctx->cl, req, rctx->mon_list, rctx->rebuild);
+}
+
+static void nm_api_handle(nm_api_client_t *cl, const nm_json_t *req,
+                          const nm_vect_t *mon_list, int *rebuild)
+{
+    nm_str_t id = NM_INIT_STR;
+    nm_str_t name = NM_INIT_STR;
+    nm_str_t res = NM_INIT_STR;
+    nm_str_t err = NM_INIT_STR;
+    const nm_json_t *params = nm_json_get(req, "params");
+    const char *method = nm_json_str(nm_json_get(req, "method"));
+    const char *vm_name = nm_json_str(nm_json_get(params, "name"));
+    const nm_mon_item_t *vm;
+
+    nm_api_json_id(&id, nm_json_get(req, "id"));
+
+    if (method == NULL) {
+        nm_api_error(cl, &id, NM_API_E_REQUEST, "Invalid Request");
+        goto out;
+    }
+
+    if (nm_str_cmp_tt(method, "vm.list") == NM_OK) {
+        nm_str_add_char(&res, '[');
+        for (size_t n = 0; n < mon_list->n_memb; n++) {
+            vm = nm_vect_at(mon_list, n);
+            nm_str_append_format(&res, "%s{\"name\":", n ? "," : "");
+            nm_api_json_str(&res, vm->name->data);
+            nm_str_append_format(&res, ",\"status\":\"%s\"}",
+                    nm_api_state(vm->state));
+        }
+        nm_str_add_char(&res, ']');
+        nm_api_reply(cl, &id, res.data);
+        goto out;
+    }
+
+    if (nm_str_cmp_tt(method, "events.subscribe") == NM_OK) {
+        cl->subscribed = 1;
+        nm_api_reply(cl, &id, "true");
+        goto out;
+    }
+
+    if (vm_name == NULL) {
+        nm_api_error(cl, &id, NM_API_E_PARAMS, "Invalid params: name");
+        goto out;
+    }
+
+    nm_str_alloc_text(&name, vm_name);
+
+    if ((vm = nm_api_find_vm(mon_list, &name)) == NULL) {
+        nm_api_error(cl, &id, NM_API_E_PARAMS, "VM not found");
+        goto out;
+    }
+
+    if (nm_str_cmp_tt(method, "vm.status") == NM_OK) {
+        nm_str_add_text(&res, "{\"name\":");
+        nm_api_json_str(&res, vm->name->data);
+        nm_str_append_format(&res, ",\"status\":\"%s\"}",
+                nm_api_state(vm->state));
+        nm_api_reply(cl, &id, res.data);
+        goto out;
+    }
+
+    if (nm_str_cmp_tt(method, "vm.stat") == NM_OK) {
+        nm_stat_t st;
+
+        nm_api_stat_time = nm_api_now();
+
+        if (vm->state != 1) {
+            nm_api_error(cl, &id, NM_API_E_FAILED, "VM must be running");
+            goto out;
+        }
+        /* first sample gives no rates, it is ready one interval later */
+        if (nm_stat_get(&name, &st) != NM_OK) {
+            nm_api_error(cl, &id, NM_API_E_FAILED, "No statistics yet");
+            goto out;
+        }
+
+        nm_str_add_text(&res, "{\"name\":");
+        nm_api_json_str(&res, vm->name->data);
+        nm_str_append_format(&res, ",\"pid\":%d,\"cpu\":%.1f"
+                ",\"rss\":%" PRIu64 ",\"pss\":%" PRIu64
+                ",\"read_rate\":%" PRIu64 ",\"write_rate\":%" PRIu64 "}",
+                st.pid, st.cpu, st.rss, st.pss, st.rd_rate, st.wr_rate);
+        nm_api_reply(cl, &id, res.data);
+        goto out;
+    }
+
+    for (size_t n = 0; n < nm_arr_len(nm_api_methods); n++) {
+        const nm_api_method_t *m = &nm_api_methods[n];
+        nm_api_defer_t *dfr;
+
+        if (nm_str_cmp_tt(method, m->method) != NM_OK)
+            continue;
+
+        if (m->state == 1 && vm->state != 1) {
+            nm_api_error(cl, &id, NM_API_E_FAILED, "VM must be running");
+            goto out;
+        } else if (m->state == 0 && vm->state == 1) {
+            nm_api_error(cl, &id, NM_API_E_FAILED, "VM must be stopped");
+            goto out;
+        } else if (m->state == 0 && nm_api_starting(&name)) {
+            nm_api_error(cl, &id, NM_API_E_FAILED, "VM is starting");
+            goto out;
+        }
+
+        dfr = nm_calloc(1, sizeof(nm_api_defer_t));
+        dfr->slot = cl - nm_api_clients;
+        dfr->gen = cl->gen;
+        dfr->m = m;
+        nm_str_copy(&dfr->id, &id);
+
+        nm_api_warn_drop();
+        if (m->op(&name, params, dfr) != NM_OK) {
+            nm_warn_pop(&err);
+            nm_api_finish(dfr, NM_ERR, err.data);
+        } else if (!m->async) {
+            *rebuild |= m->rebuild;
+            nm_api_finish(dfr, NM_OK, NULL);
+        }
+        goto out;
+    }
+
+    nm_api_error(cl, &id, NM_API_E_METHOD, "Method not found");
+
+out:
+    nm_str_free(&id);
+    nm_str_free(&name);
+    nm_str_free(&res);
+    nm_str_free(&err);
+}
+
+static const nm_mon_item_t *nm_api_find_vm(const nm_vect_t *mon_list,
+                                           const nm_str_t *name)
+{
+    for (size_t n = 0; n < mon_list->n_memb; n++) {
+        const nm_mon_item_t *vm = nm_vect_at(mon_list, n);
+
+        if (nm_str_cmp_ss(vm->name, name) == NM_OK)
+            return vm;
+    }
+
+    return NULL;
+}
+
+static int nm_api_starting(const nm_str_t *name)
+{
+    for (size_t n = 0; n < nm_api_starts.n_memb; n++) {
+        const nm_api_defer_t *dfr =
+            *(nm_api_defer_t **) nm_arr_at(&nm_api_starts, n);
+
+        if (nm_str_cmp_ss(&dfr->name, name) == NM_OK)
+            return NM_TRUE;
+    }
+
+    return NM_FALSE;
+}
+
+static time_t nm_api_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec;
+}
+
+/* QEMU is only spawned here, start is finished by nm_api_jobs_check()
+ * when it has daemonized */
+static int nm_api_vm_start(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr)
+{
+    struct epoll_event ev;
+    int flags = 0, pidfd;
+
+    if (nm_json_bool(nm_json_get(params, "temp")))
+        flags |= NM_VMCTL_TEMP;
+
+    if ((dfr->job = nm_vmctl_start_begin(name, flags)) == NULL)
+        return NM_ERR;
+
+    nm_str_copy(&dfr->name, name);
+    pidfd = nm_spawn_pidfd(nm_vmctl_job_spawn(dfr->job));
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = nm_api_job_tag;
+    if (pidfd != -1 && nm_api_efd != -1 &&
+            epoll_ctl(nm_api_efd, EPOLL_CTL_ADD, pidfd, &ev) == 0)
+        dfr->polled = 1;
+
+    nm_arr_push(&nm_api_starts, &dfr);
+
+    return NM_OK;
+}
+
+static int nm_api_vm_shut(const nm_str_t *name,
+                          const nm_json_t *params NM_UNUSED,
+                          nm_api_defer_t *dfr)
+{
+    return nm_qmp_vm_shut_async(name, nm_api_qmp_done, dfr);
+}
+
+static int nm_api_vm_stop(const nm_str_t *name,
+                          const nm_json_t *params NM_UNUSED,
+                          nm_api_defer_t *dfr)
+{
+    return nm_qmp_vm_stop_async(name, nm_api_stop_done, dfr);
+}
+
+static int nm_api_vm_reset(const nm_str_t *name,
+                           const nm_json_t *params NM_UNUSED,
+                           nm_api_defer_t *dfr)
+{
+    return nm_qmp_vm_reset_async(name, nm_api_qmp_done, dfr);
+}
+
+static int nm_api_vm_pause(const nm_str_t *name,
+                           const nm_json_t *params NM_UNUSED,
+                           nm_api_defer_t *dfr)
+{
+    return nm_qmp_vm_pause_async(name, nm_api_qmp_done, dfr);
+}
+
+static int nm_api_vm_resume(const nm_str_t *name,
+                            const nm_json_t *params NM_UNUSED,
+                            nm_api_defer_t *dfr)
+{
+    return nm_qmp_vm_resume_async(name, nm_api_qmp_done, dfr);
+}
+
+static int nm_api_vm_kill(const nm_str_t *name,
+                          const nm_json_t *params NM_UNUSED,
+                          nm_api_defer_t *dfr NM_UNUSED)
+{
+    nm_vmctl_kill(name);
+
+    return NM_OK;
+}
+
+static int nm_api_vm_delete(const nm_str_t *name,
+                            const nm_json_t *params NM_UNUSED,
+                            nm_api_defer_t *dfr NM_UNUSED)
+{
+    nm_vmctl_delete(name);
+
+    return NM_OK;
+}
+
+static int nm_api_vm_savevm(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr)
+{
+    return nm_api_vm_snap(name, params, nm_qmp_savevm_async, dfr);
+}
+
+static int nm_api_vm_loadvm(const nm_str_t *name, const nm_json_t *params,
+                            nm_api_defer_t *dfr)
+{
+    return nm_api_vm_snap(name, params, nm_qmp_loadvm_async, dfr);
+}
+
+static int nm_api_vm_delvm(const nm_str_t *name, const nm_json_t *params,
+                           nm_api_defer_t *dfr)
+{
+    return nm_api_vm_snap(name, params, nm_qmp_delvm_async, dfr);
+}
+
+static int nm_api_vm_snap(const nm_str_t *name, const nm_json_t *params,
+                          nm_api_snap_op_t op, nm_api_defer_t *dfr)
+{
+    const char *snap = nm_json_str(nm_json_get(params, "snapshot"));
+    nm_str_t str = NM_INIT_STR;
+    int rc;
+
+    if (snap == NULL || *snap == '\0')
+        return NM_ERR;
+
+    nm_str_alloc_text(&str, snap);
+    rc = op(name, &str, nm_api_qmp_done, dfr);
+    nm_str_free(&str);
+
+    return rc;
+}
+
+static void nm_api_qmp_done(const nm_str_t *name NM_UNUSED, int rc, void *ctx)
+{
+    nm_api_finish(ctx, rc, nm_qmp_error());
+}
+
+/* QEMU closes the session on quit */
+static void nm_api_stop_done(const nm_str_t *name, int rc, void *ctx)
+{
+    nm_qmp_pool_drop(name);
+    nm_api_finish(ctx, rc, nm_qmp_error());
+}
+
+/* Warning is kept process-wide until popped: one left by an earlier
+ * operation of any VM must not be reported as reason of the next one */
+static void nm_api_warn_drop(void)
+{
+    nm_str_t old = NM_INIT_STR;
+
+    nm_warn_pop(&old);
+    nm_str_free(&old);
+}
+
+/* Reply is dropped if client has gone meanwhile.
+ * err is the reason of failure of this request, may be NULL. */
+static void nm_api_finish(nm_api_defer_t *dfr, int rc, const char *err)
+{
+    nm_api_client_t *cl = &nm_api_clients[dfr->slot];
+    nm_str_t res = NM_INIT_STR;
+
+    if (cl->fd != -1 && cl->gen == dfr->gen) {
+        if (rc == NM_OK) {
+            nm_api_reply(cl, &dfr->id, "true");
+        } else {
+            if (err && *err)
+                nm_str_add_text(&res, err);
+            else
+                nm_str_format(&res, "%s failed", dfr->m->method);
+            nm_api_error(cl, &dfr->id, NM_API_E_FAILED, res.data);
+        }
+    }
+
+    nm_str_free(&res);
+    nm_str_free(&dfr->id);
+    nm_str_free(&dfr->name);
+    free(dfr);
+}
+
+static void nm_api_reply(nm_api_client_t *cl, const nm_str_t *id,
+                         const char *result)
+{
+    nm_str_t msg = NM_INIT_STR;
+
+    nm_str_format(&msg, "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":%s}",
+            (id && id->len) ? id->data : "null", result);
+    nm_api_send(cl, &msg);
+    nm_str_free(&msg);
+}
+
+static void nm_api_error(nm_api_client_t *cl, const nm_str_t *id,
+                         int code, const char *err)
+{
+    nm_str_t msg = NM_INIT_STR;
+
+    nm_str_format(&msg, "{\"jsonrpc\":\"2.0\",\"id\":%s,"
+            "\"error\":{\"code\":%d,\"message\":",
+            (id && id->len) ? id->data : "null", code);
+    nm_api_json_str(&msg, err);
+    nm_str_add_text(&msg, "}}");
+    nm_api_send(cl, &msg);
+    nm_str_free(&msg);
+}
+
+static int nm_api_send(nm_api_client_t *cl, nm_str_t *msg)
+{
+    size_t sent = 0;
+
+    nm_str_add_char(msg, '\n');
+
+    while (sent < msg->len) {
+        ssize_t n = send(cl->fd, msg->data + sent, msg->len - sent,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd pfd = { .fd = cl->fd, .events = POLLOUT };
+
+            /* do not let slow reader stall the daemon */
+            if (poll(&pfd, 1, NM_API_SEND_TIMEOUT) > 0)
+                continue;
+        }
+
+        nm_api_drop(cl);
+        nm_str_trunc(msg, msg->len - 1);
+        return NM_ERR;
+    }
+
+    nm_str_trunc(msg, msg->len - 1);
+
+    return NM_OK;
+}
+
+static void nm_api_drop(nm_api_client_t *cl)
+{
+    if (cl->fd != -1)
+        close(cl->fd);
+
+    cl->fd = -1;
+    cl->subscribed = 0;
+    nm_str_free(&cl->buf);
+}
+
+static int nm_api_connect(void)
+{
+    struct sockaddr_un addr;
+    const nm_str_t *path = &nm_cfg_get()->daemon_sock;
+    int sd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    nm_strlcpy(addr.sun_path, path->data, sizeof(addr.sun_path));
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return -1;
+
+    if (connect(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+static int nm_api_send_call(int sd, const char *method, const char *name,
+                            size_t id)
+{
+    nm_str_t req = NM_INIT_STR;
+    int rc = NM_OK;
+
+    nm_str_format(&req, "{\"jsonrpc\":\"2.0\",\"id\":%zu,\"method\":\"%s\","
+            "\"params\":{\"name\":", id, method);
+    nm_api_json_str(&req, name);
+    nm_str_add_text(&req, "}}\n");
+
+    if (send(sd, req.data, req.len, MSG_NOSIGNAL) != (ssize_t) req.len)
+        rc = NM_ERR;
+
+    nm_str_free(&req);
+
+    return rc;
+}
+
+static void nm_api_answer_cb(const nm_json_t *ans, void *ctx)
+{
+    nm_api_ans_ctx_t *actx = ctx;
+    const char *msg;
+    int64_t id;
+
+    /* every answer frees place for next request */
+    actx->replied++;
+
+    if (nm_json_int(nm_json_get(ans, "id"), &id) != NM_OK ||
+        id < 0 || (uint64_t) id >= actx->count || actx->done[id])
+        return;
+
+    actx->done[id] = 1;
+
+    if (nm_json_get(ans, "result") != NULL) {
+        actx->results[id] = NM_OK;
+        return;
+    }
+
+    msg = nm_json_str(nm_json_get(nm_json_get(ans, "error"), "message"));
+    nm_str_format(&actx->errs[id], "%s",
+            msg ? msg : _("bad answer from nemu-monitor"));
+}
+
+/* id is sent back as it came: number or string, otherwise null */
+static void nm_api_json_id(nm_str_t *out, const nm_json_t *id)
+{
+    if (id == NULL)
+        return;
+
+    if (id->type == NM_JSON_NUMBER)
+        nm_str_add_str(out, &id->str);
+    else if (id->type == NM_JSON_STRING)
+        nm_api_json_str(out, id->str.data);
+}
+
+static void nm_api_json_str(nm_str_t *out, const char *str)
+{
+    nm_str_add_char(out, '"');
+
+    for (; *str; str++) {
+        switch (*str) {
+        case '"':  nm_str_add_text(out, "\\\""); break;
+        case '\\': nm_str_add_text(out, "\\\\"); break;
+        case '\n': nm_str_add_text(out, "\\n");  break;
+        case '\r': nm_str_add_text(out, "\\r");  break;
+        case '\t': nm_str_add_text(out, "\\t");  break;
+        default:
+            if ((unsigned char) *str < 0x20)
+                nm_str_append_format(out, "\\u%04x", *str);
+            else
+                nm_str_add_char(out, *str);
+        }
+    }
+
+    nm_str_add_char(out, '"');
+}
+
+static const char *nm_api_state(int8_t state)
+{
+    switch (state) {
+    case 1:
+        return "running";
+    case 0:
+        return "stopped";
+    default:
+        return "unknown";
+    }
+}
+/* vim:set ts=4 sw=4: */
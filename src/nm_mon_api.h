@@ -0,0 +1,29 @@
+#ifndef NM_MON_API_H_
+#define NM_MON_API_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+
+/* nm_api_call() result when nemu-monitor is not reachable */
+enum {NM_API_NOCONN = 1};
+
+/* pidfd of started QEMU is added to epoll set efd with job_tag,
+ * nm_api_jobs_check() must be called when it is readable */
+int nm_api_listen(int efd, uint64_t job_tag);
+int nm_api_accept(int lfd);
+int nm_api_client_fd(int slot);
+int nm_api_read(int slot, const nm_vect_t *mon_list, int *rebuild);
+void nm_api_jobs_check(void);
+/* ms until jobs must be checked without event, -1 - no limit */
+int nm_api_timeout(void);
+/* vm.stat was requested recently, so usage of VMs must be sampled */
+int nm_api_stat_wanted(void);
+void nm_api_notify(const char *name, const char *event);
+void nm_api_close(void);
+/* method is called for every VM of names on one connection, at most
+ * jobs requests are in flight. results and errs get outcome of each VM */
+int nm_api_call(const char *method, const nm_vect_t *names, size_t jobs,
+                int *results, nm_str_t *errs);
+
+#endif /* NM_MON_API_H_ */
+/* vim:set ts=4 sw=4: */
@@ -2,31 +2,73 @@
 #include <nm_dbus.h>
 #include <nm_utils.h>
 #include <nm_cfg_file.h>
+#include <nm_mon_api.h>
+#include <nm_mon_daemon.h>
+#include <nm_stat_usage.h>
 #include <nm_qmp_control.h>
 
 #include <sys/wait.h> /* waitpid(2) */
 #include <time.h> /* nanosleep(2) */
+#if defined (NM_OS_LINUX)
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
 
 static volatile sig_atomic_t nm_mon_rebuild = 0;
 
-static void nm_mon_check_vms(const nm_vect_t *mon_list);
-static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms);
-static void nm_mon_signals_handler(int signal);
-static int nm_mon_store_pid(void);
-
-typedef struct nm_mon_item {
-    nm_str_t *name;
-    int8_t state;
-} nm_mon_item_t;
-
 typedef struct nm_clean_data {
     nm_vect_t *mon_list;
     nm_vect_t *vm_list;
 } nm_clean_data_t;
 
+#if defined (NM_OS_LINUX)
+#define NM_ITEM_INIT (nm_mon_item_t) { NULL, -1, -1, -1, -1, 0, NULL }
+#else
 #define NM_ITEM_INIT (nm_mon_item_t) { NULL, -1 }
+#endif
 #define NM_CLEAN_INIT (nm_clean_data_t) { NULL, NULL }
 
+#if defined (NM_OS_LINUX)
+static const char NM_MON_QMP_INIT[] = "{\"execute\":\"qmp_capabilities\"}";
+
+/* epoll event source is stored in low bits of epoll_data.u64,
+ * index of monitored VM in high bits */
+enum {
+    NM_MON_EV_INOTIFY,
+    NM_MON_EV_QMP,
+    NM_MON_EV_PIDFD,
+    NM_MON_EV_API,
+    NM_MON_EV_CLIENT,
+    NM_MON_EV_JOB,
+    NM_MON_EV_SHIFT = 3,
+    NM_MON_EV_MASK = (1 << NM_MON_EV_SHIFT) - 1
+};
+
+enum {NM_MON_MAXEVENTS = 64};
+enum {NM_MON_READLEN = 4096};
+
+static void nm_mon_event_loop(nm_vect_t *mon_list, nm_vect_t *vm_list);
+static void nm_mon_watch_list(nm_vect_t *list, int efd, int ifd);
+static void nm_mon_api_accept(int efd, int lfd);
+static void nm_mon_unwatch_list(nm_vect_t *list, int ifd);
+static void nm_mon_attach_qmp(nm_mon_item_t *item, size_t idx, int efd);
+static void nm_mon_attach_pid(nm_mon_item_t *item, size_t idx, int efd);
+static void nm_mon_detach(nm_mon_item_t *item);
+static void nm_mon_read_inotify(nm_vect_t *list, int efd, int ifd, int root_wd);
+static void nm_mon_read_qmp(nm_mon_item_t *item);
+static void nm_mon_qmp_event(const nm_json_t *msg, void *ctx);
+static void nm_mon_set_state(nm_mon_item_t *item, int8_t state);
+static void nm_mon_item_free_cb(void *unit_p);
+#endif /* NM_OS_LINUX */
+static void nm_mon_check_vms(const nm_vect_t *mon_list);
+static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms);
+static void nm_mon_notify(const char *name, const char *what);
+static void nm_mon_signals_handler(int signal);
+static int nm_mon_store_pid(void);
+
 static inline int8_t nm_mon_item_get_status(const nm_vect_t *v, const size_t idx)
 {
     return ((nm_mon_item_t *) nm_vect_at(v, idx))->state;
@@ -54,13 +96,15 @@ static void nm_mon_cleanup(int rc, void *arg)
 
     nm_debug("mon daemon exited: %d\n", rc);
 
-    nm_vect_free(data->mon_list, NULL);
+    nm_vect_free(data->mon_list, nm_mon_item_free_cb);
     nm_vect_free(data->vm_list, nm_str_vect_free_cb);
+    nm_stat_free();
 
 #if NM_WITH_DBUS
     nm_dbus_disconnect();
 #endif
 
+    nm_api_close();
     unlink(nm_cfg_get()->daemon_pid.data);
     nm_exit_core();
 }
@@ -199,9 +243,6 @@ void nm_mon_loop(void)
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 
-    ts.tv_sec = cfg->daemon_sleep / 1000;
-    ts.tv_nsec = (cfg->daemon_sleep % 1000) * 1e+6;
-
     if (nm_mon_store_pid() != NM_OK) {
         exit(EXIT_FAILURE);
     }
@@ -213,7 +254,15 @@ void nm_mon_loop(void)
         exit(EXIT_FAILURE);
     }
 #endif
-    
+
+#if defined (NM_OS_LINUX)
+    /* returns only if epoll or inotify cannot be used */
+    nm_mon_event_loop(&mon_list, &vm_list);
+#endif
+
+    ts.tv_sec = cfg->daemon_sleep / 1000;
+    ts.tv_nsec = (cfg->daemon_sleep % 1000) * 1e+6;
+
     for (;;) {
         if (nm_mon_rebuild) {
             nm_mon_build_list(&mon_list, &vm_list);
@@ -226,36 +275,44 @@ void nm_mon_loop(void)
 
 static void nm_mon_check_vms(const nm_vect_t *mon_list)
 {
-    nm_str_t body = NM_INIT_STR;
-
     for (size_t n = 0; n < mon_list->n_memb; n++) {
         char *name = nm_mon_item_get_name_cstr(mon_list, n);
         int8_t status = nm_mon_item_get_status(mon_list, n);
 
         if (nm_qmp_test_socket(nm_mon_item_get_name(mon_list, n)) == NM_OK) {
             if (!status) {
-                nm_str_format(&body, "%s started", name);
-#if NM_WITH_DBUS
-                nm_dbus_send_notify("VM status changed:", body.data);
-#endif
+                nm_mon_notify(name, "started");
             }
             nm_mon_item_set_status(mon_list, n, NM_TRUE);
         } else {
             if (status == 1) {
-                nm_str_format(&body, "%s stoped", name);
-#if NM_WITH_DBUS
-                nm_dbus_send_notify("VM status changed:", body.data);
-#endif
+                nm_mon_notify(name, "stoped");
             }
             nm_mon_item_set_status(mon_list, n, NM_FALSE);
         }
-        nm_str_free(&body);
     }
 }
 
+static void nm_mon_notify(const char *name, const char *what)
+{
+    nm_str_t body = NM_INIT_STR;
+
+    nm_str_format(&body, "%s %s", name, what);
+    nm_debug("mon: %s\n", body.data);
+#if NM_WITH_DBUS
+    nm_dbus_send_notify("VM status changed:", body.data);
+#endif
+    nm_api_notify(name, what);
+    nm_str_free(&body);
+}
+
 static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms)
 {
+#if defined (NM_OS_LINUX)
+    nm_vect_free(list, nm_mon_item_free_cb);
+#else
     nm_vect_free(list, NULL);
+#endif
     nm_vect_free(vms, nm_str_vect_free_cb);
 
     nm_db_select(NM_GET_VMS_SQL, vms);
@@ -268,6 +325,471 @@ static void nm_mon_build_list(nm_vect_t *list, nm_vect_t *vms)
     }
 }
 
+#if defined (NM_OS_LINUX)
+static void nm_mon_event_loop(nm_vect_t *mon_list, nm_vect_t *vm_list)
+{
+    struct epoll_event ev, events[NM_MON_MAXEVENTS];
+    const nm_cfg_t *cfg = nm_cfg_get();
+    int efd, ifd, lfd, root_wd, sampling = 0;
+
+    if ((efd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        nm_debug("%s: epoll_create1 error: %s\n", __func__, strerror(errno));
+        return;
+    }
+
+    if ((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        nm_debug("%s: inotify_init1 error: %s\n", __func__, strerror(errno));
+        close(efd);
+        return;
+    }
+
+    /* VM directories are created and removed here */
+    root_wd = inotify_add_watch(ifd, cfg->vm_dir.data,
+            IN_CREATE | IN_DELETE | IN_ONLYDIR);
+    if (root_wd == -1) {
+        nm_debug("%s: cannot watch %s: %s\n",
+                __func__, cfg->vm_dir.data, strerror(errno));
+        close(ifd);
+        close(efd);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = NM_MON_EV_INOTIFY;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, ifd, &ev) == -1) {
+        nm_debug("%s: epoll_ctl error: %s\n", __func__, strerror(errno));
+        close(ifd);
+        close(efd);
+        return;
+    }
+
+    /* control API is optional */
+    if ((lfd = nm_api_listen(efd, NM_MON_EV_JOB)) != -1) {
+        ev.data.u64 = NM_MON_EV_API;
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev) == -1) {
+            nm_debug("%s: epoll_ctl error: %s\n", __func__, strerror(errno));
+            nm_api_close();
+        }
+    }
+
+    nm_mon_watch_list(mon_list, efd, ifd);
+
+    for (;;) {
+        int nfds, timeout = -1, rebuild = 0, jobs = 0, left;
+
+        if (nm_mon_rebuild) {
+            nm_mon_unwatch_list(mon_list, ifd);
+            nm_mon_build_list(mon_list, vm_list);
+            nm_mon_watch_list(mon_list, efd, ifd);
+            nm_mon_rebuild = 0;
+        }
+
+        for (size_t n = 0; n < mon_list->n_memb; n++) {
+            if (((nm_mon_item_t *) nm_vect_at(mon_list, n))->poll) {
+                timeout = cfg->daemon_sleep;
+                break;
+            }
+        }
+
+        /* QMP sessions opened by API calls must be closed when idle */
+        nm_qmp_pool_expire();
+        if (nm_qmp_pool_count())
+            timeout = cfg->daemon_sleep;
+
+        /* resource usage of running VMs is sampled only while clients
+         * ask for vm.stat, otherwise daemon sleeps until next event.
+         * Samples are dropped when sampling stops, so rates are not
+         * computed over the idle period */
+        if (nm_api_stat_wanted()) {
+            nm_stat_update(vm_list);
+            sampling = 1;
+            for (size_t n = 0; n < mon_list->n_memb; n++) {
+                if (((nm_mon_item_t *) nm_vect_at(mon_list, n))->state != NM_TRUE)
+                    continue;
+                if (timeout == -1 || timeout > NM_STAT_INTERVAL)
+                    timeout = NM_STAT_INTERVAL;
+                break;
+            }
+        } else if (sampling) {
+            nm_stat_free();
+            sampling = 0;
+        }
+
+        /* VM start requested by API client without pidfd */
+        if ((left = nm_api_timeout()) != -1 && (timeout == -1 || left < timeout))
+            timeout = left;
+
+        /* replies to QMP commands of API clients are read while waiting */
+        if (nm_qmp_pending()) {
+            nm_qmp_poll_fd(efd, timeout);
+            timeout = 0;
+        }
+
+        nfds = epoll_wait(efd, events, NM_MON_MAXEVENTS, timeout);
+        if (nfds == -1) {
+            if (errno == EINTR)
+                continue;
+            nm_bug("%s: epoll_wait error: %s", __func__, strerror(errno));
+        }
+
+        for (int n = 0; n < nfds; n++) {
+            uint64_t type = events[n].data.u64 & NM_MON_EV_MASK;
+            size_t idx = events[n].data.u64 >> NM_MON_EV_SHIFT;
+            nm_mon_item_t *item;
+
+            if (type == NM_MON_EV_INOTIFY) {
+                nm_mon_read_inotify(mon_list, efd, ifd, root_wd);
+                continue;
+            }
+
+            if (type == NM_MON_EV_API) {
+                nm_mon_api_accept(efd, lfd);
+                continue;
+            }
+
+            if (type == NM_MON_EV_CLIENT) {
+                nm_api_read(idx, mon_list, &rebuild);
+                continue;
+            }
+
+            if (type == NM_MON_EV_JOB) {
+                jobs = 1;
+                continue;
+            }
+
+            item = nm_vect_at(mon_list, idx);
+
+            if (type == NM_MON_EV_QMP && item->qmp_sd != -1) {
+                nm_mon_read_qmp(item);
+            } else if (type == NM_MON_EV_PIDFD && item->pidfd != -1) {
+                nm_mon_detach(item);
+                nm_mon_set_state(item, NM_FALSE);
+            }
+        }
+
+        if (jobs || nm_api_timeout() != -1)
+            nm_api_jobs_check();
+
+        if (rebuild)
+            nm_mon_rebuild = 1;
+
+        if (nfds != 0)
+            continue;
+
+        /* timeout: VMs without event sources */
+        for (size_t n = 0; n < mon_list->n_memb; n++) {
+            nm_mon_item_t *item = nm_vect_at(mon_list, n);
+
+            if (!item->poll)
+                continue;
+
+            nm_mon_attach_qmp(item, n, efd);
+            nm_mon_attach_pid(item, n, efd);
+
+            if (item->qmp_sd != -1 || item->pidfd != -1) {
+                item->poll = 0;
+                nm_mon_set_state(item, NM_TRUE);
+            } else {
+                nm_mon_set_state(item, nm_qmp_test_socket(item->name) == NM_OK);
+                item->poll = item->state;
+            }
+        }
+    }
+}
+
+static void nm_mon_watch_list(nm_vect_t *list, int efd, int ifd)
+{
+    nm_str_t path = NM_INIT_STR;
+
+    for (size_t n = 0; n < list->n_memb; n++) {
+        nm_mon_item_t *item = nm_vect_at(list, n);
+
+        nm_str_format(&path, "%s/%s", nm_cfg_get()->vm_dir.data,
+                item->name->data);
+        item->wd = inotify_add_watch(ifd, path.data,
+                IN_CREATE | IN_MODIFY | IN_MOVED_TO | IN_ONLYDIR);
+
+        nm_mon_attach_qmp(item, n, efd);
+        nm_mon_attach_pid(item, n, efd);
+
+        if (item->qmp_sd != -1 || item->pidfd != -1) {
+            nm_mon_set_state(item, NM_TRUE);
+        } else {
+            /* VM may be started without events socket */
+            nm_mon_set_state(item, nm_qmp_test_socket(item->name) == NM_OK);
+            item->poll = item->state;
+        }
+    }
+
+    nm_str_free(&path);
+}
+
+static void nm_mon_api_accept(int efd, int lfd)
+{
+    struct epoll_event ev;
+    int slot;
+
+    while ((slot = nm_api_accept(lfd)) != -1) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = ((uint64_t) slot << NM_MON_EV_SHIFT) | NM_MON_EV_CLIENT;
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, nm_api_client_fd(slot), &ev) == -1)
+            nm_debug("%s: epoll_ctl error: %s\n", __func__, strerror(errno));
+    }
+}
+
+static void nm_mon_unwatch_list(nm_vect_t *list, int ifd)
+{
+    for (size_t n = 0; n < list->n_memb; n++) {
+        nm_mon_item_t *item = nm_vect_at(list, n);
+
+        if (item->wd != -1) {
+            inotify_rm_watch(ifd, item->wd);
+            item->wd = -1;
+        }
+        nm_mon_detach(item);
+    }
+}
+
+static void nm_mon_attach_qmp(nm_mon_item_t *item, size_t idx, int efd)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    nm_str_t path = NM_INIT_STR;
+    int sd;
+
+    if (item->qmp_sd != -1)
+        return;
+
+    nm_str_format(&path, "%s/%s/%s", nm_cfg_get()->vm_dir.data,
+            item->name->data, NM_VM_QMP_EVT_FILE);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    nm_strlcpy(addr.sun_path, path.data, sizeof(addr.sun_path));
+    nm_str_free(&path);
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+        return;
+
+    if (connect(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(sd);
+        return;
+    }
+
+    /* events are sent only after capabilities negotiation */
+    if (send(sd, NM_MON_QMP_INIT, strlen(NM_MON_QMP_INIT), MSG_NOSIGNAL) == -1) {
+        close(sd);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = ((uint64_t) idx << NM_MON_EV_SHIFT) | NM_MON_EV_QMP;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, sd, &ev) == -1) {
+        close(sd);
+        return;
+    }
+
+    item->qmp_sd = sd;
+}
+
+static void nm_mon_attach_pid(nm_mon_item_t *item, size_t idx, int efd)
+{
+#if defined (SYS_pidfd_open)
+    struct epoll_event ev;
+    nm_str_t path = NM_INIT_STR;
+    char buf[32];
+    ssize_t nread;
+    pid_t pid;
+    int fd;
+
+    if (item->pidfd != -1)
+        return;
+
+    nm_str_format(&path, "%s/%s/%s", nm_cfg_get()->vm_dir.data,
+            item->name->data, NM_VM_PID_FILE);
+
+    fd = open(path.data, O_RDONLY | O_CLOEXEC);
+    nm_str_free(&path);
+    if (fd == -1)
+        return;
+
+    nread = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (nread <= 0)
+        return;
+
+    buf[nread] = '\0';
+    if ((pid = atoi(buf)) <= 0)
+        return;
+
+    if ((fd = syscall(SYS_pidfd_open, pid, 0)) == -1)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t) idx << NM_MON_EV_SHIFT) | NM_MON_EV_PIDFD;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        close(fd);
+        return;
+    }
+
+    item->pidfd = fd;
+#else
+    (void) item;
+    (void) idx;
+    (void) efd;
+#endif /* SYS_pidfd_open */
+}
+
+static void nm_mon_detach(nm_mon_item_t *item)
+{
+    /* close(2) also removes descriptor from epoll set */
+    if (item->qmp_sd != -1) {
+        close(item->qmp_sd);
+        item->qmp_sd = -1;
+    }
+    if (item->pidfd != -1) {
+        close(item->pidfd);
+        item->pidfd = -1;
+    }
+    item->poll = 0;
+
+    if (item->evjson) {
+        nm_json_free(item->evjson);
+        free(item->evjson);
+        item->evjson = NULL;
+    }
+}
+
+static void nm_mon_read_inotify(nm_vect_t *list, int efd, int ifd, int root_wd)
+{
+    char buf[NM_MON_READLEN]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ie;
+    ssize_t nread;
+
+    while ((nread = read(ifd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + nread;
+                ptr += sizeof(struct inotify_event) + ie->len) {
+            ie = (const struct inotify_event *) ptr;
+
+            if (ie->wd == root_wd) {
+                if (ie->mask & IN_ISDIR)
+                    nm_mon_rebuild = 1;
+                continue;
+            }
+
+            if (!ie->len)
+                continue;
+
+            for (size_t n = 0; n < list->n_memb; n++) {
+                nm_mon_item_t *item = nm_vect_at(list, n);
+
+                if (item->wd != ie->wd)
+                    continue;
+
+                if ((ie->mask & IN_CREATE) &&
+                        nm_str_cmp_tt(ie->name, NM_VM_QMP_EVT_FILE) == NM_OK) {
+                    nm_mon_attach_qmp(item, n, efd);
+                    /* socket file exists before listen(2), retry later */
+                    if (item->qmp_sd == -1)
+                        item->poll = 1;
+                    else
+                        nm_mon_set_state(item, NM_TRUE);
+                } else if ((ie->mask & (IN_MODIFY | IN_MOVED_TO)) &&
+                        nm_str_cmp_tt(ie->name, NM_VM_PID_FILE) == NM_OK) {
+                    nm_mon_attach_pid(item, n, efd);
+                    nm_mon_attach_qmp(item, n, efd);
+                    /* pid file is written after QEMU has started */
+                    if (item->pidfd != -1 || item->qmp_sd != -1) {
+                        item->poll = 0;
+                        nm_mon_set_state(item, NM_TRUE);
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void nm_mon_read_qmp(nm_mon_item_t *item)
+{
+    char buf[NM_MON_READLEN];
+    ssize_t nread;
+
+    if (item->evjson == NULL)
+        item->evjson = nm_calloc(1, sizeof(nm_json_parser_t));
+
+    for (;;) {
+        nread = read(item->qmp_sd, buf, sizeof(buf));
+        if (nread > 0) {
+            /* parser is reset on error, next message is parsed anew */
+            if (nm_json_feed(item->evjson, buf, nread,
+                        nm_mon_qmp_event, item) != NM_OK) {
+                nm_debug("%s: bad QMP message from %s\n",
+                        __func__, item->name->data);
+            }
+            continue;
+        }
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        /* QMP session is closed by QEMU */
+        nm_mon_detach(item);
+        nm_mon_set_state(item, NM_FALSE);
+        return;
+    }
+}
+
+/* Greeting and command replies have no "event" member */
+static void nm_mon_qmp_event(const nm_json_t *msg, void *ctx)
+{
+    static const struct {
+        const char *event;
+        const char *what;
+    } events[] = {
+        { "SHUTDOWN", "shutdown" },
+        { "STOP",     "paused"   },
+        { "RESUME",   "resumed"  },
+        { "RESET",    "reset"    }
+    };
+    const nm_mon_item_t *item = ctx;
+    const char *ev = nm_json_str(nm_json_get(msg, "event"));
+
+    if (ev == NULL)
+        return;
+
+    for (size_t n = 0; n < nm_arr_len(events); n++) {
+        if (nm_str_cmp_tt(ev, events[n].event) == NM_OK) {
+            nm_mon_notify(item->name->data, events[n].what);
+            break;
+        }
+    }
+}
+
+static void nm_mon_set_state(nm_mon_item_t *item, int8_t state)
+{
+    if (item->state == state)
+        return;
+
+    /* initial state is not a change */
+    if (item->state != -1)
+        nm_mon_notify(item->name->data, state ? "started" : "stoped");
+
+    item->state = state;
+}
+
+static void nm_mon_item_free_cb(void *unit_p)
+{
+    nm_mon_detach((nm_mon_item_t *) unit_p);
+}
+#endif /* NM_OS_LINUX */
+
 static void nm_mon_signals_handler(int signal)
 {
     switch (signal) {
@@ -1,10 +1,26 @@
 #ifndef NM_MON_DAEMON_H_
 #define NM_MON_DAEMON_H_
 
+#include <nm_string.h>
+#include <nm_json.h>
+
+typedef struct nm_mon_item {
+    nm_str_t *name;
+    int8_t state;
+#if defined (NM_OS_LINUX)
+    int qmp_sd;     /* QMP session subscribed to events */
+    int pidfd;      /* QEMU process, readable on exit */
+    int wd;         /* inotify watch of VM directory */
+    int poll;       /* no event source, fallback to polling */
+    nm_json_parser_t *evjson; /* QMP messages, keeps incomplete one */
+#endif
+} nm_mon_item_t;
+
 void nm_mon_start(void);
 void nm_mon_loop(void);
 void nm_mon_ping(void);
 
 static const int NM_MON_SLEEP = 1000;
+static const char NM_MON_API_SOCK[] = "/tmp/nemu-monitor.sock";
 #endif
 /* vim:set ts=4 sw=4: */
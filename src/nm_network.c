@@ -1,6 +1,7 @@
 #include <nm_core.h>
 #include <nm_utils.h>
 #include <nm_network.h>
+#include <nm_trace.h>
 
 #include <sys/ioctl.h>
 
@@ -31,6 +32,10 @@ extern unsigned int if_nametoindex (const char *__ifname) __THROW;
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
 static const char NM_TUNDEV[]      = "/dev/net/tun";
 static const char NM_NET_MACVTAP[] = "macvtap";
 static const char NM_NET_VETH[]    = "veth";
@@ -46,6 +51,14 @@ enum {
     NM_MACVTAP_BRIDGE_MODE = 4
 };
 
+enum {
+    NM_NET_BATCH_LEN = 32768,       /* kept below socket send buffer */
+    NM_NET_BATCH_MSGS = 64,         /* ACKs must fit in receive buffer */
+    NM_NET_READLEN = 32768,
+    NM_NET_LINKS_RCVBUF = 1048576,
+    NM_NET_LINKS_MIN = 64,          /* hash buckets */
+};
+
 struct iplink_req {
     struct nlmsghdr n;
     struct ifinfomsg i;
@@ -64,10 +77,62 @@ struct rtnl_handle {
     struct sockaddr_nl sa;
 };
 
+/* Shared rtnetlink session. Requests are queued and sent with
+ * one sendmsg(2) when batch is over, or at once outside of batch.
+ * ACKs are matched to requests by sequence number. */
+typedef struct {
+    struct rtnl_handle rth;
+    uint32_t first_seq; /* first queued request */
+    size_t len;         /* queued bytes */
+    int depth;          /* nested batches */
+    char buf[NM_NET_BATCH_LEN]
+        __attribute__ ((aligned(NLMSG_ALIGNTO)));
+} nm_net_batch_t;
+
+/* Table of host links: filled by one RTM_GETLINK dump and kept
+ * current by RTNLGRP_LINK events, which are read before lookup.
+ * Links are found by name and by index through hash chains.
+ * Removed links are left as holes until the table is rebuilt. */
+typedef struct {
+    char name[IFNAMSIZ];
+    uint32_t index;     /* 0 if link is removed */
+    uint32_t flags;
+    size_t next_name;
+    size_t next_index;
+} nm_net_link_t;
+
+typedef struct {
+    struct rtnl_handle rth;
+    nm_arr_t links;
+    size_t *by_name;
+    size_t *by_index;
+    size_t size;        /* buckets in each hash */
+    size_t holes;
+} nm_net_links_t;
+
+#define NM_NET_LINK_END SIZE_MAX
+
+static nm_net_batch_t nm_rtnl = { .rth.sd = -1 };
+static nm_net_links_t nm_links = {
+    .rth.sd = -1,
+    .links = { 0, 0, sizeof(nm_net_link_t), NULL, NULL }
+};
+
 static void nm_net_set_link_status(const nm_str_t *name, int action);
-static void nm_net_rtnl_open(struct rtnl_handle *rth);
-static void nm_net_rtnl_talk(struct rtnl_handle *rth, struct nlmsghdr *n,
-                             struct nlmsghdr *res, size_t res_len);
+static void nm_net_rtnl_open(struct rtnl_handle *rth, uint32_t groups);
+static void nm_net_rtnl_talk(struct nlmsghdr *n);
+static void nm_net_rtnl_flush(void);
+static const nm_net_link_t *nm_net_link_get(const char *name);
+static void nm_net_links_update(void);
+static int nm_net_links_dump(void);
+static int nm_net_links_read(int flags, uint32_t dump_seq);
+static void nm_net_links_msg(const struct nlmsghdr *nh);
+static nm_net_link_t *nm_net_links_find(uint32_t index);
+static void nm_net_links_add(const char *name, uint32_t index, uint32_t flags);
+static void nm_net_links_chain(size_t pos);
+static void nm_net_links_rebuild(void);
+static size_t nm_net_hash_name(const char *name);
+static size_t nm_net_hash_index(uint32_t index);
 static int nm_net_add_attr(struct nlmsghdr *n, size_t mlen,
                            int type, const void *data, size_t dlen);
 static struct rtattr *nm_net_add_attr_nest(struct nlmsghdr *n, size_t mlen,
@@ -102,7 +167,7 @@ static void nm_net_addr_change(const nm_str_t *name, const nm_str_t *net,
 
 int nm_net_iface_exists(const nm_str_t *name)
 {
-    if (if_nametoindex(name->data) == 0)
+    if (nm_net_iface_idx(name) == 0)
         return NM_ERR;
 
     return NM_OK;
@@ -110,9 +175,53 @@ int nm_net_iface_exists(const nm_str_t *name)
 
 uint32_t nm_net_iface_idx(const nm_str_t *name)
 {
+#if defined (NM_OS_LINUX)
+    const nm_net_link_t *link = nm_net_link_get(name->data);
+
+    return link ? link->index : 0;
+#else
     return if_nametoindex(name->data);
+#endif
 }
 
+#if defined (NM_OS_LINUX)
+void nm_net_batch_begin(void)
+{
+    nm_rtnl.depth++;
+}
+
+void nm_net_batch_end(void)
+{
+    if (nm_rtnl.depth <= 0)
+        nm_bug("%s: no batch started", __func__);
+
+    if (--nm_rtnl.depth == 0)
+        nm_net_rtnl_flush();
+}
+
+void nm_net_free(void)
+{
+    nm_net_rtnl_flush();
+
+    if (nm_rtnl.rth.sd != -1)
+    {
+        close(nm_rtnl.rth.sd);
+        nm_rtnl.rth.sd = -1;
+    }
+    if (nm_links.rth.sd != -1)
+    {
+        close(nm_links.rth.sd);
+        nm_links.rth.sd = -1;
+    }
+
+    nm_arr_free(&nm_links.links, NULL);
+    free(nm_links.by_name);
+    free(nm_links.by_index);
+    nm_links.by_name = nm_links.by_index = NULL;
+    nm_links.size = nm_links.holes = 0;
+}
+#endif /* NM_OS_LINUX */
+
 void nm_net_add_tap(const nm_str_t *name)
 {
     nm_net_manage_tap(name, NM_TAP_ON);
@@ -128,7 +237,6 @@ void nm_net_add_macvtap(const nm_str_t *name, const nm_str_t *parent,
                         const nm_str_t *maddr, int type)
 {
     struct iplink_req req;
-    struct rtnl_handle rth;
     struct rtattr *linkinfo, *data;
     uint32_t dev_index, mode = 0;
     size_t mac_len;
@@ -136,8 +244,8 @@ void nm_net_add_macvtap(const nm_str_t *name, const nm_str_t *parent,
 
     memset(&req, 0, sizeof(req));
 
-    if ((dev_index = if_nametoindex(parent->data)) == 0)
-        nm_bug("%s: if_nametoindex: %s", __func__, strerror(errno));
+    if ((dev_index = nm_net_iface_idx(parent)) == 0)
+        nm_bug("%s: %s: no such interface", __func__, parent->data);
 
     req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
     req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
@@ -191,15 +299,12 @@ void nm_net_add_macvtap(const nm_str_t *name, const nm_str_t *parent,
     nm_net_add_attr_nest_end(&req.n, data);
     nm_net_add_attr_nest_end(&req.n, linkinfo);
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    nm_net_rtnl_talk(&req.n);
 }
 
 void nm_net_add_veth(const nm_str_t *l_name, const nm_str_t *r_name)
 {
     struct iplink_req req;
-    struct rtnl_handle rth;
     struct rtattr *linkinfo, *data;
 
     memset(&req, 0, sizeof(req));
@@ -264,32 +369,29 @@ void nm_net_add_veth(const nm_str_t *l_name, const nm_str_t *r_name)
     nm_net_add_attr_nest_end(&req.n, data);
     nm_net_add_attr_nest_end(&req.n, linkinfo);
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    nm_net_rtnl_talk(&req.n);
 }
 
+/* Link is given by name, so it can be created in the same batch */
 void nm_net_del_iface(const nm_str_t *name)
 {
     struct iplink_req req;
-    struct rtnl_handle rth;
-    uint32_t dev_index;
 
     memset(&req, 0, sizeof(req));
 
-    if ((dev_index = if_nametoindex(name->data)) == 0)
-        nm_bug("%s: if_nametoindex: %s", __func__, strerror(errno));
-
     req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
     req.n.nlmsg_flags = NLM_F_REQUEST;
     req.n.nlmsg_type = RTM_DELLINK;
 
     req.i.ifi_family = AF_UNSPEC;
-    req.i.ifi_index = dev_index;
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    if ((nm_net_add_attr(&req.n, sizeof(req), IFLA_IFNAME,
+            name->data, name->len + 1) != NM_OK))
+    {
+        nm_bug("%s: Error add_attr", __func__);
+    }
+
+    nm_net_rtnl_talk(&req.n);
 }
 #endif /* NM_OS_LINUX */
 
@@ -301,8 +403,6 @@ void nm_net_set_ipaddr(const nm_str_t *name, const nm_str_t *addr)
 void nm_net_set_altname(const nm_str_t *name, const nm_str_t *altname)
 {
 #if defined (NM_WITH_NEWLINKPROP)
-    uint32_t dev_index;
-    struct rtnl_handle rth;
     struct rtattr *props;
     struct iplink_req req = {
         .n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
@@ -316,13 +416,13 @@ void nm_net_set_altname(const nm_str_t *name, const nm_str_t *altname)
             altname->data, altname->len + 1);
     nm_net_add_attr_nest_end(&req.n, props);
 
-    if ((dev_index = if_nametoindex(name->data)) == 0)
-        nm_bug("%s: if_nametoindex: %s", __func__, strerror(errno));
-    req.i.ifi_index = dev_index;
+    if ((nm_net_add_attr(&req.n, sizeof(req), IFLA_IFNAME,
+            name->data, name->len + 1) != NM_OK))
+    {
+        nm_bug("%s: Error add_attr", __func__);
+    }
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    nm_net_rtnl_talk(&req.n);
 #else
     (void) name;
     (void) altname;
@@ -526,12 +626,12 @@ static void nm_net_manage_tap(const nm_str_t *name, int on_off)
 }
 
 #if defined (NM_OS_LINUX)
-static void nm_net_rtnl_open(struct rtnl_handle *rth)
+static void nm_net_rtnl_open(struct rtnl_handle *rth, uint32_t groups)
 {
     memset(rth, 0, sizeof(*rth));
 
     rth->sa.nl_family = AF_NETLINK;
-    rth->sa.nl_groups = 0;
+    rth->sa.nl_groups = groups;
 
     if ((rth->sd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) == -1)
         nm_bug("%s: cannot open netlink socket: %s", __func__, strerror(errno));
@@ -542,6 +642,14 @@ static void nm_net_rtnl_open(struct rtnl_handle *rth)
         nm_bug("%s: cannot bind netlink socket: %s", __func__, strerror(errno));
     }
 
+#if defined (NETLINK_CAP_ACK)
+    {
+        /* error ACK does not carry the whole request back */
+        int on = 1;
+        setsockopt(rth->sd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+    }
+#endif
+
     rth->seq = time(NULL);
 }
 
@@ -583,57 +691,94 @@ static int nm_net_add_attr_nest_end(struct nlmsghdr *n, struct rtattr *nest)
     return n->nlmsg_len;
 }
 
-static void nm_net_rtnl_talk(struct rtnl_handle *rth, struct nlmsghdr *n,
-                             struct nlmsghdr *res, size_t res_len)
+static void nm_net_rtnl_talk(struct nlmsghdr *n)
 {
-    ssize_t len;
-    struct sockaddr_nl sa;
-    struct iovec iov;
-    struct msghdr msg;
-    struct nlmsghdr *nh;
-    char buf[16384] = {0};
+    nm_net_batch_t *b = &nm_rtnl;
+    size_t len = NLMSG_ALIGN(n->nlmsg_len);
 
-    iov.iov_base = (void *) n;
-    iov.iov_len = n->nlmsg_len;
+    if (len > sizeof(b->buf))
+        nm_bug("%s: message is too long: %zu", __func__, len);
 
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sa;
-    msg.msg_namelen = sizeof(sa);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
+    if ((b->len + len > sizeof(b->buf)) ||
+        (b->len && b->rth.seq - b->first_seq + 1 >= NM_NET_BATCH_MSGS))
+    {
+        nm_net_rtnl_flush();
+    }
 
-    memset(&sa, 0, sizeof(sa));
-    sa.nl_family = AF_NETLINK;
+    if (b->rth.sd == -1)
+        nm_net_rtnl_open(&b->rth, 0);
 
     n->nlmsg_flags |= NLM_F_ACK;
-    n->nlmsg_seq = ++rth->seq;
+    n->nlmsg_seq = ++b->rth.seq;
+    if (!b->len)
+        b->first_seq = n->nlmsg_seq;
+
+    memset(b->buf + b->len, 0, len);
+    memcpy(b->buf + b->len, n, n->nlmsg_len);
+    b->len += len;
 
-    if ((len = sendmsg(rth->sd, &msg, 0)) < 0)
-        nm_bug("%s: cannot talk to rtnetlink", __func__);
+    if (!b->depth)
+        nm_net_rtnl_flush();
+}
+
+static void nm_net_rtnl_flush(void)
+{
+    nm_net_batch_t *b = &nm_rtnl;
+    uint32_t first = b->first_seq, last = b->rth.seq;
+    nm_trace_span_t span;
+    size_t acks = 0;
+    struct sockaddr_nl sa;
+    char buf[NM_NET_READLEN]
+        __attribute__ ((aligned(NLMSG_ALIGNTO)));
 
-    memset(buf, 0, sizeof(buf));
+    if (!b->len)
+        return;
 
-    iov.iov_base = buf;
-    iov.iov_len = sizeof(buf);
+    span = nm_trace_begin();
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
 
-    len = recvmsg(rth->sd, &msg, 0);
+    if (sendto(b->rth.sd, b->buf, b->len, 0,
+            (struct sockaddr *) &sa, sizeof(sa)) != (ssize_t) b->len)
+    {
+        nm_bug("%s: cannot talk to rtnetlink: %s", __func__, strerror(errno));
+    }
+    b->len = 0;
 
-    for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len);
-         nh = NLMSG_NEXT(nh, len))
+    while (acks < (size_t) (last - first) + 1)
     {
-        if (nh->nlmsg_type == NLMSG_DONE)
-            return;
-        if (nh->nlmsg_type == NLMSG_ERROR)
+        struct nlmsghdr *nh;
+        ssize_t len = recv(b->rth.sd, buf, sizeof(buf), 0);
+
+        if (len < 0)
         {
-            struct nlmsgerr *nlerr = (struct nlmsgerr *) NLMSG_DATA(nh);
-            if (!nlerr->error)
-                return;
-            nm_bug("%s: RTNETLINK answers: %s",
-                __func__, strerror(-nlerr->error));
+            if (errno == EINTR)
+                continue;
+            nm_bug("%s: cannot read rtnetlink: %s", __func__, strerror(errno));
+        }
+
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len);
+             nh = NLMSG_NEXT(nh, len))
+        {
+            struct nlmsgerr *nlerr;
+
+            if (nh->nlmsg_type != NLMSG_ERROR ||
+                nh->nlmsg_seq - first > last - first)
+            {
+                continue;
+            }
+
+            nlerr = (struct nlmsgerr *) NLMSG_DATA(nh);
+            if (nlerr->error)
+            {
+                nm_bug("%s: RTNETLINK answers: %s",
+                    __func__, strerror(-nlerr->error));
+            }
+            acks++;
         }
-        if (res)
-            memcpy(res, nh, nm_min(res_len, nh->nlmsg_len));
     }
+
+    nm_trace_end(span, "netlink: %zu requests", acks);
 }
 
 void nm_net_link_up(const nm_str_t *name)
@@ -647,71 +792,337 @@ void nm_net_link_down(const nm_str_t *name)
 }
 
 int nm_net_link_status(const nm_str_t *name)
+{
+    const nm_net_link_t *link = nm_net_link_get(name->data);
+
+    if (!link || !(link->flags & IFF_UP))
+        return NM_ERR;
+
+    return NM_OK;
+}
+
+/* Link is given by name, so it can be created in the same batch */
+static void nm_net_set_link_status(const nm_str_t *name, int action)
 {
     struct iplink_req req;
-    struct rtnl_handle rth;
-    struct {
-        struct nlmsghdr n;
-        char buf[16384];
-    } result;
 
     memset(&req, 0, sizeof(req));
 
     req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
     req.n.nlmsg_flags = NLM_F_REQUEST;
-    req.n.nlmsg_type = RTM_GETLINK;
+    req.n.nlmsg_type = RTM_NEWLINK;
+
     req.i.ifi_family = AF_UNSPEC;
+    req.i.ifi_change |= IFF_UP;
 
     if ((nm_net_add_attr(&req.n, sizeof(req), IFLA_IFNAME,
-            name->data, name->len) != NM_OK))
+            name->data, name->len + 1) != NM_OK))
     {
         nm_bug("%s: Error add_attr", __func__);
     }
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, &result.n, sizeof(result));
-    close(rth.sd);
+    switch (action) {
+    case NM_SET_LINK_UP:
+        req.i.ifi_flags |= IFF_UP;
+        break;
+    case NM_SET_LINK_DOWN:
+        req.i.ifi_flags &= ~IFF_UP;
+        break;
+    }
+
+    nm_net_rtnl_talk(&req.n);
+}
+
+static const nm_net_link_t *nm_net_link_get(const char *name)
+{
+    nm_net_links_update();
+
+    if (!nm_links.size)
+        return NULL;
 
+    for (size_t n = nm_links.by_name[nm_net_hash_name(name)];
+         n != NM_NET_LINK_END;)
     {
-        struct ifinfomsg *ifi = NLMSG_DATA(&result.n);
-        if (!(ifi->ifi_flags & IFF_UP))
-            return NM_ERR;
+        const nm_net_link_t *link = nm_arr_at(&nm_links.links, n);
+
+        if (link->index && strncmp(link->name, name, IFNAMSIZ) == 0)
+            return link;
+
+        n = link->next_name;
     }
 
-    return NM_OK;
+    return NULL;
 }
 
-static void nm_net_set_link_status(const nm_str_t *name, int action)
+/* Queued requests are sent first, their events are read with the rest */
+static void nm_net_links_update(void)
+{
+    nm_net_rtnl_flush();
+
+    if (nm_links.rth.sd == -1)
+    {
+        int rcvbuf = NM_NET_LINKS_RCVBUF;
+
+        nm_net_rtnl_open(&nm_links.rth, RTMGRP_LINK);
+        setsockopt(nm_links.rth.sd, SOL_SOCKET, SO_RCVBUF,
+                &rcvbuf, sizeof(rcvbuf));
+    }
+    else if (nm_net_links_read(MSG_DONTWAIT, 0) == NM_OK)
+    {
+        return;
+    }
+
+    /* events were lost or table is not loaded yet */
+    while (nm_net_links_dump() != NM_OK)
+        ;
+}
+
+static int nm_net_links_dump(void)
 {
     struct iplink_req req;
-    struct rtnl_handle rth;
-    uint32_t dev_index;
 
     memset(&req, 0, sizeof(req));
 
-    if ((dev_index = if_nametoindex(name->data)) == 0)
-        nm_bug("%s: if_nametoindex: %s", __func__, strerror(errno));
-
     req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    req.n.nlmsg_flags = NLM_F_REQUEST;
-    req.n.nlmsg_type = RTM_NEWLINK;
-
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.n.nlmsg_type = RTM_GETLINK;
+    req.n.nlmsg_seq = ++nm_links.rth.seq;
     req.i.ifi_family = AF_UNSPEC;
-    req.i.ifi_index = dev_index;
-    req.i.ifi_change |= IFF_UP;
 
-    switch (action) {
-    case NM_SET_LINK_UP:
-        req.i.ifi_flags |= IFF_UP;
-        break;
-    case NM_SET_LINK_DOWN:
-        req.i.ifi_flags &= ~IFF_UP;
-        break;
+#if defined (RTEXT_FILTER_SKIP_STATS)
+    {
+        uint32_t mask = RTEXT_FILTER_SKIP_STATS;
+
+        if ((nm_net_add_attr(&req.n, sizeof(req), IFLA_EXT_MASK,
+                &mask, sizeof(mask)) != NM_OK))
+        {
+            nm_bug("%s: Error add_attr", __func__);
+        }
+    }
+#endif
+
+    nm_arr_clear(&nm_links.links, NULL);
+    nm_net_links_rebuild();
+
+    /* queued events are older than dump, they are dropped */
+    for (;;)
+    {
+        char buf[NM_NET_READLEN];
+
+        if (recv(nm_links.rth.sd, buf, sizeof(buf), MSG_DONTWAIT) < 0 &&
+            errno != ENOBUFS && errno != EINTR)
+        {
+            break;
+        }
+    }
+
+    if (send(nm_links.rth.sd, &req, req.n.nlmsg_len, 0) != (ssize_t) req.n.nlmsg_len)
+        nm_bug("%s: cannot talk to rtnetlink: %s", __func__, strerror(errno));
+
+    return nm_net_links_read(0, req.n.nlmsg_seq);
+}
+
+/* Events are read until socket is empty, or until end of dump
+ * if dump_seq is set. NM_ERR means the table must be dumped again. */
+static int nm_net_links_read(int flags, uint32_t dump_seq)
+{
+    static char buf[NM_NET_READLEN]
+        __attribute__ ((aligned(NLMSG_ALIGNTO)));
+    int intr = 0;
+
+    for (;;)
+    {
+        struct nlmsghdr *nh;
+        ssize_t len = recv(nm_links.rth.sd, buf, sizeof(buf), flags);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return NM_OK;
+            if (errno == ENOBUFS)
+                return NM_ERR;
+            nm_bug("%s: cannot read rtnetlink: %s", __func__, strerror(errno));
+        }
+
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len);
+             nh = NLMSG_NEXT(nh, len))
+        {
+            if (dump_seq && nh->nlmsg_seq == dump_seq)
+            {
+                if (nh->nlmsg_flags & NLM_F_DUMP_INTR)
+                    intr = 1;
+                if (nh->nlmsg_type == NLMSG_DONE)
+                    return intr ? NM_ERR : NM_OK;
+                if (nh->nlmsg_type == NLMSG_ERROR)
+                {
+                    struct nlmsgerr *nlerr = NLMSG_DATA(nh);
+                    nm_bug("%s: RTNETLINK answers: %s",
+                        __func__, strerror(-nlerr->error));
+                }
+            }
+
+            nm_net_links_msg(nh);
+        }
+    }
+}
+
+static void nm_net_links_msg(const struct nlmsghdr *nh)
+{
+    const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    const char *name = NULL;
+    nm_net_link_t *link;
+    struct rtattr *rta;
+    int len;
+
+    if ((nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) ||
+        nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)) || ifi->ifi_index <= 0)
+    {
+        return;
+    }
+
+    len = IFLA_PAYLOAD(nh);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if (rta->rta_type == IFLA_IFNAME)
+        {
+            name = RTA_DATA(rta);
+            break;
+        }
     }
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    link = nm_net_links_find(ifi->ifi_index);
+
+    if (link && nh->nlmsg_type == RTM_NEWLINK && name &&
+        strncmp(link->name, name, IFNAMSIZ) == 0)
+    {
+        link->flags = ifi->ifi_flags;
+        return;
+    }
+
+    /* link is removed or renamed */
+    if (link)
+    {
+        link->index = 0;
+        nm_links.holes++;
+    }
+
+    if (nh->nlmsg_type == RTM_NEWLINK && name)
+        nm_net_links_add(name, ifi->ifi_index, ifi->ifi_flags);
+    else if (nm_links.holes > nm_links.links.n_memb / 2)
+        nm_net_links_rebuild();
+}
+
+static nm_net_link_t *nm_net_links_find(uint32_t index)
+{
+    if (!nm_links.size)
+        return NULL;
+
+    for (size_t n = nm_links.by_index[nm_net_hash_index(index)];
+         n != NM_NET_LINK_END;)
+    {
+        nm_net_link_t *link = nm_arr_at(&nm_links.links, n);
+
+        if (link->index == index)
+            return link;
+
+        n = link->next_index;
+    }
+
+    return NULL;
+}
+
+static void nm_net_links_add(const char *name, uint32_t index, uint32_t flags)
+{
+    nm_net_link_t link;
+
+    memset(&link, 0, sizeof(link));
+    nm_strlcpy(link.name, name, sizeof(link.name));
+    link.index = index;
+    link.flags = flags;
+
+    nm_arr_push(&nm_links.links, &link);
+
+    /* at least two buckets per unit */
+    if (nm_links.links.n_memb * 2 > nm_links.size ||
+        nm_links.holes > nm_links.links.n_memb / 2)
+    {
+        nm_net_links_rebuild();
+        return;
+    }
+
+    nm_net_links_chain(nm_links.links.n_memb - 1);
+}
+
+static void nm_net_links_chain(size_t pos)
+{
+    nm_net_link_t *link = nm_arr_at(&nm_links.links, pos);
+    size_t name_bucket = nm_net_hash_name(link->name);
+    size_t index_bucket = nm_net_hash_index(link->index);
+
+    link->next_name = nm_links.by_name[name_bucket];
+    nm_links.by_name[name_bucket] = pos;
+    link->next_index = nm_links.by_index[index_bucket];
+    nm_links.by_index[index_bucket] = pos;
+}
+
+/* Holes are removed and hashes are filled again */
+static void nm_net_links_rebuild(void)
+{
+    nm_arr_t *links = &nm_links.links;
+    size_t size = NM_NET_LINKS_MIN;
+    size_t live = 0;
+
+    for (size_t n = 0; n < links->n_memb; n++)
+    {
+        nm_net_link_t *link = nm_arr_at(links, n);
+
+        if (!link->index)
+            continue;
+        if (live != n)
+            memcpy(nm_arr_at(links, live), link, sizeof(*link));
+        live++;
+    }
+    links->n_memb = live;
+    nm_links.holes = 0;
+
+    while (size < live * 4)
+        size *= 2;
+
+    if (size != nm_links.size)
+    {
+        free(nm_links.by_name);
+        free(nm_links.by_index);
+        nm_links.by_name = nm_alloc(size * sizeof(size_t));
+        nm_links.by_index = nm_alloc(size * sizeof(size_t));
+        nm_links.size = size;
+    }
+
+    for (size_t n = 0; n < size; n++)
+        nm_links.by_name[n] = nm_links.by_index[n] = NM_NET_LINK_END;
+
+    for (size_t n = 0; n < live; n++)
+        nm_net_links_chain(n);
+}
+
+/* FNV-1a */
+static size_t nm_net_hash_name(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    for (size_t n = 0; n < IFNAMSIZ && name[n]; n++)
+    {
+        hash ^= (unsigned char) name[n];
+        hash *= 16777619U;
+    }
+
+    return hash & (nm_links.size - 1);
+}
+
+static size_t nm_net_hash_index(uint32_t index)
+{
+    return ((index * 0x9e3779b1U) >> 8) & (nm_links.size - 1);
 }
 #endif /* NM_OS_LINUX */
 
@@ -720,13 +1131,12 @@ static void nm_net_addr_change(const nm_str_t *name, const nm_str_t *src,
 {
 #if defined (NM_OS_LINUX)
     struct ipaddr_req req;
-    struct rtnl_handle rth;
     uint32_t dev_index;
 
     memset(&req, 0, sizeof(req));
 
-    if ((dev_index = if_nametoindex(name->data)) == 0)
-        nm_bug("%s: if_nametoindex: %s", __func__, strerror(errno));
+    if ((dev_index = nm_net_iface_idx(name)) == 0)
+        nm_bug("%s: %s: no such interface", __func__, name->data);
 
     req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
     req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
@@ -765,9 +1175,7 @@ static void nm_net_addr_change(const nm_str_t *name, const nm_str_t *src,
         break;
     }
 
-    nm_net_rtnl_open(&rth);
-    nm_net_rtnl_talk(&rth, &req.n, NULL, 0);
-    close(rth.sd);
+    nm_net_rtnl_talk(&req.n);
 #else
     (void) name;
     (void) action;
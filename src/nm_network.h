@@ -23,6 +23,10 @@ void nm_net_add_veth(const nm_str_t *l_name, const nm_str_t *r_name);
 void nm_net_link_up(const nm_str_t *name);
 void nm_net_link_down(const nm_str_t *name);
 int nm_net_link_status(const nm_str_t *name);
+/* Requests made between begin and end are sent at once */
+void nm_net_batch_begin(void);
+void nm_net_batch_end(void);
+void nm_net_free(void);
 #endif
 void nm_net_add_tap(const nm_str_t *name);
 void nm_net_del_tap(const nm_str_t *name);
@@ -22,12 +22,15 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 
-enum {NM_BLOCK_SIZE = 10240};
-static const char NM_OVA_DIR_TEMPL[] = "/tmp/ova_extract_XXXXXX";
+enum {
+    NM_BLOCK_SIZE = 10240,
+    NM_OVA_MAGIC_LEN = 512,
+};
 
 static const char NM_OVF_FORM_PATH[] = "Path to OVA";
 static const char NM_OVF_FORM_ARCH[] = "Architecture";
 static const char NM_OVF_FORM_NAME[] = "Name (optional)";
+static const char NM_OVF_FORM_PLACE[] = "Run in place";
 static const char NM_XML_OVF_NS[]    = "ovf";
 static const char NM_XML_RASD_NS[]   = "rasd";
 static const char NM_XML_OVF_HREF[]  = "http://schemas.dmtf.org/ovf/envelope/1";
@@ -74,17 +77,40 @@ enum {
     NM_OVA_FLD_SRC = 0,
     NM_OVA_FLD_ARCH,
     NM_OVA_FLD_NAME,
+    NM_OVA_FLD_PLACE,
     NM_OVA_FLD_COUNT
 };
 
 static const char *nm_form_msg[] = {
     NM_OVF_FORM_PATH, NM_OVF_FORM_ARCH,
-    NM_OVF_FORM_NAME, NULL
+    NM_OVF_FORM_NAME, NM_OVF_FORM_PLACE, NULL
 };
 
 typedef struct archive nm_archive_t;
 typedef struct archive_entry nm_archive_entry_t;
 
+/* OVA is uncompressed tar, each file is stored contiguously,
+ * so disks are read by QEMU directly from the archive */
+typedef struct {
+    nm_str_t name;
+    int64_t offset; /* data offset in OVA file */
+    int64_t size;
+} nm_ova_entry_t;
+
+/* disk image formats that can be found in OVA */
+static const struct {
+    const char *magic;
+    size_t off;
+    size_t len;
+    const char *fmt;
+} nm_ova_formats[] = {
+    { "KDMV",               0,    4, "vmdk"  },
+    { "QFI\xfb",            0,    4, "qcow2" },
+    { "vhdxfile",           0,    8, "vhdx"  },
+    { "conectix",           0,    8, "vpc"   },
+    { "\x7f\x10\xda\xbe",   0x40, 4, "vdi"   },
+};
+
 typedef xmlChar nm_xml_char_t;
 typedef xmlDocPtr nm_xml_doc_pt;
 typedef xmlNodePtr nm_xml_node_pt;
@@ -95,12 +121,14 @@ typedef xmlXPathContextPtr nm_xml_xpath_ctx_pt;
 void nm_drive_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_drive_vect_free_cb(void *unit_p);
 
-static int nm_clean_temp_dir(const char *tmp_dir, const nm_vect_t *files);
-static void nm_archive_copy_data(nm_archive_t *in, nm_archive_t *out);
-static void nm_ovf_extract(const nm_str_t *ova_path, const char *tmp_dir,
-                           nm_vect_t *files);
-static const char *nm_find_ovf(const nm_vect_t *files);
-static nm_xml_doc_pt nm_ovf_open(const char *tmp_dir, const char *ovf_file);
+static int nm_ova_scan(const nm_str_t *ova_path, nm_str_t *ovf,
+                       nm_arr_t *entries);
+static int64_t nm_ova_position(nm_archive_t *in);
+static const nm_ova_entry_t *nm_ova_find(const nm_arr_t *entries,
+                                         const nm_str_t *name);
+static const char *nm_ova_format(int fd, const nm_ova_entry_t *entry);
+static void nm_ova_entry_free_cb(void *unit_p);
+static nm_xml_doc_pt nm_ovf_open(const nm_str_t *ovf);
 static int nm_register_xml_ns(nm_xml_xpath_ctx_pt ctx);
 static int __nm_register_xml_ns(nm_xml_xpath_ctx_pt ctx, const char *ns,
                                 const char *href);
@@ -115,8 +143,15 @@ static uint32_t nm_ovf_get_usb(nm_xml_xpath_ctx_pt ctx);
 static void nm_ovf_get_text(nm_str_t *res, nm_xml_xpath_ctx_pt ctx,
                             const char *xpath, const char *param);
 static inline void nm_drive_free(nm_drive_t *d);
-static void nm_ovf_convert_drives(const nm_vect_t *drives, const nm_str_t *name,
-                                  const char *templ_path);
+static int nm_ovf_convert_drives(nm_vect_t *drives, const nm_str_t *name,
+                                 const nm_str_t *ova_path,
+                                 const nm_arr_t *entries, int in_place);
+static void nm_ovf_drive_argv(nm_argv_t *argv, const nm_str_t *ova_path,
+                              const nm_ova_entry_t *entry, const char *fmt,
+                              const char *dst, int in_place);
+static void nm_ovf_drive_source(nm_drive_t *drive, const nm_str_t *ova_path,
+                                const nm_ova_entry_t *entry, const char *fmt);
+static void nm_ovf_json_str(nm_str_t *out, const char *str);
 static void nm_ovf_to_db(nm_vm_t *vm, const nm_vect_t *drives);
 static int nm_ova_get_data(nm_vm_t *vm);
 
@@ -124,9 +159,8 @@ static nm_field_t *fields[NM_OVA_FLD_COUNT + 1];
 
 void nm_ovf_import(void)
 {
-    char templ_path[sizeof(NM_OVA_DIR_TEMPL)];
-    const char *ovf_file;
-    nm_vect_t files = NM_INIT_VECT;
+    nm_str_t ovf = NM_INIT_STR;
+    nm_arr_t entries = NM_INIT_ARR(nm_ova_entry_t);
     nm_vect_t drives = NM_INIT_VECT;
     nm_vm_t vm = NM_INIT_VM;
     nm_xml_doc_pt doc = NULL;
@@ -134,12 +168,11 @@ void nm_ovf_import(void)
     nm_form_t *form = NULL;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
+    nm_str_t in_place = NM_INIT_STR;
     size_t msg_len;
     pthread_t spin_th;
     int done = 0;
 
-    strncpy(templ_path, NM_OVA_DIR_TEMPL, sizeof(templ_path));
-
     msg_len = nm_max_msg_len(nm_form_msg);
 
     if (nm_form_calc_size(msg_len, NM_OVA_FLD_COUNT, &form_data) != NM_OK)
@@ -160,7 +193,10 @@ void nm_ovf_import(void)
                    nm_cfg_get_arch(), false, false);
     set_field_type(fields[NM_OVA_FLD_NAME], TYPE_REGEXP,
                    "^[a-zA-Z0-9_-]{1,30} *$");
+    set_field_type(fields[NM_OVA_FLD_PLACE], TYPE_ENUM,
+                   nm_form_yes_no, false, false);
     set_field_buffer(fields[NM_OVA_FLD_ARCH], 0, *nm_cfg_get()->qemu_targets.data);
+    set_field_buffer(fields[NM_OVA_FLD_PLACE], 0, nm_form_yes_no[1]);
     field_opts_off(fields[NM_OVA_FLD_SRC], O_STATIC);
     field_opts_off(fields[NM_OVA_FLD_NAME], O_STATIC);
 
@@ -177,25 +213,20 @@ void nm_ovf_import(void)
     if (nm_ova_get_data(&vm) != NM_OK)
         goto cancel;
 
+    nm_get_field_buf(fields[NM_OVA_FLD_PLACE], &in_place);
+
     sp_data.stop = &done;
 
     if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
         nm_bug(_("%s: cannot create thread"), __func__);
 
-    if (mkdtemp(templ_path) == NULL)
-        nm_bug("%s: mkdtemp error: %s", __func__, strerror(errno));
-
-    nm_ovf_extract(&vm.srcp, templ_path, &files);
-
-    if ((ovf_file = nm_find_ovf(&files)) == NULL)
+    if (nm_ova_scan(&vm.srcp, &ovf, &entries) != NM_OK)
     {
         nm_warn(_(NM_MSG_OVF_MISS));
         goto out;
     }
 
-    nm_debug("ova: ovf file found: %s\n", ovf_file);
-
-    if ((doc = nm_ovf_open(templ_path, ovf_file)) == NULL)
+    if ((doc = nm_ovf_open(&ovf)) == NULL)
     {
         nm_warn(_(NM_MSG_OVF_EPAR));
         goto out;
@@ -225,7 +256,13 @@ void nm_ovf_import(void)
     if (nm_form_name_used(&vm.name) != NM_OK)
         goto out;
 
-    nm_ovf_convert_drives(&drives, &vm.name, templ_path);
+    if (nm_ovf_convert_drives(&drives, &vm.name, &vm.srcp, &entries,
+            nm_str_cmp_st(&in_place, "yes") == NM_OK) != NM_OK)
+    {
+        nm_warn(_(NM_MSG_OVA_CONV));
+        goto out;
+    }
+
     nm_ovf_to_db(&vm, &drives);
 
 out:
@@ -233,51 +270,45 @@ out:
     if (pthread_join(spin_th, NULL) != 0)
         nm_bug(_("%s: cannot join thread"), __func__);
 
-    if (nm_clean_temp_dir(templ_path, &files) != NM_OK)
-        nm_warn(_(NM_MSG_INC_DEL));
-
     xmlXPathFreeContext(xpath_ctx);
     xmlFreeDoc(doc);
     xmlCleanupParser();
 
-    nm_vect_free(&files, NULL);
+    nm_str_free(&ovf);
+    nm_arr_free(&entries, nm_ova_entry_free_cb);
     nm_vect_free(&drives, nm_drive_vect_free_cb);
 
 cancel:
     NM_FORM_EXIT();
     nm_form_free(form, fields);
+    nm_str_free(&in_place);
     nm_vm_free(&vm);
     delwin(form_data.form_window);
 }
 
-static void nm_ovf_extract(const nm_str_t *ova_path, const char *tmp_dir,
-                           nm_vect_t *files)
+/* Only headers are read, data of disks is skipped.
+ * Descriptor is the first .ovf file, it is loaded to memory. */
+static int nm_ova_scan(const nm_str_t *ova_path, nm_str_t *ovf,
+                       nm_arr_t *entries)
 {
-    nm_archive_t *in, *out;
+    nm_archive_t *in;
     nm_archive_entry_t *ar_entry;
-    char cwd[PATH_MAX] = {0};
+    char buf[NM_BLOCK_SIZE];
     int rc;
 
     in = archive_read_new();
-    out = archive_write_disk_new();
-
-    archive_write_disk_set_options(out, 0);
     archive_read_support_format_tar(in);
 
     if (archive_read_open_filename(in, ova_path->data, NM_BLOCK_SIZE) != 0)
         nm_bug("%s: ovf read error: %s", __func__, archive_error_string(in));
 
-    /* save current working directory */
-    if (getcwd(cwd, sizeof(cwd)) == NULL)
-        nm_bug("%s: getcwd error: %s", __func__, strerror(errno));
-
-    /* change current working directory to temporary */
-    if (chdir(tmp_dir) == -1)
-        nm_bug("%s: chdir error: %s", __func__, strerror(errno));
-
     for (;;)
     {
+        nm_ova_entry_t entry;
         const char *file;
+        size_t len;
+        ssize_t nread;
+
         rc = archive_read_next_header(in, &ar_entry);
 
         if (rc == ARCHIVE_EOF)
@@ -286,112 +317,102 @@ static void nm_ovf_extract(const nm_str_t *ova_path, const char *tmp_dir,
         if (rc != ARCHIVE_OK)
             nm_bug("%s: bad archive: %s", __func__, archive_error_string(in));
 
+        if (archive_entry_filetype(ar_entry) != AE_IFREG)
+            continue;
+
         file = archive_entry_pathname(ar_entry);
+        len = strlen(file);
 
-        nm_vect_insert(files, file, strlen(file) + 1, NULL);
-        nm_debug("ova: extract file: %s\n", file);
+        memset(&entry, 0, sizeof(entry));
+        nm_str_alloc_text(&entry.name, file);
+        entry.offset = nm_ova_position(in);
+        entry.size = archive_entry_size(ar_entry);
+        nm_arr_push(entries, &entry);
 
-        rc = archive_write_header(out, ar_entry);
-        if (rc != ARCHIVE_OK)
-            nm_bug("%s: bad archive: %s", __func__, archive_error_string(in));
-        else
+        nm_debug("ova: file: %s offset: %" PRId64 " size: %" PRId64 "\n",
+                 file, entry.offset, entry.size);
+
+        if (ovf->len || len < 4 ||
+            nm_str_cmp_tt(file + (len - 4), ".ovf") != NM_OK)
         {
-            nm_archive_copy_data(in, out);
-            if (archive_write_finish_entry(out) != ARCHIVE_OK)
-            {
-                nm_bug("%s: archive_write_finish_entry: %s",
-                       __func__, archive_error_string(out));
-            }
+            continue;
         }
+
+        while ((nread = archive_read_data(in, buf, sizeof(buf))) > 0)
+            nm_str_add_text_part(ovf, buf, nread);
+
+        if (nread < 0)
+            nm_bug("%s: error read archive: %s", __func__, archive_error_string(in));
     }
 
     archive_read_free(in);
-    archive_write_free(out);
 
-    /* restore current working directory */
-    if (chdir(cwd) == -1)
-        nm_bug("%s: chdir error: %s", __func__, strerror(errno));
+    return ovf->len ? NM_OK : NM_ERR;
 }
 
-static void nm_archive_copy_data(nm_archive_t *in, nm_archive_t *out)
+/* After header is read archive position is the start of file data */
+static int64_t nm_ova_position(nm_archive_t *in)
 {
-    int rc;
-    const void *buf;
-    size_t size;
 #if ARCHIVE_VERSION_NUMBER >= 3000000
-    int64_t offset;
+    return archive_filter_bytes(in, 0);
 #else
-    off_t offset;
+    return archive_position_uncompressed(in);
 #endif
-
-    for (;;)
-    {
-        rc = archive_read_data_block(in, &buf, &size, &offset);
-        if (rc == ARCHIVE_EOF)
-            break;
-        if (rc != ARCHIVE_OK)
-            nm_bug("%s: error read archive: %s", __func__, archive_error_string(in));
-
-        if (archive_write_data_block(out, buf, size, offset) != ARCHIVE_OK)
-            nm_bug("%s: error write archive: %s", __func__, archive_error_string(out));
-    }
 }
 
-static int nm_clean_temp_dir(const char *tmp_dir, const nm_vect_t *files)
+static const nm_ova_entry_t *nm_ova_find(const nm_arr_t *entries,
+                                         const nm_str_t *name)
 {
-    nm_str_t path = NM_INIT_STR;
-    int rc = NM_OK;
-
-    for (size_t n = 0; n < files->n_memb; n++)
+    for (size_t n = 0; n < entries->n_memb; n++)
     {
-        nm_str_format(&path, "%s/%s", tmp_dir, (char *) nm_vect_at(files, n));
-
-        if (unlink(path.data) == -1)
-            rc = NM_ERR;
+        const nm_ova_entry_t *entry = nm_arr_at(entries, n);
 
-        nm_debug("ova: clean file: %s\n", path.data);
+        if (nm_str_cmp_ss(&entry->name, name) == NM_OK)
+            return entry;
     }
 
-    if (rc == NM_OK)
-    {
-        if (rmdir(tmp_dir) == -1)
-            rc = NM_ERR;
-    }
-
-    nm_str_free(&path);
-
-    return rc;
+    return NULL;
 }
 
-static const char *nm_find_ovf(const nm_vect_t *files)
+/* Format is detected here: image in the middle of archive
+ * cannot be probed by qemu-img */
+static const char *nm_ova_format(int fd, const nm_ova_entry_t *entry)
 {
-    for (size_t n = 0; n < files->n_memb; n++)
-    {
-        const char *file = nm_vect_at(files, n);
-        size_t len = strlen(file);
+    char buf[NM_OVA_MAGIC_LEN];
+    ssize_t nread;
+
+    nread = pread(fd, buf, sizeof(buf), entry->offset);
+    if (nread < 0)
+        return NULL;
+
+    if (nread > entry->size)
+        nread = entry->size;
 
-        if (len < 4)
+    for (size_t n = 0; n < nm_arr_len(nm_ova_formats); n++)
+    {
+        if ((size_t) nread < nm_ova_formats[n].off + nm_ova_formats[n].len)
             continue;
 
-        if (nm_str_cmp_tt(file + (len - 4), ".ovf") == NM_OK)
-            return file;
+        if (memcmp(buf + nm_ova_formats[n].off, nm_ova_formats[n].magic,
+                   nm_ova_formats[n].len) == 0)
+        {
+            return nm_ova_formats[n].fmt;
+        }
     }
 
-    return NULL;
+    return "raw";
 }
 
-static nm_xml_doc_pt nm_ovf_open(const char *tmp_dir, const char *ovf_file)
+static void nm_ova_entry_free_cb(void *unit_p)
 {
-    nm_xml_doc_pt doc = NULL;
-    nm_str_t ovf_path = NM_INIT_STR;
+    nm_ova_entry_t *entry = unit_p;
 
-    nm_str_format(&ovf_path, "%s/%s", tmp_dir, ovf_file);
-
-    doc = xmlParseFile(ovf_path.data);
-
-    nm_str_free(&ovf_path);
+    nm_str_free(&entry->name);
+}
 
-    return doc;
+static nm_xml_doc_pt nm_ovf_open(const nm_str_t *ovf)
+{
+    return xmlReadMemory(ovf->data, ovf->len, "descriptor.ovf", NULL, 0);
 }
 
 static int nm_register_xml_ns(nm_xml_xpath_ctx_pt ctx)
@@ -578,28 +599,57 @@ static void nm_ovf_get_text(nm_str_t *res, nm_xml_xpath_ctx_pt ctx,
 
 void nm_drive_vect_ins_cb(void *unit_p, const void *ctx)
 {
-    nm_str_copy(nm_drive_file(unit_p), nm_drive_file(ctx));
-    nm_str_copy(nm_drive_size(unit_p), nm_drive_size(ctx));
+    nm_drive_t *dst = unit_p;
+    const nm_drive_t *src = ctx;
+
+    nm_str_copy(&dst->file_name, &src->file_name);
+    nm_str_copy(&dst->capacity, &src->capacity);
+    nm_str_copy(&dst->ova_path, &src->ova_path);
+    nm_str_copy(&dst->ova_offset, &src->ova_offset);
+    nm_str_copy(&dst->ova_size, &src->ova_size);
+    nm_str_copy(&dst->ova_fmt, &src->ova_fmt);
 }
 
 void nm_drive_vect_free_cb(void *unit_p)
 {
-    nm_str_free(nm_drive_file(unit_p));
-    nm_str_free(nm_drive_size(unit_p));
+    nm_drive_free(unit_p);
 }
 
 static inline void nm_drive_free(nm_drive_t *d)
 {
     nm_str_free(&d->file_name);
     nm_str_free(&d->capacity);
+    nm_str_free(&d->ova_path);
+    nm_str_free(&d->ova_offset);
+    nm_str_free(&d->ova_size);
+    nm_str_free(&d->ova_fmt);
 }
 
-static void nm_ovf_convert_drives(const nm_vect_t *drives, const nm_str_t *name,
-                                  const char *templ_path)
+/* Disks are converted from OVA to VM directory, up to one qemu-img
+ * per CPU at once. If disks are run in place, only qcow2 overlays
+ * are created. On error all created images are removed. */
+static int nm_ovf_convert_drives(nm_vect_t *drives, const nm_str_t *name,
+                                 const nm_str_t *ova_path,
+                                 const nm_arr_t *entries, int in_place)
 {
     nm_str_t vm_dir = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
+    nm_argv_t argv = NM_INIT_ARGV;
+    size_t ndrives = drives->n_memb;
+    nm_spawn_t **procs = nm_calloc(ndrives, sizeof(nm_spawn_t *));
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t started = 0, waited = 0;
+    int rc = NM_OK;
+    int fd;
+
+    if (jobs < 1)
+        jobs = 1;
+
+    if ((fd = open(ova_path->data, O_RDONLY)) == -1)
+    {
+        nm_bug(_("%s: cannot open %s: %s"),
+               __func__, ova_path->data, strerror(errno));
+    }
 
     nm_str_format(&vm_dir, "%s/%s", nm_cfg_get()->vm_dir.data, name->data);
 
@@ -609,38 +659,131 @@ static void nm_ovf_convert_drives(const nm_vect_t *drives, const nm_str_t *name,
                __func__, vm_dir.data, strerror(errno));
     }
 
-    for (size_t n = 0; n < drives->n_memb; n++)
+    for (; started < ndrives && rc == NM_OK; started++)
     {
-        nm_str_alloc_text(&buf, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+        nm_drive_t *drive = drives->data[started];
+        const nm_ova_entry_t *entry = nm_ova_find(entries, &drive->file_name);
+        const char *fmt;
 
-        nm_vect_insert_cstr(&argv, "convert");
-        nm_vect_insert_cstr(&argv, "-O");
-        nm_vect_insert_cstr(&argv, "qcow2");
+        if (!entry || !(fmt = nm_ova_format(fd, entry)))
+        {
+            nm_debug("ova: %s is not found in archive\n",
+                     drive->file_name.data);
+            rc = NM_ERR;
+            break;
+        }
+
+        if (started - waited == (size_t) jobs)
+        {
+            if (nm_spawn_wait(procs[waited], NULL) != NM_OK)
+                rc = NM_ERR;
+            if (waited++, rc != NM_OK)
+                break;
+        }
 
-        nm_str_format(&buf, "%s/%s",
-            templ_path, (nm_drive_file(drives->data[n]))->data);
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+        if (in_place)
+            nm_ovf_drive_source(drive, ova_path, entry, fmt);
 
-        nm_str_format(&buf, "%s/%s",
-            vm_dir.data, (nm_drive_file(drives->data[n]))->data);
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+        nm_str_format(&buf, "%s/%s", vm_dir.data, drive->file_name.data);
+        nm_ovf_drive_argv(&argv, ova_path, entry, fmt, buf.data, in_place);
 
         nm_cmd_str(&buf, &argv);
         nm_debug("ova: exec: %s\n", buf.data);
 
-        nm_vect_end_zero(&argv);
-        if (nm_spawn_process(&argv, NULL) != NM_OK)
+        procs[started] = nm_spawn_start(&argv, 0, 0);
+        nm_argv_free(&argv);
+    }
+
+    /* running qemu-img are waited even after error */
+    for (; waited < started; waited++)
+    {
+        if (nm_spawn_wait(procs[waited], NULL) != NM_OK)
+            rc = NM_ERR;
+    }
+
+    if (rc != NM_OK)
+    {
+        for (size_t n = 0; n < started; n++)
         {
-            rmdir(vm_dir.data);
-            nm_bug(_("%s: cannot create image file"), __func__);
+            nm_str_format(&buf, "%s/%s",
+                vm_dir.data, nm_drive_file(drives->data[n])->data);
+            unlink(buf.data);
         }
-
-        nm_vect_free(&argv, NULL);
+        rmdir(vm_dir.data);
     }
 
+    close(fd);
+    free(procs);
     nm_str_free(&vm_dir);
     nm_str_free(&buf);
+
+    return rc;
+}
+
+/* Source is raw slice of OVA file:
+ * json:{"driver":"vmdk","file":{"driver":"raw","offset":N,"size":N,
+ *       "file":{"driver":"file","filename":"/path/vm.ova"}}}
+ * It is converted to qcow2 or becomes backing file of qcow2 overlay */
+static void nm_ovf_drive_argv(nm_argv_t *argv, const nm_str_t *ova_path,
+                              const nm_ova_entry_t *entry, const char *fmt,
+                              const char *dst, int in_place)
+{
+    nm_str_t src = NM_INIT_STR;
+
+    nm_str_format(&src, "json:{\"driver\":\"%s\",\"file\":{\"driver\":\"raw\","
+        "\"offset\":%" PRId64 ",\"size\":%" PRId64 ","
+        "\"file\":{\"driver\":\"file\",\"filename\":",
+        fmt, entry->offset, entry->size);
+    nm_ovf_json_str(&src, ova_path->data);
+    nm_str_add_text(&src, "}}}");
+
+    nm_argv_add(argv, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
+
+    if (in_place)
+    {
+        nm_argv_add(argv, "create");
+        nm_argv_add(argv, "-f");
+        nm_argv_add(argv, "qcow2");
+        nm_argv_add(argv, "-F");
+        nm_argv_add(argv, fmt);
+        nm_argv_add(argv, "-b");
+        nm_argv_add(argv, src.data);
+    }
+    else
+    {
+        nm_argv_add(argv, "convert");
+        nm_argv_add(argv, "-O");
+        nm_argv_add(argv, "qcow2");
+        nm_argv_add(argv, src.data);
+    }
+
+    nm_argv_add(argv, dst);
+
+    nm_str_free(&src);
+}
+
+/* Saved to database, QEMU gets the same source from nm_vmctl_gen_cmd() */
+static void nm_ovf_drive_source(nm_drive_t *drive, const nm_str_t *ova_path,
+                                const nm_ova_entry_t *entry, const char *fmt)
+{
+    nm_str_copy(&drive->ova_path, ova_path);
+    nm_str_format(&drive->ova_offset, "%" PRId64, entry->offset);
+    nm_str_format(&drive->ova_size, "%" PRId64, entry->size);
+    nm_str_alloc_text(&drive->ova_fmt, fmt);
+}
+
+static void nm_ovf_json_str(nm_str_t *out, const char *str)
+{
+    nm_str_add_char(out, '"');
+
+    for (const char *p = str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            nm_str_add_char(out, '\\');
+        nm_str_add_char(out, *p);
+    }
+
+    nm_str_add_char(out, '"');
 }
 
 static void nm_ovf_to_db(nm_vm_t *vm, const nm_vect_t *drives)
@@ -650,10 +793,12 @@ static void nm_ovf_to_db(nm_vm_t *vm, const nm_vect_t *drives)
 
     nm_str_alloc_text(&vm->ifs.driver, NM_DEFAULT_NETDRV);
 
+    nm_db_begin();
     nm_form_get_last(&last_mac, &last_vnc);
     nm_str_format(&vm->vncp, "%u", last_vnc);
 
     nm_add_vm_to_db(vm, last_mac, NM_IMPORT_VM, drives);
+    nm_db_commit();
 }
 
 static int nm_ova_get_data(nm_vm_t *vm)
@@ -7,12 +7,19 @@
 void nm_ovf_import(void);
 #endif
 
+/* ova_* are set if drive is run in place: overlay in VM directory
+ * is based on the disk image stored in OVA at ova_offset */
 typedef struct {
     nm_str_t file_name;
     nm_str_t capacity;
+    nm_str_t ova_path;
+    nm_str_t ova_offset;
+    nm_str_t ova_size;
+    nm_str_t ova_fmt;
 } nm_drive_t;
 
-#define NM_INIT_DRIVE (nm_drive_t) { NM_INIT_STR, NM_INIT_STR }
+#define NM_INIT_DRIVE (nm_drive_t) { NM_INIT_STR, NM_INIT_STR, \
+    NM_INIT_STR, NM_INIT_STR, NM_INIT_STR, NM_INIT_STR }
 
 static inline nm_str_t *nm_drive_file(const nm_drive_t *drive)
 {
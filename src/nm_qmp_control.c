@@ -1,12 +1,16 @@
 #include <nm_core.h>
 #include <nm_utils.h>
 #include <nm_string.h>
+#include <nm_vector.h>
 #include <nm_window.h>
 #include <nm_cfg_file.h>
+#include <nm_json.h>
+#include <nm_trace.h>
 #include <nm_usb_devices.h>
 #include <nm_qmp_control.h>
 
-#include <sys/time.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 
@@ -43,75 +47,140 @@ static const char NM_QMP_CMD_USB_DEL[] = \
         {"name": "dev2", "type": "child<usb-host>"}]}
 */
 
-enum {NM_QMP_READLEN = 1024};
+enum {NM_QMP_READLEN = 16384};
 
+/* Pooled sessions unused for this long are closed, so that
+ * other QMP clients (daemon, CLI) are not blocked by us */
+enum {NM_QMP_POOL_IDLE = 5};
+
+/* Messages are parsed as they arrive, parser state is kept
+ * between reads: session may have a part of event pending */
 typedef struct {
     int sd;
     struct sockaddr_un sock;
+    nm_json_parser_t json;
 } nm_qmp_handle_t;
 
 #define NM_INIT_QMP (nm_qmp_handle_t) { .sd = -1 }
 
+#define NM_QMP_ERR_LEN 160
+
+/* Command in flight. Reply is matched by id, so several commands
+ * can be sent at once and late reply of expired command is dropped. */
+typedef struct {
+    uint64_t id;
+    int64_t deadline; /* CLOCK_MONOTONIC, ms */
+    nm_trace_span_t span; /* round trip */
+    nm_qmp_cb_t cb;
+    void *ctx;
+    int done;
+    int answered;
+    int rc;
+    int quiet; /* qmp_capabilities: failure is reported by next command */
+    char err[NM_QMP_ERR_LEN]; /* desc of error reply, may be cut */
+} nm_qmp_req_t;
+
+/* One negotiated QMP session per VM. dev/ino identify the qmp.sock
+ * the session was opened on: if QEMU is restarted socket is recreated
+ * and session must be opened again */
+typedef struct {
+    nm_str_t name;
+    nm_qmp_handle_t qmp;
+    dev_t dev;
+    ino_t ino;
+    time_t used;
+    nm_arr_t reqs; /* nm_qmp_req_t */
+} nm_qmp_conn_t;
+
+#define NM_INIT_QMP_CONN (nm_qmp_conn_t) \
+    { NM_INIT_STR, NM_INIT_QMP, 0, 0, 0, NM_INIT_ARR(nm_qmp_req_t) }
+
+/* Result of synchronous call */
+typedef struct {
+    int done;
+    int rc;
+} nm_qmp_sync_t;
+
+#define NM_INIT_QMP_SYNC (nm_qmp_sync_t) { 0, NM_ERR }
+
+static nm_vect_t nm_qmp_pool = NM_INIT_VECT;
+static uint64_t nm_qmp_last_id;
+static const char *nm_qmp_cur_err; /* set while callback runs */
+
 static int nm_qmp_vm_exec(const nm_str_t *name, const char *cmd,
-                          struct timeval *tv);
-static int nm_qmp_init_cmd(nm_qmp_handle_t *h);
+                          int timeout, nm_qmp_cb_t cb, void *ctx);
+static int nm_qmp_send(nm_qmp_conn_t *conn, const char *cmd,
+                       int timeout, nm_qmp_cb_t cb, void *ctx);
+static int nm_qmp_wait(int rc, nm_qmp_sync_t *sync);
+static void nm_qmp_sync_cb(const nm_str_t *name, int rc, void *ctx);
+static size_t nm_qmp_dispatch(nm_qmp_conn_t *conn);
+static nm_qmp_conn_t *nm_qmp_pool_get(const nm_str_t *name);
+static void nm_qmp_pool_close(nm_qmp_conn_t *conn);
+static int nm_qmp_conn_alive(nm_qmp_conn_t *conn);
+static int nm_qmp_init_cmd(nm_qmp_conn_t *conn);
 static void nm_qmp_sock_path(const nm_str_t *name, nm_str_t *path);
-static int nm_qmp_talk(int sd, const char *cmd,
-                       size_t len, struct timeval *tv);
+static ssize_t nm_qmp_read(nm_qmp_conn_t *conn);
+static void nm_qmp_msg_cb(const nm_json_t *msg, void *ctx);
 static int nm_qmp_vmsnap(const nm_str_t *name, const nm_str_t *snap,
-                         const char *cmd);
-static int nm_qmp_check_answer(const nm_str_t *answer);
+                         const char *cmd, nm_qmp_cb_t cb, void *ctx);
+static int64_t nm_qmp_now(void);
 
-void nm_qmp_vm_shut(const nm_str_t *name)
+int nm_qmp_vm_shut(const nm_str_t *name)
 {
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_vm_shut_async(name, nm_qmp_sync_cb, &sync);
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_SHUT, &tv);
+    return nm_qmp_wait(rc, &sync);
 }
 
-void nm_qmp_vm_stop(const nm_str_t *name)
+int nm_qmp_vm_stop(const nm_str_t *name)
 {
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_vm_stop_async(name, nm_qmp_sync_cb, &sync);
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_QUIT, &tv);
+    rc = nm_qmp_wait(rc, &sync);
+    nm_qmp_pool_drop(name);
+
+    return rc;
 }
 
-void nm_qmp_vm_reset(const nm_str_t *name)
+int nm_qmp_vm_reset(const nm_str_t *name)
 {
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; /* 0.1s */
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_vm_reset_async(name, nm_qmp_sync_cb, &sync);
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_RESET, &tv);
+    return nm_qmp_wait(rc, &sync);
 }
 
-void nm_qmp_vm_pause(const nm_str_t *name)
+int nm_qmp_vm_pause(const nm_str_t *name)
 {
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 1000000 }; /* 1s */
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_vm_pause_async(name, nm_qmp_sync_cb, &sync);
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_STOP, &tv);
+    return nm_qmp_wait(rc, &sync);
 }
 
-void nm_qmp_vm_resume(const nm_str_t *name)
+int nm_qmp_vm_resume(const nm_str_t *name)
 {
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 1000000 }; /* 1s */
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_vm_resume_async(name, nm_qmp_sync_cb, &sync);
 
-    nm_qmp_vm_exec(name, NM_QMP_CMD_VM_CONT, &tv);
+    return nm_qmp_wait(rc, &sync);
 }
 
 int nm_qmp_drive_snapshot(const nm_str_t *name, const nm_str_t *drive,
                           const nm_str_t *path)
 {
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
     nm_str_t qmp_query = NM_INIT_STR;
-    struct timeval tv;
     int rc;
 
-    tv.tv_sec = 10;
-    tv.tv_usec = 0; /* 10 s */
-
     nm_str_format(&qmp_query, NM_QMP_CMD_SNAP_SYNC,
         drive->data, path->data);
 
-    nm_debug("exec qmp: %s\n", qmp_query.data);
-    rc = nm_qmp_vm_exec(name, qmp_query.data, &tv);
+    rc = nm_qmp_vm_exec(name, qmp_query.data, 10000, /* 10 s */
+            nm_qmp_sync_cb, &sync);
+    rc = nm_qmp_wait(rc, &sync);
 
     nm_str_free(&qmp_query);
 
@@ -120,65 +189,241 @@ int nm_qmp_drive_snapshot(const nm_str_t *name, const nm_str_t *drive,
 
 int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap)
 {
-    return nm_qmp_vmsnap(name, snap, "savevm");
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_savevm_async(name, snap, nm_qmp_sync_cb, &sync);
+
+    return nm_qmp_wait(rc, &sync);
 }
 
 int nm_qmp_loadvm(const nm_str_t *name, const nm_str_t *snap)
 {
-    return nm_qmp_vmsnap(name, snap, "loadvm");
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_loadvm_async(name, snap, nm_qmp_sync_cb, &sync);
+
+    return nm_qmp_wait(rc, &sync);
 }
 
 int nm_qmp_delvm(const nm_str_t *name, const nm_str_t *snap)
 {
-    return nm_qmp_vmsnap(name, snap, "delvm");
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_delvm_async(name, snap, nm_qmp_sync_cb, &sync);
+
+    return nm_qmp_wait(rc, &sync);
 }
 
 int nm_qmp_usb_attach(const nm_str_t *name, const nm_usb_data_t *usb)
+{
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_usb_attach_async(name, usb, nm_qmp_sync_cb, &sync);
+
+    return nm_qmp_wait(rc, &sync);
+}
+
+int nm_qmp_usb_detach(const nm_str_t *name, const nm_usb_data_t *usb)
+{
+    nm_qmp_sync_t sync = NM_INIT_QMP_SYNC;
+    int rc = nm_qmp_usb_detach_async(name, usb, nm_qmp_sync_cb, &sync);
+
+    return nm_qmp_wait(rc, &sync);
+}
+
+int nm_qmp_vm_shut_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_SHUT, 100, cb, ctx); /* 0.1s */
+}
+
+/* Session is closed when QEMU exits */
+int nm_qmp_vm_stop_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_QUIT, 100, cb, ctx); /* 0.1s */
+}
+
+int nm_qmp_vm_reset_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_RESET, 100, cb, ctx); /* 0.1s */
+}
+
+int nm_qmp_vm_pause_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_STOP, 1000, cb, ctx); /* 1s */
+}
+
+int nm_qmp_vm_resume_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vm_exec(name, NM_QMP_CMD_VM_CONT, 1000, cb, ctx); /* 1s */
+}
+
+int nm_qmp_savevm_async(const nm_str_t *name, const nm_str_t *snap,
+                        nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vmsnap(name, snap, "savevm", cb, ctx);
+}
+
+int nm_qmp_loadvm_async(const nm_str_t *name, const nm_str_t *snap,
+                        nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vmsnap(name, snap, "loadvm", cb, ctx);
+}
+
+int nm_qmp_delvm_async(const nm_str_t *name, const nm_str_t *snap,
+                       nm_qmp_cb_t cb, void *ctx)
+{
+    return nm_qmp_vmsnap(name, snap, "delvm", cb, ctx);
+}
+
+int nm_qmp_usb_attach_async(const nm_str_t *name, const nm_usb_data_t *usb,
+                            nm_qmp_cb_t cb, void *ctx)
 {
     nm_str_t qmp_query = NM_INIT_STR;
     int rc;
 
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 5000000 }; /* 5s */
-
     nm_str_format(&qmp_query, NM_QMP_CMD_USB_ADD,
                   usb->dev->bus_num, usb->dev->dev_addr,
                   usb->dev->vendor_id.data, usb->dev->product_id.data,
                   (usb->serial.len) ? usb->serial.data : "NULL");
 
-    nm_debug("exec qmp: %s\n", qmp_query.data);
-    rc = nm_qmp_vm_exec(name, qmp_query.data, &tv);
+    rc = nm_qmp_vm_exec(name, qmp_query.data, 5000, cb, ctx); /* 5s */
 
     nm_str_free(&qmp_query);
 
     return rc;
 }
 
-int nm_qmp_usb_detach(const nm_str_t *name, const nm_usb_data_t *usb)
+int nm_qmp_usb_detach_async(const nm_str_t *name, const nm_usb_data_t *usb,
+                            nm_qmp_cb_t cb, void *ctx)
 {
     nm_str_t qmp_query = NM_INIT_STR;
     int rc;
 
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 1000000 }; /* 1s */
-
     nm_str_format(&qmp_query, NM_QMP_CMD_USB_DEL,
                   usb->dev->vendor_id.data,
                   usb->dev->product_id.data,
                   (usb->serial.len) ? usb->serial.data : "NULL");
 
-    nm_debug("exec qmp: %s\n", qmp_query.data);
-    rc = nm_qmp_vm_exec(name, qmp_query.data, &tv);
+    rc = nm_qmp_vm_exec(name, qmp_query.data, 1000, cb, ctx); /* 1s */
 
     nm_str_free(&qmp_query);
 
     return rc;
 }
 
+size_t nm_qmp_poll(int timeout)
+{
+    return nm_qmp_poll_fd(-1, timeout);
+}
+
+/* fd is polled along with sessions and is not read here */
+size_t nm_qmp_poll_fd(int fd, int timeout)
+{
+    struct pollfd *fds = nm_calloc(nm_qmp_pool.n_memb + 1,
+                                   sizeof(struct pollfd));
+    nm_qmp_conn_t **polled = nm_calloc(nm_qmp_pool.n_memb + 1,
+                                       sizeof(nm_qmp_conn_t *));
+    int64_t now = nm_qmp_now();
+    size_t nfds = 0, pending = 0;
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *conn = nm_vect_at(&nm_qmp_pool, n);
+        int waiting = 0;
+
+        for (size_t m = 0; m < conn->reqs.n_memb; m++)
+        {
+            const nm_qmp_req_t *req = nm_arr_at(&conn->reqs, m);
+            int64_t left = req->done ? 0 : req->deadline - now;
+
+            if (left < 0)
+                left = 0;
+            if (timeout < 0 || left < timeout)
+                timeout = left;
+
+            waiting |= !req->done;
+        }
+
+        if (!waiting || conn->qmp.sd == -1)
+            continue;
+
+        fds[nfds].fd = conn->qmp.sd;
+        fds[nfds].events = POLLIN;
+        polled[nfds++] = conn;
+    }
+
+    if (fd != -1)
+    {
+        fds[nfds].fd = fd;
+        fds[nfds++].events = POLLIN;
+    }
+
+    if (nfds && poll(fds, nfds, timeout) > 0)
+    {
+        for (size_t n = 0; n < nfds; n++)
+        {
+            if (polled[n] && fds[n].revents &&
+                nm_qmp_conn_alive(polled[n]) != NM_OK)
+            {
+                nm_qmp_pool_close(polled[n]);
+            }
+        }
+    }
+
+    free(fds);
+    free(polled);
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+        pending += nm_qmp_dispatch(nm_vect_at(&nm_qmp_pool, n));
+
+    return pending;
+}
+
+size_t nm_qmp_pending(void)
+{
+    size_t pending = 0;
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+        pending += ((nm_qmp_conn_t *) nm_vect_at(&nm_qmp_pool, n))->reqs.n_memb;
+
+    return pending;
+}
+
+/* Replies are waited for up to timeout ms in total */
+size_t nm_qmp_drain(int timeout)
+{
+    int64_t deadline = nm_qmp_now() + timeout;
+    size_t pending;
+
+    while ((pending = nm_qmp_pending()) != 0)
+    {
+        int64_t left = deadline - nm_qmp_now();
+
+        if (left <= 0)
+            break;
+
+        nm_qmp_poll((int) left);
+    }
+
+    return pending;
+}
+
 int nm_qmp_test_socket(const nm_str_t *name)
 {
     int rc = NM_ERR;
     nm_str_t sock_path = NM_INIT_STR;
     nm_qmp_handle_t qmp = NM_INIT_QMP;
 
+    /* open pooled session already proves that QEMU is alive */
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *conn = nm_vect_at(&nm_qmp_pool, n);
+
+        if (conn->qmp.sd != -1 && nm_str_cmp_ss(&conn->name, name) == NM_OK)
+        {
+            if (nm_qmp_conn_alive(conn) == NM_OK)
+                return NM_OK;
+            nm_qmp_pool_close(conn);
+            break;
+        }
+    }
+
     nm_qmp_sock_path(name, &sock_path);
 
     qmp.sock.sun_family = AF_UNIX;
@@ -198,20 +443,15 @@ out:
 }
 
 static int nm_qmp_vmsnap(const nm_str_t *name, const nm_str_t *snap,
-                         const char *cmd)
+                         const char *cmd, nm_qmp_cb_t cb, void *ctx)
 {
     nm_str_t qmp_query = NM_INIT_STR;
-    struct timeval tv;
     int rc;
 
-    /* this operation can take a long time */
-    tv.tv_sec = 300;
-    tv.tv_usec = 0; /* 5 m */
-
     nm_str_format(&qmp_query, NM_QMP_CMD_EXECUTE, cmd, snap->data);
 
-    nm_debug("exec qmp: %s\n", qmp_query.data);
-    rc = nm_qmp_vm_exec(name, qmp_query.data, &tv);
+    /* this operation can take a long time */
+    rc = nm_qmp_vm_exec(name, qmp_query.data, 300000, cb, ctx); /* 5 m */
 
     nm_str_free(&qmp_query);
 
@@ -219,35 +459,305 @@ static int nm_qmp_vmsnap(const nm_str_t *name, const nm_str_t *snap,
 }
 
 static int nm_qmp_vm_exec(const nm_str_t *name, const char *cmd,
-                          struct timeval *tv)
+                          int timeout, nm_qmp_cb_t cb, void *ctx)
 {
-    nm_str_t sock_path = NM_INIT_STR;
-    nm_qmp_handle_t qmp = NM_INIT_QMP;
-    int rc = NM_ERR;
+    nm_qmp_conn_t *conn;
 
-    nm_qmp_sock_path(name, &sock_path);
+    if ((conn = nm_qmp_pool_get(name)) == NULL)
+        return NM_ERR;
 
-    qmp.sock.sun_family = AF_UNIX;
-    nm_strlcpy(qmp.sock.sun_path, sock_path.data, sizeof(qmp.sock.sun_path));
+    return nm_qmp_send(conn, cmd, timeout, cb, ctx);
+}
+
+/* Command text is expected to start with '{', id is inserted after it */
+static int nm_qmp_send(nm_qmp_conn_t *conn, const char *cmd,
+                       int timeout, nm_qmp_cb_t cb, void *ctx)
+{
+    nm_qmp_req_t req = { .id = ++nm_qmp_last_id, .cb = cb, .ctx = ctx };
+    nm_str_t buf = NM_INIT_STR;
+    int rc = NM_OK;
 
-    if (nm_qmp_init_cmd(&qmp) == NM_ERR)
+    nm_str_format(&buf, "{\"id\":%" PRIu64 ",%s", req.id, cmd + 1);
+    nm_debug("exec qmp: %s\n", buf.data);
+
+    /* pooled session may be closed by peer at any time,
+     * get EPIPE instead of SIGPIPE */
+    if (send(conn->qmp.sd, buf.data, buf.len, MSG_NOSIGNAL) !=
+        (ssize_t) buf.len)
+    {
+        nm_warn(_(NM_MSG_Q_SE_ERR));
+        nm_qmp_pool_close(conn);
+        rc = NM_ERR;
         goto out;
+    }
 
-    rc = nm_qmp_talk(qmp.sd, cmd, strlen(cmd), tv);
-    close(qmp.sd);
+    req.rc = NM_ERR;
+    req.quiet = (cmd == NM_QMP_CMD_INIT);
+    req.deadline = nm_qmp_now() + timeout;
+    req.span = nm_trace_begin();
 
+    /* handshake is not awaited: it lives as long as the command after it */
+    for (size_t n = 0; n < conn->reqs.n_memb; n++)
+    {
+        nm_qmp_req_t *prev = nm_arr_at(&conn->reqs, n);
+
+        if (prev->quiet && prev->deadline < req.deadline)
+            prev->deadline = req.deadline;
+    }
+
+    nm_arr_push(&conn->reqs, &req);
+    conn->used = time(NULL);
 out:
-    nm_str_free(&sock_path);
+    nm_str_free(&buf);
+
     return rc;
 }
 
-static int nm_qmp_init_cmd(nm_qmp_handle_t *h)
+/* Wait for the command queued with nm_qmp_sync_cb, rc is the result
+ * of queuing. Commands of other VMs are completed meanwhile. */
+static int nm_qmp_wait(int rc, nm_qmp_sync_t *sync)
 {
-    socklen_t len = sizeof(h->sock);
-    struct timeval tv;
+    if (rc != NM_OK)
+        return NM_ERR;
+
+    while (!sync->done)
+        nm_qmp_poll(-1);
+
+    return sync->rc;
+}
+
+static void nm_qmp_sync_cb(const nm_str_t *name, int rc, void *ctx)
+{
+    nm_qmp_sync_t *sync = ctx;
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 100000; /* 0.1 s */
+    (void) name;
+
+    sync->done = 1;
+    sync->rc = rc;
+}
+
+/* Finished and expired commands are removed before callback is run:
+ * callback may queue new commands to the same session.
+ * Returns count of commands still in flight. */
+static size_t nm_qmp_dispatch(nm_qmp_conn_t *conn)
+{
+    int64_t now = nm_qmp_now();
+    size_t n = 0;
+
+    while (n < conn->reqs.n_memb)
+    {
+        char *unit = nm_arr_at(&conn->reqs, n);
+        nm_qmp_req_t req;
+
+        memcpy(&req, unit, sizeof(req));
+
+        if (!req.done && req.deadline > now)
+        {
+            n++;
+            continue;
+        }
+
+        memmove(unit, unit + sizeof(req),
+                (conn->reqs.n_memb - n - 1) * sizeof(req));
+        conn->reqs.n_memb--;
+
+        nm_trace_end(req.span, "qmp: %s id %" PRIu64 ": %s", conn->name.data,
+                req.id, !req.answered ? "no answer" :
+                (req.rc != NM_OK) ? "error" : "ok");
+
+        if (!req.answered && !req.quiet)
+        {
+            nm_warn(_(NM_MSG_Q_NO_ANS));
+            snprintf(req.err, sizeof(req.err), "no answer from QEMU");
+        }
+        else if (req.rc != NM_OK && !req.quiet)
+            nm_warn(_(NM_MSG_Q_EXEC_E));
+
+        if (req.cb)
+        {
+            nm_qmp_cur_err = (req.rc != NM_OK && *req.err) ? req.err : NULL;
+            req.cb(&conn->name, req.rc, req.ctx);
+            nm_qmp_cur_err = NULL;
+        }
+    }
+
+    return conn->reqs.n_memb;
+}
+
+const char *nm_qmp_error(void)
+{
+    return nm_qmp_cur_err;
+}
+
+void nm_qmp_pool_drop(const nm_str_t *name)
+{
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *conn = nm_vect_at(&nm_qmp_pool, n);
+
+        if (nm_str_cmp_ss(&conn->name, name) == NM_OK)
+        {
+            nm_qmp_pool_close(conn);
+            return;
+        }
+    }
+}
+
+void nm_qmp_pool_expire(void)
+{
+    time_t now = time(NULL);
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *conn = nm_vect_at(&nm_qmp_pool, n);
+
+        if (conn->qmp.sd != -1 && !conn->reqs.n_memb &&
+            (now - conn->used) >= NM_QMP_POOL_IDLE)
+        {
+            nm_qmp_pool_close(conn);
+        }
+    }
+}
+
+size_t nm_qmp_pool_count(void)
+{
+    size_t count = 0;
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        if (((nm_qmp_conn_t *) nm_vect_at(&nm_qmp_pool, n))->qmp.sd != -1)
+            count++;
+    }
+
+    return count;
+}
+
+/* Callbacks of commands in flight are not called */
+void nm_qmp_pool_free(void)
+{
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *conn = nm_vect_at(&nm_qmp_pool, n);
+
+        nm_qmp_pool_close(conn);
+        nm_arr_free(&conn->reqs, NULL);
+        nm_str_free(&conn->name);
+    }
+
+    nm_vect_free(&nm_qmp_pool, NULL);
+}
+
+static nm_qmp_conn_t *nm_qmp_pool_get(const nm_str_t *name)
+{
+    nm_qmp_conn_t *conn = NULL;
+    nm_str_t sock_path = NM_INIT_STR;
+    struct stat info;
+
+    for (size_t n = 0; n < nm_qmp_pool.n_memb; n++)
+    {
+        nm_qmp_conn_t *cur = nm_vect_at(&nm_qmp_pool, n);
+
+        if (nm_str_cmp_ss(&cur->name, name) == NM_OK)
+        {
+            conn = cur;
+            break;
+        }
+    }
+
+    if (conn == NULL)
+    {
+        nm_qmp_conn_t new = NM_INIT_QMP_CONN;
+
+        nm_str_copy(&new.name, name);
+        nm_vect_insert(&nm_qmp_pool, &new, sizeof(new), NULL);
+        conn = nm_vect_at(&nm_qmp_pool, nm_qmp_pool.n_memb - 1);
+    }
+
+    nm_qmp_sock_path(name, &sock_path);
+    memset(&info, 0, sizeof(info));
+
+    if (stat(sock_path.data, &info) == -1)
+    {
+        nm_qmp_pool_close(conn);
+        nm_str_free(&sock_path);
+        nm_warn(_(NM_MSG_Q_CN_ERR));
+        return NULL;
+    }
+
+    if (conn->qmp.sd != -1 &&
+        (conn->dev != info.st_dev || conn->ino != info.st_ino ||
+         nm_qmp_conn_alive(conn) != NM_OK))
+    {
+        nm_debug("QMP: reopen session for %s\n", name->data);
+        nm_qmp_pool_close(conn);
+    }
+
+    if (conn->qmp.sd == -1)
+    {
+        conn->qmp.sock.sun_family = AF_UNIX;
+        nm_strlcpy(conn->qmp.sock.sun_path, sock_path.data,
+                   sizeof(conn->qmp.sock.sun_path));
+
+        if (nm_qmp_init_cmd(conn) == NM_ERR)
+        {
+            nm_qmp_pool_close(conn);
+            nm_str_free(&sock_path);
+            return NULL;
+        }
+
+        conn->dev = info.st_dev;
+        conn->ino = info.st_ino;
+    }
+
+    conn->used = time(NULL);
+    nm_str_free(&sock_path);
+
+    return conn;
+}
+
+/* Commands in flight are failed, callbacks are run by nm_qmp_poll() */
+static void nm_qmp_pool_close(nm_qmp_conn_t *conn)
+{
+    if (conn->qmp.sd != -1)
+        close(conn->qmp.sd);
+
+    conn->qmp.sd = -1;
+    nm_json_free(&conn->qmp.json);
+    conn->dev = 0;
+    conn->ino = 0;
+
+    for (size_t n = 0; n < conn->reqs.n_memb; n++)
+        ((nm_qmp_req_t *) nm_arr_at(&conn->reqs, n))->done = 1;
+}
+
+/* Read replies and asynchronous events QEMU sent since the last call
+ * and check that the peer did not close the session. */
+static int nm_qmp_conn_alive(nm_qmp_conn_t *conn)
+{
+    ssize_t nread;
+
+    for (;;)
+    {
+        nread = nm_qmp_read(conn);
+
+        if (nread > 0)
+            continue;
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return NM_OK;
+
+        return NM_ERR;
+    }
+}
+
+/* QEMU handles commands in order, so commands sent after
+ * qmp_capabilities need not wait for its reply. If handshake
+ * fails, they fail too and report the error. */
+static int nm_qmp_init_cmd(nm_qmp_conn_t *conn)
+{
+    nm_qmp_handle_t *h = &conn->qmp;
+    socklen_t len = sizeof(h->sock);
 
     if ((h->sd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
     {
@@ -258,6 +768,7 @@ static int nm_qmp_init_cmd(nm_qmp_handle_t *h)
     if (fcntl(h->sd, F_SETFL, O_NONBLOCK) == -1)
     {
         close(h->sd);
+        h->sd = -1;
         nm_warn(_(NM_MSG_Q_FL_ERR));
         return NM_ERR;
     }
@@ -265,96 +776,82 @@ static int nm_qmp_init_cmd(nm_qmp_handle_t *h)
     if (connect(h->sd, (struct sockaddr *) &h->sock, len) == -1)
     {
         close(h->sd);
+        h->sd = -1;
         nm_warn(_(NM_MSG_Q_CN_ERR));
         return NM_ERR;
     }
 
-    return nm_qmp_talk(h->sd, NM_QMP_CMD_INIT, strlen(NM_QMP_CMD_INIT), &tv);
+    return nm_qmp_send(conn, NM_QMP_CMD_INIT, 100, NULL, NULL); /* 0.1 s */
 }
 
-static int nm_qmp_check_answer(const nm_str_t *answer)
+/* Returns the result of read(2), malformed data is reported as EPROTO */
+static ssize_t nm_qmp_read(nm_qmp_conn_t *conn)
 {
-    /* {"return": {}} from answer means OK
-     * TODO: use JSON parser instead, e.g: json-c */
-    const char *regex = ".*\\{\"return\":[[:space:]]\\{\\}\\}.*";
-    regex_t reg;
-    int rc = NM_OK;
+    char buf[NM_QMP_READLEN];
+    ssize_t nread;
 
-    if (regcomp(&reg, regex, REG_NOSUB | REG_EXTENDED) != 0)
-    {
-        nm_bug("%s: regcomp failed", __func__);
-    }
+    if ((nread = read(conn->qmp.sd, buf, sizeof(buf))) <= 0)
+        return nread;
 
-    if (regexec(&reg, answer->data, 0, NULL, 0) != 0)
+    if (nm_json_feed(&conn->qmp.json, buf, nread,
+                     nm_qmp_msg_cb, conn) != NM_OK)
     {
-        rc = NM_ERR;
+        nm_debug("QMP: malformed message\n");
+        errno = EPROTO;
+        return -1;
     }
 
-    regfree(&reg);
-
-    return rc;
+    return nread;
 }
 
-static int nm_qmp_talk(int sd, const char *cmd,
-                       size_t len, struct timeval *tv)
+/* Reply without id is an answer to the request QEMU could not parse,
+ * it is taken as reply of the oldest command in flight. */
+static void nm_qmp_msg_cb(const nm_json_t *msg, void *ctx)
 {
-    nm_str_t answer = NM_INIT_STR;
-    char buf[NM_QMP_READLEN];
-    ssize_t nread;
-    fd_set readset;
-    int ret, read_done = 0;
-    int rc = NM_OK;
-
-    FD_ZERO(&readset);
-    FD_SET(sd, &readset);
+    nm_qmp_conn_t *conn = ctx;
+    const nm_json_t *val, *err;
+    const char *desc = NULL;
+    int64_t id = 0;
+    int has_id;
 
-    if (write(sd, cmd, len) == -1)
+    if ((val = nm_json_get(msg, "event")) != NULL)
     {
-        close(sd);
-        nm_warn(_(NM_MSG_Q_SE_ERR));
-        return NM_ERR;
+        nm_debug("QMP: event %s\n",
+                 nm_json_str(val) ? nm_json_str(val) : "?");
+        return;
     }
 
-    while (!read_done)
+    /* greeting {"QMP": {...}} needs no answer */
+    val = nm_json_get(msg, "return");
+    err = nm_json_get(msg, "error");
+    if (!val && !err)
+        return;
+
+    has_id = (nm_json_int(nm_json_get(msg, "id"), &id) == NM_OK);
+
+    if (err)
     {
-        ret = select(sd + 1, &readset, NULL, NULL, tv);
-        if (ret == -1)
-            nm_bug("%s: select error: %s", __func__, strerror(errno));
-        else if (ret && FD_ISSET(sd, &readset)) /* data is available */
-        {
-            memset(buf, 0, NM_QMP_READLEN);
-            nread = read(sd, buf, NM_QMP_READLEN);
-            if (nread > 1)
-            {
-                buf[nread - 2] = '\0';
-                nm_str_add_text(&answer, buf);
-                /* check for command succesfully executed here
-                 * and return if it done */
-                if ((rc = nm_qmp_check_answer(&answer)) == NM_OK)
-                    goto out;
-            }
-            else if (nread == 0) /* socket closed */
-                read_done = 1;
-        }
-        else /* timeout, nothing happens */
-            read_done = 1;
+        desc = nm_json_str(nm_json_get(err, "desc"));
+        nm_debug("QMP: error: %s\n", desc ? desc : "?");
     }
 
-    if (answer.len == 0)
+    for (size_t n = 0; n < conn->reqs.n_memb; n++)
     {
-        nm_warn(_(NM_MSG_Q_NO_ANS));
-        rc = NM_ERR;
-        goto err;
+        nm_qmp_req_t *req = nm_arr_at(&conn->reqs, n);
+
+        if (req->done || (has_id && req->id != (uint64_t) id))
+            continue;
+
+        req->done = 1;
+        req->answered = 1;
+        req->rc = val ? NM_OK : NM_ERR;
+        if (desc)
+            snprintf(req->err, sizeof(req->err), "%s", desc);
+        conn->used = time(NULL);
+        return;
     }
 
-out:
-    nm_debug("QMP: %s\n", answer.data);
-    if (rc != NM_OK)
-        nm_warn(_(NM_MSG_Q_EXEC_E));
-err:
-    nm_str_free(&answer);
-
-    return rc;
+    nm_debug("QMP: reply to expired command %" PRId64 "\n", id);
 }
 
 static void nm_qmp_sock_path(const nm_str_t *name, nm_str_t *path)
@@ -363,4 +860,13 @@ static void nm_qmp_sock_path(const nm_str_t *name, nm_str_t *path)
         nm_cfg_get()->vm_dir.data, name->data);
 }
 
+static int64_t nm_qmp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /* vim:set ts=4 sw=4: */
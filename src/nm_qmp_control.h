@@ -4,11 +4,11 @@
 #include <nm_string.h>
 #include <nm_usb_devices.h>
 
-void nm_qmp_vm_shut(const nm_str_t *name);
-void nm_qmp_vm_stop(const nm_str_t *name);
-void nm_qmp_vm_reset(const nm_str_t *name);
-void nm_qmp_vm_pause(const nm_str_t *name);
-void nm_qmp_vm_resume(const nm_str_t *name);
+int nm_qmp_vm_shut(const nm_str_t *name);
+int nm_qmp_vm_stop(const nm_str_t *name);
+int nm_qmp_vm_reset(const nm_str_t *name);
+int nm_qmp_vm_pause(const nm_str_t *name);
+int nm_qmp_vm_resume(const nm_str_t *name);
 int nm_qmp_savevm(const nm_str_t *name, const nm_str_t *snap);
 int nm_qmp_loadvm(const nm_str_t *name, const nm_str_t *snap);
 int nm_qmp_delvm(const nm_str_t *name, const nm_str_t *snap);
@@ -16,7 +16,50 @@ int nm_qmp_drive_snapshot(const nm_str_t *name, const nm_str_t *drive,
                           const nm_str_t *path);
 int nm_qmp_usb_attach(const nm_str_t *name, const nm_usb_data_t *usb);
 int nm_qmp_usb_detach(const nm_str_t *name, const nm_usb_data_t *usb);
+
+/* Asynchronous commands: several can be in flight on one session.
+ * cb (may be NULL) is called from nm_qmp_poll() with NM_OK or NM_ERR
+ * when reply is received or timeout expires. If NM_ERR is returned
+ * command was not sent and cb is not called. */
+typedef void (*nm_qmp_cb_t)(const nm_str_t *name, int rc, void *ctx);
+
+int nm_qmp_vm_shut_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_vm_stop_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_vm_reset_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_vm_pause_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_vm_resume_async(const nm_str_t *name, nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_savevm_async(const nm_str_t *name, const nm_str_t *snap,
+                        nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_loadvm_async(const nm_str_t *name, const nm_str_t *snap,
+                        nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_delvm_async(const nm_str_t *name, const nm_str_t *snap,
+                       nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_usb_attach_async(const nm_str_t *name, const nm_usb_data_t *usb,
+                            nm_qmp_cb_t cb, void *ctx);
+int nm_qmp_usb_detach_async(const nm_str_t *name, const nm_usb_data_t *usb,
+                            nm_qmp_cb_t cb, void *ctx);
+
+/* Error of the failed command, valid only inside its callback.
+ * NULL if QEMU gave no description. */
+const char *nm_qmp_error(void);
+
+/* Wait up to timeout ms (-1: until the nearest command deadline) for
+ * replies and run callbacks of completed commands.
+ * Returns count of commands still in flight. */
+size_t nm_qmp_poll(int timeout);
+/* Same, but returns also when fd is readable, e.g. epoll descriptor */
+size_t nm_qmp_poll_fd(int fd, int timeout);
+/* Count of commands in flight, no I/O is done */
+size_t nm_qmp_pending(void);
+/* Poll until all commands are completed or timeout ms has passed.
+ * Returns count of commands still in flight. */
+size_t nm_qmp_drain(int timeout);
+
 int nm_qmp_test_socket(const nm_str_t *name);
+void nm_qmp_pool_drop(const nm_str_t *name);
+void nm_qmp_pool_expire(void);
+size_t nm_qmp_pool_count(void);
+void nm_qmp_pool_free(void);
 
 #endif /* NM_QMP_CONTROL_H_ */
 /* vim:set ts=4 sw=4: */
@@ -1,153 +1,328 @@
 #include <nm_core.h>
 #include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_vm_status.h>
 #include <nm_stat_usage.h>
 
+#include <time.h> /* clock_gettime(2) */
 
+/* Host side resource usage of running VMs.
+ * All QEMU processes are sampled in one pass: CPU time from
+ * /proc/<pid>/stat, memory from /proc/<pid>/smaps_rollup (statm on old
+ * kernels) and disk I/O from /proc/<pid>/io. Values are kept per VM,
+ * so TUI, CLI and nemu-monitor read deltas without sampling twice. */
+
+#if defined (NM_OS_LINUX)
 enum {
-    NM_STAT_BUF_LEN = 512,
-    NM_STAT_RES_LEN = 12,
+    NM_STAT_BUF_LEN = 4096,
+    NM_STAT_PATH_LEN = 64,
+    NM_STAT_UTIME_FIELD = 11, /* after process state, see proc(5) */
 };
 
-static const char NM_STAT_PATH[] = "/proc/stat";
-
-uint64_t nm_total_cpu_before;
-uint64_t nm_total_cpu_after;
-uint64_t nm_proc_cpu_before;
-uint64_t nm_proc_cpu_after;
-uint8_t  nm_cpu_iter;
-float    nm_cpu_usage;
-
-static void nm_stat_cpu_total_time(void)
+typedef struct {
+    nm_str_t name;
+    nm_stat_t st;
+    uint64_t ticks;
+    uint64_t rd_bytes;
+    uint64_t wr_bytes;
+    struct timespec ts;
+    int sampled; /* previous values are set */
+    int ready;   /* st is filled */
+    int seen;
+} nm_stat_entry_t;
+
+static nm_arr_t nm_stat_list = { 0, 0, sizeof(nm_stat_entry_t), NULL, NULL };
+static struct timespec nm_stat_last;
+
+static nm_stat_entry_t *nm_stat_find(const nm_str_t *name);
+static void nm_stat_sample(nm_stat_entry_t *entry, int pid,
+                           const struct timespec *now);
+static int nm_stat_read(int pid, const char *file, char *buf, size_t len);
+static int nm_stat_cpu_ticks(int pid, uint64_t *ticks);
+static void nm_stat_mem(int pid, nm_stat_t *st);
+static int nm_stat_io(int pid, uint64_t *rd, uint64_t *wr);
+static int nm_stat_field(const char *buf, const char *key, uint64_t *val);
+static double nm_stat_diff(const struct timespec *a, const struct timespec *b);
+static void nm_stat_free_cb(void *unit_p);
+#endif /* NM_OS_LINUX */
+
+void nm_stat_update(const nm_vect_t *vm_list)
 {
-    int fd, space_num = 0;
-    char buf[NM_STAT_BUF_LEN] = {0};
-    char buf_time[NM_STAT_RES_LEN] = {0};
-    size_t nread = 0;
-    char ch;
-    char *token_b = NULL, *token_e = NULL;
-    uint64_t res = 0;
-
-    if ((fd = open(NM_STAT_PATH, O_RDONLY)) == -1)
-        return;
+#if defined (NM_OS_LINUX)
+    struct timespec now;
+    size_t kept = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    while ((read(fd, &ch, 1) > 0) && ch != '\n')
+    if ((nm_stat_last.tv_sec || nm_stat_last.tv_nsec) &&
+        nm_stat_diff(&now, &nm_stat_last) * 1000 < NM_STAT_INTERVAL)
     {
-        buf[nread] = ch;
-        nread++;
+        return;
     }
 
-    for (size_t n = 0; n < nread; n++)
+    nm_stat_last = now;
+
+    for (size_t n = 0; n < nm_stat_list.n_memb; n++)
+        ((nm_stat_entry_t *) nm_arr_at(&nm_stat_list, n))->seen = 0;
+
+    for (size_t n = 0; n < vm_list->n_memb; n++)
     {
-        if (buf[n] == 0x20)
-            space_num++;
-        else
+        const nm_str_t *name = nm_vect_str(vm_list, n);
+        nm_stat_entry_t *entry;
+        int pid;
+
+        if ((pid = nm_vm_status_pid(name)) <= 0)
             continue;
 
-        if (space_num == 2)
+        if (!(entry = nm_stat_find(name)))
         {
-            token_b = buf + n + 1;
+            nm_stat_entry_t add;
+
+            memset(&add, 0, sizeof(add));
+            nm_str_copy(&add.name, name);
+            entry = nm_arr_push(&nm_stat_list, &add);
         }
 
-        if (space_num > 2)
+        nm_stat_sample(entry, pid, &now);
+    }
+
+    /* forget stopped and removed VMs */
+    for (size_t n = 0; n < nm_stat_list.n_memb; n++)
+    {
+        nm_stat_entry_t *entry = nm_arr_at(&nm_stat_list, n);
+
+        if (!entry->seen)
         {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            res += nm_str_ttoul(buf_time, 10);
-            token_b = token_e + 1;
-            memset(buf_time, 0, sizeof(buf_time));
+            nm_stat_free_cb(entry);
+            continue;
         }
 
-        if (space_num == 6)
-            break;
+        if (kept != n)
+            memcpy(nm_arr_at(&nm_stat_list, kept), entry, sizeof(*entry));
+        kept++;
     }
 
-    if (nm_cpu_iter)
-        nm_total_cpu_after = res;
-    else
-        nm_total_cpu_before = res;
+    nm_stat_list.n_memb = kept;
+#else
+    (void) vm_list;
+#endif /* NM_OS_LINUX */
+}
 
-    close(fd);
+int nm_stat_get(const nm_str_t *name, nm_stat_t *st)
+{
+#if defined (NM_OS_LINUX)
+    const nm_stat_entry_t *entry = nm_stat_find(name);
+
+    if (!entry || !entry->ready)
+        return NM_ERR;
+
+    *st = entry->st;
+
+    return NM_OK;
+#else
+    (void) name;
+    (void) st;
+
+    return NM_ERR;
+#endif /* NM_OS_LINUX */
 }
 
-static void nm_stat_cpu_proc_time(int pid)
+void nm_stat_free(void)
 {
-    int fd, space_num = 0;
-    ssize_t nread;
-    char buf[NM_STAT_BUF_LEN] = {0};
-    char buf_time[NM_STAT_RES_LEN] = {0};
-    char *token_b = NULL, *token_e = NULL;
-    uint64_t utime = 0, stime = 0;
-    nm_str_t path = NM_INIT_STR;
+#if defined (NM_OS_LINUX)
+    nm_arr_free(&nm_stat_list, nm_stat_free_cb);
+    memset(&nm_stat_last, 0, sizeof(nm_stat_last));
+#endif
+}
+
+#if defined (NM_OS_LINUX)
+static nm_stat_entry_t *nm_stat_find(const nm_str_t *name)
+{
+    for (size_t n = 0; n < nm_stat_list.n_memb; n++)
+    {
+        nm_stat_entry_t *entry = nm_arr_at(&nm_stat_list, n);
 
-    nm_str_format(&path, "/proc/%d/stat", pid);
+        if (nm_str_cmp_ss(&entry->name, name) == NM_OK)
+            return entry;
+    }
 
-    if ((fd = open(path.data, O_RDONLY)) == -1)
-        goto out;
+    return NULL;
+}
 
-    if ((nread = read(fd, buf, sizeof(buf))) <= 0)
-        goto out;
+static void nm_stat_sample(nm_stat_entry_t *entry, int pid,
+                           const struct timespec *now)
+{
+    uint64_t ticks, rd = 0, wr = 0;
+    int has_io;
+    double dt;
 
-    buf[nread - 1] = '\0';
+    entry->seen = 1;
 
-    for (ssize_t n = 0; n < nread; n++)
+    /* VM was restarted, previous values belong to other process */
+    if (entry->st.pid != pid)
     {
-        if (buf[n] == 0x20)
-            space_num++;
-        else
-            continue;
+        entry->sampled = entry->ready = 0;
+        entry->st.pid = pid;
+    }
 
-        if (space_num == 13)
-        {
-            token_b = buf + n + 1;
-        }
+    if (nm_stat_cpu_ticks(pid, &ticks) != NM_OK)
+    {
+        entry->sampled = entry->ready = 0;
+        return;
+    }
 
-        if (space_num == 14)
-        {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            utime = nm_str_ttoul(buf_time, 10);
-            token_b = token_e + 1;
-            memset(buf_time, 0, sizeof(buf_time));
-        }
+    has_io = (nm_stat_io(pid, &rd, &wr) == NM_OK);
+    nm_stat_mem(pid, &entry->st);
 
-        if (space_num == 15)
-        {
-            token_e = buf + n;
-            memcpy(buf_time, token_b, token_e - token_b);
-            stime = nm_str_ttoul(buf_time, 10);
-            break;
-        }
+    if (entry->sampled && (dt = nm_stat_diff(now, &entry->ts)) > 0)
+    {
+        entry->st.cpu = (ticks - entry->ticks) * 100.0 /
+            (sysconf(_SC_CLK_TCK) * dt);
+        entry->st.rd_rate = has_io ? (rd - entry->rd_bytes) / dt : 0;
+        entry->st.wr_rate = has_io ? (wr - entry->wr_bytes) / dt : 0;
+        entry->ready = 1;
+    }
+
+    entry->ticks = ticks;
+    entry->rd_bytes = rd;
+    entry->wr_bytes = wr;
+    entry->ts = *now;
+    entry->sampled = 1;
+}
+
+static int nm_stat_read(int pid, const char *file, char *buf, size_t len)
+{
+    char path[NM_STAT_PATH_LEN];
+    size_t total = 0;
+    ssize_t nread;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return NM_ERR;
+
+    while (total < len - 1 &&
+           (nread = read(fd, buf + total, len - 1 - total)) > 0)
+    {
+        total += nread;
     }
 
     close(fd);
+    buf[total] = '\0';
+
+    return total ? NM_OK : NM_ERR;
+}
+
+/* Process name is checked as well: pid file of killed QEMU
+ * may point to unrelated process */
+static int nm_stat_cpu_ticks(int pid, uint64_t *ticks)
+{
+    char buf[NM_STAT_BUF_LEN];
+    uint64_t utime, stime;
+    char *p, *end;
+
+    if (nm_stat_read(pid, "stat", buf, sizeof(buf)) != NM_OK)
+        return NM_ERR;
+
+    if (!(p = strchr(buf, '(')) || strncmp(p + 1, "qemu", 4) != 0)
+        return NM_ERR;
+
+    /* comm may contain spaces and brackets */
+    if (!(p = strrchr(p, ')')))
+        return NM_ERR;
+
+    p++;
+    for (int field = 0; field < NM_STAT_UTIME_FIELD; field++)
+    {
+        if (!(p = strchr(p + 1, ' ')))
+            return NM_ERR;
+    }
+
+    utime = strtoull(p, &end, 10);
+    if (end == p)
+        return NM_ERR;
+
+    stime = strtoull(end, &p, 10);
+    if (end == p)
+        return NM_ERR;
+
+    *ticks = utime + stime;
+
+    return NM_OK;
+}
+
+static void nm_stat_mem(int pid, nm_stat_t *st)
+{
+    char buf[NM_STAT_BUF_LEN];
+    uint64_t size, rss;
 
-    if (nm_cpu_iter)
-        nm_proc_cpu_after = utime + stime;
-    else
-        nm_proc_cpu_before = utime + stime;
+    st->rss = st->pss = 0;
 
-out:
-    nm_str_free(&path);
+    if (nm_stat_read(pid, "smaps_rollup", buf, sizeof(buf)) == NM_OK &&
+        nm_stat_field(buf, "Rss:", &st->rss) == NM_OK)
+    {
+        nm_stat_field(buf, "Pss:", &st->pss);
+        return;
+    }
+
+    if (nm_stat_read(pid, "statm", buf, sizeof(buf)) == NM_OK &&
+        sscanf(buf, "%" SCNu64 " %" SCNu64, &size, &rss) == 2)
+    {
+        st->rss = rss * (sysconf(_SC_PAGESIZE) / 1024);
+    }
 }
 
-float nm_stat_get_usage(int pid)
+/* /proc/<pid>/io is readable only by owner of the process */
+static int nm_stat_io(int pid, uint64_t *rd, uint64_t *wr)
 {
-    float pa, pb, ta, tb;
+    char buf[NM_STAT_BUF_LEN];
 
-    nm_stat_cpu_total_time();
-    nm_stat_cpu_proc_time(pid);
+    if (nm_stat_read(pid, "io", buf, sizeof(buf)) != NM_OK)
+        return NM_ERR;
 
-    pa = nm_proc_cpu_after;
-    pb = nm_proc_cpu_before;
-    ta = nm_total_cpu_after;
-    tb = nm_total_cpu_before;
+    if (nm_stat_field(buf, "read_bytes:", rd) != NM_OK ||
+        nm_stat_field(buf, "write_bytes:", wr) != NM_OK)
+    {
+        return NM_ERR;
+    }
+
+    return NM_OK;
+}
 
-    if (nm_cpu_iter)
-        nm_cpu_usage = ((pa - pb) / (ta - tb)) * 100 * sysconf(_SC_NPROCESSORS_ONLN);
+/* Key must start a line: "Pss:" is also a part of "SwapPss:" */
+static int nm_stat_field(const char *buf, const char *key, uint64_t *val)
+{
+    size_t len = strlen(key);
+    const char *p = buf;
+    char *end;
 
-    nm_cpu_iter ^= 1;
+    while (p && *p)
+    {
+        if (strncmp(p, key, len) == 0)
+        {
+            *val = strtoull(p + len, &end, 10);
+            return (end != p + len) ? NM_OK : NM_ERR;
+        }
+
+        if ((p = strchr(p, '\n')))
+            p++;
+    }
+
+    return NM_ERR;
+}
+
+static double nm_stat_diff(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+static void nm_stat_free_cb(void *unit_p)
+{
+    nm_stat_entry_t *entry = unit_p;
 
-    return nm_cpu_usage;
+    nm_str_free(&entry->name);
 }
+#endif /* NM_OS_LINUX */
 
 /* vim:set ts=4 sw=4: */
@@ -1,19 +1,30 @@
 #ifndef NM_STAT_USAGE_H_
 #define NM_STAT_USAGE_H_
 
+#include <nm_string.h>
+#include <nm_vector.h>
+
 #include <stdint.h>
 
-extern uint64_t nm_total_cpu_before;
-extern uint64_t nm_total_cpu_after;
-extern uint64_t nm_proc_cpu_before;
-extern uint64_t nm_proc_cpu_after;
-extern uint8_t  nm_cpu_iter;
-extern float    nm_cpu_usage;
+enum {
+    NM_STAT_INTERVAL = 1000, /* ms between samples */
+};
 
-#define NM_STAT_CLEAN() nm_total_cpu_before = nm_total_cpu_after = \
-    nm_proc_cpu_before = nm_proc_cpu_after = nm_cpu_iter = nm_cpu_usage = 0;
+/* Resource usage of QEMU process between two last samples */
+typedef struct {
+    int pid;
+    float cpu;        /* percent of one host CPU */
+    uint64_t rss;     /* KiB */
+    uint64_t pss;     /* KiB, 0 if kernel has no smaps_rollup */
+    uint64_t rd_rate; /* disk read, bytes/s */
+    uint64_t wr_rate; /* disk write, bytes/s */
+} nm_stat_t;
 
-float nm_stat_get_usage(int pid);
+/* Samples all running VMs of the list in one pass, at most once per
+ * NM_STAT_INTERVAL; it is safe to call on every loop iteration */
+void nm_stat_update(const nm_vect_t *vm_list);
+int nm_stat_get(const nm_str_t *name, nm_stat_t *st);
+void nm_stat_free(void);
 
 #endif /* NM_STAT_USAGE_H_ */
 /* vim:set ts=4 sw=4: */
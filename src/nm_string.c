@@ -2,9 +2,16 @@
 #include <nm_utils.h>
 #include <nm_string.h>
 
+/* Capacity grows geometrically from NM_STR_MIN_ALLOC, so short strings
+ * get one allocation and appending one item at a time is amortized O(1).
+ * Strings reused in loops (nm_str_trunc, nm_str_format) keep capacity. */
+enum {NM_STR_MIN_ALLOC = 32};
+
 static void nm_str_alloc_mem(nm_str_t *str, const char *src, size_t len);
 static void nm_str_append_mem(nm_str_t *str, const char *src, size_t len);
-static void nm_str_append_mem_opt(nm_str_t *str, const char *src, size_t len);
+static void nm_str_reserve(nm_str_t *str, size_t len_needed, int keep);
+static void nm_str_vformat(nm_str_t *str, size_t pos,
+                           const char *fmt, va_list args);
 static const char *nm_str_get(const nm_str_t *str);
 static uint64_t nm_str_stoul__(const char *str, int base);
 
@@ -27,7 +34,7 @@ void nm_str_add_char(nm_str_t *str, char ch)
 
 void nm_str_add_char_opt(nm_str_t *str, char ch)
 {
-    nm_str_append_mem_opt(str, &ch, sizeof(ch));
+    nm_str_append_mem(str, &ch, sizeof(ch));
 }
 
 void nm_str_add_text(nm_str_t *str, const char *src)
@@ -64,6 +71,10 @@ void nm_str_trunc(nm_str_t *str, size_t len)
 {
     assert(str != NULL);
 
+    /* nothing allocated yet, string is already empty */
+    if (!len && !str->alloc_bytes)
+        return;
+
     if (len >= str->alloc_bytes)
         nm_bug(_("%s: bad length"), __func__);
 
@@ -255,58 +266,24 @@ void nm_str_basename(const nm_str_t *str, nm_str_t *res)
 
 void nm_str_append_format(nm_str_t *str, const char *fmt, ...)
 {
-    int len = 0;
-    char *buf = NULL;
     va_list args;
 
-    /* get required length */
-    va_start(args, fmt);
-    len = vsnprintf(buf, len, fmt, args);
-    va_end(args);
-
-    if (len < 0)
-        nm_bug(_("%s: invalid length: %d"), __func__, len);
-
-    len++; /* for \0 */
-
-    buf = nm_calloc(1, len);
+    assert(str != NULL);
 
     va_start(args, fmt);
-    len = vsnprintf(buf, len, fmt, args);
-    if (len < 0)
-        nm_bug(_("%s: invalid length: %d"), __func__, len);
+    nm_str_vformat(str, str->len, fmt, args);
     va_end(args);
-
-    nm_str_append_mem(str, buf, len);
-    free(buf);
 }
 
 void nm_str_format(nm_str_t *str, const char *fmt, ...)
 {
-    int len = 0;
-    char *buf = NULL;
     va_list args;
 
-    /* get required length */
-    va_start(args, fmt);
-    len = vsnprintf(buf, len, fmt, args);
-    va_end(args);
-
-    if (len < 0)
-        nm_bug(_("%s: invalid length: %d"), __func__, len);
-
-    len++; /* for \0 */
-
-    buf = nm_calloc(1, len);
+    assert(str != NULL);
 
     va_start(args, fmt);
-    len = vsnprintf(buf, len, fmt, args);
-    if (len < 0)
-        nm_bug(_("%s: invalid length: %d"), __func__, len);
+    nm_str_vformat(str, 0, fmt, args);
     va_end(args);
-
-    nm_str_alloc_mem(str, buf, len);
-    free(buf);
 }
 
 void nm_str_remove_char(nm_str_t *str, char ch)
@@ -354,23 +331,16 @@ void nm_str_vect_free_cb(void *unit_p)
 
 static void nm_str_alloc_mem(nm_str_t *str, const char *src, size_t len)
 {
-    size_t len_needed;
-
     assert(str != NULL);
 
     if (len + 1 < len)
         nm_bug(_("Integer overflow\n"));
 
-    len_needed = len + 1;
-
-    if (len_needed > str->alloc_bytes)
-    {
-        nm_str_free(str);
-        str->data = nm_alloc(len_needed);
-        str->alloc_bytes = len_needed;
-    }
+    /* old content is replaced, no need to copy it */
+    nm_str_reserve(str, len + 1, 0);
 
-    memcpy(str->data, src, len);
+    if (len)
+        memmove(str->data, src, len);
     str->data[len] = '\0';
     str->len = len;
 }
@@ -388,43 +358,68 @@ static void nm_str_append_mem(nm_str_t *str, const char *src, size_t len)
     if (len_needed + 1 < len_needed)
         nm_bug(_("Integer overflow\n"));
 
-    len_needed++;
-
-    if (len_needed > str->alloc_bytes)
-    {
-        str->data = nm_realloc(str->data, len_needed);
-        str->alloc_bytes = len_needed;
-    }
+    nm_str_reserve(str, len_needed + 1, 1);
 
-    memcpy(str->data + str->len, src, len);
+    if (len)
+        memcpy(str->data + str->len, src, len);
     str->data[str->len + len] = '\0';
     str->len += len;
 }
 
-static void nm_str_append_mem_opt(nm_str_t *str, const char *src, size_t len)
+static void nm_str_reserve(nm_str_t *str, size_t len_needed, int keep)
 {
-    size_t len_needed;
+    size_t alloc = str->alloc_bytes ? str->alloc_bytes : NM_STR_MIN_ALLOC;
 
-    assert(str != NULL);
+    if (len_needed <= str->alloc_bytes)
+        return;
 
-    if (len + str->len < len)
-        nm_bug(_("Integer overflow"));
+    while (alloc < len_needed)
+    {
+        if (alloc * 2 < alloc)
+        {
+            alloc = len_needed;
+            break;
+        }
+        alloc *= 2;
+    }
 
-    len_needed = len + str->len;
-    if ((len_needed + 1) * 10 < len_needed)
-        nm_bug(_("Integer overflow"));
+    if (keep)
+        str->data = nm_realloc(str->data, alloc);
+    else
+    {
+        free(str->data);
+        str->data = nm_alloc(alloc);
+    }
+
+    str->alloc_bytes = alloc;
+}
+
+/* Text is formatted right into free space of str, so fmt arguments
+ * must not point to str->data. */
+static void nm_str_vformat(nm_str_t *str, size_t pos,
+                           const char *fmt, va_list args)
+{
+    size_t spare = (str->alloc_bytes > pos) ? str->alloc_bytes - pos : 0;
+    va_list args_try;
+    int len;
+
+    va_copy(args_try, args);
+    len = vsnprintf(spare ? str->data + pos : NULL, spare, fmt, args_try);
+    va_end(args_try);
 
-    len_needed++;
+    if (len < 0)
+        nm_bug(_("%s: invalid length: %d"), __func__, len);
 
-    if (len_needed > str->alloc_bytes)
+    if ((size_t) len >= spare)
     {
-        str->data = nm_realloc(str->data, len_needed * 10);
-        str->alloc_bytes = len_needed * 10;
+        nm_str_reserve(str, pos + len + 1, 1);
+
+        len = vsnprintf(str->data + pos, str->alloc_bytes - pos, fmt, args);
+        if (len < 0)
+            nm_bug(_("%s: invalid length: %d"), __func__, len);
     }
 
-    memcpy(str->data + str->len, src, len);
-    str->data[str->len + len] = '\0';
-    str->len += len;
+    str->len = pos + len;
 }
 
 static const char *nm_str_get(const nm_str_t *str)
@@ -4,6 +4,7 @@
 #include <nm_vector.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 typedef struct {
     char *data;
@@ -44,6 +45,12 @@ void nm_str_append_format(nm_str_t *str, const char *fmt, ...)
 void nm_str_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_str_vect_free_cb(void *unit_p);
 
+/* Read-only string over foreign buffer: must not be modified or freed */
+static inline nm_str_t nm_str_view(const char *text)
+{
+    return (nm_str_t) { (char *) text, strlen(text), 0 };
+}
+
 static inline nm_str_t *nm_vect_str(const nm_vect_t *v, const size_t index)
 {
     return (nm_str_t *)nm_vect_at(v, index);
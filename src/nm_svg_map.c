@@ -46,7 +46,6 @@ void nm_svg_map(const char *path, const nm_vect_t *veths, int layer)
         nm_vect_t vms = NM_INIT_VECT;
         nm_str_t lname = NM_INIT_STR;
         nm_str_t rname = NM_INIT_STR;
-        nm_str_t query = NM_INIT_STR;
         nm_gvnode_t *vnode;
         size_t vms_count;
 
@@ -70,8 +69,7 @@ void nm_svg_map(const char *path, const nm_vect_t *veths, int layer)
         agsafeset(vnode, NM_GV_FCOL, NM_VE_COLOR, NM_EMPTY_STR);
         agsafeset(vnode, NM_GV_SHAPE, NM_GV_RECT, NM_EMPTY_STR);
 
-        nm_str_format(&query, NM_GET_IFMAP_SQL, lname.data, rname.data);
-        nm_db_select(query.data, &vms);
+        nm_db_select(NM_GET_IFMAP_SQL, &vms, lname.data, rname.data);
 
         vms_count = vms.n_memb / 2;
         for (size_t n = 0; n < vms_count; n++)
@@ -86,7 +84,6 @@ void nm_svg_map(const char *path, const nm_vect_t *veths, int layer)
         }
 
         nm_vect_free(&vms, nm_str_vect_free_cb);
-        nm_str_free(&query);
 next:
         nm_str_free(&lname);
         nm_str_free(&rname);
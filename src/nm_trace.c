@@ -0,0 +1,394 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_trace.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#if defined (NM_OS_LINUX)
+#include <sys/syscall.h>
+#endif
+
+/* Ring is bounded MPSC queue: writer takes slot by moving head,
+ * fills it and publishes by storing sequence number. Flusher thread
+ * is the only reader. Sequence is stored minus slot index, so zeroed
+ * ring is ready to use and needs no init, records may be put before
+ * the config is read. If ring is full, record is dropped and counted. */
+
+#define NM_TRACE_DEFAULT_PATH "/tmp/nemu_debug.log"
+
+enum {
+    NM_TRACE_RING     = 2048,  /* records, power of 2 */
+    NM_TRACE_MSGLEN   = 232,
+    NM_TRACE_OUTLEN   = 65536,
+    NM_TRACE_INTERVAL = 100    /* ms between flushes */
+};
+
+typedef struct {
+    uint64_t seq;
+    int64_t ts;
+    long tid;
+    int level;
+    char msg[NM_TRACE_MSGLEN];
+} nm_trace_rec_t;
+
+typedef struct {
+    uint64_t head;
+    uint64_t tail;      /* used by reader only */
+    uint64_t dropped;
+    int level;
+    int64_t slow;       /* ns */
+    int running;        /* flusher thread is started */
+    int stop;
+    int hooks;          /* atexit and atfork handlers are set */
+    int fd;
+    pthread_t thread;
+    char path[PATH_MAX];
+} nm_trace_t;
+
+static nm_trace_rec_t nm_trace_ring[NM_TRACE_RING];
+static char nm_trace_out[NM_TRACE_OUTLEN];
+static __thread long nm_trace_tid_cache;
+
+static nm_trace_t nm_trc = {
+#ifdef NM_DEBUG
+    .level = NM_TRACE_DEBUG,
+#else
+    .level = NM_TRACE_OFF,
+#endif
+    .slow = NM_TRACE_SLOW * 1000000LL,
+    .fd = -1,
+    .path = NM_TRACE_DEFAULT_PATH
+};
+
+static void nm_trace_start(void);
+static void *nm_trace_flusher(void *arg);
+static void nm_trace_drain(void);
+static size_t nm_trace_line(size_t pos, int64_t ts, long tid, int level,
+                            const char *msg);
+static void nm_trace_write(size_t len);
+static void nm_trace_exit(void);
+static void nm_trace_atfork_child(void);
+static int64_t nm_trace_now(void);
+static long nm_trace_tid(void);
+
+void nm_trace_init(const char *path, int level, uint64_t slow)
+{
+    if (path && *path)
+        snprintf(nm_trc.path, sizeof(nm_trc.path), "%s", path);
+
+    __atomic_store_n(&nm_trc.slow, (int64_t) slow * 1000000, __ATOMIC_RELAXED);
+    __atomic_store_n(&nm_trc.level, level, __ATOMIC_RELAXED);
+
+    if (!nm_trc.hooks)
+    {
+        atexit(nm_trace_exit);
+        pthread_atfork(NULL, NULL, nm_trace_atfork_child);
+        nm_trc.hooks = 1;
+    }
+}
+
+int nm_trace_enabled(int level)
+{
+    return level <= __atomic_load_n(&nm_trc.level, __ATOMIC_RELAXED);
+}
+
+void nm_trace(int level, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    nm_trace_va(level, fmt, args);
+    va_end(args);
+}
+
+void nm_trace_va(int level, const char *fmt, va_list args)
+{
+    uint64_t pos;
+    nm_trace_rec_t *rec;
+
+    if (!nm_trace_enabled(level))
+        return;
+
+    pos = __atomic_load_n(&nm_trc.head, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        size_t idx = pos & (NM_TRACE_RING - 1);
+        int64_t diff;
+
+        rec = &nm_trace_ring[idx];
+        diff = (int64_t) (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) +
+                idx - pos);
+
+        if (diff == 0)
+        {
+            /* pos is reloaded on failure */
+            if (__atomic_compare_exchange_n(&nm_trc.head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&nm_trc.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&nm_trc.head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->ts = nm_trace_now();
+    rec->tid = nm_trace_tid();
+    rec->level = level;
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+
+    __atomic_store_n(&rec->seq, pos + 1 - (pos & (NM_TRACE_RING - 1)),
+            __ATOMIC_RELEASE);
+
+    if (!__atomic_load_n(&nm_trc.running, __ATOMIC_ACQUIRE))
+        nm_trace_start();
+}
+
+nm_trace_span_t nm_trace_begin(void)
+{
+    nm_trace_span_t span = { 0 };
+
+    if (nm_trace_enabled(NM_TRACE_INFO))
+        span.start = nm_trace_now();
+
+    return span;
+}
+
+void nm_trace_end(nm_trace_span_t span, const char *fmt, ...)
+{
+    char buf[NM_TRACE_MSGLEN];
+    int64_t took;
+    va_list args;
+    int level;
+
+    if (!span.start)
+        return;
+
+    took = nm_trace_now() - span.start;
+    level = (took >= __atomic_load_n(&nm_trc.slow, __ATOMIC_RELAXED)) ?
+        NM_TRACE_INFO : NM_TRACE_DEBUG;
+
+    if (!nm_trace_enabled(level))
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    nm_trace(level, "%" PRId64 ".%03" PRId64 " ms: %s",
+            took / 1000000, (took / 1000) % 1000, buf);
+}
+
+/* Flusher is started by the first record, so forked process
+ * gets its own one. Signals are handled by other threads. */
+static void nm_trace_start(void)
+{
+    sigset_t all, old;
+    int expect = 0;
+
+    if (__atomic_load_n(&nm_trc.stop, __ATOMIC_ACQUIRE))
+        return;
+
+    if (!__atomic_compare_exchange_n(&nm_trc.running, &expect, 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    if (pthread_create(&nm_trc.thread, NULL, nm_trace_flusher, NULL) != 0)
+    {
+        __atomic_store_n(&nm_trc.level, NM_TRACE_OFF, __ATOMIC_RELAXED);
+        __atomic_store_n(&nm_trc.running, 0, __ATOMIC_RELEASE);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void *nm_trace_flusher(void *arg)
+{
+    struct timespec ts = { 0, NM_TRACE_INTERVAL * 1000000L };
+
+    (void) arg;
+
+    while (!__atomic_load_n(&nm_trc.stop, __ATOMIC_ACQUIRE))
+    {
+        nm_trace_drain();
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+/* All published records are written with one write(2). Record that
+ * is taken but not published yet stops drain, so order is kept. */
+static void nm_trace_drain(void)
+{
+    uint64_t dropped;
+    size_t len = 0;
+
+    for (;;)
+    {
+        size_t idx = nm_trc.tail & (NM_TRACE_RING - 1);
+        nm_trace_rec_t *rec = &nm_trace_ring[idx];
+
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) + idx !=
+                nm_trc.tail + 1)
+        {
+            break;
+        }
+
+        if (nm_trc.fd == -1)
+        {
+            nm_trc.fd = open(nm_trc.path,
+                    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (nm_trc.fd == -1)
+            {
+                __atomic_store_n(&nm_trc.level, NM_TRACE_OFF, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+
+        if (len + NM_TRACE_MSGLEN + 64 > sizeof(nm_trace_out))
+        {
+            nm_trace_write(len);
+            len = 0;
+        }
+
+        len = nm_trace_line(len, rec->ts, rec->tid, rec->level, rec->msg);
+
+        __atomic_store_n(&rec->seq, nm_trc.tail + NM_TRACE_RING - idx,
+                __ATOMIC_RELEASE);
+        nm_trc.tail++;
+    }
+
+    if ((dropped = __atomic_exchange_n(&nm_trc.dropped, 0, __ATOMIC_RELAXED)))
+    {
+        char msg[64];
+
+        snprintf(msg, sizeof(msg), "%" PRIu64 " records dropped", dropped);
+        len = nm_trace_line(len, nm_trace_now(), nm_trace_tid(),
+                NM_TRACE_WARN, msg);
+    }
+
+    nm_trace_write(len);
+}
+
+/* Line is "seconds.microseconds tid level message" */
+static size_t nm_trace_line(size_t pos, int64_t ts, long tid, int level,
+                            const char *msg)
+{
+    size_t msg_len = strlen(msg);
+    int n;
+
+    /* messages of nm_debug() have own newline */
+    while (msg_len && msg[msg_len - 1] == '\n')
+        msg_len--;
+
+    n = snprintf(nm_trace_out + pos, sizeof(nm_trace_out) - pos,
+            "%" PRId64 ".%06" PRId64 " %ld %c %.*s\n",
+            ts / 1000000000, (ts / 1000) % 1000000,
+            tid, "-EWID"[level], (int) msg_len, msg);
+
+    return (n > 0) ? pos + n : pos;
+}
+
+/* Trace is best effort, write errors are ignored */
+static void nm_trace_write(size_t len)
+{
+    size_t done = 0;
+
+    while (nm_trc.fd != -1 && done < len)
+    {
+        ssize_t n = write(nm_trc.fd, nm_trace_out + done, len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+}
+
+/* Records left in ring are written at exit, e.g. after nm_bug() */
+static void nm_trace_exit(void)
+{
+    __atomic_store_n(&nm_trc.stop, 1, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&nm_trc.running, __ATOMIC_ACQUIRE))
+    {
+        if (pthread_equal(pthread_self(), nm_trc.thread))
+            return;
+
+        pthread_join(nm_trc.thread, NULL);
+        __atomic_store_n(&nm_trc.running, 0, __ATOMIC_RELEASE);
+    }
+
+    nm_trace_drain();
+
+    if (nm_trc.fd != -1)
+    {
+        close(nm_trc.fd);
+        nm_trc.fd = -1;
+    }
+}
+
+/* Flusher thread is not copied by fork(2). Records of parent
+ * are written by parent, slots taken by its other threads
+ * would never be published, so ring is cleared. */
+static void nm_trace_atfork_child(void)
+{
+    memset(nm_trace_ring, 0, sizeof(nm_trace_ring));
+    nm_trc.head = 0;
+    nm_trc.tail = 0;
+    nm_trc.dropped = 0;
+    nm_trc.running = 0;
+    nm_trace_tid_cache = 0;
+
+    if (nm_trc.fd != -1)
+    {
+        close(nm_trc.fd);
+        nm_trc.fd = -1;
+    }
+}
+
+static int64_t nm_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Thread id is taken once per thread */
+static long nm_trace_tid(void)
+{
+#if !defined (NM_OS_LINUX) || !defined (SYS_gettid)
+    static long last;
+#endif
+
+    if (!nm_trace_tid_cache)
+    {
+#if defined (NM_OS_LINUX) && defined (SYS_gettid)
+        nm_trace_tid_cache = syscall(SYS_gettid);
+#else
+        nm_trace_tid_cache = __atomic_add_fetch(&last, 1, __ATOMIC_RELAXED);
+#endif
+    }
+
+    return nm_trace_tid_cache;
+}
+
+/* vim:set ts=4 sw=4: */
@@ -0,0 +1,43 @@
+#ifndef NM_TRACE_H_
+#define NM_TRACE_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/* Levelled trace log. Records are put into in-memory ring without
+ * locks and written to file by background thread, so tracing costs
+ * no syscalls in the calling thread. Records above configured level
+ * are dropped at once. */
+
+enum nm_trace_level {
+    NM_TRACE_OFF = 0,
+    NM_TRACE_ERR,
+    NM_TRACE_WARN,
+    NM_TRACE_INFO,  /* slow operations */
+    NM_TRACE_DEBUG  /* everything, former nm_debug() output */
+};
+
+enum {NM_TRACE_SLOW = 100}; /* default threshold of spans, ms */
+
+/* Latency of operation, e.g. database query or QMP command.
+ * Spans longer than slow threshold are logged with NM_TRACE_INFO,
+ * others with NM_TRACE_DEBUG. */
+typedef struct {
+    int64_t start; /* CLOCK_MONOTONIC, ns, 0 - span is not traced */
+} nm_trace_span_t;
+
+/* slow is threshold of spans in ms, can be called again */
+void nm_trace_init(const char *path, int level, uint64_t slow);
+int nm_trace_enabled(int level);
+
+void nm_trace(int level, const char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)));
+void nm_trace_va(int level, const char *fmt, va_list args)
+    __attribute__ ((format(printf, 2, 0)));
+
+nm_trace_span_t nm_trace_begin(void);
+void nm_trace_end(nm_trace_span_t span, const char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)));
+
+#endif /* NM_TRACE_H_ */
+/* vim:set ts=4 sw=4: */
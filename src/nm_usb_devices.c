@@ -13,6 +13,40 @@ static inline void nm_usb_dev_free(nm_usb_dev_t *dev);
 #include <libudev.h>
 #include <libusb.h>
 
+/* Registry of USB devices, loaded once per process.
+ * Changes are taken from udev monitor socket before each lookup,
+ * so the bus is not enumerated again on every VM start.
+ * Without udev daemon there are no events, and registry is reloaded.
+ * Serial is read from sysfs, where kernel stores it at enumeration,
+ * so devices are not opened with libusb_open(). */
+typedef struct {
+    nm_str_t syspath;
+    nm_str_t serial;
+    nm_usb_dev_t dev;
+    uint32_t key;  /* vid << 16 | pid */
+    size_t next;   /* next unit in the same bucket */
+} nm_usb_reg_t;
+
+#define NM_USB_IDX_END SIZE_MAX
+
+static nm_arr_t nm_usb_reg = {0, 0, sizeof(nm_usb_reg_t), NULL, NULL};
+static struct udev *udev = NULL;
+static struct udev_monitor *mon = NULL;
+
+/* hash index on vid:pid, rebuilt after registry was changed */
+static size_t *nm_usb_idx = NULL;
+static size_t nm_usb_idx_size = 0;
+static int nm_usb_idx_valid = 0;
+
+static void nm_usb_reg_sync(void);
+static void nm_usb_reg_init(void);
+static void nm_usb_reg_load(void);
+static void nm_usb_reg_update(void);
+static void nm_usb_reg_add(struct udev_device *device);
+static void nm_usb_reg_del(const char *syspath);
+static void nm_usb_reg_free_cb(void *unit_p);
+static void nm_usb_idx_build(void);
+static size_t nm_usb_idx_hash(uint32_t key);
 static const char *nm_usb_hwdb_get(const char *modalias, const char *key);
 static const char *nm_usb_get_vendor(uint16_t vid);
 static const char *nm_usb_get_product(uint16_t vid, uint16_t pid);
@@ -22,67 +56,89 @@ static int nm_usb_get_product_str(char *buf, size_t size, uint16_t vid, uint16_t
 static struct udev_hwdb *hwdb = NULL;
 #endif /* NM_OS_LINUX */
 
-void nm_usb_get_devs(nm_vect_t *v)
+void nm_usb_get_devs(nm_arr_t *v)
 {
 #if defined (NM_OS_LINUX)
-    libusb_context *ctx = NULL;
-    libusb_device **list = NULL;
-    struct udev *udev = NULL;
-    int rc;
-    ssize_t dev_count, n;
-    char vendor[128], product[128];
-
-    if ((udev = udev_new()) == NULL)
-        nm_bug(_("%s: udev_new failed"), __func__);
-
-    if ((hwdb = udev_hwdb_new(udev)) == NULL)
-        nm_bug(_("%s: udev_hwdb_new failed"), __func__);
+    nm_usb_reg_sync();
 
-    if ((rc = libusb_init(&ctx)) != 0)
-        nm_bug("%s: %s", __func__, libusb_strerror(rc));
+    nm_arr_reserve(v, v->n_memb + nm_usb_reg.n_memb);
 
-    if ((dev_count = libusb_get_device_list(ctx, &list)) < 1)
-        nm_bug(_("%s: libusb_get_device_list failed"), __func__);
-
-    //@TODO Some of variables may be moved outside, and freed only once
-    for (n = 0; n < dev_count; n++)
+    for (size_t n = 0; n < nm_usb_reg.n_memb; n++)
     {
+        const nm_usb_dev_t *reg = &((nm_usb_reg_t *)
+                nm_arr_at(&nm_usb_reg, n))->dev;
         nm_usb_dev_t dev = NM_INIT_USB;
-        libusb_device *device = list[n];
-        struct libusb_device_descriptor desc;
 
-        memset(&desc, 0, sizeof(desc));
+        nm_str_copy(&dev.name, &reg->name);
+        nm_str_copy(&dev.vendor_id, &reg->vendor_id);
+        nm_str_copy(&dev.product_id, &reg->product_id);
+        dev.bus_num = reg->bus_num;
+        dev.dev_addr = reg->dev_addr;
 
-        if (libusb_get_device_descriptor(device, &desc) != 0)
-            continue;
+        /* strings are owned by list now */
+        nm_arr_push(v, &dev);
+    }
+#else
+    (void) v;
+#endif /* NM_OS_LINUX */
+}
 
-        if (nm_usb_get_vendor_str(vendor, sizeof(vendor), desc.idVendor) == 0)
-            nm_str_alloc_text(&dev.name, "vendor-unknown");
-        else
-            nm_str_alloc_text(&dev.name, vendor);
+/* Devices without serial match "NULL", stored by USB plug dialog */
+const nm_usb_dev_t *nm_usb_find(const char *vid, const char *pid,
+                                const char *serial)
+{
+#if defined (NM_OS_LINUX)
+    uint32_t key;
 
-        if (nm_usb_get_product_str(product, sizeof(product), desc.idVendor, desc.idProduct) == 0)
-            nm_str_add_text(&dev.name, " product-unknown");
-        else
-            nm_str_add_text(&dev.name, product);
+    nm_usb_reg_sync();
 
-        dev.bus_num = libusb_get_bus_number(device);
-        dev.dev_addr = libusb_get_device_address(device);
+    if (!nm_usb_idx_valid)
+        nm_usb_idx_build();
 
-        nm_str_format(&dev.vendor_id, "%04x", desc.idVendor);
-        nm_str_format(&dev.product_id, "%04x", desc.idProduct);
+    key = (strtoul(vid, NULL, 16) << 16) | strtoul(pid, NULL, 16);
 
-        nm_vect_insert(v, &dev, sizeof(dev), nm_usb_vect_ins_cb);
-        nm_usb_dev_free(&dev);
-    }
+    for (size_t n = nm_usb_idx[nm_usb_idx_hash(key)]; n != NM_USB_IDX_END;)
+    {
+        const nm_usb_reg_t *reg = nm_arr_at(&nm_usb_reg, n);
 
-    /* cleanup */
-    libusb_free_device_list(list, 1);
-    udev_hwdb_unref(hwdb);
-    udev_unref(udev);
-    libusb_exit(ctx);
+        if (reg->key == key &&
+            ((reg->serial.len && nm_str_cmp_st(&reg->serial, serial) == NM_OK) ||
+             (!reg->serial.len && (!*serial ||
+                nm_str_cmp_tt(serial, "NULL") == NM_OK))))
+        {
+            return &reg->dev;
+        }
+
+        n = reg->next;
+    }
 #else
-    (void) v;
+    (void) vid;
+    (void) pid;
+    (void) serial;
+#endif /* NM_OS_LINUX */
+
+    return NULL;
+}
+
+void nm_usb_free(void)
+{
+#if defined (NM_OS_LINUX)
+    nm_arr_free(&nm_usb_reg, nm_usb_reg_free_cb);
+    free(nm_usb_idx);
+    nm_usb_idx = NULL;
+    nm_usb_idx_size = 0;
+    nm_usb_idx_valid = 0;
+
+    if (mon)
+        udev_monitor_unref(mon);
+    if (hwdb)
+        udev_hwdb_unref(hwdb);
+    if (udev)
+        udev_unref(udev);
+
+    mon = NULL;
+    hwdb = NULL;
+    udev = NULL;
 #endif /* NM_OS_LINUX */
 }
 
@@ -98,6 +154,26 @@ int nm_usb_get_serial(const nm_usb_dev_t *dev, nm_str_t *serial)
     if (dev == NULL)
         nm_bug(_("%s: null nm_usb_dev_t pointer"), __func__);
 
+    nm_usb_reg_sync();
+
+    for (size_t n = 0; n < nm_usb_reg.n_memb; n++)
+    {
+        const nm_usb_reg_t *reg = nm_arr_at(&nm_usb_reg, n);
+
+        if (reg->dev.bus_num != dev->bus_num ||
+            reg->dev.dev_addr != dev->dev_addr)
+        {
+            continue;
+        }
+
+        if (!reg->serial.len)
+            return NM_ERR;
+
+        nm_str_copy(serial, &reg->serial);
+        return NM_OK;
+    }
+
+    /* device is not known yet, ask it directly */
     if ((usb_rc = libusb_init(&ctx)) != 0)
         nm_bug("%s: %s", __func__, libusb_strerror(usb_rc));
 
@@ -151,15 +227,6 @@ int nm_usb_get_serial(const nm_usb_dev_t *dev, nm_str_t *serial)
     return rc;
 }
 
-void nm_usb_vect_ins_cb(void *unit_p, const void *ctx)
-{
-    nm_str_copy(nm_usb_name(unit_p), nm_usb_name(ctx));
-    nm_str_copy(nm_usb_vendor_id(unit_p), nm_usb_vendor_id(ctx));
-    nm_str_copy(nm_usb_product_id(unit_p), nm_usb_product_id(ctx));
-    *nm_usb_bus_num(unit_p) = *nm_usb_bus_num(ctx);
-    *nm_usb_dev_addr(unit_p) = *nm_usb_dev_addr(ctx);
-}
-
 void nm_usb_vect_free_cb(void *unit_p)
 {
     nm_str_free(nm_usb_name(unit_p));
@@ -167,12 +234,6 @@ void nm_usb_vect_free_cb(void *unit_p)
     nm_str_free(nm_usb_product_id(unit_p));
 }
 
-void nm_usb_data_vect_ins_cb(void *unit_p, const void *ctx)
-{
-    nm_str_copy(nm_usb_data_serial(unit_p), nm_usb_data_serial(ctx));
-    *nm_usb_data_dev(unit_p) = *nm_usb_data_dev(ctx);
-}
-
 void nm_usb_data_vect_free_cb(void *unit_p)
 {
     nm_str_free(nm_usb_data_serial(unit_p));
@@ -192,6 +253,200 @@ static inline void nm_usb_dev_free(nm_usb_dev_t *dev)
 }
 
 #if defined (NM_OS_LINUX)
+static void nm_usb_reg_sync(void)
+{
+    if (!udev)
+        nm_usb_reg_init();
+    else if (mon)
+        nm_usb_reg_update();
+    else
+        nm_usb_reg_load();
+}
+
+/* Monitor is set up before enumeration, so no device is missed:
+ * device added twice is replaced by the same syspath */
+static void nm_usb_reg_init(void)
+{
+    if ((udev = udev_new()) == NULL)
+        nm_bug(_("%s: udev_new failed"), __func__);
+
+    if ((hwdb = udev_hwdb_new(udev)) == NULL)
+        nm_bug(_("%s: udev_hwdb_new failed"), __func__);
+
+    /* events are sent by udev daemon only */
+    if (access("/run/udev/control", F_OK) == 0 &&
+        (mon = udev_monitor_new_from_netlink(udev, "udev")) != NULL)
+    {
+        if (udev_monitor_filter_add_match_subsystem_devtype(mon,
+                "usb", "usb_device") < 0 ||
+            udev_monitor_enable_receiving(mon) < 0)
+        {
+            udev_monitor_unref(mon);
+            mon = NULL;
+        }
+    }
+
+    nm_usb_reg_load();
+}
+
+static void nm_usb_reg_load(void)
+{
+    struct udev_enumerate *en;
+    struct udev_list_entry *entry;
+
+    nm_arr_clear(&nm_usb_reg, nm_usb_reg_free_cb);
+    nm_usb_idx_valid = 0;
+
+    if ((en = udev_enumerate_new(udev)) == NULL)
+        nm_bug(_("%s: udev_enumerate_new failed"), __func__);
+
+    udev_enumerate_add_match_subsystem(en, "usb");
+    udev_enumerate_add_match_property(en, "DEVTYPE", "usb_device");
+    udev_enumerate_scan_devices(en);
+
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(en))
+    {
+        struct udev_device *device;
+
+        device = udev_device_new_from_syspath(udev,
+                udev_list_entry_get_name(entry));
+        if (!device)
+            continue;
+
+        nm_usb_reg_add(device);
+        udev_device_unref(device);
+    }
+
+    udev_enumerate_unref(en);
+}
+
+/* Monitor socket is non-blocking, all queued events are read */
+static void nm_usb_reg_update(void)
+{
+    struct udev_device *device;
+
+    while ((device = udev_monitor_receive_device(mon)) != NULL)
+    {
+        const char *action = udev_device_get_action(device);
+
+        if (action && nm_str_cmp_tt(action, "remove") == NM_OK)
+            nm_usb_reg_del(udev_device_get_syspath(device));
+        else
+            nm_usb_reg_add(device);
+
+        udev_device_unref(device);
+    }
+}
+
+static void nm_usb_reg_add(struct udev_device *device)
+{
+    const char *syspath = udev_device_get_syspath(device);
+    const char *vid = udev_device_get_sysattr_value(device, "idVendor");
+    const char *pid = udev_device_get_sysattr_value(device, "idProduct");
+    const char *bus = udev_device_get_sysattr_value(device, "busnum");
+    const char *addr = udev_device_get_sysattr_value(device, "devnum");
+    const char *ser = udev_device_get_sysattr_value(device, "serial");
+    nm_usb_reg_t reg = { NM_INIT_STR, NM_INIT_STR, NM_INIT_USB, 0, 0 };
+    char vendor[128], product[128];
+    uint16_t vid_num, pid_num;
+
+    if (!syspath || !vid || !pid || !bus || !addr)
+        return;
+
+    nm_usb_reg_del(syspath);
+
+    vid_num = strtoul(vid, NULL, 16);
+    pid_num = strtoul(pid, NULL, 16);
+
+    if (nm_usb_get_vendor_str(vendor, sizeof(vendor), vid_num) == 0)
+        nm_str_alloc_text(&reg.dev.name, "vendor-unknown");
+    else
+        nm_str_alloc_text(&reg.dev.name, vendor);
+
+    if (nm_usb_get_product_str(product, sizeof(product), vid_num, pid_num) == 0)
+        nm_str_add_text(&reg.dev.name, " product-unknown");
+    else
+        nm_str_add_text(&reg.dev.name, product);
+
+    nm_str_alloc_text(&reg.syspath, syspath);
+    if (ser && *ser)
+        nm_str_alloc_text(&reg.serial, ser);
+    reg.key = ((uint32_t) vid_num << 16) | pid_num;
+    nm_str_format(&reg.dev.vendor_id, "%04x", vid_num);
+    nm_str_format(&reg.dev.product_id, "%04x", pid_num);
+    reg.dev.bus_num = atoi(bus);
+    reg.dev.dev_addr = atoi(addr);
+
+    nm_arr_push(&nm_usb_reg, &reg);
+    nm_usb_idx_valid = 0;
+}
+
+/* Last unit takes place of removed one */
+static void nm_usb_reg_del(const char *syspath)
+{
+    for (size_t n = 0; n < nm_usb_reg.n_memb; n++)
+    {
+        nm_usb_reg_t *reg = nm_arr_at(&nm_usb_reg, n);
+
+        if (!syspath || nm_str_cmp_st(&reg->syspath, syspath) != NM_OK)
+            continue;
+
+        nm_usb_reg_free_cb(reg);
+        if (n != nm_usb_reg.n_memb - 1)
+        {
+            memcpy(reg, nm_arr_at(&nm_usb_reg, nm_usb_reg.n_memb - 1),
+                sizeof(*reg));
+        }
+        nm_usb_reg.n_memb--;
+        nm_usb_idx_valid = 0;
+        break;
+    }
+}
+
+static void nm_usb_reg_free_cb(void *unit_p)
+{
+    nm_usb_reg_t *reg = unit_p;
+
+    nm_str_free(&reg->syspath);
+    nm_str_free(&reg->serial);
+    nm_usb_dev_free(&reg->dev);
+}
+
+/* Chains are kept in units, table has at least two buckets per unit */
+static void nm_usb_idx_build(void)
+{
+    size_t size = 16;
+
+    while (size < nm_usb_reg.n_memb * 2)
+        size *= 2;
+
+    if (size != nm_usb_idx_size)
+    {
+        free(nm_usb_idx);
+        nm_usb_idx = nm_alloc(size * sizeof(size_t));
+        nm_usb_idx_size = size;
+    }
+
+    for (size_t n = 0; n < size; n++)
+        nm_usb_idx[n] = NM_USB_IDX_END;
+
+    for (size_t n = 0; n < nm_usb_reg.n_memb; n++)
+    {
+        nm_usb_reg_t *reg = nm_arr_at(&nm_usb_reg, n);
+        size_t bucket = nm_usb_idx_hash(reg->key);
+
+        reg->next = nm_usb_idx[bucket];
+        nm_usb_idx[bucket] = n;
+    }
+
+    nm_usb_idx_valid = 1;
+}
+
+static size_t nm_usb_idx_hash(uint32_t key)
+{
+    return ((key * 0x9e3779b1U) >> 12) & (nm_usb_idx_size - 1);
+}
+
 static const char *nm_usb_hwdb_get(const char *modalias, const char *key)
 {
     struct udev_list_entry *entry;
@@ -21,10 +21,14 @@ typedef struct {
 
 #define NM_INIT_USB_DATA (nm_usb_data_t) { NM_INIT_STR, NULL }
 
-void nm_usb_get_devs(nm_vect_t *v);
-void nm_usb_vect_ins_cb(void *unit_p, const void *ctx);
+/* v must be initialized with NM_INIT_ARR(nm_usb_dev_t),
+ * devices are copied from registry kept up to date by udev events */
+void nm_usb_get_devs(nm_arr_t *v);
+/* Device is owned by registry and valid until next call */
+const nm_usb_dev_t *nm_usb_find(const char *vid, const char *pid,
+                                const char *serial);
+void nm_usb_free(void);
 void nm_usb_vect_free_cb(void *unit_p);
-void nm_usb_data_vect_ins_cb(void *unit_p, const void *ctx);
 void nm_usb_data_vect_free_cb(void *unit_p);
 int nm_usb_get_serial(const nm_usb_dev_t *dev, nm_str_t *serial);
 void nm_usb_data_free(nm_usb_data_t *dev);
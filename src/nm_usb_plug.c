@@ -11,11 +11,11 @@
 
 static const char NM_USB_FORM_MSG[] = "Device";
 
-static void nm_usb_plug_list(nm_vect_t *devs, nm_vect_t *names);
-static void nm_usb_unplug_list(const nm_vect_t *db_list, nm_vect_t *names);
+static void nm_usb_plug_list(nm_arr_t *devs, nm_vect_t *names);
+static void nm_usb_unplug_list(const nm_db_res_t *db_list, nm_vect_t *names);
 static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
-        const nm_vect_t *usb_list);
-static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list);
+        const nm_arr_t *usb_list);
+static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_db_res_t *db_list);
 static void nm_usb_plug_update_db(const nm_str_t *name, const nm_usb_data_t *usb);
 
 static nm_field_t *fields[2];
@@ -23,8 +23,7 @@ static nm_field_t *fields[2];
 void nm_usb_plug(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
-    nm_str_t buf = NM_INIT_STR;
-    nm_vect_t usb_devs = NM_INIT_VECT;
+    nm_arr_t usb_devs = NM_INIT_ARR(nm_usb_dev_t);
     nm_vect_t usb_names = NM_INIT_VECT;
     nm_vect_t db_result = NM_INIT_VECT;
     nm_usb_data_t usb = NM_INIT_USB_DATA;
@@ -35,8 +34,7 @@ void nm_usb_plug(const nm_str_t *name, int vm_status)
         return;
 
     /* check for usb enabled first */
-    nm_str_format(&buf, NM_USB_CHECK_SQL, name->data);
-    nm_db_select(buf.data, &db_result);
+    nm_db_select(NM_USB_CHECK_SQL, &db_result, name->data);
 
     if (nm_str_cmp_st(nm_vect_str(&db_result, 0), NM_DISABLE) == NM_OK)
     {
@@ -74,7 +72,7 @@ void nm_usb_plug(const nm_str_t *name, int vm_status)
         goto clean_and_out;
 
     if (vm_status)
-        (void) nm_qmp_usb_attach(name, &usb);
+        (void) nm_qmp_usb_attach_async(name, &usb, NULL, NULL);
 
     nm_usb_plug_update_db(name, &usb);
 
@@ -86,22 +84,20 @@ out:
     wtimeout(action_window, -1);
     delwin(form_data.form_window);
     nm_vect_free(&usb_names, NULL);
-    nm_vect_free(&usb_devs, nm_usb_vect_free_cb);
+    nm_arr_free(&usb_devs, nm_usb_vect_free_cb);
     nm_vect_free(&db_result, nm_str_vect_free_cb);
 
     nm_form_free(form, fields);
-    nm_str_free(&buf);
     nm_str_free(&usb.serial);
 }
 
 void nm_usb_unplug(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
-    nm_str_t buf = NM_INIT_STR;
     nm_usb_data_t usb_data = NM_INIT_USB_DATA;
     nm_usb_dev_t usb_dev = NM_INIT_USB;
     nm_vect_t usb_names = NM_INIT_VECT;
-    nm_vect_t db_result = NM_INIT_VECT;
+    nm_db_res_t db_result = NM_INIT_DB_RES;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     size_t msg_len = mbstowcs(NULL, NM_USB_FORM_MSG, strlen(NM_USB_FORM_MSG));
 
@@ -110,10 +106,9 @@ void nm_usb_unplug(const nm_str_t *name, int vm_status)
 
     usb_data.dev = &usb_dev;
 
-    nm_str_format(&buf, NM_USB_GET_SQL, name->data);
-    nm_db_select(buf.data, &db_result);
+    nm_db_select_rows(NM_USB_GET_SQL, NM_DB_ROW_USB, &db_result, name->data);
 
-    if (!db_result.n_memb)
+    if (!db_result.n_rows)
     {
         nm_warn(_(NM_MSG_USB_NONE));
         goto out;
@@ -143,15 +138,14 @@ void nm_usb_unplug(const nm_str_t *name, int vm_status)
         goto clean_and_out;
 
     if (vm_status)
-        (void) nm_qmp_usb_detach(name, &usb_data);
+        (void) nm_qmp_usb_detach_async(name, &usb_data, NULL, NULL);
 
-    nm_str_format(&buf, NM_USB_DELETE_SQL,
+    nm_db_edit(NM_USB_DELETE_SQL,
             name->data,
             usb_dev.name.data,
             usb_dev.vendor_id.data,
             usb_dev.product_id.data,
             usb_data.serial.data);
-    nm_db_edit(buf.data);
 
 clean_and_out:
     werase(help_window);
@@ -161,46 +155,45 @@ out:
     wtimeout(action_window, -1);
     delwin(form_data.form_window);
     nm_vect_free(&usb_names, NULL);
-    nm_vect_free(&db_result, nm_str_vect_free_cb);
+    nm_db_res_free(&db_result);
     nm_form_free(form, fields);
     nm_usb_data_free(&usb_data);
-    nm_str_free(&buf);
 }
 
-static void nm_usb_unplug_list(const nm_vect_t *db_list, nm_vect_t *names)
+static void nm_usb_unplug_list(const nm_db_res_t *db_list, nm_vect_t *names)
 {
-    size_t dev_count = db_list->n_memb / NM_USB_IDX_COUNT;
     nm_str_t buf = NM_INIT_STR;
 
-    for (size_t n = 0; n < dev_count; n++)
+    for (size_t n = 0; n < db_list->n_rows; n++)
     {
-        size_t idx_shift = NM_USB_IDX_COUNT * n;
+        const nm_db_usb_t *dev = nm_db_usb(db_list, n);
 
         nm_str_format(&buf, "%zu:%s [serial:%s]", n + 1,
-                nm_vect_str_ctx(db_list, NM_SQL_USB_NAME + idx_shift),
-                nm_vect_str_ctx(db_list, NM_SQL_USB_SERIAL + idx_shift));
+                dev->dev_name, dev->serial);
         nm_vect_insert(names, buf.data, buf.len + 1, NULL);
     }
 
     nm_str_free(&buf);
 }
 
-static void nm_usb_plug_list(nm_vect_t *devs, nm_vect_t *names)
+static void nm_usb_plug_list(nm_arr_t *devs, nm_vect_t *names)
 {
     nm_usb_get_devs(devs);
     nm_str_t dev_name = NM_INIT_STR;
 
     for (size_t n = 0; n < devs->n_memb; n++)
     {
-        nm_str_format(&dev_name, "%zu:%s", n + 1, nm_usb_name(devs->data[n])->data);
+        const nm_usb_dev_t *dev = nm_arr_at(devs, n);
+
+        nm_str_format(&dev_name, "%zu:%s", n + 1, nm_usb_name(dev)->data);
         nm_vect_insert(names, dev_name.data, dev_name.len + 1, NULL);
 
         nm_debug("usb >> %03u:%03u %s:%s %s\n",
-                *nm_usb_bus_num(devs->data[n]),
-                *nm_usb_dev_addr(devs->data[n]),
-                nm_usb_vendor_id(devs->data[n])->data,
-                nm_usb_product_id(devs->data[n])->data,
-                nm_usb_name(devs->data[n])->data);
+                *nm_usb_bus_num(dev),
+                *nm_usb_dev_addr(dev),
+                nm_usb_vendor_id(dev)->data,
+                nm_usb_product_id(dev)->data,
+                nm_usb_name(dev)->data);
     }
 
     nm_vect_end_zero(names);
@@ -208,7 +201,7 @@ static void nm_usb_plug_list(nm_vect_t *devs, nm_vect_t *names)
 }
 
 static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
-        const nm_vect_t *usb_list)
+        const nm_arr_t *usb_list)
 {
     int rc = NM_ERR;
     nm_str_t buf = NM_INIT_STR;
@@ -237,19 +230,17 @@ static int nm_usb_plug_get_data(const nm_str_t *name, nm_usb_data_t *usb,
 
     *fo = '\0';
     idx = nm_str_stoui(&buf, 10);
-    usb->dev = usb_list->data[idx - 1];
+    usb->dev = nm_arr_at(usb_list, idx - 1);
 
     nm_usb_get_serial(usb->dev, &usb->serial);
 
-    nm_str_format(&buf, NM_USB_EXISTS_SQL,
+    nm_db_select(NM_USB_EXISTS_SQL, &db_list,
             name->data,
             usb->dev->name.data,
             usb->dev->vendor_id.data,
             usb->dev->product_id.data,
             (usb->serial.data) ? usb->serial.data : "NULL");
 
-    nm_db_select(buf.data, &db_list);
-
     if (db_list.n_memb)
     {
         nm_warn(_(NM_MSG_USB_ATTAC));
@@ -265,12 +256,13 @@ out:
     return rc;
 }
 
-static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list)
+static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_db_res_t *db_list)
 {
     int rc = NM_ERR;
     nm_str_t buf = NM_INIT_STR;
     nm_str_t input = NM_INIT_STR;
-    uint32_t idx, idx_shift;
+    const nm_db_usb_t *dev;
+    uint32_t idx;
     char *fo;
 
     nm_get_field_buf(fields[0], &input);
@@ -290,17 +282,13 @@ static int nm_usb_unplug_get_data(nm_usb_data_t *usb, const nm_vect_t *db_list)
 
     *fo = '\0';
     idx = nm_str_stoui(&buf, 10);
-    idx_shift = --idx * NM_USB_IDX_COUNT;
+    dev = nm_db_usb(db_list, --idx);
     nm_debug("s:%s, idx=%u\n", buf.data, idx);
 
-    nm_str_copy(&usb->dev->name,
-            nm_vect_str(db_list, NM_SQL_USB_NAME + idx_shift));
-    nm_str_copy(&usb->dev->vendor_id,
-            nm_vect_str(db_list, NM_SQL_USB_VID + idx_shift));
-    nm_str_copy(&usb->dev->product_id,
-            nm_vect_str(db_list, NM_SQL_USB_PID + idx_shift));
-    nm_str_copy(&usb->serial,
-            nm_vect_str(db_list, NM_SQL_USB_SERIAL + idx_shift));
+    nm_str_alloc_text(&usb->dev->name, dev->dev_name);
+    nm_str_alloc_text(&usb->dev->vendor_id, dev->vendor_id);
+    nm_str_alloc_text(&usb->dev->product_id, dev->product_id);
+    nm_str_alloc_text(&usb->serial, dev->serial);
 
     rc = NM_OK;
 out:
@@ -312,17 +300,11 @@ out:
 
 static void nm_usb_plug_update_db(const nm_str_t *name, const nm_usb_data_t *usb)
 {
-    nm_str_t query = NM_INIT_STR;
-
-    nm_str_format(&query, NM_USB_ADD_SQL,
+    nm_db_edit(NM_USB_ADD_SQL,
             name->data,
             usb->dev->name.data,
             usb->dev->vendor_id.data,
             usb->dev->product_id.data,
             (usb->serial.data) ? usb->serial.data : "NULL");
-
-    nm_db_edit(query.data);
-
-    nm_str_free(&query);
 }
 /* vim:set ts=4 sw=4: */
@@ -3,24 +3,62 @@
 #include <nm_vector.h>
 #include <nm_ncurses.h>
 #include <nm_vm_control.h>
+#include <nm_trace.h>
 
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 
 enum {
     NM_BLKSIZE      = 131072, /* 128KiB */
-    NM_SOCK_READLEN = 1024,
+    NM_SOCK_READLEN = 16384,
 };
 
+extern char **environ;
+
 #if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
 #include <sys/sendfile.h>
 #endif
 
+#if defined (NM_OS_LINUX)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+#if defined (NM_OS_LINUX)
+static int nm_copy_file_reflink(int in_fd, int out_fd);
+static int nm_copy_file_range(int in_fd, int out_fd);
+#endif
 #if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
 static void nm_copy_file_sendfile(int in_fd, int out_fd);
 #else
 static void nm_copy_file_default(int in_fd, int out_fd);
 #endif
+static void nm_spawn_step(int block);
+static void nm_spawn_read(nm_spawn_t *sp);
+static int64_t nm_spawn_now(void);
+
+struct nm_spawn {
+    nm_spawn_t *next; /* list of running processes */
+    pid_t pid;
+    int fd;           /* stdout and stderr, stdin with NM_SPAWN_STDIN */
+    int pidfd;        /* readable on exit, -1 if not supported */
+    int eof;
+    int exited;
+    int rc;
+    int64_t deadline; /* CLOCK_MONOTONIC, ms, 0 - no limit */
+    nm_trace_span_t span;
+    char name[32];    /* argv[0], for trace */
+    nm_str_t out;
+};
+
+/* Started processes that are not reaped yet. Output of all of them
+ * is read while any one is waited for, so no process is blocked
+ * on full socket buffer. */
+static nm_spawn_t *nm_spawn_list;
 
 void nm_bug(const char *fmt, ...)
 {
@@ -29,6 +67,16 @@ void nm_bug(const char *fmt, ...)
 
     nm_curses_deinit();
 
+    /* trace is written at exit */
+    if (nm_trace_enabled(NM_TRACE_ERR))
+    {
+        va_list copy;
+
+        va_copy(copy, args);
+        nm_trace_va(NM_TRACE_ERR, fmt, copy);
+        va_end(copy);
+    }
+
     vfprintf(stderr, fmt, args);
     putc('\n', stderr);
     va_end(args);
@@ -117,16 +165,108 @@ void nm_copy_file(const nm_str_t *src, const nm_str_t *dst)
             __func__, dst->data, strerror(errno));
     }
 
+#if defined (NM_OS_LINUX)
+    /* cheapest way first: shared extents, then in-kernel copy
+     * (server-side copy on NFS), then plain copy */
+    if (nm_copy_file_reflink(in_fd, out_fd) == NM_OK)
+    {
+        nm_debug("%s: %s cloned with reflink\n", __func__, src->data);
+        goto out;
+    }
+    if (nm_copy_file_range(in_fd, out_fd) == NM_OK)
+    {
+        nm_debug("%s: %s copied with copy_file_range\n", __func__, src->data);
+        goto out;
+    }
+#endif
+
 #if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
     nm_copy_file_sendfile(in_fd, out_fd);
 #else
     nm_copy_file_default(in_fd, out_fd);
 #endif
 
+#if defined (NM_OS_LINUX)
+out:
+#endif
     close(in_fd);
     close(out_fd);
 }
 
+#if defined (NM_OS_LINUX)
+/* btrfs, XFS with reflink=1, etc: no data is copied at all */
+static int nm_copy_file_reflink(int in_fd, int out_fd)
+{
+#if defined (FICLONE)
+    if (ioctl(out_fd, FICLONE, in_fd) == 0)
+        return NM_OK;
+#else
+    (void) in_fd;
+    (void) out_fd;
+#endif
+
+    return NM_ERR;
+}
+
+/* Returns NM_ERR if kernel or filesystem cannot do it
+ * and nothing was copied, so other method can be used */
+static int nm_copy_file_range(int in_fd, int out_fd)
+{
+#if defined (SYS_copy_file_range)
+    struct stat file_info;
+    off_t left;
+
+    memset(&file_info, 0, sizeof(file_info));
+
+    if (fstat(in_fd, &file_info) != 0)
+        nm_bug("%s: cannot get file info %d: %s", __func__, in_fd, strerror(errno));
+
+    left = file_info.st_size;
+
+    while (left > 0)
+    {
+        ssize_t rc = syscall(SYS_copy_file_range, in_fd, NULL,
+                             out_fd, NULL, (size_t) left, 0);
+
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (left == file_info.st_size &&
+                (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                 errno == EOPNOTSUPP || errno == EBADF))
+            {
+                return NM_ERR;
+            }
+
+            nm_bug("%s: cannot copy file: %s", __func__, strerror(errno));
+        }
+
+        /* some filesystems return 0 instead of error */
+        if (rc == 0)
+        {
+            if (left == file_info.st_size)
+                return NM_ERR;
+            break;
+        }
+
+        left -= rc;
+    }
+
+    if (left != 0)
+        nm_bug("%s: incomplete transfer from copy_file_range", __func__);
+
+    return NM_OK;
+#else
+    (void) in_fd;
+    (void) out_fd;
+
+    return NM_ERR;
+#endif /* SYS_copy_file_range */
+}
+#endif /* NM_OS_LINUX */
+
 #if defined (NM_OS_LINUX) && defined (NM_WITH_SENDFILE)
 static void nm_copy_file_sendfile(int in_fd, int out_fd)
 {
@@ -187,94 +327,282 @@ static void nm_copy_file_default(int in_fd, int out_fd)
 }
 #endif
 
-int nm_spawn_process(const nm_vect_t *argv, nm_str_t *answer)
+int nm_spawn_process(nm_argv_t *argv, nm_str_t *answer)
 {
-    int rc = NM_OK;
-    int fd[2];
-    pid_t child_pid = 0;
+    return nm_spawn_wait(nm_spawn_start(argv, 0, 0), answer);
+}
+
+/* Child is created with posix_spawn(3): nemu memory, curses state
+ * and database handle are not copied. Output socket is close-on-exec,
+ * so processes started one after another do not hold output sockets
+ * of each other. If process cannot be executed, handle of finished
+ * process with error message is returned. */
+nm_spawn_t *nm_spawn_start(nm_argv_t *argv, int flags, int timeout)
+{
+    nm_spawn_t *sp = nm_calloc(1, sizeof(nm_spawn_t));
+    char *const *args = nm_argv_data(argv);
+    posix_spawn_file_actions_t fa;
+    int sv[2];
+    int rc;
 
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1)
+    sp->pidfd = -1;
+    sp->span = nm_trace_begin();
+    snprintf(sp->name, sizeof(sp->name), "%s", args[0]);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
         nm_bug("%s: error create socketpair: %s", __func__, strerror(errno));
 
-    switch (child_pid = fork()) {
-    case (-1):  /* error*/
-        nm_bug("%s: fork: %s", __func__, strerror(errno));
-        break;
+    if ((rc = posix_spawn_file_actions_init(&fa)) != 0)
+        nm_bug("%s: posix_spawn_file_actions_init: %s", __func__, strerror(rc));
+
+    /* copies made by dup2(2) are inherited */
+    if (flags & NM_SPAWN_STDIN)
+        posix_spawn_file_actions_adddup2(&fa, sv[1], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, sv[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, sv[1], STDERR_FILENO);
+
+    rc = posix_spawnp(&sp->pid, args[0], &fa, NULL, args, environ);
+
+    posix_spawn_file_actions_destroy(&fa);
+    close(sv[1]);
+    sp->fd = sv[0];
+
+    if (rc != 0)
+    {
+        nm_str_format(&sp->out, "%s: %s\n", args[0], strerror(rc));
+        sp->eof = NM_TRUE;
+        sp->exited = NM_TRUE;
+        sp->rc = NM_ERR;
+        return sp;
+    }
+
+    if (fcntl(sp->fd, F_SETFL, O_NONBLOCK) == -1)
+        nm_bug("%s: fcntl: %s", __func__, strerror(errno));
+
+#if defined (NM_OS_LINUX) && defined (SYS_pidfd_open)
+    sp->pidfd = syscall(SYS_pidfd_open, sp->pid, 0);
+#endif
+
+    if (timeout > 0)
+        sp->deadline = nm_spawn_now() + timeout;
+
+    sp->next = nm_spawn_list;
+    nm_spawn_list = sp;
+
+    return sp;
+}
+
+int nm_spawn_fd(const nm_spawn_t *sp)
+{
+    return sp->fd;
+}
+
+int nm_spawn_pidfd(const nm_spawn_t *sp)
+{
+    return sp->pidfd;
+}
+
+int nm_spawn_done(nm_spawn_t *sp)
+{
+    if (!sp->exited)
+        nm_spawn_step(NM_FALSE);
+
+    return sp->exited;
+}
+
+int nm_spawn_wait(nm_spawn_t *sp, nm_str_t *answer)
+{
+    int rc;
+
+    while (!sp->exited)
+        nm_spawn_step(NM_TRUE);
+
+    if ((rc = sp->rc) != NM_OK)
+    {
+        nm_vmctl_log_last(&sp->out);
+        nm_debug("exec_error: %s", sp->out.len ? sp->out.data : "\n");
+    }
+    else if (answer && sp->out.len)
+    {
+        nm_str_add_str(answer, &sp->out);
+    }
+
+    close(sp->fd);
+    if (sp->pidfd != -1)
+        close(sp->pidfd);
+    nm_str_free(&sp->out);
+    free(sp);
+
+    return rc;
+}
+
+size_t nm_spawn_wait_any(nm_spawn_t *const *list, size_t count)
+{
+    size_t n;
 
-    case (0):   /* child */
-        close(fd[0]);
-        dup2(fd[1], STDOUT_FILENO);
-        dup2(fd[1], STDERR_FILENO);
+    for (n = 0; n < count && !list[n]; n++)
+        ;
 
-        execvp(((char *const *) argv->data)[0], (char *const *) argv->data);
-        nm_bug("%s: unreachable reached", __func__);
-        break;
+    if (n == count)
+        nm_bug("%s: nothing to wait for", __func__);
 
-    default:    /* parent */
+    for (;;)
+    {
+        for (n = 0; n < count; n++)
         {
-            int wstatus = 0;
-            pid_t w_rc;
-            char buf[NM_SOCK_READLEN] = {0};
+            if (list[n] && list[n]->exited)
+                return n;
+        }
 
-            close(fd[1]);
-            w_rc = waitpid(child_pid, &wstatus, 0);
+        nm_spawn_step(NM_TRUE);
+    }
+}
 
-            if ((w_rc == child_pid) && (WEXITSTATUS(wstatus) != 0))
-            {
-                nm_str_t err_msg = NM_INIT_STR;
-                while (read(fd[0], buf, sizeof(buf) - 1) > 0)
-                {
-                    nm_str_add_text(&err_msg, buf);
-                    memset(&buf, 0, sizeof(buf));
-                }
-                nm_vmctl_log_last(&err_msg);
-                nm_debug("exec_error: %s", err_msg.data);
-                nm_str_free(&err_msg);
-                rc = NM_ERR;
-            }
-            else if (answer && (w_rc == child_pid) && (WEXITSTATUS(wstatus) == 0))
-            {
-                while (read(fd[0], buf, sizeof(buf) - 1) > 0)
-                {
-                    nm_str_add_text(answer, buf);
-                    memset(buf, 0, sizeof(buf));
-                }
-            }
+/* Wait for output or exit of any running process, read output
+ * of all of them, reap exited ones and kill ones out of time.
+ * Without pidfd exit is checked every NM_SPAWN_TICK ms.
+ * If block is not set, only ready processes are handled. */
+static void nm_spawn_step(int block)
+{
+    struct pollfd *fds;
+    size_t nfds = 0, count = 0;
+    int64_t now = nm_spawn_now();
+    int timeout = -1;
+
+    for (nm_spawn_t *sp = nm_spawn_list; sp; sp = sp->next)
+        count++;
+
+    fds = nm_calloc(count * 2 + 1, sizeof(struct pollfd));
+
+    for (nm_spawn_t *sp = nm_spawn_list; sp; sp = sp->next)
+    {
+        int left = NM_SPAWN_TICK;
+
+        if (!sp->eof)
+        {
+            fds[nfds].fd = sp->fd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        if (sp->pidfd != -1)
+        {
+            fds[nfds].fd = sp->pidfd;
+            fds[nfds++].events = POLLIN;
+            left = -1;
+        }
 
-            close(fd[0]);
+        if (sp->deadline && (left == -1 || sp->deadline - now < left))
+            left = (sp->deadline > now) ? sp->deadline - now : 0;
+
+        if (left != -1 && (timeout == -1 || left < timeout))
+            timeout = left;
+    }
+
+    if (!block)
+        timeout = 0;
+
+    if (poll(fds, nfds, timeout) == -1 && errno != EINTR)
+        nm_bug("%s: poll: %s", __func__, strerror(errno));
+
+    free(fds);
+    now = nm_spawn_now();
+
+    for (nm_spawn_t **link = &nm_spawn_list; *link;)
+    {
+        nm_spawn_t *sp = *link;
+        int wstatus = 0;
+        pid_t w_rc;
+
+        nm_spawn_read(sp);
+
+        w_rc = waitpid(sp->pid, &wstatus, WNOHANG);
+
+        if (w_rc == 0 && sp->deadline && now >= sp->deadline)
+        {
+            nm_debug("%s: pid %d is killed by timeout\n", __func__, sp->pid);
+            nm_str_add_text(&sp->out, "process is killed by timeout\n");
+            kill(sp->pid, SIGKILL);
+            w_rc = waitpid(sp->pid, &wstatus, 0);
+            wstatus = -1;
+        }
+
+        if (w_rc == 0 || (w_rc == -1 && errno == EINTR))
+        {
+            link = &sp->next;
+            continue;
+        }
+
+        /* data written before exit is still in socket */
+        nm_spawn_read(sp);
+
+        if (w_rc == -1)
+        {
+            nm_debug("%s: waitpid(%d): %s\n",
+                    __func__, sp->pid, strerror(errno));
         }
+
+        sp->exited = NM_TRUE;
+        sp->rc = (w_rc == sp->pid && wstatus != -1 &&
+                  WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) ?
+            NM_OK : NM_ERR;
+
+        *link = sp->next;
+        sp->next = NULL;
+
+        nm_trace_end(sp->span, "spawn: %s pid %d: %s, %zu bytes of output",
+                sp->name, sp->pid, (sp->rc == NM_OK) ? "ok" : "error",
+                sp->out.len);
     }
+}
 
-    return rc;
+/* Daemonized QEMU may keep output socket open,
+ * so output is read only while data is available */
+static void nm_spawn_read(nm_spawn_t *sp)
+{
+    char buf[NM_SOCK_READLEN];
+    ssize_t nread;
+
+    while (!sp->eof)
+    {
+        nread = read(sp->fd, buf, sizeof(buf));
+
+        if (nread > 0)
+            nm_str_add_text_part(&sp->out, buf, nread);
+        else if (nread == -1 && errno == EINTR)
+            continue;
+        else if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            sp->eof = NM_TRUE;
+    }
+}
+
+static int64_t nm_spawn_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 void nm_debug(const char *fmt, ...)
 {
-#ifdef NM_DEBUG
     va_list args;
-    FILE *fp;
-
-    if ((fp = fopen("/tmp/nemu_debug.log", "a+")) == NULL)
-        return;
 
     va_start(args, fmt);
-    vfprintf(fp, fmt, args);
+    nm_trace_va(NM_TRACE_DEBUG, fmt, args);
     va_end(args);
-
-    fclose(fp);
-#else
-    (void) fmt;
-#endif
 }
 
-void nm_cmd_str(nm_str_t *str, const nm_vect_t *argv)
+void nm_cmd_str(nm_str_t *str, const nm_argv_t *argv)
 {
     if (str->len > 0)
         nm_str_trunc(str, 0);
 
-    for (size_t m = 0; m < argv->n_memb; m++)
+    for (size_t m = 0; m < nm_argv_count(argv); m++)
     {
-        nm_str_append_format(str, "%s ", (char *)nm_vect_at(argv, m));
+        nm_str_append_format(str, "%s ", nm_argv_at(argv, m));
     }
 }
 
@@ -19,8 +19,33 @@ void *nm_realloc(void *p, size_t size);
 void nm_map_file(nm_file_map_t *file);
 void nm_copy_file(const nm_str_t *src, const nm_str_t *dst);
 void nm_unmap_file(const nm_file_map_t *file);
+/* Child process, stdout and stderr are captured */
+typedef struct nm_spawn nm_spawn_t;
+
+enum {
+    NM_SPAWN_STDIN = (1 << 0), /* stdin is also read from socket */
+};
+
+enum {NM_SPAWN_TICK = 50}; /* ms, exit check interval without pidfd */
+
 /* Execute process. Read stdout if answer is not NULL */
-int nm_spawn_process(const nm_vect_t *argv, nm_str_t *answer);
+int nm_spawn_process(nm_argv_t *argv, nm_str_t *answer);
+/* Same in two steps: several processes can be started before waiting.
+ * Process is killed after timeout ms, 0 - no limit */
+nm_spawn_t *nm_spawn_start(nm_argv_t *argv, int flags, int timeout);
+/* Socket of process, e.g. to write to stdin */
+int nm_spawn_fd(const nm_spawn_t *sp);
+/* Readable when process exits, -1 if pidfd is not supported:
+ * then nm_spawn_done() must be called every NM_SPAWN_TICK ms */
+int nm_spawn_pidfd(const nm_spawn_t *sp);
+/* Read output and reap exited processes without waiting.
+ * NM_TRUE if process has exited, nm_spawn_wait() will not block */
+int nm_spawn_done(nm_spawn_t *sp);
+/* Handle is freed */
+int nm_spawn_wait(nm_spawn_t *sp, nm_str_t *answer);
+/* Returns index of exited process, NULL items are skipped.
+ * Process must be reaped with nm_spawn_wait() */
+size_t nm_spawn_wait_any(nm_spawn_t *const *list, size_t count);
 
 void nm_bug(const char *fmt, ...)
     __attribute__ ((format(printf, 1, 2)));
@@ -28,7 +53,7 @@ void nm_bug(const char *fmt, ...)
 void nm_debug(const char *fmt, ...)
     __attribute__ ((format(printf, 1, 2)));
 
-void nm_cmd_str(nm_str_t *str, const nm_vect_t *argv);
+void nm_cmd_str(nm_str_t *str, const nm_argv_t *argv);
 
 #endif /* NM_UTILS_H_ */
 /* vim:set ts=4 sw=4: */
@@ -2,7 +2,11 @@
 #include <nm_utils.h>
 #include <nm_vector.h>
 
-enum {NM_VECT_INIT_NMEMB = 10};
+enum {
+    NM_VECT_INIT_NMEMB = 10,
+    NM_ARGV_INIT_POOL = 1024,
+    NM_ARGV_INIT_NMEMB = 64,
+};
 
 void nm_vect_insert(nm_vect_t *v, const void *data, size_t len, nm_vect_ins_cb_pt cb)
 {
@@ -72,4 +76,145 @@ void nm_vect_free(nm_vect_t *v, nm_vect_free_cb_pt cb)
     v->n_alloc = 0;
 }
 
+void *nm_arr_push(nm_arr_t *a, const void *unit)
+{
+    return nm_arr_append(a, unit, 1);
+}
+
+/* units may be NULL, then new units are zeroed */
+void *nm_arr_append(nm_arr_t *a, const void *units, size_t count)
+{
+    char *dst;
+
+    if (a == NULL)
+        nm_bug(_("%s: NULL vector pointer value"), __func__);
+
+    if (a->n_memb + count > a->n_alloc)
+    {
+        size_t n_alloc = a->n_alloc ? a->n_alloc * 2 : NM_VECT_INIT_NMEMB;
+
+        while (n_alloc < a->n_memb + count)
+            n_alloc *= 2;
+
+        nm_arr_reserve(a, n_alloc);
+    }
+
+    dst = (char *) a->data + a->n_memb * a->unit_size;
+    if (units != NULL)
+        memcpy(dst, units, count * a->unit_size);
+    else
+        memset(dst, 0, count * a->unit_size);
+
+    a->n_memb += count;
+
+    return dst;
+}
+
+void nm_arr_reserve(nm_arr_t *a, size_t n_memb)
+{
+    if (n_memb <= a->n_alloc)
+        return;
+
+    if (a->data == a->buf)
+    {
+        void *data = nm_alloc(n_memb * a->unit_size);
+
+        if (a->n_memb)
+            memcpy(data, a->buf, a->n_memb * a->unit_size);
+        a->data = data;
+    }
+    else
+        a->data = nm_realloc(a->data, n_memb * a->unit_size);
+
+    a->n_alloc = n_memb;
+}
+
+void *nm_arr_at(const nm_arr_t *a, size_t index)
+{
+    if (a == NULL)
+        nm_bug(_("%s: NULL vector pointer value"), __func__);
+
+    if (index >= a->n_memb)
+        nm_bug(_("%s: invalid index"), __func__);
+
+    return (char *) a->data + index * a->unit_size;
+}
+
+/* Remove all units, memory is kept for reuse */
+void nm_arr_clear(nm_arr_t *a, nm_vect_free_cb_pt cb)
+{
+    if (a == NULL)
+        return;
+
+    if (cb != NULL)
+    {
+        for (size_t n = 0; n < a->n_memb; n++)
+            cb((char *) a->data + n * a->unit_size);
+    }
+
+    a->n_memb = 0;
+}
+
+void nm_arr_free(nm_arr_t *a, nm_vect_free_cb_pt cb)
+{
+    if (a == NULL)
+        return;
+
+    nm_arr_clear(a, cb);
+
+    if (a->data != a->buf)
+        free(a->data);
+
+    a->data = NULL;
+    a->buf = NULL;
+    a->n_alloc = 0;
+    a->n_memb = 0;
+}
+
+void nm_argv_add(nm_argv_t *a, const char *arg)
+{
+    size_t off = a->pool.n_memb;
+
+    if (!a->pool.n_alloc)
+    {
+        nm_arr_reserve(&a->pool, NM_ARGV_INIT_POOL);
+        nm_arr_reserve(&a->offs, NM_ARGV_INIT_NMEMB);
+    }
+
+    nm_arr_append(&a->pool, arg, strlen(arg) + 1);
+    nm_arr_push(&a->offs, &off);
+}
+
+const char *nm_argv_at(const nm_argv_t *a, size_t index)
+{
+    const size_t *off = nm_arr_at(&a->offs, index);
+
+    return (const char *) a->pool.data + *off;
+}
+
+/* Pointers are valid until next nm_argv_add() */
+char *const *nm_argv_data(nm_argv_t *a)
+{
+    const char *null = NULL;
+
+    a->ptrs.n_memb = 0;
+    nm_arr_reserve(&a->ptrs, a->offs.n_memb + 1);
+
+    for (size_t n = 0; n < a->offs.n_memb; n++)
+    {
+        const char *arg = nm_argv_at(a, n);
+        nm_arr_push(&a->ptrs, &arg);
+    }
+    nm_arr_push(&a->ptrs, &null);
+
+    return a->ptrs.data;
+}
+
+void nm_argv_free(nm_argv_t *a)
+{
+    nm_arr_free(&a->pool, NULL);
+    nm_arr_free(&a->offs, NULL);
+    nm_arr_free(&a->ptrs, NULL);
+}
+
 /* vim:set ts=4 sw=4: */
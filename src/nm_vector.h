@@ -26,5 +26,48 @@ static inline void nm_vect_insert_cstr(nm_vect_t *v, const char *data)
     nm_vect_insert(v, data, strlen(data) + 1, NULL);
 }
 
+/* Contiguous vector: units of fixed size are stored one after another.
+ * Initial storage can be given by caller (e.g. array on stack),
+ * it is replaced with heap memory when it is full. */
+typedef struct {
+    size_t n_memb;    /* unit count */
+    size_t n_alloc;   /* count of allocated memory in units */
+    size_t unit_size;
+    void *data;       /* units */
+    void *buf;        /* caller storage, never freed */
+} nm_arr_t;
+
+#define NM_INIT_ARR(type) (nm_arr_t) { 0, 0, sizeof(type), NULL, NULL }
+#define NM_INIT_ARR_BUF(buf) (nm_arr_t) \
+    { 0, sizeof(buf) / sizeof((buf)[0]), sizeof((buf)[0]), (buf), (buf) }
+
+void *nm_arr_push(nm_arr_t *a, const void *unit);
+void *nm_arr_append(nm_arr_t *a, const void *units, size_t count);
+void nm_arr_reserve(nm_arr_t *a, size_t n_memb);
+void *nm_arr_at(const nm_arr_t *a, size_t index);
+void nm_arr_clear(nm_arr_t *a, nm_vect_free_cb_pt cb);
+void nm_arr_free(nm_arr_t *a, nm_vect_free_cb_pt cb);
+
+/* Command line for exec(3): arguments are stored in one buffer,
+ * NULL terminated pointer array is built on demand. */
+typedef struct {
+    nm_arr_t pool; /* char: arguments with \x00 */
+    nm_arr_t offs; /* size_t: offset of each argument in pool */
+    nm_arr_t ptrs; /* char *: argv array */
+} nm_argv_t;
+
+#define NM_INIT_ARGV (nm_argv_t) { \
+    NM_INIT_ARR(char), NM_INIT_ARR(size_t), NM_INIT_ARR(char *) }
+
+void nm_argv_add(nm_argv_t *a, const char *arg);
+const char *nm_argv_at(const nm_argv_t *a, size_t index);
+char *const *nm_argv_data(nm_argv_t *a);
+void nm_argv_free(nm_argv_t *a);
+
+static inline size_t nm_argv_count(const nm_argv_t *a)
+{
+    return a->offs.n_memb;
+}
+
 #endif /* NM_VECTOR_H_ */
 /* vim:set ts=4 sw=4: */
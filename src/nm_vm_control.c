@@ -5,8 +5,10 @@
 #include <nm_network.h>
 #include <nm_database.h>
 #include <nm_cfg_file.h>
+#include <nm_arena.h>
 #include <nm_vm_control.h>
 #include <nm_usb_devices.h>
+#include <nm_machine.h>
 
 #include <time.h>
 
@@ -15,109 +17,245 @@ enum {
     NM_VIEWER_VNC
 };
 
+/* QEMU is started, waiting for -daemonize */
+struct nm_vmctl_job {
+    size_t idx; /* index in names of nm_vmctl_start_list() */
+    nm_str_t name;
+    nm_spawn_t *sp;
+    nm_argv_t argv;
+    nm_arr_t tfds;
+};
+
 #if defined(NM_WITH_VNC_CLIENT) || defined(NM_WITH_SPICE)
 static void nm_vmctl_gen_viewer(const nm_str_t *name, uint32_t port, nm_str_t *cmd, int type);
 #endif
 static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms);
+static int nm_vmctl_start_prep(const nm_str_t *name, int flags,
+                               nm_argv_t *argv, nm_arr_t *tfds);
+static void nm_vmctl_start_done(const nm_str_t *name, int rc,
+                                const nm_argv_t *argv, const nm_arr_t *tfds);
+static void nm_vmctl_job_reap(nm_arr_t *jobs, int *results);
 
 void nm_vmctl_get_data(const nm_str_t *name, nm_vmctl_data_t *vm)
 {
-    nm_str_t query = NM_INIT_STR;
+    nm_db_select_rows(NM_VM_GET_LIST_SQL, NM_DB_ROW_VM,
+            &vm->main, name->data);
+    nm_db_select_rows(NM_VM_GET_IFACES_SQL, NM_DB_ROW_IFACE,
+            &vm->ifs, name->data);
+    nm_db_select_rows(NM_VM_GET_DRIVES_SQL, NM_DB_ROW_DRIVE,
+            &vm->drives, name->data);
+    nm_db_select_rows(NM_USB_GET_SQL, NM_DB_ROW_USB,
+            &vm->usb, name->data);
+}
+
+int nm_vmctl_start(const nm_str_t *name, int flags)
+{
+    nm_vmctl_job_t *job;
 
-    nm_str_format(&query, NM_VM_GET_LIST_SQL, name->data);
-    nm_db_select(query.data, &vm->main);
+    if ((job = nm_vmctl_start_begin(name, flags)) == NULL)
+        return NM_ERR;
 
-    nm_str_format(&query, NM_VM_GET_IFACES_SQL, name->data);
-    nm_db_select(query.data, &vm->ifs);
+    return nm_vmctl_start_end(job);
+}
 
-    nm_str_format(&query, NM_VM_GET_DRIVES_SQL, name->data);
-    nm_db_select(query.data, &vm->drives);
+/* Command is generated and QEMU is spawned, but not waited for */
+nm_vmctl_job_t *nm_vmctl_start_begin(const nm_str_t *name, int flags)
+{
+    nm_vmctl_job_t *job = nm_calloc(1, sizeof(nm_vmctl_job_t));
+
+    job->argv = NM_INIT_ARGV;
+    job->tfds = NM_INIT_ARR(int);
+
+    if (nm_vmctl_start_prep(name, flags, &job->argv, &job->tfds) != NM_OK)
+    {
+        nm_argv_free(&job->argv);
+        nm_arr_free(&job->tfds, NULL);
+        free(job);
+        return NULL;
+    }
 
-    nm_str_format(&query, NM_USB_GET_SQL, name->data);
-    nm_db_select(query.data, &vm->usb);
+    nm_str_copy(&job->name, name);
+    job->sp = nm_spawn_start(&job->argv, 0, 0);
 
-    nm_str_free(&query);
+    /* taps of this VM must not leak to QEMU started next */
+    for (size_t n = 0; n < job->tfds.n_memb; n++)
+        fcntl(*((int *) nm_arr_at(&job->tfds, n)), F_SETFD, FD_CLOEXEC);
+
+    return job;
 }
 
-void nm_vmctl_start(const nm_str_t *name, int flags)
+nm_spawn_t *nm_vmctl_job_spawn(const nm_vmctl_job_t *job)
+{
+    return job->sp;
+}
+
+/* Waits for QEMU if it is still running, job is freed */
+int nm_vmctl_start_end(nm_vmctl_job_t *job)
+{
+    int rc = nm_spawn_wait(job->sp, NULL);
+
+    nm_vmctl_start_done(&job->name, rc, &job->argv, &job->tfds);
+
+    nm_argv_free(&job->argv);
+    nm_arr_free(&job->tfds, NULL);
+    nm_str_free(&job->name);
+    free(job);
+
+    return rc;
+}
+
+/* Start several VMs, at most jobs QEMU processes are started at once.
+ * Commands are generated one by one in this process, so database
+ * and taps are used from one thread, only waiting for QEMU -daemonize
+ * is done in parallel. Result of each VM is stored to results. */
+int nm_vmctl_start_list(const nm_vect_t *names, size_t jobs, int *results)
+{
+    nm_arr_t running = NM_INIT_ARR(nm_vmctl_job_t *);
+    int rc = NM_OK;
+
+    if (!jobs)
+        jobs = 1;
+
+    for (size_t n = 0; n < names->n_memb; n++)
+    {
+        nm_vmctl_job_t *job;
+
+        if (running.n_memb == jobs)
+            nm_vmctl_job_reap(&running, results);
+
+        if ((job = nm_vmctl_start_begin(nm_vect_str(names, n), 0)) == NULL)
+        {
+            results[n] = NM_ERR;
+            continue;
+        }
+
+        job->idx = n;
+        nm_arr_push(&running, &job);
+    }
+
+    while (running.n_memb)
+        nm_vmctl_job_reap(&running, results);
+
+    for (size_t n = 0; n < names->n_memb; n++)
+    {
+        if (results[n] != NM_OK)
+            rc = NM_ERR;
+    }
+
+    nm_arr_free(&running, NULL);
+
+    return rc;
+}
+
+static int nm_vmctl_start_prep(const nm_str_t *name, int flags,
+                               nm_argv_t *argv, nm_arr_t *tfds)
 {
-    nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
     nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
-    nm_vect_t tfds = NM_INIT_VECT;
 
     nm_vmctl_get_data(name, &vm);
 
+    if (!vm.main.n_rows)
+    {
+        nm_vmctl_free_data(&vm);
+        return NM_ERR;
+    }
+
     /* check if VM is already installed */
-    if (nm_str_cmp_st(nm_vect_str(&vm.main, NM_SQL_INST), NM_ENABLE) == NM_OK)
+    if (nm_db_vm(&vm.main, 0)->install)
     {
         int ch = nm_notify(_(NM_MSG_INST_CONF));
         if (ch == 'y')
         {
-            flags &= ~NM_VMCTL_TEMP;
-            nm_str_t query = NM_INIT_STR;
-
-            nm_str_trunc(nm_vect_str(&vm.main, NM_SQL_INST), 0);
-            nm_str_add_text(nm_vect_str(&vm.main, NM_SQL_INST), NM_DISABLE);
+            nm_db_vm_t *row = vm.main.rows;
 
-            nm_str_alloc_text(&query, "UPDATE vms SET install='0' WHERE name='");
-            nm_str_add_str(&query, name);
-            nm_str_add_char(&query, '\'');
-            nm_db_edit(query.data);
+            flags &= ~NM_VMCTL_TEMP;
+            row->install = 0;
 
-            nm_str_free(&query);
+            nm_db_edit("UPDATE vms SET install='0' WHERE name=?", name->data);
         }
     }
 
-    nm_vmctl_gen_cmd(&argv, &vm, name, flags, &tfds);
-    if (argv.n_memb > 0)
+    nm_vmctl_gen_cmd(argv, &vm, name, flags, tfds);
+    nm_vmctl_free_data(&vm);
+
+    return (nm_argv_count(argv) > 0) ? NM_OK : NM_ERR;
+}
+
+static void nm_vmctl_start_done(const nm_str_t *name, int rc,
+                                const nm_argv_t *argv, const nm_arr_t *tfds)
+{
+    if (rc != NM_OK)
     {
-        if (nm_spawn_process(&argv, NULL) != NM_OK)
-        {
-            nm_str_t qmp_path = NM_INIT_STR;
-            struct stat qmp_info;
+        nm_str_t qmp_path = NM_INIT_STR;
+        struct stat qmp_info;
 
-            nm_str_format(&qmp_path, "%s/%s/%s",
-                nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_FILE);
+        nm_str_format(&qmp_path, "%s/%s/%s",
+            nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_FILE);
 
-            /* must delete qmp sock file if exists */
-            if (stat(qmp_path.data, &qmp_info) != -1)
-                unlink(qmp_path.data);
+        /* must delete qmp sock file if exists */
+        if (stat(qmp_path.data, &qmp_info) != -1)
+            unlink(qmp_path.data);
 
-            nm_str_free(&qmp_path);
+        nm_str_format(&qmp_path, "%s/%s/%s",
+            nm_cfg_get()->vm_dir.data, name->data, NM_VM_QMP_EVT_FILE);
+        if (stat(qmp_path.data, &qmp_info) != -1)
+            unlink(qmp_path.data);
 
-            nm_warn(_(NM_MSG_START_ERR));
-        }
-        else
-        {
-            nm_cmd_str(&buf, &argv);
-            nm_debug("cmd=%s\n", buf.data);
-            nm_vmctl_log_last(&buf);
+        nm_str_free(&qmp_path);
 
-            /* close all tap file descriptors */
-            for (size_t n = 0; n < tfds.n_memb; n++)
-                close(*((int *) tfds.data[n]));
-        }
+        nm_warn(_(NM_MSG_START_ERR));
     }
+    else
+    {
+        nm_str_t buf = NM_INIT_STR;
 
-    nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
-    nm_vect_free(&tfds, NULL);
-    nm_vmctl_free_data(&vm);
+        nm_cmd_str(&buf, argv);
+        nm_debug("cmd=%s\n", buf.data);
+        nm_vmctl_log_last(&buf);
+        nm_str_free(&buf);
+    }
+
+    /* close all tap file descriptors, QEMU has its own copies */
+    for (size_t n = 0; n < tfds->n_memb; n++)
+        close(*((int *) nm_arr_at(tfds, n)));
+}
+
+/* Wait for any started QEMU, job is removed from running list.
+ * Only our own processes are waited for, so children of
+ * libraries are not reaped here. */
+static void nm_vmctl_job_reap(nm_arr_t *jobs, int *results)
+{
+    nm_spawn_t **list = nm_calloc(jobs->n_memb, sizeof(nm_spawn_t *));
+    nm_vmctl_job_t **last = nm_arr_at(jobs, jobs->n_memb - 1);
+    nm_vmctl_job_t **job;
+    size_t n;
+
+    for (n = 0; n < jobs->n_memb; n++)
+        list[n] = (*(nm_vmctl_job_t **) nm_arr_at(jobs, n))->sp;
+
+    n = nm_spawn_wait_any(list, jobs->n_memb);
+    free(list);
+
+    job = nm_arr_at(jobs, n);
+    results[(*job)->idx] = nm_vmctl_start_end(*job);
+
+    /* order does not matter, last job is moved here */
+    *job = *last;
+    jobs->n_memb--;
 }
 
 void nm_vmctl_delete(const nm_str_t *name)
 {
     nm_str_t vmdir = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t drives = NM_INIT_VECT;
+    nm_vect_t bases = NM_INIT_VECT;
     nm_vect_t snaps = NM_INIT_VECT;
     int delete_ok = NM_TRUE;
 
     nm_str_format(&vmdir, "%s/%s/", nm_cfg_get()->vm_dir.data, name->data);
 
-    nm_str_format(&query, NM_SELECT_DRIVE_NAMES_SQL, name->data);
-    nm_db_select(query.data, &drives);
+    nm_db_select(NM_SELECT_DRIVE_NAMES_SQL, &drives, name->data);
+    nm_db_select(NM_SELECT_DRIVE_BASES_SQL, &bases, name->data);
 
     for (size_t n = 0; n < drives.n_memb; n++)
     {
@@ -143,6 +281,11 @@ void nm_vmctl_delete(const nm_str_t *name)
         if (unlink(path.data) == -1 && errno != ENOENT)
             delete_ok = NM_FALSE;
 
+        nm_str_trunc(&path, vmdir.len);
+        nm_str_add_text(&path, NM_VM_QMP_EVT_FILE);
+        if (unlink(path.data) == -1 && errno != ENOENT)
+            delete_ok = NM_FALSE;
+
         nm_str_free(&path);
     }
 
@@ -154,30 +297,47 @@ void nm_vmctl_delete(const nm_str_t *name)
 
     nm_vmctl_clear_tap(name);
 
-    nm_str_format(&query, NM_DEL_DRIVES_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_VMSNAP_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_IFS_SQL, name->data);
-    nm_db_edit(query.data);
-
-    nm_str_format(&query, NM_DEL_USB_SQL, name->data);
-    nm_db_edit(query.data);
+    nm_db_begin();
+    nm_db_edit(NM_DEL_DRIVES_SQL, name->data);
+    nm_db_edit(NM_DEL_VMSNAP_SQL, name->data);
+    nm_db_edit(NM_DEL_IFS_SQL, name->data);
+    nm_db_edit(NM_DEL_USB_SQL, name->data);
+    nm_db_edit(NM_DEL_VM_SQL, name->data);
+    nm_db_commit();
 
-    nm_str_format(&query, NM_DEL_VM_SQL, name->data);
-    nm_db_edit(query.data);
+    /* drives rows are gone, so only other VMs hold bases now */
+    for (size_t n = 0; n < bases.n_memb; n++)
+        nm_vmctl_base_unref(nm_vect_str_ctx(&bases, n));
 
     if (!delete_ok)
         nm_warn(_(NM_MSG_INC_DEL));
 
     nm_str_free(&vmdir);
-    nm_str_free(&query);
     nm_vect_free(&drives, nm_str_vect_free_cb);
+    nm_vect_free(&bases, nm_str_vect_free_cb);
     nm_vect_free(&snaps, nm_str_vect_free_cb);
 }
 
+/* Base image of linked clones is deleted with the last drive using it */
+void nm_vmctl_base_unref(const char *base)
+{
+    nm_vect_t refs = NM_INIT_VECT;
+
+    if (!base || !*base)
+        return;
+
+    nm_db_select(NM_DRIVE_BASE_REFS_SQL, &refs, base);
+
+    if (refs.n_memb && nm_str_cmp_st(nm_vect_str(&refs, 0), "0") == NM_OK)
+    {
+        nm_debug("%s: delete unused base %s\n", __func__, base);
+        if (unlink(base) == -1 && errno != ENOENT)
+            nm_warn(_(NM_MSG_DRV_EDEL));
+    }
+
+    nm_vect_free(&refs, nm_str_vect_free_cb);
+}
+
 void nm_vmctl_kill(const nm_str_t *name)
 {
     pid_t pid;
@@ -209,13 +369,11 @@ void nm_vmctl_kill(const nm_str_t *name)
 void nm_vmctl_connect(const nm_str_t *name)
 {
     nm_str_t cmd = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t vm = NM_INIT_VECT;
     uint32_t port;
     int unused __attribute__((unused));
 
-    nm_str_format(&query, NM_VMCTL_GET_VNC_PORT_SQL, name->data);
-    nm_db_select(query.data, &vm);
+    nm_db_select(NM_VMCTL_GET_VNC_PORT_SQL, &vm, name->data);
     port = nm_str_stoui(nm_vect_str(&vm, 0), 10) + 5900;
 #if defined(NM_WITH_SPICE)
     if (nm_str_cmp_st(nm_vect_str(&vm, 1), NM_ENABLE) == NM_OK)
@@ -232,61 +390,62 @@ void nm_vmctl_connect(const nm_str_t *name)
     unused = system(cmd.data);
 
     nm_vect_free(&vm, nm_str_vect_free_cb);
-    nm_str_free(&query);
     nm_str_free(&cmd);
 }
 #endif
 
-void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
-    const nm_str_t *name, int flags, nm_vect_t *tfds)
+void nm_vmctl_gen_cmd(nm_argv_t *argv, const nm_vmctl_data_t *vm,
+    const nm_str_t *name, int flags, nm_arr_t *tfds)
 {
-    nm_str_t vmdir = NM_INIT_STR;
+    /* temporary data of one command, released at once */
+    nm_arena_t arena = NM_INIT_ARENA;
     const nm_cfg_t *cfg = nm_cfg_get();
-    size_t drives_count = vm->drives.n_memb / NM_DRV_IDX_COUNT;
-    size_t ifs_count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
+    const nm_db_vm_t *row = nm_db_vm(&vm->main, 0);
     int scsi_added = NM_FALSE;
+    int iothread = NM_FALSE;
+    int io_uring;
+    int net_batch = NM_FALSE;
     nm_str_t buf = NM_INIT_STR;
-
-    nm_str_format(&vmdir, "%s/%s/", cfg->vm_dir.data, name->data);
+    nm_str_t vmdir = nm_arena_format(&arena, "%s/%s/",
+            cfg->vm_dir.data, name->data);
 
     nm_str_format(&buf, "%s%s",
-        NM_STRING(NM_USR_PREFIX) "/bin/qemu-system-",
-        nm_vect_str(&vm->main, NM_SQL_ARCH)->data);
-    nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        NM_STRING(NM_USR_PREFIX) "/bin/qemu-system-", row->arch);
+    nm_argv_add(argv, buf.data);
 
-    nm_vect_insert_cstr(argv, "-daemonize");
+    nm_argv_add(argv, "-daemonize");
 
     /* setup install source */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_INST), NM_ENABLE) == NM_OK)
+    if (row->install)
     {
-        const char *iso = nm_vect_str_ctx(&vm->main, NM_SQL_ISO);
+        const char *iso = row->iso;
         size_t srcp_len = strlen(iso);
 
         if ((srcp_len == 0) && (!(flags & NM_VMCTL_INFO)))
         {
             nm_warn(_(NM_MSG_ISO_MISS));
-            nm_vect_free(argv, NULL);
+            nm_argv_free(argv);
             goto out;
         }
         if ((srcp_len > 4) &&
             (nm_str_cmp_tt(iso + (srcp_len - 4), ".iso") == NM_OK))
         {
-            nm_vect_insert_cstr(argv, "-boot");
-            nm_vect_insert_cstr(argv, "d");
-            nm_vect_insert_cstr(argv, "-cdrom");
-            nm_vect_insert_cstr(argv, iso);
+            nm_argv_add(argv, "-boot");
+            nm_argv_add(argv, "d");
+            nm_argv_add(argv, "-cdrom");
+            nm_argv_add(argv, iso);
         }
         else
         {
-            nm_vect_insert_cstr(argv, "-drive");
+            nm_argv_add(argv, "-drive");
 
             nm_str_format(&buf, "file=%s,media=disk,if=ide", iso);
-            nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            nm_argv_add(argv, buf.data);
         }
     }
     else /* just mount cdrom */
     {
-        const char *iso = nm_vect_str_ctx(&vm->main, NM_SQL_ISO);
+        const char *iso = row->iso;
         size_t srcp_len = strlen(iso);
         struct stat info;
         int rc = -1;
@@ -299,102 +458,135 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
             if ((rc == -1) && (!(flags & NM_VMCTL_INFO)))
             {
                 nm_warn(_(NM_MSG_ISO_NF));
-                nm_vect_free(argv, NULL);
+                nm_argv_free(argv);
                 goto out;
             }
             if (rc != -1)
             {
-                nm_vect_insert_cstr(argv, "-cdrom");
-                nm_vect_insert_cstr(argv, iso);
+                nm_argv_add(argv, "-cdrom");
+                nm_argv_add(argv, iso);
             }
         }
     }
 
-    for (size_t n = 0; n < drives_count; n++)
+    /* virtio disks get own I/O thread if it is enabled in config
+     * and QEMU binary supports it */
+    if (nm_cfg_get()->iothread &&
+        nm_mach_has_cap(row->arch, NM_CAP_IOTHREAD) &&
+        nm_mach_has_device(row->arch, "virtio-blk-pci"))
+    {
+        iothread = NM_TRUE;
+    }
+
+    /* Linux io_uring AIO, if QEMU is built with it */
+    io_uring = nm_cfg_get()->io_uring &&
+        nm_mach_has_cap(row->arch, NM_CAP_IO_URING);
+
+    for (size_t n = 0; n < vm->drives.n_rows; n++)
     {
         int nvme_drv = NM_FALSE;
         int scsi_drv = NM_FALSE;
-        size_t idx_shift = NM_DRV_IDX_COUNT * n;
-        const nm_str_t *drive_img = nm_vect_str(&vm->drives, NM_SQL_DRV_NAME + idx_shift);
-        const nm_str_t *blk_drv = nm_vect_str(&vm->drives, NM_SQL_DRV_TYPE + idx_shift);
-        const char *blk_drv_type = blk_drv->data;
+        int virtio_drv = NM_FALSE;
+        const nm_db_drive_t *drive = nm_db_drive(&vm->drives, n);
+        const char *blk_drv_type = drive->drv;
 
-        if (nm_str_cmp_st(blk_drv, "nvme") == NM_OK)
+        if (nm_str_cmp_tt(drive->drv, "nvme") == NM_OK)
         {
             nvme_drv = NM_TRUE;
             blk_drv_type = "none";
         }
-        else if (nm_str_cmp_st(blk_drv, "scsi") == NM_OK)
+        else if (nm_str_cmp_tt(drive->drv, "scsi") == NM_OK)
         {
             scsi_drv = NM_TRUE;
             blk_drv_type = "none";
             if (!scsi_added)
             {
-                nm_vect_insert_cstr(argv, "-device");
-                nm_vect_insert_cstr(argv, "virtio-scsi-pci,id=scsi");
+                nm_argv_add(argv, "-device");
+                nm_argv_add(argv, "virtio-scsi-pci,id=scsi");
                 scsi_added = NM_TRUE;
             }
         }
+        else if (iothread &&
+                 nm_str_cmp_tt(drive->drv, NM_DEFAULT_DRVINT) == NM_OK)
+        {
+            virtio_drv = NM_TRUE;
+            blk_drv_type = "none";
+        }
 
-        nm_vect_insert_cstr(argv, "-drive");
+        nm_argv_add(argv, "-drive");
 
         nm_str_format(&buf, "id=hd%zu,media=disk,if=%s,file=%s%s",
-            n, blk_drv_type, vmdir.data, drive_img->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            n, blk_drv_type, vmdir.data, drive->name);
+
+        if (io_uring)
+            nm_str_add_text(&buf, ",aio=io_uring");
+
+        /* overlay of disk image stored in OVA: backing is read
+         * by raw driver from its offset in the archive */
+        if (*drive->ova_path)
+        {
+            nm_str_append_format(&buf, ",backing.driver=%s"
+                ",backing.file.driver=raw,backing.file.offset=%s"
+                ",backing.file.size=%s,backing.file.file.filename=%s",
+                drive->ova_fmt, drive->ova_offset, drive->ova_size,
+                drive->ova_path);
+        }
+        nm_argv_add(argv, buf.data);
 
         if (nvme_drv)
         {
             long int host_id = labs(gethostid());
-            nm_vect_insert_cstr(argv, "-device");
+            nm_argv_add(argv, "-device");
             nm_str_format(&buf, "nvme,drive=hd%zu,serial=%lX%zX", n, host_id, n);
-            nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            nm_argv_add(argv, buf.data);
         }
         else if (scsi_drv)
         {
-            nm_vect_insert_cstr(argv, "-device");
+            nm_argv_add(argv, "-device");
             nm_str_format(&buf, "scsi-hd,drive=hd%zu", n);
-            nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            nm_argv_add(argv, buf.data);
+        }
+        else if (virtio_drv)
+        {
+            nm_argv_add(argv, "-object");
+            nm_str_format(&buf, "iothread,id=io%zu", n);
+            nm_argv_add(argv, buf.data);
+            nm_argv_add(argv, "-device");
+            nm_str_format(&buf, "virtio-blk-pci,drive=hd%zu,iothread=io%zu", n, n);
+            nm_argv_add(argv, buf.data);
         }
     }
 
 #ifdef NM_SAVEVM_SNAPSHOTS
     /* load vm snapshot if exists */
     {
-        nm_str_t query = NM_INIT_STR;
         nm_vect_t snap_res = NM_INIT_VECT;
 
-        nm_str_format(&query, NM_GET_VMSNAP_LOAD_SQL, name->data);
-        nm_db_select(query.data, &snap_res);
+        nm_db_select(NM_GET_VMSNAP_LOAD_SQL, &snap_res, name->data);
 
         if (snap_res.n_memb > 0)
         {
-            nm_vect_insert_cstr(argv, "-loadvm");
-            nm_vect_insert_cstr(argv, nm_vect_str_ctx(&snap_res, 0));
+            nm_argv_add(argv, "-loadvm");
+            nm_argv_add(argv, nm_vect_str_ctx(&snap_res, 0));
 
             /* reset load flag */
             if (!(flags & NM_VMCTL_INFO))
-            {
-                nm_str_format(&query, NM_RESET_LOAD_SQL, name->data);
-                nm_db_edit(query.data);
-            }
+                nm_db_edit(NM_RESET_LOAD_SQL, name->data);
         }
 
-        nm_str_free(&query);
         nm_vect_free(&snap_res, nm_str_vect_free_cb);
     }
 #endif /* NM_SAVEVM_SNAPSHOTS */
 
-    nm_vect_insert_cstr(argv, "-m");
-    nm_vect_insert(argv,
-        nm_vect_str(&vm->main, NM_SQL_MEM)->data,
-        nm_vect_str(&vm->main, NM_SQL_MEM)->len + 1, NULL);
+    nm_argv_add(argv, "-m");
+    nm_str_format(&buf, "%d", row->mem);
+    nm_argv_add(argv, buf.data);
 
-    if (nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_SMP), 10) > 1)
+    if (row->smp > 1)
     {
-        nm_vect_insert_cstr(argv, "-smp");
-        nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_SMP)->data,
-            nm_vect_str(&vm->main, NM_SQL_SMP)->len + 1, NULL);
+        nm_argv_add(argv, "-smp");
+        nm_str_format(&buf, "%d", row->smp);
+        nm_argv_add(argv, buf.data);
     }
 
     /* 9p sharing.
@@ -402,26 +594,26 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
      * guest mount example:
      * mount -t 9p -o trans=virtio,version=9p2000.L hostshare /mnt/host
      */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_9FLG), NM_ENABLE) == NM_OK)
+    if (row->fs9p_enable)
     {
-        nm_vect_insert_cstr(argv, "-fsdev");
+        nm_argv_add(argv, "-fsdev");
         nm_str_format(&buf, "local,security_model=none,id=fsdev0,path=%s",
-            nm_vect_str(&vm->main, NM_SQL_9PTH)->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            row->fs9p_path);
+        nm_argv_add(argv, buf.data);
 
-        nm_vect_insert_cstr(argv, "-device");
+        nm_argv_add(argv, "-device");
         nm_str_format(&buf, "virtio-9p-pci,fsdev=fsdev0,mount_tag=%s",
-            nm_vect_str(&vm->main, NM_SQL_9ID)->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            row->fs9p_name);
+        nm_argv_add(argv, buf.data);
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK)
+    if (row->kvm)
     {
-        nm_vect_insert_cstr(argv, "-enable-kvm");
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
+        nm_argv_add(argv, "-enable-kvm");
+        if (row->hcpu)
         {
-            nm_vect_insert_cstr(argv, "-cpu");
-            nm_vect_insert_cstr(argv, "host");
+            nm_argv_add(argv, "-cpu");
+            nm_argv_add(argv, "host");
         }
     }
 
@@ -429,210 +621,119 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
      * Needed for USB hotplug feature. */
     if (!(flags & NM_VMCTL_INFO))
     {
-        nm_str_t query = NM_INIT_STR;
-        nm_str_format(&query,
-                      NM_USB_UPDATE_STATE_SQL,
-                      nm_vect_str_ctx(&vm->main, NM_SQL_USBF),
-                      name->data);
-        nm_db_edit(query.data);
-        nm_str_free(&query);
+        nm_db_edit(NM_USB_UPDATE_STATE_SQL,
+                   row->usb ? NM_ENABLE : NM_DISABLE, name->data);
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBF), NM_ENABLE) == NM_OK)
+    if (row->usb)
     {
-        size_t usb_count = vm->usb.n_memb / NM_USB_IDX_COUNT;
-        nm_vect_t usb_list = NM_INIT_VECT;
-        nm_vect_t serial_cache = NM_INIT_VECT;
-        nm_str_t serial = NM_INIT_STR;
-
-        nm_vect_insert_cstr(argv, "-usb");
-        nm_vect_insert_cstr(argv, "-device");
+        nm_argv_add(argv, "-usb");
+        nm_argv_add(argv, "-device");
 
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBT), NM_DEFAULT_USBVER) == NM_OK)
-            nm_vect_insert_cstr(argv, "qemu-xhci");
+        if (nm_str_cmp_tt(row->usb_type, NM_DEFAULT_USBVER) == NM_OK)
+            nm_argv_add(argv, "qemu-xhci");
         else
-            nm_vect_insert_cstr(argv, "usb-ehci");
-
-        if (usb_count > 0)
-            nm_usb_get_devs(&usb_list);
+            nm_argv_add(argv, "usb-ehci");
 
-        for (size_t n = 0; n < usb_count; n++)
+        for (size_t n = 0; n < vm->usb.n_rows; n++)
         {
-            int found_in_cache = 0;
-            int found_in_devs = 0;
-            size_t idx_shift = NM_USB_IDX_COUNT * n;
-            nm_usb_dev_t *usb = NULL;
-
-            const char *vid = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_VID + idx_shift);
-            const char *pid = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_PID + idx_shift);
-            const char *ser = nm_vect_str_ctx(&vm->usb, NM_SQL_USB_SERIAL + idx_shift);
-
-            /* look for cached data first, libusb_open() is very expensive */
-            for (size_t m = 0; m < serial_cache.n_memb; m++)
-            {
-                usb = *nm_usb_data_dev(serial_cache.data[m]);
-                nm_str_t *ser_str = nm_usb_data_serial(serial_cache.data[m]);
-
-                if ((nm_str_cmp_st(nm_usb_vendor_id(usb), vid) == NM_OK) &&
-                    (nm_str_cmp_st(nm_usb_product_id(usb), pid) == NM_OK) &&
-                    (nm_str_cmp_st(ser_str, ser) == NM_OK))
-                {
-                    found_in_cache = 1;
-                    break;
-                }
-            }
-
-            if (found_in_cache)
-            {
-                assert(usb != NULL);
-                nm_vect_insert_cstr(argv, "-device");
-                nm_str_format(&buf, "usb-host,hostbus=%d,hostaddr=%d,id=usb-%s-%s-%s",
-                    *nm_usb_bus_num(usb), *nm_usb_dev_addr(usb),
-                    nm_usb_vendor_id(usb)->data, nm_usb_product_id(usb)->data, ser);
-                nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            const nm_db_usb_t *dev = nm_db_usb(&vm->usb, n);
+            const nm_usb_dev_t *usb;
 
+            usb = nm_usb_find(dev->vendor_id, dev->product_id, dev->serial);
+            if (!usb)
                 continue;
-            }
-
-            for (size_t m = 0; m < usb_list.n_memb; m++)
-            {
-                usb = (nm_usb_dev_t *) usb_list.data[m];
-                if ((nm_str_cmp_st(nm_usb_vendor_id(usb), vid) == NM_OK) &&
-                    (nm_str_cmp_st(nm_usb_product_id(usb), pid) == NM_OK))
-                {
-                    if (serial.len)
-                        nm_str_trunc(&serial, 0);
 
-                    nm_usb_get_serial(usb, &serial);
-                    if (nm_str_cmp_st(&serial, ser) == NM_OK)
-                    {
-                        found_in_devs = 1;
-                        break;
-                    }
-                    else
-                    {
-                        /* save result in cache */
-                        nm_usb_data_t usb_data = NM_INIT_USB_DATA;
-                        nm_str_copy(&usb_data.serial, &serial);
-                        usb_data.dev = usb;
-                        nm_vect_insert(&serial_cache, &usb_data,
-                                sizeof(usb_data), nm_usb_data_vect_ins_cb);
-                        nm_str_free(&usb_data.serial);
-                    }
-                }
-            }
-
-            if (found_in_devs)
-            {
-                assert(usb != NULL);
-                nm_vect_insert_cstr(argv, "-device");
-                nm_str_format(&buf, "usb-host,hostbus=%d,hostaddr=%d,id=usb-%s-%s-%s",
-                    *nm_usb_bus_num(usb), *nm_usb_dev_addr(usb),
-                    nm_usb_vendor_id(usb)->data, nm_usb_product_id(usb)->data, ser);
-                nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
-
-                continue;
-            }
+            nm_argv_add(argv, "-device");
+            nm_str_format(&buf, "usb-host,hostbus=%d,hostaddr=%d,id=usb-%s-%s-%s",
+                usb->bus_num, usb->dev_addr,
+                usb->vendor_id.data, usb->product_id.data, dev->serial);
+            nm_argv_add(argv, buf.data);
         }
-
-        nm_vect_free(&serial_cache, nm_usb_data_vect_free_cb);
-        nm_vect_free(&usb_list, nm_usb_vect_free_cb);
-        nm_str_free(&serial);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_BIOS))
+    if (*row->bios)
     {
-        nm_vect_insert_cstr(argv, "-bios");
-        nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_BIOS)->data,
-            nm_vect_str(&vm->main, NM_SQL_BIOS)->len + 1, NULL);
+        nm_argv_add(argv, "-bios");
+        nm_argv_add(argv, row->bios);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_MACH))
+    if (*row->machine)
     {
-        nm_vect_insert_cstr(argv, "-M");
-        nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_MACH)->data,
-            nm_vect_str(&vm->main, NM_SQL_MACH)->len + 1, NULL);
+        nm_argv_add(argv, "-M");
+        nm_argv_add(argv, row->machine);
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_KERN))
+    if (*row->kernel)
     {
-        nm_vect_insert_cstr(argv, "-kernel");
-        nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_KERN)->data,
-            nm_vect_str(&vm->main, NM_SQL_KERN)->len + 1, NULL);
+        nm_argv_add(argv, "-kernel");
+        nm_argv_add(argv, row->kernel);
 
-        if (nm_vect_str_len(&vm->main, NM_SQL_KAPP))
+        if (*row->kernel_append)
         {
-            nm_vect_insert_cstr(argv, "-append");
-            nm_vect_insert(argv,
-                nm_vect_str(&vm->main, NM_SQL_KAPP)->data,
-                nm_vect_str(&vm->main, NM_SQL_KAPP)->len + 1, NULL);
+            nm_argv_add(argv, "-append");
+            nm_argv_add(argv, row->kernel_append);
         }
     }
 
-    if (nm_vect_str_len(&vm->main, NM_SQL_INIT))
+    if (*row->initrd)
     {
-        nm_vect_insert_cstr(argv, "-initrd");
-        nm_vect_insert(argv,
-            nm_vect_str(&vm->main, NM_SQL_INIT)->data,
-            nm_vect_str(&vm->main, NM_SQL_INIT)->len + 1, NULL);
+        nm_argv_add(argv, "-initrd");
+        nm_argv_add(argv, row->initrd);
     }
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_OVER), NM_ENABLE) == NM_OK)
+    if (row->mouse_override)
     {
-        nm_vect_insert_cstr(argv, "-usbdevice");
-        nm_vect_insert_cstr(argv, "tablet");
+        nm_argv_add(argv, "-usbdevice");
+        nm_argv_add(argv, "tablet");
     }
 
     /* setup serial socket */
-    if (nm_vect_str_len(&vm->main, NM_SQL_SOCK))
+    if (*row->socket_path)
     {
         if (!(flags & NM_VMCTL_INFO))
         {
             struct stat info;
 
-            if (stat(nm_vect_str_ctx(&vm->main, NM_SQL_SOCK), &info) != -1)
+            if (stat(row->socket_path, &info) != -1)
             {
                 nm_warn(_(NM_MSG_SOCK_USED));
-                nm_vect_free(argv, NULL);
+                nm_argv_free(argv);
                 goto out;
             }
         }
 
-        nm_vect_insert_cstr(argv, "-chardev");
+        nm_argv_add(argv, "-chardev");
         nm_str_format(&buf, "socket,path=%s,server,nowait,id=socket_%s",
-            nm_vect_str(&vm->main, NM_SQL_SOCK)->data, name->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            row->socket_path, name->data);
+        nm_argv_add(argv, buf.data);
 
-        nm_vect_insert_cstr(argv, "-device");
+        nm_argv_add(argv, "-device");
         nm_str_format(&buf, "isa-serial,chardev=socket_%s", name->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(argv, buf.data);
     }
 
     /* setup debug port for GDB */
-    if (nm_vect_str_len(&vm->main, NM_SQL_DEBP))
+    if (row->debug_port)
     {
-        nm_vect_insert_cstr(argv, "-gdb");
-        nm_str_format(&buf, "tcp::%s",
-            nm_vect_str(&vm->main, NM_SQL_DEBP)->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(argv, "-gdb");
+        nm_str_format(&buf, "tcp::%d", row->debug_port);
+        nm_argv_add(argv, buf.data);
     }
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
-        nm_vect_insert_cstr(argv, "-S");
+    if (row->debug_freeze)
+        nm_argv_add(argv, "-S");
 
     /* setup serial TTY */
-    if (nm_vect_str_len(&vm->main, NM_SQL_TTY))
+    if (*row->tty_path)
     {
         if (!(flags & NM_VMCTL_INFO))
         {
             int fd;
 
-            if ((fd = open(nm_vect_str_ctx(&vm->main, NM_SQL_TTY), O_RDONLY)) == -1)
+            if ((fd = open(row->tty_path, O_RDONLY)) == -1)
             {
                 nm_warn(_(NM_MSG_TTY_MISS));
-                nm_vect_free(argv, NULL);
+                nm_argv_free(argv);
                 goto out;
             }
 
@@ -640,41 +741,46 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
             {
                 close(fd);
                 nm_warn(_(NM_MSG_TTY_INVAL));
-                nm_vect_free(argv, NULL);
+                nm_argv_free(argv);
                 goto out;
             }
         }
 
-        nm_vect_insert_cstr(argv, "-chardev");
+        nm_argv_add(argv, "-chardev");
         nm_str_format(&buf, "tty,path=%s,id=tty_%s",
-            nm_vect_str(&vm->main, NM_SQL_TTY)->data,
-            name->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            row->tty_path, name->data);
+        nm_argv_add(argv, buf.data);
 
-        nm_vect_insert_cstr(argv, "-device");
+        nm_argv_add(argv, "-device");
         nm_str_format(&buf, "isa-serial,chardev=tty_%s",
             name->data);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(argv, buf.data);
     }
 
-    /* setup network interfaces */
-    for (size_t n = 0; n < ifs_count; n++)
+    /* setup network interfaces, requests of all of them are sent
+     * together, unless index of interface is needed */
+#if defined (NM_OS_LINUX)
+    if (!(flags & NM_VMCTL_INFO))
     {
-        size_t idx_shift = NM_IFS_IDX_COUNT * n;
+        nm_net_batch_begin();
+        net_batch = NM_TRUE;
+    }
+#endif
+    for (size_t n = 0; n < vm->ifs.n_rows; n++)
+    {
+        const nm_db_iface_t *iface = nm_db_iface(&vm->ifs, n);
+        nm_str_t if_name = nm_str_view(iface->name);
 
-        nm_vect_insert_cstr(argv, "-device");
+        nm_argv_add(argv, "-device");
         nm_str_format(&buf, "%s,mac=%s,netdev=netdev%zu",
-            nm_vect_str(&vm->ifs, NM_SQL_IF_DRV + idx_shift)->data,
-            nm_vect_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift)->data,
-            n);
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+            iface->drv, iface->mac_addr, n);
+        nm_argv_add(argv, buf.data);
 
-        if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift),
-            NM_DISABLE) == NM_OK)
+        if (!iface->macvtap)
         {
-            nm_vect_insert_cstr(argv, "-netdev");
+            nm_argv_add(argv, "-netdev");
             nm_str_format(&buf, "tap,ifname=%s,script=no,downscript=no,id=netdev%zu",
-                nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)->data, n);
+                iface->name, n);
 
 #if defined (NM_OS_LINUX)
             /* Delete macvtap iface if exists, we using simple tap iface now.
@@ -682,8 +788,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
             if (!(flags & NM_VMCTL_INFO))
             {
                 uint32_t tap_idx = 0;
-                tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
-                    NM_SQL_IF_NAME + idx_shift));
+                tap_idx = nm_net_iface_idx(&if_name);
 
                 if (tap_idx != 0)
                 {
@@ -695,8 +800,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     if (stat(tap_path.data, &tap_info) == 0)
                     {
                         /* iface is macvtap, delete it */
-                        nm_net_del_iface(nm_vect_str(&vm->ifs,
-                            NM_SQL_IF_NAME + idx_shift));
+                        nm_net_del_iface(&if_name);
                     }
                     nm_str_free(&tap_path);
                 }
@@ -714,8 +818,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                 uint32_t tap_idx = 0;
 
                 /* Delete simple tap iface if exists, we using macvtap iface now */
-                if ((tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
-                        NM_SQL_IF_NAME + idx_shift))) != 0)
+                if ((tap_idx = nm_net_iface_idx(&if_name)) != 0)
                 {
                     /* is this iface simple tap? */
                     struct stat tap_info;
@@ -723,40 +826,36 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     if (stat(tap_path.data, &tap_info) != 0)
                     {
                         /* iface is simple tap, delete it */
-                        nm_net_del_tap(nm_vect_str(&vm->ifs,
-                                                   NM_SQL_IF_NAME + idx_shift));
+                        nm_net_del_tap(&if_name);
                     }
 
                     tap_idx = 0;
                 }
 
-                if (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK)
+                if (nm_net_iface_exists(&if_name) != NM_OK)
                 {
+                    nm_str_t parent = nm_str_view(iface->parent_eth);
+                    nm_str_t maddr = nm_str_view(iface->mac_addr);
+
                     wait_perm = 1;
-                    int macvtap_type = nm_str_stoui(nm_vect_str(&vm->ifs,
-                                                                NM_SQL_IF_MVT + idx_shift), 10);
 
                     /* check for lower iface (parent) exists */
-                    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_PET + idx_shift) == 0)
+                    if (!parent.len)
                     {
                         nm_warn(_(NM_MSG_MTAP_NSET));
-                        nm_vect_free(argv, NULL);
+                        nm_argv_free(argv);
                         goto out;
                     }
 
-                    nm_net_add_macvtap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                                       nm_vect_str(&vm->ifs, NM_SQL_IF_PET + idx_shift),
-                                       nm_vect_str(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
-                                       macvtap_type);
+                    nm_net_add_macvtap(&if_name, &parent, &maddr, iface->macvtap);
 
-                    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
-                        nm_net_set_altname(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                                nm_vect_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
+                    if (*iface->altname) {
+                        nm_str_t altname = nm_str_view(iface->altname);
+                        nm_net_set_altname(&if_name, &altname);
                     }
                 }
 
-                tap_idx = nm_net_iface_idx(nm_vect_str(&vm->ifs,
-                    NM_SQL_IF_NAME + idx_shift));
+                tap_idx = nm_net_iface_idx(&if_name);
                 if (tap_idx == 0)
                     nm_bug("%s: MacVTap interface not found", __func__);
 
@@ -783,7 +882,7 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     if (!tap_rw_ok)
                     {
                         nm_warn(_(NM_MSG_TAP_EACC));
-                        nm_vect_free(argv, NULL);
+                        nm_argv_free(argv);
                         goto out;
                     }
                 }
@@ -793,101 +892,114 @@ void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
                     nm_bug("%s: open failed: %s", __func__, strerror(errno));
                 if (tfds == NULL)
                     nm_bug("%s: tfds is NULL", __func__);
-                nm_vect_insert(tfds, &tap_fd, sizeof(int), NULL);
+                nm_arr_push(tfds, &tap_fd);
                 nm_str_free(&tap_path);
             }
 
-            nm_vect_insert_cstr(argv, "-netdev");
+            nm_argv_add(argv, "-netdev");
             nm_str_format(&buf, "tap,id=netdev%zu,fd=%d",
                 n, (flags & NM_VMCTL_INFO) ? -1 : tap_fd);
 #endif /* NM_OS_LINUX */
         }
-        if (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift), NM_ENABLE) == NM_OK)
+        if (iface->vhost)
             nm_str_add_text(&buf, ",vhost=on");
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(argv, buf.data);
 
 #if defined (NM_OS_LINUX)
         /* Simple tap interface additional setup:
          * If we need to setup IPv4 address or altname we must create
          * the tap interface yourself. */
         if ((!(flags & NM_VMCTL_INFO)) &&
-            (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) != NM_OK) &&
-            (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), NM_DISABLE) == NM_OK))
+            (nm_net_iface_exists(&if_name) != NM_OK) &&
+            (!iface->macvtap))
         {
-            nm_net_add_tap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
+            nm_net_add_tap(&if_name);
 
-            if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) != 0) {
-                nm_net_set_ipaddr(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                        nm_vect_str(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+            if (*iface->ipv4_addr) {
+                nm_str_t addr = nm_str_view(iface->ipv4_addr);
+                nm_net_set_ipaddr(&if_name, &addr);
             }
-            if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_ALT + idx_shift) != 0) {
-                nm_net_set_altname(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                        nm_vect_str(&vm->ifs, NM_SQL_IF_ALT + idx_shift));
+            if (*iface->altname) {
+                nm_str_t altname = nm_str_view(iface->altname);
+                nm_net_set_altname(&if_name, &altname);
             }
         }
 #elif defined (NM_OS_FREEBSD)
-        if (nm_net_iface_exists(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift)) == NM_OK)
+        if (nm_net_iface_exists(&if_name) == NM_OK)
         {
-            nm_net_del_tap(nm_vect_str(&vm->ifs, NM_SQL_IF_NAME + idx_shift));
+            nm_net_del_tap(&if_name);
         }
         (void) tfds;
 #endif /* NM_OS_LINUX */
     }
 
+#if defined (NM_OS_LINUX)
+    if (net_batch)
+    {
+        nm_net_batch_end();
+        net_batch = NM_FALSE;
+    }
+#endif
+
     if (flags & NM_VMCTL_TEMP)
-        nm_vect_insert_cstr(argv, "-snapshot");
+        nm_argv_add(argv, "-snapshot");
 
-    nm_vect_insert_cstr(argv, "-pidfile");
+    nm_argv_add(argv, "-pidfile");
     nm_str_format(&buf, "%s%s",
         vmdir.data, NM_VM_PID_FILE);
-    nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(argv, buf.data);
 
-    nm_vect_insert_cstr(argv, "-qmp");
+    nm_argv_add(argv, "-qmp");
     nm_str_format(&buf, "unix:%s%s,server,nowait",
         vmdir.data, NM_VM_QMP_FILE);
-    nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(argv, buf.data);
+
+    nm_argv_add(argv, "-qmp");
+    nm_str_format(&buf, "unix:%s%s,server,nowait",
+        vmdir.data, NM_VM_QMP_EVT_FILE);
+    nm_argv_add(argv, buf.data);
 
 #if defined (NM_WITH_SPICE)
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_SPICE), NM_ENABLE) == NM_OK)
+    if (row->spice)
     {
-        nm_vect_insert_cstr(argv, "-vga");
-        nm_vect_insert_cstr(argv, "qxl");
-        nm_vect_insert_cstr(argv, "-spice");
-        nm_str_format(&buf, "port=%u,disable-ticketing",
-            nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_VNC), 10) + 5900);
+        nm_argv_add(argv, "-vga");
+        nm_argv_add(argv, "qxl");
+        nm_argv_add(argv, "-spice");
+        nm_str_format(&buf, "port=%d,disable-ticketing", row->vnc + 5900);
         if (!cfg->listen_any)
             nm_str_append_format(&buf, ",addr=127.0.0.1");
-        nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(argv, buf.data);
     }
     else
     {
 #endif
-    nm_vect_insert_cstr(argv, "-vnc");
-    if (cfg->listen_any)
-        nm_str_format(&buf, ":");
-    else
-        nm_str_format(&buf, "127.0.0.1:");
-    nm_str_add_str(&buf, nm_vect_str(&vm->main, NM_SQL_VNC));
-    nm_vect_insert(argv, buf.data, buf.len + 1, NULL);
+    nm_argv_add(argv, "-vnc");
+    nm_str_format(&buf, "%s:%d",
+        cfg->listen_any ? "" : "127.0.0.1", row->vnc);
+    nm_argv_add(argv, buf.data);
 #if defined (NM_WITH_SPICE)
     }
 #endif
-    nm_vect_end_zero(argv);
 
     nm_cmd_str(&buf, argv);
     nm_debug("cmd=%s\n", buf.data);
 
 out:
-    nm_str_free(&vmdir);
+#if defined (NM_OS_LINUX)
+    if (net_batch)
+        nm_net_batch_end();
+#endif
+    (void) net_batch;
+    nm_arena_free(&arena);
     nm_str_free(&buf);
 }
 
 void nm_vmctl_free_data(nm_vmctl_data_t *vm)
 {
-    nm_vect_free(&vm->main, nm_str_vect_free_cb);
-    nm_vect_free(&vm->ifs, nm_str_vect_free_cb);
-    nm_vect_free(&vm->drives, nm_str_vect_free_cb);
-    nm_vect_free(&vm->usb, nm_str_vect_free_cb);
+    nm_db_res_free(&vm->main);
+    nm_db_res_free(&vm->ifs);
+    nm_db_res_free(&vm->drives);
+    nm_db_res_free(&vm->usb);
 }
 
 void nm_vmctl_log_last(const nm_str_t *msg)
@@ -921,7 +1033,6 @@ void nm_vmctl_clear_tap(const nm_str_t *name)
 void nm_vmctl_clear_all_tap(void)
 {
     nm_vect_t vms = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     int clear_done;
 
     nm_db_select("SELECT name FROM vms", &vms);
@@ -929,21 +1040,20 @@ void nm_vmctl_clear_all_tap(void)
 
     nm_notify(clear_done ? _(NM_MSG_IFCLR_DONE) : _(NM_MSG_IFCLR_NONE));
 
-    nm_str_free(&query);
     nm_vect_free(&vms, nm_str_vect_free_cb);
 }
 
+/* Interfaces are looked up first and deleted in one batch */
 static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms)
 {
     nm_str_t lock_path = NM_INIT_STR;
-    nm_str_t query = NM_INIT_STR;
+    nm_vect_t del = NM_INIT_VECT;
     int clear_done = 0;
 
     for (size_t n = 0; n < vms->n_memb; n++)
     {
         struct stat file_info;
-        size_t ifs_count;
-        nm_vect_t ifaces = NM_INIT_VECT;
+        nm_db_res_t ifaces = NM_INIT_DB_RES;
 
         nm_str_format(&lock_path, "%s/%s/%s",
             nm_cfg_get()->vm_dir.data, nm_vect_str(vms, n)->data, NM_VM_QMP_FILE);
@@ -951,30 +1061,41 @@ static int nm_vmctl_clear_tap_vect(const nm_vect_t *vms)
         if (stat(lock_path.data, &file_info) == 0)
             continue;
 
-        nm_str_format(&query, NM_VM_GET_IFACES_SQL, nm_vect_str_ctx(vms, n));
-        nm_db_select(query.data, &ifaces);
-        ifs_count = ifaces.n_memb / NM_IFS_IDX_COUNT;
+        nm_db_select_rows(NM_VM_GET_IFACES_SQL, NM_DB_ROW_IFACE,
+                &ifaces, nm_vect_str_ctx(vms, n));
 
-        for (size_t ifn = 0; ifn < ifs_count; ifn++)
+        for (size_t ifn = 0; ifn < ifaces.n_rows; ifn++)
         {
-            size_t idx_shift = NM_IFS_IDX_COUNT * ifn;
-            if (nm_net_iface_exists(nm_vect_str(&ifaces, NM_SQL_IF_NAME + idx_shift)) == NM_OK)
+            nm_str_t if_name = nm_str_view(nm_db_iface(&ifaces, ifn)->name);
+
+            if (nm_net_iface_exists(&if_name) == NM_OK)
             {
-#if defined (NM_OS_LINUX)
-                nm_net_del_iface(nm_vect_str(&ifaces, NM_SQL_IF_NAME + idx_shift));
-#else
-                nm_net_del_tap(nm_vect_str(&ifaces, NM_SQL_IF_NAME + idx_shift));
-#endif
-                clear_done = 1;
+                nm_vect_insert(&del, &if_name, sizeof(nm_str_t),
+                        nm_str_vect_ins_cb);
             }
         }
 
         nm_str_trunc(&lock_path, 0);
-        nm_str_trunc(&query, 0);
-        nm_vect_free(&ifaces, nm_str_vect_free_cb);
+        nm_db_res_free(&ifaces);
     }
 
-    nm_str_free(&query);
+#if defined (NM_OS_LINUX)
+    nm_net_batch_begin();
+#endif
+    for (size_t n = 0; n < del.n_memb; n++)
+    {
+#if defined (NM_OS_LINUX)
+        nm_net_del_iface(nm_vect_str(&del, n));
+#else
+        nm_net_del_tap(nm_vect_str(&del, n));
+#endif
+        clear_done = 1;
+    }
+#if defined (NM_OS_LINUX)
+    nm_net_batch_end();
+#endif
+
+    nm_vect_free(&del, nm_str_vect_free_cb);
     nm_str_free(&lock_path);
 
     return clear_done;
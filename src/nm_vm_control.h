@@ -3,6 +3,8 @@
 
 #include <nm_string.h>
 #include <nm_vector.h>
+#include <nm_database.h>
+#include <nm_utils.h>
 
 enum vmctl_flags {
     NM_VMCTL_TEMP = (1 << 1),
@@ -10,25 +12,33 @@ enum vmctl_flags {
 };
 
 typedef struct {
-    nm_vect_t main;
-    nm_vect_t ifs;
-    nm_vect_t drives;
-    nm_vect_t usb;
+    nm_db_res_t main;
+    nm_db_res_t ifs;
+    nm_db_res_t drives;
+    nm_db_res_t usb;
 } nm_vmctl_data_t;
 
 #define NM_VMCTL_INIT_DATA (nm_vmctl_data_t) { \
-                            NM_INIT_VECT, NM_INIT_VECT, \
-                            NM_INIT_VECT, NM_INIT_VECT }
+                            NM_INIT_DB_RES, NM_INIT_DB_RES, \
+                            NM_INIT_DB_RES, NM_INIT_DB_RES }
 
-void nm_vmctl_start(const nm_str_t *name, int flags);
+/* VM start in progress, see nm_vmctl_start_begin() */
+typedef struct nm_vmctl_job nm_vmctl_job_t;
+
+int nm_vmctl_start(const nm_str_t *name, int flags);
+nm_vmctl_job_t *nm_vmctl_start_begin(const nm_str_t *name, int flags);
+nm_spawn_t *nm_vmctl_job_spawn(const nm_vmctl_job_t *job);
+int nm_vmctl_start_end(nm_vmctl_job_t *job);
+int nm_vmctl_start_list(const nm_vect_t *names, size_t jobs, int *results);
 void nm_vmctl_delete(const nm_str_t *name);
 void nm_vmctl_kill(const nm_str_t *name);
+void nm_vmctl_base_unref(const char *base);
 void nm_vmctl_get_data(const nm_str_t *name, nm_vmctl_data_t *vm);
 void nm_vmctl_free_data(nm_vmctl_data_t *vm);
 void nm_vmctl_clear_tap(const nm_str_t *name);
 void nm_vmctl_clear_all_tap(void);
-void nm_vmctl_gen_cmd(nm_vect_t *argv, const nm_vmctl_data_t *vm,
-    const nm_str_t *name, int flags, nm_vect_t *tfds);
+void nm_vmctl_gen_cmd(nm_argv_t *argv, const nm_vmctl_data_t *vm,
+    const nm_str_t *name, int flags, nm_arr_t *tfds);
 void nm_vmctl_log_last(const nm_str_t *msg);
 #if defined(NM_WITH_VNC_CLIENT) || defined(NM_WITH_SPICE)
 void nm_vmctl_connect(const nm_str_t *name);
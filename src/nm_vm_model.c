@@ -0,0 +1,177 @@
+#include <nm_core.h>
+#include <nm_utils.h>
+#include <nm_string.h>
+#include <nm_database.h>
+#include <nm_vm_model.h>
+
+#include <stddef.h>
+
+/* In-memory copy of all VMs for the main loop.
+ * Model is loaded by one query per table and reloaded only after
+ * the database was changed: by this process (nm_db_edit) or by another
+ * connection, e.g. nemu-monitor or CLI (PRAGMA data_version).
+ * Items are views into model result sets, they are valid until next
+ * reload and must not be freed with nm_vmctl_free_data(). */
+
+typedef struct {
+    nm_db_res_t vms;
+    nm_db_res_t ifs;
+    nm_db_res_t drives;
+    nm_db_res_t usb;
+    nm_vmctl_data_t *items;
+    uint64_t edits;
+    int64_t data_version;
+    int loaded;
+} nm_vm_model_t;
+
+static nm_vm_model_t nm_model;
+
+static void nm_vm_model_load(void);
+static void nm_vm_model_group(const nm_db_res_t *res, size_t name_off,
+                              const char *name, size_t *pos, nm_db_res_t *view);
+static const char *nm_vm_model_row_vm(const nm_db_res_t *res, size_t idx,
+                                      size_t name_off);
+
+int nm_vm_model_update(int check_db)
+{
+    if (nm_model.loaded && nm_model.edits == nm_db_edit_count())
+    {
+        if (!check_db)
+            return 0;
+
+        if (nm_db_data_version() == nm_model.data_version)
+            return 0;
+    }
+
+    nm_vm_model_load();
+
+    return 1;
+}
+
+size_t nm_vm_model_count(void)
+{
+    return nm_model.vms.n_rows;
+}
+
+const nm_vmctl_data_t *nm_vm_model_at(size_t idx)
+{
+    if (idx >= nm_model.vms.n_rows)
+        nm_bug(_("%s: invalid index"), __func__);
+
+    return &nm_model.items[idx];
+}
+
+/* vms are sorted by name with BINARY collation, same order as strcmp() */
+const nm_vmctl_data_t *nm_vm_model_get(const nm_str_t *name)
+{
+    size_t lo = 0, hi = nm_model.vms.n_rows;
+
+    if (!name->data)
+        return NULL;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int rc = strcmp(nm_db_vm(&nm_model.vms, mid)->name, name->data);
+
+        if (rc == 0)
+            return &nm_model.items[mid];
+
+        if (rc < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+void nm_vm_model_free(void)
+{
+    nm_db_res_free(&nm_model.vms);
+    nm_db_res_free(&nm_model.ifs);
+    nm_db_res_free(&nm_model.drives);
+    nm_db_res_free(&nm_model.usb);
+    free(nm_model.items);
+
+    memset(&nm_model, 0, sizeof(nm_model));
+}
+
+static void nm_vm_model_load(void)
+{
+    size_t ifs_pos = 0, drives_pos = 0, usb_pos = 0;
+
+    nm_vm_model_free();
+
+    /* version is taken first: change made during load
+     * will cause one more reload, but will not be lost */
+    nm_model.data_version = nm_db_data_version();
+    nm_model.edits = nm_db_edit_count();
+
+    nm_db_select_rows(NM_MODEL_GET_VMS_SQL, NM_DB_ROW_VM, &nm_model.vms);
+    nm_db_select_rows(NM_MODEL_GET_IFACES_SQL, NM_DB_ROW_IFACE, &nm_model.ifs);
+    nm_db_select_rows(NM_MODEL_GET_DRIVES_SQL, NM_DB_ROW_DRIVE, &nm_model.drives);
+    nm_db_select_rows(NM_MODEL_GET_USB_SQL, NM_DB_ROW_USB, &nm_model.usb);
+
+    if (nm_model.vms.n_rows)
+    {
+        nm_model.items = nm_calloc(nm_model.vms.n_rows,
+                sizeof(nm_vmctl_data_t));
+    }
+
+    for (size_t n = 0; n < nm_model.vms.n_rows; n++)
+    {
+        nm_vmctl_data_t *item = &nm_model.items[n];
+        const char *name = nm_db_vm(&nm_model.vms, n)->name;
+
+        item->main.rows = (char *) nm_model.vms.rows + n * nm_model.vms.row_size;
+        item->main.n_rows = 1;
+        item->main.row_size = nm_model.vms.row_size;
+
+        nm_vm_model_group(&nm_model.ifs, offsetof(nm_db_iface_t, vm_name),
+                name, &ifs_pos, &item->ifs);
+        nm_vm_model_group(&nm_model.drives, offsetof(nm_db_drive_t, vm_name),
+                name, &drives_pos, &item->drives);
+        nm_vm_model_group(&nm_model.usb, offsetof(nm_db_usb_t, vm_name),
+                name, &usb_pos, &item->usb);
+    }
+
+    nm_model.loaded = 1;
+}
+
+/* Rows are sorted by VM name, so rows of each VM are contiguous
+ * and view is set to them. Rows of unknown VMs are skipped. */
+static void nm_vm_model_group(const nm_db_res_t *res, size_t name_off,
+                              const char *name, size_t *pos, nm_db_res_t *view)
+{
+    size_t start;
+
+    while (*pos < res->n_rows &&
+           strcmp(nm_vm_model_row_vm(res, *pos, name_off), name) < 0)
+    {
+        (*pos)++;
+    }
+
+    start = *pos;
+
+    while (*pos < res->n_rows &&
+           strcmp(nm_vm_model_row_vm(res, *pos, name_off), name) == 0)
+    {
+        (*pos)++;
+    }
+
+    view->rows = (start != *pos) ?
+        (char *) res->rows + start * res->row_size : NULL;
+    view->n_rows = *pos - start;
+    view->row_size = res->row_size;
+}
+
+static const char *nm_vm_model_row_vm(const nm_db_res_t *res, size_t idx,
+                                      size_t name_off)
+{
+    const char *row = nm_db_row(res, idx);
+
+    return *(const char * const *) (row + name_off);
+}
+
+/* vim:set ts=4 sw=4: */
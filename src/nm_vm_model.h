@@ -0,0 +1,14 @@
+#ifndef NM_VM_MODEL_H_
+#define NM_VM_MODEL_H_
+
+#include <nm_string.h>
+#include <nm_vm_control.h>
+
+int nm_vm_model_update(int check_db);
+size_t nm_vm_model_count(void);
+const nm_vmctl_data_t *nm_vm_model_at(size_t idx);
+const nm_vmctl_data_t *nm_vm_model_get(const nm_str_t *name);
+void nm_vm_model_free(void);
+
+#endif /* NM_VM_MODEL_H_ */
+/* vim:set ts=4 sw=4: */
@@ -22,14 +22,6 @@ static const char *nm_form_msg[] = {
     NM_FORMSTR_NAME, NM_FORMSTR_LOAD, NULL
 };
 
-enum {
-    NM_SQL_VMSNAP_ID = 0,
-    NM_SQL_VMSNAP_VM,
-    NM_SQL_VMSNAP_NAME,
-    NM_SQL_VMSNAP_LOAD,
-    NM_SQL_VMSNAP_TIME
-};
-
 typedef struct {
     nm_str_t snap_name;
     nm_str_t load;
@@ -40,6 +32,9 @@ typedef struct {
 
 static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data);
 static void nm_vm_snapshot_to_db(const nm_str_t *name, const nm_vmsnap_t *data);
+static void nm_vm_snapshot_saved(const nm_str_t *name, int rc, void *ctx);
+static void nm_vm_snapshot_deleted(const nm_str_t *name, int rc, void *ctx);
+static void nm_vm_snapshot_free(nm_vmsnap_t *data);
 static void __nm_vm_snapshot_load(const nm_str_t *name, const nm_str_t *snap,
                                   int vm_status);
 static void __nm_vm_snapshot_delete(const nm_str_t *name, const nm_str_t *snap,
@@ -50,11 +45,9 @@ static nm_field_t *fields[NM_FLD_COUNT + 1];
 void nm_vm_snapshot_create(const nm_str_t *name)
 {
     nm_form_t *form = NULL;
-    nm_spinner_data_t sp_data = NM_INIT_SPINNER;
     nm_vmsnap_t data = NM_INIT_VMSNAP;
+    nm_vmsnap_t *job;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
-    pthread_t spin_th;
-    int done = 0;
     size_t msg_len = nm_max_msg_len(nm_form_msg);
 
     if (nm_form_calc_size(msg_len, NM_FLD_COUNT, &form_data) != NM_OK)
@@ -86,17 +79,16 @@ void nm_vm_snapshot_create(const nm_str_t *name)
     if (nm_vm_snapshot_get_data(name, &data) != NM_OK)
         goto out;
 
-    sp_data.stop = &done;
-
-    if (pthread_create(&spin_th, NULL, nm_progress_bar, (void *) &sp_data) != 0)
-        nm_bug(_("%s: cannot create thread"), __func__);
+    /* QEMU saves state in background, TUI is not blocked */
+    job = nm_alloc(sizeof(nm_vmsnap_t));
+    memcpy(job, &data, sizeof(data));
+    data = NM_INIT_VMSNAP;
 
-    if (nm_qmp_savevm(name, &data.snap_name) != NM_ERR)
-        nm_vm_snapshot_to_db(name, &data);
-
-    done = 1;
-    if (pthread_join(spin_th, NULL) != 0)
-        nm_bug(_("%s: cannot join thread"), __func__);
+    if (nm_qmp_savevm_async(name, &job->snap_name,
+                nm_vm_snapshot_saved, job) != NM_OK)
+    {
+        nm_vm_snapshot_free(job);
+    }
 
 out:
     NM_FORM_EXIT();
@@ -109,21 +101,19 @@ void nm_vm_snapshot_delete(const nm_str_t *name, int vm_status)
 {
     nm_form_t *form = NULL;
     nm_vect_t err = NM_INIT_VECT;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
-    nm_vect_t snaps = NM_INIT_VECT;
+    nm_db_res_t snaps = NM_INIT_DB_RES;
     nm_vect_t choices = NM_INIT_VECT;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
     int done = 0;
     pthread_t spin_th;
-    size_t snaps_count = 0;
     size_t msg_len = mbstowcs(NULL, _(NM_FORMSTR_SNAP), strlen(_(NM_FORMSTR_SNAP)));
 
-    nm_str_format(&query, NM_GET_SNAPS_ALL_SQL, name->data);
-    nm_db_select(query.data, &snaps);
+    nm_db_select_rows(NM_GET_SNAPS_ALL_SQL, NM_DB_ROW_SNAP,
+            &snaps, name->data);
 
-    if (snaps.n_memb == 0)
+    if (snaps.n_rows == 0)
     {
         nm_warn(_(NM_MSG_NO_SNAPS));
         goto out;
@@ -139,16 +129,8 @@ void nm_vm_snapshot_delete(const nm_str_t *name, int vm_status)
 
     nm_print_snapshots(&snaps);
 
-    snaps_count = snaps.n_memb / 5;
-    for (size_t n = 0; n < snaps_count; n++)
-    {
-        size_t idx_shift = 5 * n;
-
-        nm_vect_insert(&choices,
-            nm_vect_str_ctx(&snaps, NM_SQL_VMSNAP_NAME + idx_shift),
-            nm_vect_str_len(&snaps, NM_SQL_VMSNAP_NAME + idx_shift) + 1,
-            NULL);
-    }
+    for (size_t n = 0; n < snaps.n_rows; n++)
+        nm_vect_insert_cstr(&choices, nm_db_snap(&snaps, n)->snap_name);
 
     nm_vect_end_zero(&choices);
 
@@ -192,32 +174,29 @@ clean_and_out:
 out:
     wtimeout(action_window, -1);
     delwin(form_data.form_window);
-    nm_vect_free(&snaps, nm_str_vect_free_cb);
+    nm_db_res_free(&snaps);
     nm_vect_free(&choices, NULL);
     nm_form_free(form, fields);
-    nm_str_free(&query);
     nm_str_free(&buf);
 }
 
 void nm_vm_snapshot_load(const nm_str_t *name, int vm_status)
 {
-    nm_vect_t snaps = NM_INIT_VECT;
+    nm_db_res_t snaps = NM_INIT_DB_RES;
     nm_vect_t choices = NM_INIT_VECT;
     nm_vect_t err = NM_INIT_VECT;
     nm_form_t *snap_form = NULL;
-    nm_str_t query = NM_INIT_STR;
     nm_str_t buf = NM_INIT_STR;
     nm_form_data_t form_data = NM_INIT_FORM_DATA;
     nm_spinner_data_t sp_data = NM_INIT_SPINNER;
-    size_t snaps_count = 0;
     int done = 0;
     pthread_t spin_th;
     size_t msg_len = mbstowcs(NULL, NM_FORMSTR_SNAP, strlen(NM_FORMSTR_SNAP));
 
-    nm_str_format(&query, NM_GET_SNAPS_ALL_SQL, name->data);
-    nm_db_select(query.data, &snaps);
+    nm_db_select_rows(NM_GET_SNAPS_ALL_SQL, NM_DB_ROW_SNAP,
+            &snaps, name->data);
 
-    if (snaps.n_memb == 0)
+    if (snaps.n_rows == 0)
     {
         nm_warn(_(NM_MSG_NO_SNAPS));
         goto out;
@@ -233,16 +212,8 @@ void nm_vm_snapshot_load(const nm_str_t *name, int vm_status)
 
     nm_print_snapshots(&snaps);
 
-    snaps_count = snaps.n_memb / 5;
-    for (size_t n = 0; n < snaps_count; n++)
-    {
-        size_t idx_shift = 5 * n;
-
-        nm_vect_insert(&choices,
-            nm_vect_str_ctx(&snaps, NM_SQL_VMSNAP_NAME + idx_shift),
-            nm_vect_str_len(&snaps, NM_SQL_VMSNAP_NAME + idx_shift) + 1,
-            NULL);
-    }
+    for (size_t n = 0; n < snaps.n_rows; n++)
+        nm_vect_insert_cstr(&choices, nm_db_snap(&snaps, n)->snap_name);
 
     nm_vect_end_zero(&choices);
 
@@ -287,9 +258,8 @@ out:
     wtimeout(action_window, -1);
     delwin(form_data.form_window);
     nm_form_free(snap_form, fields);
-    nm_vect_free(&snaps, nm_str_vect_free_cb);
+    nm_db_res_free(&snaps);
     nm_vect_free(&choices, NULL);
-    nm_str_free(&query);
     nm_str_free(&buf);
 }
 
@@ -299,22 +269,20 @@ static void __nm_vm_snapshot_load(const nm_str_t *name, const nm_str_t *snap,
     /* vm is not running, will load snapshot at next boot */
     if (!vm_status)
     {
-        nm_str_t query = NM_INIT_STR;
+        nm_db_begin();
 
         /* reset load flag for all snapshots for current vm */
-        nm_str_format(&query, NM_RESET_LOAD_SQL, name->data);
-        nm_db_edit(query.data);
+        nm_db_edit(NM_RESET_LOAD_SQL, name->data);
 
         /* set load flag for current shapshot */
-        nm_str_format(&query, NM_SNAP_UPDATE_LOAD_SQL, name->data, snap->data);
-        nm_db_edit(query.data);
+        nm_db_edit(NM_SNAP_UPDATE_LOAD_SQL, name->data, snap->data);
 
-        nm_str_free(&query);
+        nm_db_commit();
         return;
     }
 
     /* vm is running, load snapshot using QMP command loadvm */
-    nm_qmp_loadvm(name, snap);
+    nm_qmp_loadvm_async(name, snap, NULL, NULL);
 }
 
 static void __nm_vm_snapshot_delete(const nm_str_t *name, const nm_str_t *snap,
@@ -327,59 +295,58 @@ static void __nm_vm_snapshot_delete(const nm_str_t *name, const nm_str_t *snap,
         /* vm is not running, use
          * qemu-img snapshot -d snapshot_name path_to_drive system command */
         nm_str_t buf = NM_INIT_STR;
-        nm_vect_t argv = NM_INIT_VECT;
-        nm_str_t query = NM_INIT_STR;
+        nm_argv_t argv = NM_INIT_ARGV;
         nm_vect_t drives = NM_INIT_VECT;
 
         /* get first drive name */
-        nm_str_format(&query, NM_GET_BOOT_DRIVE_SQL, name->data);
-        nm_db_select(query.data, &drives);
+        nm_db_select(NM_GET_BOOT_DRIVE_SQL, &drives, name->data);
         assert(drives.n_memb != 0);
 
         nm_str_alloc_text(&buf, NM_STRING(NM_USR_PREFIX) "/bin/qemu-img");
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(&argv, buf.data);
 
-        nm_vect_insert_cstr(&argv, "snapshot");
-        nm_vect_insert_cstr(&argv, "-d");
+        nm_argv_add(&argv, "snapshot");
+        nm_argv_add(&argv, "-d");
 
-        nm_vect_insert(&argv, snap->data, snap->len + 1, NULL);
+        nm_argv_add(&argv, snap->data);
 
         nm_str_format(&buf, "%s/%s/%s", nm_cfg_get()->vm_dir.data, name->data, nm_vect_str_ctx(&drives, 0));
-        nm_vect_insert(&argv, buf.data, buf.len + 1, NULL);
+        nm_argv_add(&argv, buf.data);
 
-        nm_vect_end_zero(&argv);
         if (nm_spawn_process(&argv, NULL) != NM_OK)
             nm_bug(_("%s: cannot delete snapshot"), __func__);
 
         rc = NM_OK;
         nm_str_free(&buf);
-        nm_vect_free(&argv, NULL);
+        nm_argv_free(&argv);
         nm_vect_free(&drives, nm_str_vect_free_cb);
-        nm_str_free(&query);
     }
     else
     {
-        /* vm is running, delete snapshot using QMP command delvm */
-        rc = nm_qmp_delvm(name, snap);
+        /* vm is running, delete snapshot using QMP command delvm,
+         * database is updated when QEMU is done */
+        nm_str_t *job = nm_calloc(1, sizeof(nm_str_t));
+
+        nm_str_copy(job, snap);
+        if (nm_qmp_delvm_async(name, job,
+                    nm_vm_snapshot_deleted, job) != NM_OK)
+        {
+            nm_str_free(job);
+            free(job);
+        }
     }
 
 
     if (rc == NM_OK)
     {
         /* delete snapshot from database */
-        nm_str_t query = NM_INIT_STR;
-
-        nm_str_format(&query, NM_DELETE_SNAP_SQL, name->data, snap->data);
-        nm_db_edit(query.data);
-
-        nm_str_free(&query);
+        nm_db_edit(NM_DELETE_SNAP_SQL, name->data, snap->data);
     }
 }
 
 static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
 {
     int rc = NM_OK;
-    nm_str_t query = NM_INIT_STR;
     nm_vect_t names = NM_INIT_VECT;
     nm_vect_t err = NM_INIT_VECT;
 
@@ -395,8 +362,8 @@ static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
         goto out;
     }
 
-    nm_str_format(&query, NM_SNAP_GET_NAME_SQL, name->data, data->snap_name.data);
-    nm_db_select(query.data, &names);
+    nm_db_select(NM_SNAP_GET_NAME_SQL, &names,
+        name->data, data->snap_name.data);
 
     if (names.n_memb != 0)
     {
@@ -411,32 +378,54 @@ static int nm_vm_snapshot_get_data(const nm_str_t *name, nm_vmsnap_t *data)
 
 out:
     nm_vect_free(&names, nm_str_vect_free_cb);
-    nm_str_free(&query);
     return rc;
 }
 
 static void nm_vm_snapshot_to_db(const nm_str_t *name, const nm_vmsnap_t *data)
 {
-    nm_str_t query = NM_INIT_STR;
-    int load = 0;
+    const char *load = NM_DISABLE;
 
     if (nm_str_cmp_st(&data->load, "yes") == NM_OK)
-        load = 1;
+        load = NM_ENABLE;
 
     if (!data->update)
     {
-        nm_str_format(&query, NM_INSERT_SNAP_SQL,
+        nm_db_edit(NM_INSERT_SNAP_SQL,
             name->data, data->snap_name.data, load);
     }
     else
     {
-        nm_str_format(&query, NM_UPDATE_SNAP_SQL, load,
+        nm_db_edit(NM_UPDATE_SNAP_SQL, load,
             name->data, data->snap_name.data);
     }
+}
+
+static void nm_vm_snapshot_saved(const nm_str_t *name, int rc, void *ctx)
+{
+    nm_vmsnap_t *data = ctx;
+
+    if (rc == NM_OK)
+        nm_vm_snapshot_to_db(name, data);
 
-    nm_db_edit(query.data);
+    nm_vm_snapshot_free(data);
+}
 
-    nm_str_free(&query);
+static void nm_vm_snapshot_deleted(const nm_str_t *name, int rc, void *ctx)
+{
+    nm_str_t *snap = ctx;
+
+    if (rc == NM_OK)
+        nm_db_edit(NM_DELETE_SNAP_SQL, name->data, snap->data);
+
+    nm_str_free(snap);
+    free(snap);
+}
+
+static void nm_vm_snapshot_free(nm_vmsnap_t *data)
+{
+    nm_str_free(&data->snap_name);
+    nm_str_free(&data->load);
+    free(data);
 }
 
 /* vim:set ts=4 sw=4: */
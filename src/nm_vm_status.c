@@ -0,0 +1,340 @@
+#include <nm_core.h>
+#include <nm_string.h>
+#include <nm_vector.h>
+#include <nm_cfg_file.h>
+#include <nm_vm_status.h>
+#include <nm_qmp_control.h>
+
+#if defined (NM_OS_LINUX)
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+/* VM running status cache for the VM list.
+ * On Linux status is tracked with inotify on VM directories (qmp.sock,
+ * qemu.pid) and pidfd of QEMU process, so redraw does not touch
+ * QMP sockets. Items without event source fall back to QMP socket test. */
+
+#if defined (NM_OS_LINUX)
+enum {
+    NM_STATUS_READLEN = 4096,
+    NM_STATUS_EVENTS = 32,
+};
+
+typedef struct {
+    nm_str_t name;
+    int running;
+    int pid;
+    int wd;    /* inotify watch of VM directory */
+    int pidfd; /* QEMU process, readable on exit */
+} nm_vm_status_t;
+
+#define NM_INIT_VM_STATUS (nm_vm_status_t) { NM_INIT_STR, 0, 0, -1, -1 }
+
+static nm_vect_t nm_status_list = NM_INIT_VECT;
+static int nm_status_efd = -1;
+static int nm_status_ifd = -1;
+
+static nm_vm_status_t *nm_vm_status_find(const nm_str_t *name);
+static int nm_vm_status_cached(const nm_vm_status_t *item);
+static void nm_vm_status_attach_pid(nm_vm_status_t *item, size_t idx);
+static void nm_vm_status_detach_pid(nm_vm_status_t *item);
+static void nm_vm_status_read_inotify(void);
+static void nm_vm_status_free_cb(void *unit_p);
+#endif /* NM_OS_LINUX */
+
+static int nm_vm_status_read_pid(const nm_str_t *name);
+
+void nm_vm_status_init(const nm_vect_t *vm_list)
+{
+#if defined (NM_OS_LINUX)
+    const nm_cfg_t *cfg = nm_cfg_get();
+    nm_str_t path = NM_INIT_STR;
+    struct epoll_event ev;
+
+    nm_vm_status_free();
+
+    if ((nm_status_efd = epoll_create1(EPOLL_CLOEXEC)) != -1)
+    {
+        nm_status_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0; /* pidfd events are tagged with index + 1 */
+
+        if (nm_status_ifd != -1 &&
+            epoll_ctl(nm_status_efd, EPOLL_CTL_ADD, nm_status_ifd, &ev) == -1)
+        {
+            close(nm_status_ifd);
+            nm_status_ifd = -1;
+        }
+    }
+
+    for (size_t n = 0; n < vm_list->n_memb; n++)
+    {
+        nm_vm_status_t item = NM_INIT_VM_STATUS;
+        nm_vm_status_t *added;
+
+        nm_str_copy(&item.name, nm_vect_str(vm_list, n));
+        nm_vect_insert(&nm_status_list, &item, sizeof(item), NULL);
+        added = nm_vect_at(&nm_status_list, n);
+
+        /* watch is added before the check, so no start is missed */
+        if (nm_status_ifd != -1)
+        {
+            nm_str_format(&path, "%s/%s", cfg->vm_dir.data, added->name.data);
+            added->wd = inotify_add_watch(nm_status_ifd, path.data,
+                    IN_CREATE | IN_DELETE | IN_MODIFY |
+                    IN_MOVED_TO | IN_ONLYDIR);
+        }
+
+        if (nm_qmp_test_socket(&added->name) == NM_OK)
+        {
+            added->running = 1;
+            nm_vm_status_attach_pid(added, n);
+        }
+    }
+
+    nm_str_free(&path);
+#else
+    (void) vm_list;
+#endif /* NM_OS_LINUX */
+}
+
+void nm_vm_status_update(void)
+{
+#if defined (NM_OS_LINUX)
+    struct epoll_event evs[NM_STATUS_EVENTS];
+    int nevents;
+
+    if (nm_status_efd == -1)
+        return;
+
+    nevents = epoll_wait(nm_status_efd, evs, NM_STATUS_EVENTS, 0);
+
+    for (int n = 0; n < nevents; n++)
+    {
+        nm_vm_status_t *item;
+        size_t idx;
+
+        if (evs[n].data.u64 == 0)
+        {
+            nm_vm_status_read_inotify();
+            continue;
+        }
+
+        idx = evs[n].data.u64 - 1;
+        if (idx >= nm_status_list.n_memb)
+            continue;
+
+        /* QEMU has exited */
+        item = nm_vect_at(&nm_status_list, idx);
+        nm_vm_status_detach_pid(item);
+        item->running = 0;
+    }
+#endif /* NM_OS_LINUX */
+}
+
+int nm_vm_status_get(const nm_str_t *name)
+{
+#if defined (NM_OS_LINUX)
+    const nm_vm_status_t *item = nm_vm_status_find(name);
+
+    if (item && nm_vm_status_cached(item))
+        return item->running;
+#endif
+
+    return (nm_qmp_test_socket(name) == NM_OK);
+}
+
+int nm_vm_status_pid(const nm_str_t *name)
+{
+#if defined (NM_OS_LINUX)
+    const nm_vm_status_t *item = nm_vm_status_find(name);
+
+    if (item && nm_vm_status_cached(item))
+        return item->running ? item->pid : 0;
+#endif
+
+    return nm_vm_status_read_pid(name);
+}
+
+void nm_vm_status_free(void)
+{
+#if defined (NM_OS_LINUX)
+    /* close(2) also removes descriptors from epoll set */
+    nm_vect_free(&nm_status_list, nm_vm_status_free_cb);
+
+    if (nm_status_ifd != -1)
+    {
+        close(nm_status_ifd);
+        nm_status_ifd = -1;
+    }
+    if (nm_status_efd != -1)
+    {
+        close(nm_status_efd);
+        nm_status_efd = -1;
+    }
+#endif /* NM_OS_LINUX */
+}
+
+static int nm_vm_status_read_pid(const nm_str_t *name)
+{
+    nm_str_t path = NM_INIT_STR;
+    char buf[32];
+    ssize_t nread;
+    int fd;
+
+    nm_str_format(&path, "%s/%s/%s",
+        nm_cfg_get()->vm_dir.data, name->data, NM_VM_PID_FILE);
+
+    fd = open(path.data, O_RDONLY);
+    nm_str_free(&path);
+    if (fd == -1)
+        return 0;
+
+    nread = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (nread <= 0)
+        return 0;
+
+    buf[nread] = '\0';
+
+    return atoi(buf);
+}
+
+#if defined (NM_OS_LINUX)
+static nm_vm_status_t *nm_vm_status_find(const nm_str_t *name)
+{
+    for (size_t n = 0; n < nm_status_list.n_memb; n++)
+    {
+        nm_vm_status_t *item = nm_vect_at(&nm_status_list, n);
+
+        if (nm_str_cmp_ss(&item->name, name) == NM_OK)
+            return item;
+    }
+
+    return NULL;
+}
+
+/* Without pidfd killed QEMU leaves stale qmp.sock behind,
+ * so running status is trusted only if process exit is tracked */
+static int nm_vm_status_cached(const nm_vm_status_t *item)
+{
+    if (item->wd == -1)
+        return 0;
+
+    return (!item->running || item->pidfd != -1);
+}
+
+static void nm_vm_status_attach_pid(nm_vm_status_t *item, size_t idx)
+{
+    if (item->pidfd != -1)
+        return;
+
+    if ((item->pid = nm_vm_status_read_pid(&item->name)) <= 0)
+    {
+        item->pid = 0;
+        return;
+    }
+
+#if defined (SYS_pidfd_open)
+    {
+        struct epoll_event ev;
+        int fd;
+
+        if ((fd = syscall(SYS_pidfd_open, item->pid, 0)) == -1)
+            return;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = idx + 1;
+        if (epoll_ctl(nm_status_efd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            close(fd);
+            return;
+        }
+
+        item->pidfd = fd;
+    }
+#else
+    (void) idx;
+#endif /* SYS_pidfd_open */
+}
+
+static void nm_vm_status_detach_pid(nm_vm_status_t *item)
+{
+    if (item->pidfd != -1)
+    {
+        close(item->pidfd);
+        item->pidfd = -1;
+    }
+    item->pid = 0;
+}
+
+static void nm_vm_status_read_inotify(void)
+{
+    char buf[NM_STATUS_READLEN]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ie;
+    ssize_t nread;
+
+    while ((nread = read(nm_status_ifd, buf, sizeof(buf))) > 0)
+    {
+        for (char *ptr = buf; ptr < buf + nread;
+             ptr += sizeof(struct inotify_event) + ie->len)
+        {
+            ie = (const struct inotify_event *) ptr;
+
+            for (size_t n = 0; n < nm_status_list.n_memb; n++)
+            {
+                nm_vm_status_t *item = nm_vect_at(&nm_status_list, n);
+
+                if (item->wd != ie->wd)
+                    continue;
+
+                /* VM directory is gone, fall back to socket test */
+                if (ie->mask & IN_IGNORED)
+                {
+                    item->wd = -1;
+                    break;
+                }
+
+                if (!ie->len)
+                    break;
+
+                if (nm_str_cmp_tt(ie->name, NM_VM_QMP_FILE) == NM_OK)
+                {
+                    if (ie->mask & IN_CREATE)
+                    {
+                        item->running = 1;
+                        nm_vm_status_attach_pid(item, n);
+                    }
+                    else if (ie->mask & IN_DELETE)
+                    {
+                        item->running = 0;
+                        nm_vm_status_detach_pid(item);
+                    }
+                }
+                else if ((ie->mask & (IN_MODIFY | IN_MOVED_TO)) &&
+                         nm_str_cmp_tt(ie->name, NM_VM_PID_FILE) == NM_OK)
+                {
+                    nm_vm_status_attach_pid(item, n);
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void nm_vm_status_free_cb(void *unit_p)
+{
+    nm_vm_status_t *item = unit_p;
+
+    nm_vm_status_detach_pid(item);
+    nm_str_free(&item->name);
+}
+#endif /* NM_OS_LINUX */
+
+/* vim:set ts=4 sw=4: */
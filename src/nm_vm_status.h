@@ -0,0 +1,14 @@
+#ifndef NM_VM_STATUS_H_
+#define NM_VM_STATUS_H_
+
+#include <nm_string.h>
+#include <nm_vector.h>
+
+void nm_vm_status_init(const nm_vect_t *vm_list);
+void nm_vm_status_update(void);
+int nm_vm_status_get(const nm_str_t *name);
+int nm_vm_status_pid(const nm_str_t *name);
+void nm_vm_status_free(void);
+
+#endif /* NM_VM_STATUS_H_ */
+/* vim:set ts=4 sw=4: */
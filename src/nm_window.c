@@ -1,12 +1,15 @@
 #include <nm_core.h>
 #include <nm_form.h>
+#include <nm_arena.h>
 #include <nm_utils.h>
 #include <nm_string.h>
 #include <nm_window.h>
 #include <nm_ncurses.h>
 #include <nm_database.h>
 #include <nm_cfg_file.h>
+#include <nm_vm_status.h>
 #include <nm_stat_usage.h>
+#include <nm_trace.h>
 
 #define NM_HELP_GEN(name)                                    \
     void nm_init_help_ ## name(void) {                       \
@@ -14,7 +17,13 @@
             nm_arr_len(nm_help_ ## name ## _msg), NM_FALSE); \
     }
 
+enum {
+    NM_STAT_LINES = 4, /* pid, cpu, memory and disk io */
+};
+
 static float nm_window_scale = 0.7;
+/* last warning shown without TUI */
+static nm_str_t nm_warn_msg = { NULL, 0, 0 };
 
 static void nm_init_window__(nm_window_t *w, const char *msg);
 static void nm_print_help_lines(const char **msg, size_t objs, int err);
@@ -182,7 +191,7 @@ void nm_destroy_windows(void)
 void nm_print_cmd(const nm_str_t *name)
 {
     nm_str_t buf = NM_INIT_STR;
-    nm_vect_t argv = NM_INIT_VECT;
+    nm_argv_t argv = NM_INIT_ARGV;
     nm_vmctl_data_t vm = NM_VMCTL_INIT_DATA;
 
     int col = getmaxx(stdscr);
@@ -198,17 +207,17 @@ void nm_print_cmd(const nm_str_t *name)
     mvprintw(3, 0, "%s", buf.data);
 
     nm_str_free(&buf);
-    nm_vect_free(&argv, NULL);
+    nm_argv_free(&argv);
     nm_vmctl_free_data(&vm);
 
     refresh();
     getch();
 }
 
-void nm_print_snapshots(const nm_vect_t *v)
+void nm_print_snapshots(const nm_db_res_t *v)
 {
     nm_str_t buf = NM_INIT_STR;
-    size_t count = v->n_memb / 5;
+    size_t count = v->n_rows;
     size_t y = 7, x = 2;
     size_t cols, rows;
     chtype ch1, ch2;
@@ -216,14 +225,8 @@ void nm_print_snapshots(const nm_vect_t *v)
 
     getmaxyx(action_window, rows, cols);
 
-    enum {
-        NM_SQL_VMSNAP_NAME = 2,
-        NM_SQL_VMSNAP_TIME = 4
-    };
-
     for (size_t n = 0; n < count; n++)
     {
-        size_t idx_shift = 5 * n;
         if (n && n < count)
         {
 
@@ -232,8 +235,7 @@ void nm_print_snapshots(const nm_vect_t *v)
         }
 
         nm_str_format(&buf, "%s (%s)",
-                nm_vect_str_ctx(v, NM_SQL_VMSNAP_NAME + idx_shift),
-                nm_vect_str_ctx(v, NM_SQL_VMSNAP_TIME + idx_shift));
+                nm_db_snap(v, n)->snap_name, nm_db_snap(v, n)->timestamp);
         NM_PR_VM_INFO();
     }
 
@@ -266,41 +268,37 @@ void nm_print_iface_info(const nm_vmctl_data_t *vm, size_t idx)
     nm_str_t buf = NM_INIT_STR;
     size_t y = 3, x = 2;
     size_t cols, rows;
-    size_t idx_shift, mvtap_idx = 0;
+    const nm_db_iface_t *iface;
+    size_t mvtap_idx = 0;
     chtype ch1, ch2;
     ch1 = ch2 = 0;
 
     assert(idx > 0);
-    idx_shift = NM_IFS_IDX_COUNT * (--idx);
+    iface = nm_db_iface(&vm->ifs, idx - 1);
 
     getmaxyx(action_window, rows, cols);
 
-    nm_str_format(&buf, "%-12s%s", "hwaddr: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift));
+    nm_str_format(&buf, "%-12s%s", "hwaddr: ", iface->mac_addr);
     NM_PR_VM_INFO();
 
-    nm_str_format(&buf, "%-12s%s", "driver: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift));
+    nm_str_format(&buf, "%-12s%s", "driver: ", iface->drv);
     NM_PR_VM_INFO();
 
-    if (nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift) > 0)
+    if (*iface->ipv4_addr)
     {
-        nm_str_format(&buf, "%-12s%s", "host addr: ",
-                nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+        nm_str_format(&buf, "%-12s%s", "host addr: ", iface->ipv4_addr);
         NM_PR_VM_INFO();
     }
 
-    nm_str_format(&buf, "%-12s%s", "vhost: ",
-            (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
-                           NM_ENABLE) == NM_OK) ? "yes" : "no");
+    nm_str_format(&buf, "%-12s%s", "vhost: ", iface->vhost ? "yes" : "no");
     NM_PR_VM_INFO();
 
-    mvtap_idx = nm_str_stoui(nm_vect_str(&vm->ifs, NM_SQL_IF_MVT + idx_shift), 10);
+    mvtap_idx = (size_t) iface->macvtap;
     if (!mvtap_idx)
         nm_str_format(&buf, "%-12s%s", "MacVTap: ", nm_form_macvtap[mvtap_idx]);
     else
         nm_str_format(&buf, "%-12s%s [iface: %s]", "MacVTap: ", nm_form_macvtap[mvtap_idx],
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_PET + idx_shift));
+            iface->parent_eth);
     NM_PR_VM_INFO();
 
     nm_str_free(&buf);
@@ -308,224 +306,186 @@ void nm_print_iface_info(const nm_vmctl_data_t *vm, size_t idx)
 
 void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int status)
 {
+    nm_arena_t *arena = nm_arena_frame();
     nm_str_t buf = NM_INIT_STR;
     size_t y = 3, x = 2;
     size_t cols, rows;
-    size_t ifs_count, drives_count;
+    const nm_db_vm_t *row = nm_db_vm(&vm->main, 0);
     chtype ch1, ch2;
     ch1 = ch2 = 0;
 
     getmaxyx(action_window, rows, cols);
 
-    nm_str_format(&buf, "%-12s%s", "arch: ",
-        nm_vect_str_ctx(&vm->main, NM_SQL_ARCH));
+    buf = nm_arena_format(arena, "%-12s%s", "arch: ", row->arch);
     NM_PR_VM_INFO();
 
-    nm_str_format(&buf, "%-12s%s", "cores: ",
-        nm_vect_str_ctx(&vm->main, NM_SQL_SMP));
+    buf = nm_arena_format(arena, "%-12s%d", "cores: ", row->smp);
     NM_PR_VM_INFO();
 
-    nm_str_format(&buf, "%-12s%s %s", "memory: ",
-        nm_vect_str_ctx(&vm->main, NM_SQL_MEM), "Mb");
+    buf = nm_arena_format(arena, "%-12s%d %s", "memory: ", row->mem, "Mb");
     NM_PR_VM_INFO();
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_KVM), NM_ENABLE) == NM_OK)
+    if (row->kvm)
     {
-        if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_HCPU), NM_ENABLE) == NM_OK)
-            nm_str_format(&buf, "%-12s%s", "kvm: ", "enabled [+hostcpu]");
+        if (row->hcpu)
+            buf = nm_arena_format(arena, "%-12s%s", "kvm: ", "enabled [+hostcpu]");
         else
-            nm_str_format(&buf, "%-12s%s", "kvm: ", "enabled");
+            buf = nm_arena_format(arena, "%-12s%s", "kvm: ", "enabled");
     }
     else
     {
-        nm_str_format(&buf, "%-12s%s", "kvm: ", "disabled");
+        buf = nm_arena_format(arena, "%-12s%s", "kvm: ", "disabled");
     }
     NM_PR_VM_INFO();
 
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBF), "1") == NM_OK)
+    if (row->usb)
     {
-        nm_str_format(&buf, "%-12s%s [%s]", "usb: ", "enabled",
-                (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_USBT), NM_DEFAULT_USBVER) == NM_OK) ?
+        buf = nm_arena_format(arena, "%-12s%s [%s]", "usb: ", "enabled",
+                (nm_str_cmp_tt(row->usb_type, NM_DEFAULT_USBVER) == NM_OK) ?
                 "XHCI" : "EHCI");
     }
     else
     {
-        nm_str_format(&buf, "%-12s%s", "usb: ", "disabled");
+        buf = nm_arena_format(arena, "%-12s%s", "usb: ", "disabled");
     }
     NM_PR_VM_INFO();
 
-    nm_str_format(&buf, "%-12s%s [%u]", "vnc port: ",
-             nm_vect_str_ctx(&vm->main, NM_SQL_VNC),
-             nm_str_stoui(nm_vect_str(&vm->main, NM_SQL_VNC), 10) + 5900);
+    buf = nm_arena_format(arena, "%-12s%d [%d]", "vnc port: ",
+             row->vnc, row->vnc + 5900);
     NM_PR_VM_INFO();
 
     /* print network interfaces info */
-    ifs_count = vm->ifs.n_memb / NM_IFS_IDX_COUNT;
-
-    for (size_t n = 0; n < ifs_count; n++)
+    for (size_t n = 0; n < vm->ifs.n_rows; n++)
     {
-        size_t idx_shift = NM_IFS_IDX_COUNT * n;
+        const nm_db_iface_t *iface = nm_db_iface(&vm->ifs, n);
 
-        nm_str_format(&buf, "eth%zu%-8s%s [%s %s%s]",
-                 n, ":",
-                 nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-                 nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_MAC + idx_shift),
-                 nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_DRV + idx_shift),
-                 (nm_str_cmp_st(nm_vect_str(&vm->ifs, NM_SQL_IF_VHO + idx_shift),
-                    NM_ENABLE) == NM_OK) ? "+vhost" : "");
+        buf = nm_arena_format(arena, "eth%zu%-8s%s [%s %s%s]",
+                 n, ":", iface->name, iface->mac_addr, iface->drv,
+                 iface->vhost ? "+vhost" : "");
 
         NM_PR_VM_INFO();
     }
 
     /* print drives info */
-    drives_count = vm->drives.n_memb / NM_DRV_IDX_COUNT;
-
-    for (size_t n = 0; n < drives_count; n++)
+    for (size_t n = 0; n < vm->drives.n_rows; n++)
     {
-        size_t idx_shift = NM_DRV_IDX_COUNT * n;
-        int boot = 0;
-
-        if (nm_str_cmp_st(nm_vect_str(&vm->drives, NM_SQL_DRV_BOOT + idx_shift),
-                NM_ENABLE) == NM_OK)
-        {
-            boot = 1;
-        }
+        const nm_db_drive_t *drive = nm_db_drive(&vm->drives, n);
 
-        nm_str_format(&buf, "disk%zu%-7s%s [%sGb %s] %s", n, ":",
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_NAME + idx_shift),
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_SIZE + idx_shift),
-                 nm_vect_str_ctx(&vm->drives, NM_SQL_DRV_TYPE + idx_shift),
-                 boot ? "*" : "");
+        buf = nm_arena_format(arena, "disk%zu%-7s%s [%sGb %s] %s%s%s", n, ":",
+                 drive->name, drive->capacity, drive->drv,
+                 drive->boot ? "*" : "", *drive->backing ? " linked" : "",
+                 *drive->ova_path ? " ova" : "");
         NM_PR_VM_INFO();
     }
 
     /* print 9pfs info */
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_9FLG), "1") == NM_OK)
+    if (row->fs9p_enable)
     {
-        nm_str_format(&buf, "%-12s%s [%s]", "9pfs: ",
-                 nm_vect_str_ctx(&vm->main, NM_SQL_9PTH),
-                 nm_vect_str_ctx(&vm->main, NM_SQL_9ID));
+        buf = nm_arena_format(arena, "%-12s%s [%s]", "9pfs: ",
+                 row->fs9p_path, row->fs9p_name);
         NM_PR_VM_INFO();
     }
 
     /* generate guest boot settings info */
-    if (nm_vect_str_len(&vm->main, NM_SQL_MACH))
+    if (*row->machine)
     {
-        nm_str_format(&buf, "%-12s%s", "machine: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_MACH));
+        buf = nm_arena_format(arena, "%-12s%s", "machine: ", row->machine);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_BIOS))
+    if (*row->bios)
     {
-        nm_str_format(&buf,"%-12s%s", "bios: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_BIOS));
+        buf = nm_arena_format(arena, "%-12s%s", "bios: ", row->bios);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_KERN))
+    if (*row->kernel)
     {
-        nm_str_format(&buf,"%-12s%s", "kernel: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_KERN));
+        buf = nm_arena_format(arena, "%-12s%s", "kernel: ", row->kernel);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_KAPP))
+    if (*row->kernel_append)
     {
-        nm_str_format(&buf, "%-12s%s", "cmdline: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_KAPP));
+        buf = nm_arena_format(arena, "%-12s%s", "cmdline: ", row->kernel_append);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_INIT))
+    if (*row->initrd)
     {
-        nm_str_format(&buf, "%-12s%s", "initrd: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_INIT));
+        buf = nm_arena_format(arena, "%-12s%s", "initrd: ", row->initrd);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_TTY))
+    if (*row->tty_path)
     {
-        nm_str_format(&buf, "%-12s%s", "tty: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_TTY));
+        buf = nm_arena_format(arena, "%-12s%s", "tty: ", row->tty_path);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_SOCK))
+    if (*row->socket_path)
     {
-        nm_str_format(&buf, "%-12s%s", "socket: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_SOCK));
+        buf = nm_arena_format(arena, "%-12s%s", "socket: ", row->socket_path);
         NM_PR_VM_INFO();
     }
-    if (nm_vect_str_len(&vm->main, NM_SQL_DEBP))
+    if (row->debug_port)
     {
-        nm_str_format(&buf, "%-12s%s", "gdb port: ",
-                nm_vect_str_ctx(&vm->main, NM_SQL_DEBP));
+        buf = nm_arena_format(arena, "%-12s%d", "gdb port: ", row->debug_port);
         NM_PR_VM_INFO();
     }
-    if (nm_str_cmp_st(nm_vect_str(&vm->main, NM_SQL_DEBF), NM_ENABLE) == NM_OK)
+    if (row->debug_freeze)
     {
-        nm_str_format(&buf, "%-12s", "freeze cpu: yes");
+        buf = nm_arena_format(arena, "%-12s", "freeze cpu: yes");
         NM_PR_VM_INFO();
     }
 
     /* print host IP addresses for TAP ints */
-    for (size_t n = 0; n < ifs_count; n++)
+    for (size_t n = 0; n < vm->ifs.n_rows; n++)
     {
-        size_t idx_shift = NM_IFS_IDX_COUNT * n;
+        const nm_db_iface_t *iface = nm_db_iface(&vm->ifs, n);
 
-        if (!nm_vect_str_len(&vm->ifs, NM_SQL_IF_IP4 + idx_shift))
+        if (!*iface->ipv4_addr)
             continue;
 
-        nm_str_format(&buf, "%-12s%s [%s]", "host IP: ",
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_NAME + idx_shift),
-            nm_vect_str_ctx(&vm->ifs, NM_SQL_IF_IP4 + idx_shift));
+        buf = nm_arena_format(arena, "%-12s%s [%s]", "host IP: ",
+            iface->name, iface->ipv4_addr);
         NM_PR_VM_INFO();
 
     }
 
-    /* print PID */
+    /* print PID and resource usage */
     {
-        int fd;
-
-#if defined (NM_OS_LINUX)
-        float usage;
-#endif
-
-        nm_str_t pid_path = NM_INIT_STR;
-        ssize_t nread;
-        char pid[10];
         int pid_num = 0;
+        nm_stat_t st;
 
-        nm_str_format(&pid_path, "%s/%s/%s",
-            nm_cfg_get()->vm_dir.data, name->data, NM_VM_PID_FILE);
-
-        if ((status && (fd = open(pid_path.data, O_RDONLY)) != -1))
+        if (status && (pid_num = nm_vm_status_pid(name)) > 0)
         {
-            if ((nread = read(fd, pid, sizeof(pid))) > 0)
+            buf = nm_arena_format(arena, "%-12s%d", "pid: ", pid_num);
+            NM_PR_VM_INFO();
+
+            if (nm_stat_get(name, &st) == NM_OK)
             {
-                pid[nread - 1] = '\0';
-                pid_num = atoi(pid);
-                nm_str_format(&buf, "%-12s%d", "pid: ", pid_num);
+                buf = nm_arena_format(arena, "%-12s%0.1f%%",
+                        "cpu usage: ", st.cpu);
+                mvwhline(action_window, y, 1, ' ', cols - 4);
                 NM_PR_VM_INFO();
-            }
-            close(fd);
 
-#if defined (NM_OS_LINUX)
-            usage = nm_stat_get_usage(pid_num);
-            nm_str_format(&buf, "%-12s%0.1f%%", "cpu usage: ", usage);
-            mvwhline(action_window, y, 1, ' ', cols - 4);
-            NM_PR_VM_INFO();
-#endif
-        }
-        else /* clear PID file info and cpu usage data */
-        {
-            if (y < (rows - 2))
-            {
+                buf = nm_arena_format(arena, "%-12s%" PRIu64 " Mb",
+                        "rss: ", st.rss / 1024);
+                if (st.pss)
+                {
+                    buf = nm_arena_format(arena, "%s (pss %" PRIu64 " Mb)",
+                            buf.data, st.pss / 1024);
+                }
+                mvwhline(action_window, y, 1, ' ', cols - 4);
+                NM_PR_VM_INFO();
+
+                buf = nm_arena_format(arena,
+                        "%-12sr %" PRIu64 " / w %" PRIu64 " Kb/s",
+                        "disk io: ", st.rd_rate / 1024, st.wr_rate / 1024);
                 mvwhline(action_window, y, 1, ' ', cols - 4);
-                mvwhline(action_window, y + 1, 1, ' ', cols - 4);
+                NM_PR_VM_INFO();
             }
-            NM_STAT_CLEAN();
         }
 
-        nm_str_free(&pid_path);
+        /* clear lines left from previous VM */
+        for (int n = 0; n < NM_STAT_LINES && y + n < (rows - 2); n++)
+            mvwhline(action_window, y + n, 1, ' ', cols - 4);
     }
-
-    nm_str_free(&buf);
 }
 
 void nm_lan_help(void)
@@ -743,6 +703,18 @@ void nm_align2line(nm_str_t *str, size_t line_len)
     }
 }
 
+/* Same as nm_align2line(), but str is not modified, so it can be a view */
+void nm_print_line(nm_window_t *w, int y, int x,
+                   const nm_str_t *str, size_t line_len)
+{
+    assert(line_len > 4);
+
+    if (str->len > (line_len - 4))
+        mvwprintw(w, y, x, "%.*s...", (int) (line_len - 7), str->data);
+    else
+        mvwprintw(w, y, x, "%s", str->data);
+}
+
 size_t nm_max_msg_len(const char **msg)
 {
     size_t len = 0;
@@ -764,6 +736,25 @@ int nm_warn__(const char *msg, int red)
     int ch;
 
     assert(msg != NULL);
+
+    /* no TUI: command line or nemu-monitor */
+    if (help_window == NULL)
+    {
+        if (red)
+        {
+            const char *any_key = strstr(msg, _(NM_MSG_ANY_KEY));
+
+            nm_str_free(&nm_warn_msg);
+            if (any_key != NULL)
+                nm_str_add_text_part(&nm_warn_msg, msg, any_key - msg);
+            else
+                nm_str_add_text(&nm_warn_msg, msg);
+
+            fprintf(stderr, "%s\n", nm_warn_msg.data);
+        }
+
+        return ERR;
+    }
     werase(help_window);
     nm_init_help(msg, red);
     ch = wgetch(help_window);
@@ -773,8 +764,21 @@ int nm_warn__(const char *msg, int red)
     return ch;
 }
 
+int nm_warn_pop(nm_str_t *msg)
+{
+    if (!nm_warn_msg.len)
+        return NM_ERR;
+
+    nm_str_copy(msg, &nm_warn_msg);
+    nm_str_free(&nm_warn_msg);
+
+    return NM_OK;
+}
+
 int nm_warn(const char *msg)
 {
+    nm_trace(NM_TRACE_WARN, "%s", msg);
+
     return nm_warn__(msg, NM_TRUE);
 }
 
@@ -9,7 +9,7 @@
 void nm_print_vm_info(const nm_str_t *name, const nm_vmctl_data_t *vm, int status);
 void nm_print_iface_info(const nm_vmctl_data_t *vm, size_t idx);
 void nm_print_drive_info(const nm_vect_t *v, size_t idx);
-void nm_print_snapshots(const nm_vect_t *v);
+void nm_print_snapshots(const nm_db_res_t *v);
 void nm_print_cmd(const nm_str_t *name);
 void nm_print_help(void);
 void nm_lan_help(void);
@@ -32,7 +32,10 @@ void nm_init_side_lan(void);
 void nm_init_side_if_list(void);
 void nm_init_side_drives(void);
 void nm_align2line(nm_str_t *str, size_t line_len);
+void nm_print_line(nm_window_t *w, int y, int x,
+                   const nm_str_t *str, size_t line_len);
 int nm_warn(const char *msg);
+int nm_warn_pop(nm_str_t *msg);
 int nm_notify(const char *msg);
 size_t nm_max_msg_len(const char **msg);
 int nm_window_scale_inc(void);
@@ -100,6 +103,8 @@ extern sig_atomic_t redraw_window;
 #define NM_MSG_MTAP_NSET  "MacVTap parent iface is not set" NM_MSG_ANY_KEY
 #define NM_MSG_TAP_EACC   "Access to tap iface is missing" NM_MSG_ANY_KEY
 #define NM_MSG_NO_SNAPS   "There are no snapshots" NM_MSG_ANY_KEY
+#define NM_MSG_CLONE_SNAP "VM with snapshots cannot be linked" NM_MSG_ANY_KEY
+#define NM_MSG_CLONE_ERR  "Clone failed, source VM is kept" NM_MSG_ANY_KEY
 #define NM_NSG_DRV_LIM    NM_STRING(NM_DRIVE_LIMIT) " disks limit reached" NM_MSG_ANY_KEY
 #define NM_MSG_DRV_NONE   "No additional disks" NM_MSG_ANY_KEY
 #define NM_MSG_DRV_EDEL   "Cannot delete drive from filesystem" NM_MSG_ANY_KEY
@@ -111,6 +116,7 @@ extern sig_atomic_t redraw_window;
 #define NM_MSG_OVF_MISS   "OVF file is not found" NM_MSG_ANY_KEY
 #define NM_MSG_OVF_EPAR   "Cannot parse OVF file" NM_MSG_ANY_KEY
 #define NM_MSG_XPATH_ERR  "Cannot create new XPath context" NM_MSG_ANY_KEY
+#define NM_MSG_OVA_CONV   "Cannot convert OVA disk images" NM_MSG_ANY_KEY
 #define NM_MSG_NS_ERROR   "Cannot register xml namespaces" NM_MSG_ANY_KEY
 #define NM_MSG_USB_EMPTY  "Empty device name" NM_MSG_ANY_KEY
 #define NM_MSG_USB_EDATA  "Malformed input data" NM_MSG_ANY_KEY
@@ -185,9 +191,9 @@ enum nm_key_upper {
             mvwaddch(action_window, y, x, ch1 );                \
             mvwaddch(action_window, y, x + 1, ch2 );            \
         }                                                       \
-        nm_align2line(&buf, (ch1 && ch2) ? cols - 2 : cols);    \
-        mvwprintw(action_window, y++,                           \
-                (ch1 && ch2) ? x + 2 : x, "%s", buf.data);      \
+        nm_print_line(action_window, y++,                       \
+                (ch1 && ch2) ? x + 2 : x, &buf,                 \
+                (ch1 && ch2) ? cols - 2 : cols);                \
         ch1 = ch2 = 0;                                          \
     } while (0)
 